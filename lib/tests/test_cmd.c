@@ -51,7 +51,7 @@ main (int argc, char **argv)
 	int c;
 	int result = UNSET;
 
-	plan_tests(50);
+	plan_tests(54);
 
 	diag ("Running plain echo command, set one");
 
@@ -221,5 +221,24 @@ main (int argc, char **argv)
 	ok (result == 3, "Get return code 3 = UNKNOWN when command does not exist");
 
 
+	/* ensure everything is empty again */
+	memset (&chld_out, 0, sizeof (output));
+	memset (&chld_err, 0, sizeof (output));
+	result = UNSET;
+
+	/* enough stderr to fill the pipe several times over before any
+	 * stdout appears; this used to hang until the plugin timed out */
+	command = (char *)malloc(COMMAND_LINE);
+	strcpy(command, "/bin/sh -c 'i=0; while [ $i -lt 20000 ]; do echo 0123456789 >&2; i=$((i+1)); done; echo done'");
+	result = cmd_run (command, &chld_out, &chld_err, 0);
+
+	ok (chld_err.lines == 20000,
+			"Large stderr output is read completely...");
+	ok (chld_out.lines == 1 && strcmp (chld_out.line[0], "done") == 0,
+			"...while stdout is still captured");
+	ok (chld_err.buflen == 20000 * 11, "stderr buffer holds every byte");
+	ok (result == 0, "Get return code 0 from chatty command");
+
+
 	return exit_status ();
 }
@@ -0,0 +1,162 @@
+/******************************************************************************
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ $Id$
+
+******************************************************************************/
+
+#include "common.h"
+#include "utils_counter.h"
+#include "tap.h"
+#include <fcntl.h>
+
+int
+main (int argc, char **argv)
+{
+	np_counter_store *st;
+	struct timeval now;
+	char path[] = "/tmp/test_counter.XXXXXX";
+	char key[128], longkey[200];
+	char *p;
+	double rate = 0;
+	int fd, i, ok_all;
+	unsigned int field;
+	FILE *fp;
+
+	plan_tests(20);
+
+	setenv ("NAGIOS_PLUGIN_STATE_DIRECTORY", "/var/lib/nagios", 1);
+	p = np_counter_path ("check_snmp_10.0.0.1");
+	ok( !strcmp (p, "/var/lib/nagios/check_snmp_10.0.0.1.state"), "state file in the state directory");
+	free (p);
+	p = np_counter_path ("check_mrtgtraf_/etc/../x");
+	ok( !strcmp (p, "/var/lib/nagios/check_mrtgtraf__etc_.._x.state"), "slashes in names are replaced");
+	free (p);
+
+	fd = mkstemp (path);
+	close (fd);
+
+	st = np_counter_open (path);
+	ok( st != NULL, "open empty file");
+	now.tv_sec = 1000000;
+	now.tv_usec = 0;
+	ok( np_counter_rate (st, "ifInOctets.1", 5000, 32, &now, &rate) == NP_COUNTER_FIRST,
+	    "first sample has no rate");
+	now.tv_sec += 10;
+	ok( np_counter_rate (st, "ifInOctets.1", 7000, 32, &now, &rate) == NP_COUNTER_OK && rate == 200,
+	    "rate from two samples");
+	ok( np_counter_rate (st, "ifInOctets.1", 7000, 32, &now, &rate) == NP_COUNTER_OK && rate == 200,
+	    "same instant again returns the last rate");
+	np_counter_close (st);
+
+	st = np_counter_open (path);
+	now.tv_sec += 5;
+	ok( np_counter_rate (st, "ifInOctets.1", 7500, 32, &now, &rate) == NP_COUNTER_OK && rate == 100,
+	    "samples survive reopening the file");
+
+	now.tv_sec += 10;
+	ok( np_counter_rate (st, "ifInOctets.1", 4294967295ULL, 32, &now, &rate) == NP_COUNTER_OK,
+	    "32 bit counter near its top");
+	now.tv_sec += 10;
+	ok( np_counter_rate (st, "ifInOctets.1", 999, 32, &now, &rate) == NP_COUNTER_WRAPPED && rate == 100,
+	    "32 bit wrap");
+
+	now.tv_sec = 1000000;
+	np_counter_rate (st, "ifHCInOctets.1", 18446744073709551000ULL, 64, &now, &rate);
+	now.tv_sec += 1;
+	ok( np_counter_rate (st, "ifHCInOctets.1", 18446744073709551600ULL, 64, &now, &rate) == NP_COUNTER_OK &&
+	    rate == 600, "64 bit counter");
+	now.tv_sec += 1;
+	ok( np_counter_rate (st, "ifHCInOctets.1", 10, 64, &now, &rate) == NP_COUNTER_FIRST,
+	    "64 bit counter going down is a reset");
+	now.tv_sec += 1;
+	ok( np_counter_rate (st, "ifHCInOctets.1", 20, 0, &now, &rate) == NP_COUNTER_OK && rate == 10,
+	    "rate again after the reset");
+
+	now.tv_sec += 1;
+	ok( np_counter_rate (st, "ifHCInOctets.1", 10, 0, &now, &rate) == NP_COUNTER_WRAPPED,
+	    "small counters of unknown width wrap at 32 bits");
+
+	/* keys sharing a long prefix */
+	memset (longkey, 'x', sizeof longkey - 2);
+	longkey[sizeof longkey - 1] = '\0';
+	longkey[sizeof longkey - 2] = 'a';
+	np_counter_rate (st, longkey, 100, 64, &now, &rate);
+	longkey[sizeof longkey - 2] = 'b';
+	np_counter_rate (st, longkey, 5000, 64, &now, &rate);
+	now.tv_sec += 1;
+	longkey[sizeof longkey - 2] = 'a';
+	ok( np_counter_rate (st, longkey, 101, 64, &now, &rate) == NP_COUNTER_OK && rate == 1,
+	    "long keys are told apart");
+
+	/* enough keys to grow the table several times */
+	now.tv_sec = 2000000;
+	for (i = 0; i < 1000; i++) {
+		snprintf (key, sizeof key, "host%d/ifInOctets", i);
+		np_counter_rate (st, key, i, 64, &now, &rate);
+	}
+	np_counter_close (st);
+	st = np_counter_open (path);
+	now.tv_sec += 1;
+	ok_all = TRUE;
+	for (i = 0; i < 1000; i++) {
+		snprintf (key, sizeof key, "host%d/ifInOctets", i);
+		if (np_counter_rate (st, key, i * 2, 64, &now, &rate) != NP_COUNTER_OK || rate != i)
+			ok_all = FALSE;
+	}
+	ok( ok_all, "1000 counters through growing the file");
+	now.tv_sec += NP_COUNTER_EXPIRE + 1;
+	for (i = 0; i < 4000; i++) {
+		snprintf (key, sizeof key, "fresh%d", i);
+		np_counter_rate (st, key, i, 64, &now, &rate);
+	}
+	now.tv_sec += 1;
+	ok( np_counter_rate (st, "host1/ifInOctets", 10, 64, &now, &rate) == NP_COUNTER_FIRST,
+	    "old samples expire when the file grows");
+	np_counter_close (st);
+
+	/* anything else in the file is started over */
+	fp = fopen (path, "w");
+	fputs ("not a state file\n", fp);
+	fclose (fp);
+	st = np_counter_open (path);
+	ok( st != NULL, "open a file that is not a state file");
+	ok( np_counter_rate (st, "ifInOctets.1", 1, 32, &now, &rate) == NP_COUNTER_FIRST,
+	    "and start over");
+	np_counter_close (st);
+
+	/* so is a header that does not match the records after it */
+	fd = open (path, O_RDWR);
+	field = 1 << 20;
+	pwrite (fd, &field, sizeof field, 8);	/* slots */
+	close (fd);
+	st = np_counter_open (path);
+	ok( st != NULL && np_counter_rate (st, "ifInOctets.1", 2, 32, &now, &rate) == NP_COUNTER_FIRST,
+	    "more slots than the file holds start over");
+	np_counter_close (st);
+
+	fd = open (path, O_RDWR);
+	field = 64;
+	pwrite (fd, &field, sizeof field, 12);	/* used */
+	close (fd);
+	st = np_counter_open (path);
+	ok( st != NULL && np_counter_rate (st, "ifInOctets.1", 3, 32, &now, &rate) == NP_COUNTER_FIRST,
+	    "a table that claims to be full starts over");
+	np_counter_close (st);
+
+	unlink (path);
+	return exit_status();
+}
@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_counter") {
+	plan skip_all => "./test_counter not compiled - please install tap library to test";
+}
+exec "./test_counter";
@@ -26,6 +26,7 @@
 void np_test_mount_entry_regex (struct mount_entry *dummy_mount_list,
 	       			char *regstr, int cflags, int expect,
 			       	char *desc);
+void np_test_best_match_benchmark (int mounts, int paths);
 
 
 int
@@ -44,7 +45,7 @@ main (int argc, char **argv)
 	int cflags = REG_NOSUB | REG_EXTENDED;
 	int found = 0, count = 0;
 
-	plan_tests(33);
+	plan_tests(37);
 
 	ok( np_find_name(exclude_filesystem, "/var/log") == FALSE, "/var/log not in list");
 	np_add_name(&exclude_filesystem, "/var/log");
@@ -200,6 +201,17 @@ main (int argc, char **argv)
 	ok(found == 0, "last (/home) element successfully deleted");
 	ok(count == 2, "two elements remaining");
 
+	for (count = 0; count < 1000; count++) {
+		char *name;
+		asprintf(&name, "/export/home%d", count);
+		np_add_name(&exclude_filesystem, name);
+	}
+	ok( np_find_name(exclude_filesystem, "/export/home999") == TRUE, "last of 1000 names found");
+	ok( np_find_name(exclude_filesystem, "/var/log") == TRUE, "names added before still found");
+	ok( np_seen_name(exclude_filesystem, "/export/home1000") == FALSE, "/export/home1000 not in list");
+
+	np_test_best_match_benchmark(5000, 2000);
+
 
 	return exit_status();
 }
@@ -223,3 +235,85 @@ np_test_mount_entry_regex (struct mount_entry *dummy_mount_list, char *regstr, i
 	} else
 		ok ( false, "regex '%s' not compileable", regstr);
 }
+
+/* The linear search np_set_best_match used before mounts were indexed */
+static struct mount_entry *
+np_test_linear_best_match (struct mount_entry *mount_list, const char *name)
+{
+	struct mount_entry *me, *best_match = NULL;
+	size_t name_len = strlen(name);
+	size_t best_match_len = 0;
+
+	for (me = mount_list; me; me = me->me_next) {
+		if (strcmp(me->me_devname, name)==0)
+			best_match = me;
+	}
+	if (best_match)
+		return best_match;
+	for (me = mount_list; me; me = me->me_next) {
+		size_t len = strlen (me->me_mountdir);
+		if (best_match_len <= len && len <= name_len &&
+		    (len == 1 || strncmp (me->me_mountdir, name, len) == 0)) {
+			best_match = me;
+			best_match_len = len;
+		}
+	}
+	return best_match;
+}
+
+/* Container hosts have thousands of overlay mounts below one directory */
+void
+np_test_best_match_benchmark (int mounts, int paths)
+{
+	struct mount_entry *mount_list = NULL, *me;
+	struct mount_entry **mtail = &mount_list;
+	struct parameter_list *desired = NULL, *p;
+	struct timeval start, end;
+	long indexed_us, linear_us;
+	int i, errors = 0;
+
+	for (i = -3; i < mounts; i++) {
+		me = (struct mount_entry *) calloc(1, sizeof *me);
+		if (i == -3) {
+			me->me_devname = strdup("/dev/sda1");
+			me->me_mountdir = strdup("/");
+		} else if (i == -2) {
+			me->me_devname = strdup("/dev/sda2");
+			me->me_mountdir = strdup("/var");
+		} else if (i == -1) {
+			me->me_devname = strdup("/dev/sdb1");
+			me->me_mountdir = strdup("/var/lib/docker");
+		} else {
+			me->me_devname = strdup("overlay");
+			asprintf(&me->me_mountdir, "/var/lib/docker/overlay2/%d/merged", i);
+		}
+		*mtail = me;
+		mtail = &me->me_next;
+	}
+
+	for (i = 0; i < paths; i++) {
+		char *name;
+		if (i % 4 == 3)
+			asprintf(&name, "/var/lib/docker/overlay2/%d/diff", i);
+		else
+			asprintf(&name, "/var/lib/docker/overlay2/%d/merged/etc", i * 2);
+		np_add_parameter(&desired, name);
+	}
+
+	gettimeofday(&start, NULL);
+	np_set_best_match(desired, mount_list, FALSE);
+	gettimeofday(&end, NULL);
+	indexed_us = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+
+	gettimeofday(&start, NULL);
+	for (p = desired; p; p = p->name_next) {
+		if (p->best_match != np_test_linear_best_match(mount_list, p->name))
+			errors++;
+	}
+	gettimeofday(&end, NULL);
+	linear_us = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+
+	ok( errors == 0, "%d paths over %d mounts: indexed best match agrees with linear search", paths, mounts);
+	diag("best match for %d paths over %d mounts: indexed %ldus, linear %ldus",
+	     paths, mounts, indexed_us, linear_us);
+}
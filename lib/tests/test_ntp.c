@@ -0,0 +1,257 @@
+/******************************************************************************
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ $Id$
+
+******************************************************************************/
+
+#include "common.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include "utils_ntp.h"
+#include "tap.h"
+
+/* Answers time requests on sd as a server 2.5 seconds ahead, and control
+ * requests as a server with two peers, the second the sync source. The
+ * peer list comes in two fragments, the last one first */
+static void
+responder (int sd, int answers)
+{
+	union {
+		ntp_message m;
+		ntp_control_message cm;
+	} pkt, out[2];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	struct timeval now;
+	ntp_assoc_status_pair *pairs;
+	const char *vars = "stratum=2, offset=-12.5, jitter=0.75, refid=\"GPS, 1\"";
+
+	while (answers-- > 0) {
+		fromlen = sizeof from;
+		if (recvfrom (sd, &pkt, sizeof pkt, 0, (struct sockaddr *) &from, &fromlen) < 12)
+			continue;
+
+		if (MODE (pkt.m.flags) == MODE_CLIENT) {
+			gettimeofday (&now, NULL);
+			now.tv_sec += 2;
+			now.tv_usec += 500000;
+			if (now.tv_usec >= 1000000) {
+				now.tv_sec++;
+				now.tv_usec -= 1000000;
+			}
+			out[0].m = pkt.m;
+			out[0].m.flags = 0;
+			VN_SET (out[0].m.flags, 4);
+			MODE_SET (out[0].m.flags, MODE_SERVER);
+			out[0].m.stratum = 1;
+			out[0].m.origts = pkt.m.txts;
+			TVtoNTP64 (now, out[0].m.rxts);
+			TVtoNTP64 (now, out[0].m.txts);
+			sendto (sd, &out[0].m, sizeof (ntp_message), 0, (struct sockaddr *) &from, fromlen);
+		}
+		else if ((pkt.cm.op & OP_MASK) == OP_READSTAT) {
+			np_ntp_setup_control_request (&out[0].cm, OP_READSTAT, ntohs (pkt.cm.seq));
+			out[1].cm = out[0].cm;
+			out[0].cm.op |= REM_RESP | REM_MORE;
+			out[1].cm.op |= REM_RESP;
+			pairs = (ntp_assoc_status_pair *) out[0].cm.data;
+			pairs[0].assoc = htons (1);
+			pairs[0].status = htons (PEER_INCLUDED << 8);
+			out[0].cm.count = htons (4);
+			pairs = (ntp_assoc_status_pair *) out[1].cm.data;
+			pairs[0].assoc = htons (2);
+			pairs[0].status = htons (PEER_SYNCSOURCE << 8);
+			out[1].cm.offset = htons (4);
+			out[1].cm.count = htons (4);
+			sendto (sd, &out[1].cm, 16, 0, (struct sockaddr *) &from, fromlen);
+			sendto (sd, &out[0].cm, 16, 0, (struct sockaddr *) &from, fromlen);
+		}
+		else {
+			np_ntp_setup_control_request (&out[0].cm, OP_READVAR, ntohs (pkt.cm.seq));
+			out[0].cm.op |= REM_RESP;
+			out[0].cm.assoc = pkt.cm.assoc;
+			strcpy (out[0].cm.data, vars);
+			out[0].cm.count = htons (strlen (vars));
+			sendto (sd, &out[0].cm, SIZEOF_NTPCM (out[0].cm), 0, (struct sockaddr *) &from, fromlen);
+		}
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	ntp_message m;
+	struct timeval t, end;
+	struct sockaddr_in sin;
+	socklen_t len = sizeof sin;
+	np_ntp_host *hosts = NULL;
+	np_ntp_server servers[3];
+	char value[32], path[] = "/tmp/test_ntp.XXXXXX";
+	int nhosts = 0, fd, sd;
+	FILE *fp;
+	pid_t pid;
+
+	plan_tests(31);
+
+	/* messages */
+	t.tv_sec = 1200000000;
+	t.tv_usec = 250000;
+	memset (&m, 0, sizeof m);
+	TVtoNTP64 (t, m.origts);
+	ok( NTP64asDOUBLE (m.origts) == 1200000000.25, "timestamps convert both ways");
+	t.tv_sec += 2;
+	TVtoNTP64 (t, m.rxts);
+	TVtoNTP64 (t, m.txts);
+	t.tv_sec -= 1;
+	ok( fabs (np_ntp_calc_offset (&m, &t) - 1.5) < 1e-6, "offset of a clock 1.5 seconds behind, 1 second away");
+
+	np_ntp_setup_request (&m);
+	ok( MODE (m.flags) == MODE_CLIENT && VN (m.flags) == 4 && LI (m.flags) == LI_ALARM,
+	    "client request flags");
+	ok( m.txts != 0, "client request has a transmit time");
+
+	/* variable lists */
+	ok( np_ntp_extract_value ("stratum=2, offset=-0.250, jitter=1.5", "offset", value, sizeof value) != NULL &&
+	    !strcmp (value, "-0.250"), "value in the middle");
+	ok( np_ntp_extract_value ("stratum=2, offset=-0.250, jitter=1.5\r\n", "jitter", value, sizeof value) != NULL &&
+	    !strcmp (value, "1.5"), "last value, without the line end");
+	ok( np_ntp_extract_value ("sys_jitter=3, jitter=1.5", "jitter", value, sizeof value) != NULL &&
+	    !strcmp (value, "1.5"), "names are matched whole");
+	ok( np_ntp_extract_value ("srcadr=\"a, b\",\r\n stratum=3", "stratum", value, sizeof value) != NULL &&
+	    !strcmp (value, "3"), "commas in quotes and names after line breaks");
+	ok( np_ntp_extract_value ("srcadr=\"a, b\"", "srcadr", value, sizeof value) != NULL &&
+	    !strcmp (value, "a, b"), "quotes are removed");
+	ok( np_ntp_extract_value ("stratum=2, offset=1", "jitter", value, sizeof value) == NULL,
+	    "missing value");
+	ok( np_ntp_extract_value ("", "jitter", value, sizeof value) == NULL, "empty list");
+
+	/* picking a server */
+	memset (servers, 0, sizeof servers);
+	servers[0].num_responses = servers[1].num_responses = servers[2].num_responses = 2;
+	servers[0].stratum = 2;
+	servers[0].rtdelay = 0.1;
+	servers[1].stratum = 1;
+	servers[1].rtdelay = 0.05;
+	servers[2].stratum = 1;
+	servers[2].rtdelay = 0.01;
+	LI_SET (servers[2].flags, LI_ALARM);
+	np_ntp_add_host (&hosts, &nhosts, "ntp");
+	hosts[0].servers = servers;
+	hosts[0].nservers = 3;
+	ok( np_ntp_best_server (&hosts[0], 0) == 1, "best server by stratum and delay, skipping alarms");
+	servers[1].num_responses = 0;
+	ok( np_ntp_best_server (&hosts[0], 0) == 0, "servers that did not answer are not picked");
+	servers[0].flags = servers[2].flags;
+	ok( np_ntp_best_server (&hosts[0], 0) == -1, "no server left");
+	servers[0].flags = 0;
+	servers[0].stratum = 1;
+	servers[0].rtdelay = 0.01;
+	servers[0].jitter = 0.1;
+	servers[1].num_responses = 2;
+	ok( np_ntp_best_server (&hosts[0], 0) == 1, "least root distance among equal strata");
+	hosts[0].servers = NULL;
+	np_ntp_free_hosts (hosts, nhosts);
+
+	/* the clock filter */
+	memset (servers, 0, sizeof servers);
+	servers[0].num_responses = 3;
+	servers[0].sample_offset[0] = 0.5;
+	servers[0].sample_delay[0] = 0.02;
+	servers[0].sample_offset[1] = 1.5;
+	servers[0].sample_delay[1] = 0.1;
+	servers[0].sample_offset[2] = 0.7;
+	servers[0].sample_delay[2] = 0.04;
+	np_ntp_filter (&servers[0]);
+	ok( fabs (servers[0].offset - 0.7) < 1e-9, "offset weighted by halves in the order of delay");
+	ok( servers[0].delay == 0.02, "least delay");
+	ok( fabs (servers[0].jitter - sqrt (0.52)) < 1e-9, "jitter from the sample of least delay");
+	ok( !np_ntp_converged (&servers[0]), "samples far apart have not converged");
+	servers[0].sample_offset[1] = 0.502;
+	servers[0].sample_offset[2] = 0.499;
+	np_ntp_filter (&servers[0]);
+	ok( np_ntp_converged (&servers[0]), "samples within the delay have");
+
+	/* host lists */
+	hosts = NULL;
+	nhosts = 0;
+	fd = mkstemp (path);
+	fp = fdopen (fd, "w");
+	fputs ("# servers\nntp1.example.com\n\n  ntp2.example.com  stratum 2\n", fp);
+	fclose (fp);
+	ok( np_ntp_read_hosts (path, &hosts, &nhosts) == OK && nhosts == 2 &&
+	    !strcmp (hosts[0].name, "ntp1.example.com") && !strcmp (hosts[1].name, "ntp2.example.com"),
+	    "host file with comments, blank lines and more words");
+	unlink (path);
+	ok( np_ntp_read_hosts (path, &hosts, &nhosts) == ERROR, "missing host file");
+	np_ntp_free_hosts (hosts, nhosts);
+
+	/* a survey of a server on the loopback, one nothing listens for,
+	 * and one that does not resolve */
+	sd = socket (AF_INET, SOCK_DGRAM, 0);
+	memset (&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	bind (sd, (struct sockaddr *) &sin, sizeof sin);
+	getsockname (sd, (struct sockaddr *) &sin, &len);
+	if ((pid = fork ()) == 0) {
+		responder (sd, NP_NTP_MAX_SAMPLES + 3);
+		_exit (0);
+	}
+	close (sd);
+
+	hosts = NULL;
+	nhosts = 0;
+	np_ntp_add_host (&hosts, &nhosts, "127.0.0.1");
+	np_ntp_add_host (&hosts, &nhosts, "127.0.0.2");
+	np_ntp_add_host (&hosts, &nhosts, "nonexistent.invalid");
+	gettimeofday (&t, NULL);
+	np_ntp_survey (hosts, nhosts, NP_NTP_TIME | NP_NTP_PEERS, NP_NTP_MAX_SAMPLES, 100,
+	               AF_INET, ntohs (sin.sin_port), 1500, 0);
+	gettimeofday (&end, NULL);
+
+	ok( hosts[0].error[0] == '\0' && hosts[0].nservers == 1 &&
+	    hosts[0].servers[0].num_responses == NP_NTP_MIN_SAMPLES, "sampling stops once the filter converged");
+	ok( fabs (hosts[0].servers[0].offset - 2.5) < 0.1, "offset of the server");
+	ok( hosts[0].peers_read && hosts[0].npeers == 2 && hosts[0].syncsource_found,
+	    "peer list from two fragments out of order");
+	ok( !hosts[0].peers[0].selected && hosts[0].peers[1].selected, "only the sync source is asked");
+	ok( hosts[0].peers[1].have_offset && hosts[0].peers[1].offset == -0.0125 &&
+	    hosts[0].peers[1].have_jitter && hosts[0].peers[1].jitter == 0.75 &&
+	    hosts[0].peers[1].have_stratum && hosts[0].peers[1].stratum == 2,
+	    "variables of the sync source");
+	ok( hosts[1].servers[0].num_responses == 0 && !hosts[1].peers_read, "no answer from the other address");
+	ok( hosts[2].error[0] != '\0', "name lookup failure");
+	ok( end.tv_sec - t.tv_sec < 3, "survey ends at the host deadline");
+	np_ntp_free_hosts (hosts, nhosts);
+
+	/* the same server again, a few samples far apart */
+	hosts = NULL;
+	nhosts = 0;
+	np_ntp_add_host (&hosts, &nhosts, "127.0.0.1");
+	gettimeofday (&t, NULL);
+	np_ntp_survey (hosts, nhosts, NP_NTP_TIME, 3, 200, AF_INET, ntohs (sin.sin_port), 1500, 0);
+	gettimeofday (&end, NULL);
+	ok( hosts[0].servers[0].num_responses == 3 &&
+	    (end.tv_sec - t.tv_sec) * 1000 + (end.tv_usec - t.tv_usec) / 1000 >= 400,
+	    "requests spaced by the interval");
+	np_ntp_free_hosts (hosts, nhosts);
+	kill (pid, SIGTERM);
+	waitpid (pid, NULL, 0);
+
+	return exit_status();
+}
@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_ntp") {
+	plan skip_all => "./test_ntp not compiled - please install tap library to test";
+}
+exec "./test_ntp";
@@ -0,0 +1,449 @@
+/******************************************************************************
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ $Id$
+
+******************************************************************************/
+
+#include "common.h"
+#include "utils_snmp.h"
+#include "tap.h"
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* The responder's MIB, in lexicographic order */
+struct mib_entry {
+	const char *oid;
+	int type;
+	unsigned long long number;
+	const char *string;
+};
+
+static struct mib_entry mib[] = {
+	{ "1.3.6.1.2.1.1.1.0", NP_SNMP_OCTET_STRING, 0, "Test agent" },
+	{ "1.3.6.1.2.1.1.3.0", NP_SNMP_TIMETICKS, 123456, NULL },
+	{ "1.3.6.1.2.1.2.1.0", NP_SNMP_INTEGER, 3, NULL },
+	{ "1.3.6.1.2.1.2.2.1.2.1", NP_SNMP_OCTET_STRING, 0, "lo" },
+	{ "1.3.6.1.2.1.2.2.1.2.2", NP_SNMP_OCTET_STRING, 0, "eth0" },
+	{ "1.3.6.1.2.1.2.2.1.2.3", NP_SNMP_OCTET_STRING, 0, "eth1" },
+	{ "1.3.6.1.2.1.2.2.1.10.1", NP_SNMP_COUNTER32, 1000, NULL },
+	{ "1.3.6.1.2.1.2.2.1.10.2", NP_SNMP_COUNTER32, 2000, NULL },
+	{ "1.3.6.1.2.1.2.2.1.10.3", NP_SNMP_COUNTER32, 4294967295ULL, NULL },
+	{ "1.3.6.1.2.1.31.1.1.1.6.1", NP_SNMP_COUNTER64, 18446744073709551615ULL, NULL },
+	{ NULL, 0, 0, NULL }
+};
+
+/* the largest message the responder sends, to test tooBig handling */
+size_t max_msg = NP_SNMP_MAX_MSG;
+
+/* what a walk found */
+struct walk_result {
+	int count[2];
+	unsigned long long last[2];
+};
+
+void walk_collect (size_t column, const np_snmp_varbind *vb, void *arg);
+int lookup (np_snmp_varbind *vb, int next);
+void serve (int sd, int requests);
+int responder (pid_t *pid);
+
+
+/* compares a slice of snmpget output with s */
+static int
+is (const char *p, size_t len, const char *s)
+{
+	return p && strlen (s) == len && !strncmp (p, s, len);
+}
+
+int
+main (int argc, char **argv)
+{
+	np_snmp_oid oid, oid2, roots[2];
+	struct walk_result walked;
+	np_snmp_pdu pdu, resp;
+	np_snmp_varbind vb[8], rvb[8];
+	unsigned char buf[NP_SNMP_MAX_MSG];
+	char str[NP_SNMP_OID_STR];
+	char longstr[300];
+	char text[256], *p;
+	np_snmp_text entry;
+	int len, sd, status;
+	pid_t pid;
+	const unsigned char get_sysuptime[] = {
+		0x30, 0x26, 0x02, 0x01, 0x00, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+		0xa0, 0x19, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+		0x30, 0x0e, 0x30, 0x0c, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01,
+		0x01, 0x03, 0x00, 0x05, 0x00
+	};
+
+	/* "test_snmp -s PORT [MAXMSG]" runs the responder on localhost for
+	 * manual tests */
+	if ((argc == 3 || argc == 4) && !strcmp (argv[1], "-s")) {
+		struct sockaddr_in sin;
+		sd = socket (AF_INET, SOCK_DGRAM, 0);
+		memset (&sin, 0, sizeof sin);
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons (atoi (argv[2]));
+		sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		if (bind (sd, (struct sockaddr *) &sin, sizeof sin) < 0) {
+			perror ("bind");
+			return 1;
+		}
+		if (argc == 4)
+			max_msg = atoi (argv[3]);
+		serve (sd, -1);
+		return 0;
+	}
+
+	plan_tests(44);
+
+	ok( np_snmp_parse_oid (".1.3.6.1.2.1.1.3.0", &oid) == OK && oid.len == 9 && oid.sub[8] == 0,
+	    "parse OID with leading dot");
+	ok( np_snmp_parse_oid ("iso.3.6.1.4.1.4294967295", &oid) == OK && oid.len == 7 &&
+	    oid.sub[0] == 1 && oid.sub[6] == 4294967295U, "parse iso. prefix and largest sub-identifier");
+	ok( np_snmp_parse_oid ("1.3.6.1.4.1.4294967296", &oid) == ERROR, "sub-identifier overflow rejected");
+	ok( np_snmp_parse_oid ("1.3.6.x", &oid) == ERROR, "non numeric OID rejected");
+	ok( np_snmp_parse_oid ("1", &oid) == ERROR, "single sub-identifier rejected");
+	ok( np_snmp_parse_oid ("1.3..6", &oid) == ERROR, "empty sub-identifier rejected");
+
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.10.1", &oid);
+	ok( !strcmp (np_snmp_format_oid (&oid, str, sizeof str), "1.3.6.1.2.1.2.2.1.10.1"), "format OID");
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.10", &oid2);
+	ok( np_snmp_oid_in_subtree (&oid2, &oid) == TRUE, "OID is in subtree");
+	ok( np_snmp_oid_in_subtree (&oid, &oid2) == FALSE, "parent is not in subtree of child");
+	ok( np_snmp_oid_compare (&oid2, &oid) < 0 && np_snmp_oid_compare (&oid, &oid2) > 0 &&
+	    np_snmp_oid_compare (&oid, &oid) == 0, "OID ordering");
+
+	memset (&pdu, 0, sizeof pdu);
+	pdu.version = NP_SNMP_V1;
+	pdu.community = "public";
+	pdu.community_len = 6;
+	pdu.type = NP_SNMP_GET;
+	pdu.request_id = 1;
+	pdu.vb = vb;
+	pdu.nvb = 1;
+	memset (vb, 0, sizeof vb);
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.3.0", &vb[0].oid);
+	vb[0].type = NP_SNMP_NULL;
+	len = np_snmp_encode (&pdu, buf, sizeof buf);
+	ok( len == sizeof get_sysuptime && !memcmp (buf, get_sysuptime, len), "GET request encoded as expected");
+	ok( np_snmp_encode (&pdu, buf, 20) == NP_SNMP_ERR_ENCODE, "encoding into a short buffer fails");
+
+	/* a response with every type, including long form lengths */
+	memset (longstr, 'x', sizeof longstr);
+	pdu.version = NP_SNMP_V2C;
+	pdu.type = NP_SNMP_RESPONSE;
+	pdu.request_id = -123456;
+	pdu.nvb = 6;
+	vb[0].type = NP_SNMP_INTEGER;
+	vb[0].number = (unsigned long long) -129;
+	np_snmp_parse_oid ("1.3.6.1.4.1.2", &vb[1].oid);
+	vb[1].type = NP_SNMP_COUNTER64;
+	vb[1].number = 18446744073709551615ULL;
+	np_snmp_parse_oid ("1.3.6.1.4.1.3", &vb[2].oid);
+	vb[2].type = NP_SNMP_OCTET_STRING;
+	vb[2].data = (unsigned char *) longstr;
+	vb[2].data_len = sizeof longstr;
+	np_snmp_parse_oid ("1.3.6.1.4.1.4", &vb[3].oid);
+	vb[3].type = NP_SNMP_IPADDRESS;
+	vb[3].data = (unsigned char *) "\x0a\x00\x00\x01";
+	vb[3].data_len = 4;
+	np_snmp_parse_oid ("1.3.6.1.4.1.5", &vb[4].oid);
+	vb[4].type = NP_SNMP_COUNTER32;
+	vb[4].number = 2147483648U;
+	np_snmp_parse_oid ("2.999.5", &vb[5].oid);
+	vb[5].type = NP_SNMP_NOSUCHINSTANCE;
+	len = np_snmp_encode (&pdu, buf, sizeof buf);
+	ok( len > 300, "response encoded");
+
+	memset (&resp, 0, sizeof resp);
+	resp.vb = rvb;
+	resp.max_vb = 5;
+	ok( np_snmp_decode (buf, len, &resp) == NP_SNMP_ERR_DECODE, "more varbinds than room is an error");
+	resp.max_vb = 8;
+	ok( np_snmp_decode (buf, len, &resp) == NP_SNMP_OK, "response decoded");
+	ok( resp.version == NP_SNMP_V2C && resp.community_len == 6 && !strncmp (resp.community, "public", 6) &&
+	    resp.type == NP_SNMP_RESPONSE && resp.request_id == -123456 && resp.nvb == 6,
+	    "header fields survive the round trip");
+	ok( rvb[0].type == NP_SNMP_INTEGER && (long long) rvb[0].number == -129, "negative INTEGER");
+	ok( rvb[1].type == NP_SNMP_COUNTER64 && rvb[1].number == 18446744073709551615ULL, "largest Counter64");
+	ok( rvb[2].data_len == sizeof longstr && !memcmp (rvb[2].data, longstr, sizeof longstr), "300 byte string");
+	ok( rvb[4].number == 2147483648U, "Counter32 with the top bit set");
+	ok( rvb[5].type == NP_SNMP_NOSUCHINSTANCE && rvb[5].oid.len == 3 && rvb[5].oid.sub[0] == 2 &&
+	    rvb[5].oid.sub[1] == 999, "exception value and OID below 2.40");
+	ok( np_snmp_decode (buf, len - 1, &resp) == NP_SNMP_ERR_DECODE, "truncated message is an error");
+
+	np_snmp_format_value (&rvb[0], str, sizeof str);
+	ok( !strcmp (str, "INTEGER: -129"), "format INTEGER");
+	np_snmp_format_value (&rvb[3], str, sizeof str);
+	ok( !strcmp (str, "IpAddress: 10.0.0.1"), "format IpAddress");
+	vb[0].type = NP_SNMP_TIMETICKS;
+	vb[0].number = 9000050;
+	np_snmp_format_value (&vb[0], str, sizeof str);
+	ok( !strcmp (str, "Timeticks: (9000050) 1 day, 1:00:00.50"), "format Timeticks");
+	vb[0].type = NP_SNMP_OCTET_STRING;
+	vb[0].data = (unsigned char *) "\x00\x1a\xff";
+	vb[0].data_len = 3;
+	np_snmp_format_value (&vb[0], str, sizeof str);
+	ok( !strcmp (str, "Hex-STRING: 00 1A FF"), "format binary OCTET STRING");
+
+	/* snmpget output */
+	strcpy (text, "iso.3.6.1.2.1.1.1.0 = STRING: \"Linux\nbox\"\n"
+	        "iso.3.6.1.2.1.1.3.0 = Timeticks: (5) 0:00:00.05\n"
+	        "x = \"a b\"\n\n");
+	p = text;
+	ok( np_snmp_text_next (&p, " = ", &entry) &&
+	    is (entry.oid, entry.oid_len, "iso.3.6.1.2.1.1.1.0") &&
+	    is (entry.type, entry.type_len, "STRING"), "split OID and type from snmpget output");
+	ok( is (entry.value, entry.value_len, "\"Linux\nbox\""), "value continues on lines without a delimiter");
+	ok( np_snmp_text_next (&p, " = ", &entry) &&
+	    is (entry.type, entry.type_len, "Timeticks") &&
+	    is (entry.value, entry.value_len, "(5) 0:00:00.05"), "next entry");
+	ok( np_snmp_text_next (&p, " = ", &entry) && entry.type == NULL &&
+	    is (entry.value, entry.value_len, "a b"), "quoted value without a type");
+	ok( !np_snmp_text_next (&p, " = ", &entry), "end of output");
+	ok( np_snmp_text_type ("Network Address: 0a", 19) == 15 &&
+	    np_snmp_text_type ("No Such Object available on this agent at this OID", 51) == 0 &&
+	    np_snmp_text_type ("Wrong Type (should be INTEGER): Gauge32: 5", 42) == 0,
+	    "types are found at the start only");
+
+	/* requests against the responder */
+	sd = responder (&pid);
+	pdu.version = NP_SNMP_V2C;
+	pdu.type = NP_SNMP_GET;
+	pdu.request_id = 42;
+	pdu.nvb = 2;
+	vb[0].type = vb[1].type = NP_SNMP_NULL;
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.3.0", &vb[0].oid);
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.4.0", &vb[1].oid);
+	ok( np_snmp_exchange (sd, &pdu, &resp, buf, sizeof buf, 2, 1) == NP_SNMP_OK, "GET answered");
+	ok( resp.nvb == 2 && rvb[0].type == NP_SNMP_TIMETICKS && rvb[0].number == 123456,
+	    "GET returns TimeTicks");
+	ok( rvb[1].type == NP_SNMP_NOSUCHOBJECT, "GET of a missing OID returns noSuchObject");
+
+	pdu.type = NP_SNMP_GETNEXT;
+	pdu.request_id = 43;
+	pdu.nvb = 1;
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.10", &vb[0].oid);
+	ok( np_snmp_exchange (sd, &pdu, &resp, buf, sizeof buf, 2, 1) == NP_SNMP_OK &&
+	    resp.nvb == 1 && rvb[0].type == NP_SNMP_COUNTER32 && rvb[0].number == 1000 &&
+	    !strcmp (np_snmp_format_oid (&rvb[0].oid, str, sizeof str), "1.3.6.1.2.1.2.2.1.10.1"),
+	    "GETNEXT returns the first column entry");
+
+	pdu.version = NP_SNMP_V1;
+	pdu.type = NP_SNMP_GET;
+	pdu.request_id = 44;
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.4.0", &vb[0].oid);
+	ok( np_snmp_exchange (sd, &pdu, &resp, buf, sizeof buf, 2, 1) == NP_SNMP_OK &&
+	    resp.error_status == NP_SNMP_NOSUCHNAME && resp.error_index == 1,
+	    "SNMPv1 GET of a missing OID returns noSuchName");
+
+	/* ifDescr and ifInOctets */
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.2", &roots[0]);
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.10", &roots[1]);
+	pdu.version = NP_SNMP_V2C;
+	memset (&walked, 0, sizeof walked);
+	ok( np_snmp_walk (sd, &pdu, roots, 2, 2, 2, 1, walk_collect, &walked) == NP_SNMP_OK &&
+	    walked.count[0] == 3 && walked.count[1] == 3 && walked.last[1] == 4294967295ULL,
+	    "GETBULK walk of two columns");
+	pdu.version = NP_SNMP_V1;
+	memset (&walked, 0, sizeof walked);
+	ok( np_snmp_walk (sd, &pdu, roots, 2, 10, 2, 1, walk_collect, &walked) == NP_SNMP_OK &&
+	    walked.count[0] == 3 && walked.count[1] == 3,
+	    "SNMPv1 walk with GETNEXT");
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.99", &roots[0]);
+	pdu.version = NP_SNMP_V2C;
+	memset (&walked, 0, sizeof walked);
+	ok( np_snmp_walk (sd, &pdu, roots, 1, 10, 2, 1, walk_collect, &walked) == NP_SNMP_OK &&
+	    walked.count[0] == 0, "walk of an empty subtree");
+
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+	ok( np_snmp_exchange (sd, &pdu, &resp, buf, sizeof buf, 1, 0) != NP_SNMP_OK,
+	    "no answer once the responder is gone");
+	close (sd);
+
+	max_msg = 100;
+	sd = responder (&pid);
+	pdu.version = NP_SNMP_V2C;
+	pdu.request_id = 45;
+	pdu.nvb = 4;
+	for (len = 0; len < 4; len++) {
+		np_snmp_parse_oid ("1.3.6.1.2.1.1.1.0", &vb[len].oid);
+		vb[len].type = NP_SNMP_NULL;
+	}
+	ok( np_snmp_exchange (sd, &pdu, &resp, buf, sizeof buf, 2, 1) == NP_SNMP_OK &&
+	    resp.error_status == NP_SNMP_TOOBIG && resp.nvb == 0,
+	    "response over the agent's message size returns tooBig");
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.2", &roots[0]);
+	memset (&walked, 0, sizeof walked);
+	ok( np_snmp_walk (sd, &pdu, roots, 2, 50, 2, 1, walk_collect, &walked) == NP_SNMP_OK &&
+	    walked.count[0] == 3 && walked.count[1] == 3,
+	    "walk continues after responses cut short");
+	pdu.nvb = 1;
+	np_snmp_parse_oid ("1.3.6.1.2.1.2.2.1.2.1", &vb[0].oid);
+	vb[0].type = NP_SNMP_NULL;
+	ok( np_snmp_exchange (sd, &pdu, &resp, buf, sizeof buf, 2, 1) == NP_SNMP_OK &&
+	    resp.error_status == NP_SNMP_NOERROR && resp.nvb == 1,
+	    "small response fits the agent's message size");
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+	close (sd);
+
+	return exit_status();
+}
+
+
+void
+walk_collect (size_t column, const np_snmp_varbind *vb, void *arg)
+{
+	struct walk_result *walked = arg;
+
+	walked->count[column]++;
+	walked->last[column] = vb->number;
+}
+
+/* Fills in vb from the table above: the entry for vb->oid itself, or with
+ * next the one after it. Returns FALSE if there is none */
+int
+lookup (np_snmp_varbind *vb, int next)
+{
+	np_snmp_oid oid;
+	int j;
+
+	for (j = 0; mib[j].oid; j++) {
+		np_snmp_parse_oid (mib[j].oid, &oid);
+		if ((!next && np_snmp_oid_compare (&oid, &vb->oid) == 0) ||
+		    (next && np_snmp_oid_compare (&oid, &vb->oid) > 0))
+			break;
+	}
+	if (mib[j].oid == NULL) {
+		vb->type = next ? NP_SNMP_ENDOFMIBVIEW : NP_SNMP_NOSUCHOBJECT;
+		return FALSE;
+	}
+	vb->oid = oid;
+	vb->type = mib[j].type;
+	vb->number = mib[j].number;
+	if (mib[j].string) {
+		vb->data = (const unsigned char *) mib[j].string;
+		vb->data_len = strlen (mib[j].string);
+	}
+	return TRUE;
+}
+
+/* Answers requests on sd from the table above; -1 serves forever */
+void
+serve (int sd, int requests)
+{
+	static np_snmp_varbind vb[1024], req[1024];
+	unsigned char buf[NP_SNMP_MAX_MSG];
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	np_snmp_pdu pdu;
+	ssize_t n;
+	size_t i, k, nreq, non_repeaters;
+	int r, len, error_index, more;
+
+	while (requests < 0 || requests-- > 0) {
+		fromlen = sizeof from;
+		n = recvfrom (sd, buf, sizeof buf, 0, (struct sockaddr *) &from, &fromlen);
+		if (n < 0)
+			continue;
+		pdu.vb = req;
+		pdu.max_vb = sizeof req / sizeof *req;
+		if (np_snmp_decode (buf, n, &pdu) != NP_SNMP_OK)
+			continue;
+		error_index = 0;
+		nreq = pdu.nvb;
+		pdu.vb = vb;
+
+		if (pdu.type == NP_SNMP_GETBULK) {
+			non_repeaters = pdu.error_status < (int)nreq ? pdu.error_status : nreq;
+			for (k = 0; k < non_repeaters; k++) {
+				vb[k] = req[k];
+				lookup (&vb[k], TRUE);
+			}
+			/* each row continues from the one before */
+			for (r = 0, more = TRUE; r < pdu.error_index && more; r++) {
+				more = FALSE;
+				for (i = non_repeaters; i < nreq && k < sizeof vb / sizeof *vb; i++, k++) {
+					vb[k] = r ? vb[k - (nreq - non_repeaters)] : req[i];
+					if (vb[k].type != NP_SNMP_ENDOFMIBVIEW && lookup (&vb[k], TRUE))
+						more = TRUE;
+				}
+			}
+			pdu.nvb = k;
+		}
+		else {
+			for (i = 0; i < nreq; i++) {
+				vb[i] = req[i];
+				if (!lookup (&vb[i], pdu.type != NP_SNMP_GET) && error_index == 0)
+					error_index = i + 1;
+			}
+		}
+
+		if (pdu.version == NP_SNMP_V1 && error_index) {
+			/* SNMPv1 returns the request unchanged along with the error */
+			pdu.vb = req;
+			pdu.error_status = NP_SNMP_NOSUCHNAME;
+			pdu.error_index = error_index;
+		} else {
+			pdu.error_status = pdu.error_index = 0;
+		}
+		pdu.type = NP_SNMP_RESPONSE;
+		len = np_snmp_encode (&pdu, buf, max_msg);
+		/* a GETBULK answer may be cut short rather than fail */
+		while (len == NP_SNMP_ERR_ENCODE && pdu.nvb > nreq) {
+			pdu.nvb--;
+			len = np_snmp_encode (&pdu, buf, max_msg);
+		}
+		if (len == NP_SNMP_ERR_ENCODE) {
+			pdu.error_status = NP_SNMP_TOOBIG;
+			pdu.error_index = 0;
+			pdu.nvb = 0;
+			len = np_snmp_encode (&pdu, buf, max_msg);
+		}
+		if (len > 0)
+			sendto (sd, buf, len, 0, (struct sockaddr *) &from, fromlen);
+	}
+}
+
+/* Forks a responder on a loopback port and returns a socket connected to it */
+int
+responder (pid_t *pid)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof sin;
+	int server, client;
+
+	server = socket (AF_INET, SOCK_DGRAM, 0);
+	memset (&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	bind (server, (struct sockaddr *) &sin, sizeof sin);
+	getsockname (server, (struct sockaddr *) &sin, &sinlen);
+
+	if ((*pid = fork ()) == 0) {
+		serve (server, -1);
+		_exit (0);
+	}
+	close (server);
+
+	client = socket (AF_INET, SOCK_DGRAM, 0);
+	connect (client, (struct sockaddr *) &sin, sizeof sin);
+	return client;
+}
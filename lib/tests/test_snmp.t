@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_snmp") {
+	plan skip_all => "./test_snmp not compiled - please install tap library to test";
+}
+exec "./test_snmp";
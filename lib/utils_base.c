@@ -15,6 +15,10 @@
 #include <stdarg.h>
 #include "common.h"
 #include "utils_base.h"
+#if defined(HAVE_SPAWN_H) && defined(HAVE_POSIX_SPAWN)
+# include <spawn.h>
+# include <sys/resource.h>
+#endif
 
 void
 die (int result, const char *fmt, ...)
@@ -229,6 +233,50 @@ char *np_escaped_string (const char *string) {
 	return data;
 }
 
+/* Starts argv with posix_spawn(), with fd_out and fd_err as its stdout
+ * and stderr, which avoids copying our address space just to throw it
+ * away in execve(). The child can't lower its own core file limit this
+ * way, so we lower ours and let it inherit that. Returns -1 if the
+ * command couldn't be spawned, in which case the caller falls back to
+ * fork(), so failures are reported the way they always were */
+pid_t
+np_spawn (char *const *argv, char **env, int fd_out, int fd_err)
+{
+#if defined(HAVE_SPAWN_H) && defined(HAVE_POSIX_SPAWN)
+	posix_spawn_file_actions_t fa;
+	pid_t pid;
+	int ret;
+#ifdef RLIMIT_CORE
+	static int core_limited = 0;
+	struct rlimit limit;
+
+	if (!core_limited) {
+		getrlimit (RLIMIT_CORE, &limit);
+		limit.rlim_cur = 0;
+		setrlimit (RLIMIT_CORE, &limit);
+		core_limited = 1;
+	}
+#endif
+
+	/* dup2() onto itself wouldn't clear close-on-exec */
+	if (fd_out <= STDERR_FILENO || fd_err <= STDERR_FILENO)
+		return -1;
+
+	if (posix_spawn_file_actions_init (&fa) != 0)
+		return -1;
+	ret = posix_spawn_file_actions_adddup2 (&fa, fd_out, STDOUT_FILENO);
+	if (!ret)
+		ret = posix_spawn_file_actions_adddup2 (&fa, fd_err, STDERR_FILENO);
+	if (!ret)
+		ret = posix_spawn (&pid, argv[0], &fa, NULL, argv, env);
+	posix_spawn_file_actions_destroy (&fa);
+
+	return ret ? -1 : pid;
+#else
+	return -1;
+#endif
+}
+
 int np_check_if_root(void) { return (geteuid() == 0); }
 
 int np_warn_if_not_root(void) {
@@ -39,6 +39,10 @@ char *np_escaped_string (const char *);
 
 void die (int, const char *, ...) __attribute__((noreturn,format(printf, 2, 3)));
 
+/* posix_spawn() argv with fd_out and fd_err as its stdout and stderr;
+ * -1 means the caller should fork() instead */
+pid_t np_spawn (char *const *, char **, int, int);
+
 /* Return codes for _set_thresholds */
 #define NP_RANGE_UNPARSEABLE 1
 #define NP_WARN_WITHIN_CRIT 2
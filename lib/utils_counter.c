@@ -0,0 +1,314 @@
+/****************************************************************************
+* Utils for counter rates
+*
+* License: GPL
+* Copyright (c) 2007 nagios-plugins team
+*
+* Last Modified: $Date$
+*
+* Description:
+*
+* This file contains a small store for the previous sample of named
+* counters, so that plugins can turn counters into per-second rates
+* without an external RRD. Samples live in a state file of fixed-size
+* records, hashed by key with linear probing. The file is mapped into
+* memory and held under flock() while open. These are tested by libtap
+*
+* License Information:
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*
+* $Id$
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_counter.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define COUNTER_MAGIC "NPCTR1"
+#define COUNTER_MIN_SLOTS 64
+
+/* record flags */
+#define COUNTER_SAMPLE 1
+#define COUNTER_RATE 2
+
+/* The file starts with a header the size of a record, followed by a
+ * power of two number of record slots. Everything is in host byte order */
+struct counter_header
+{
+	char magic[8];
+	unsigned int slots;
+	unsigned int used;
+	char reserved[112];
+};
+
+struct counter_record
+{
+	unsigned long long hash;	/* of the whole key; 0 marks a free slot */
+	unsigned long long value;
+	long long sec;
+	long long usec;
+	double rate;	/* the last rate, for samples within the same instant */
+	int flags;
+	char key[84];	/* longer keys are told apart by hash */
+};
+
+struct np_counter_store
+{
+	int fd;
+	size_t size;
+	struct counter_header *header;
+	struct counter_record *records;
+};
+
+static unsigned long long
+counter_hash (const char *key)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	while (*key)
+		hash = (hash ^ (unsigned char) *key++) * 1099511628211ULL;
+	return hash ? hash : 1;
+}
+
+/* Resizes the file to hold slots records and maps it */
+static int
+counter_map (np_counter_store *st, unsigned int slots, int resize)
+{
+	if (st->header)
+		munmap (st->header, st->size);
+	st->header = NULL;
+	st->size = sizeof (struct counter_header) + slots * sizeof (struct counter_record);
+	if (resize && ftruncate (st->fd, st->size) < 0)
+		return ERROR;
+	st->header = mmap (NULL, st->size, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+	if (st->header == MAP_FAILED) {
+		st->header = NULL;
+		return ERROR;
+	}
+	st->records = (struct counter_record *) (st->header + 1);
+	return OK;
+}
+
+static struct counter_record *
+counter_slot (np_counter_store *st, const char *key, unsigned long long hash)
+{
+	struct counter_record *r;
+	unsigned int i, mask = st->header->slots - 1;
+
+	for (i = hash & mask;; i = (i + 1) & mask) {
+		r = &st->records[i];
+		if (r->hash == 0 ||
+		    (r->hash == hash && !strncmp (r->key, key, sizeof r->key - 1)))
+			return r;
+	}
+}
+
+/* Doubles the number of slots, dropping samples older than NP_COUNTER_EXPIRE */
+static int
+counter_grow (np_counter_store *st, time_t now)
+{
+	struct counter_record *old, *r;
+	unsigned int i, slots = st->header->slots;
+
+	if ((old = malloc (slots * sizeof (struct counter_record))) == NULL)
+		return ERROR;
+	memcpy (old, st->records, slots * sizeof (struct counter_record));
+
+	if (counter_map (st, slots * 2, TRUE) == ERROR) {
+		free (old);
+		return ERROR;
+	}
+	memset (st->records, 0, slots * 2 * sizeof (struct counter_record));
+	st->header->slots = slots * 2;
+	st->header->used = 0;
+
+	for (i = 0; i < slots; i++) {
+		if (old[i].hash == 0 || now - old[i].sec > NP_COUNTER_EXPIRE)
+			continue;
+		r = counter_slot (st, old[i].key, old[i].hash);
+		*r = old[i];
+		st->header->used++;
+	}
+	free (old);
+	return OK;
+}
+
+/* Returns the state file for name in the state directory, which the
+ * caller must free */
+char *
+np_counter_path (const char *name)
+{
+	const char *dir = getenv ("NAGIOS_PLUGIN_STATE_DIRECTORY");
+	size_t len;
+	char *path, *p;
+
+	if (dir == NULL || *dir == '\0')
+		dir = NP_COUNTER_DIR;
+	len = strlen (dir) + strlen (name) + sizeof ("/.state");
+	if ((path = malloc (len)) == NULL)
+		return NULL;
+	snprintf (path, len, "%s/%s.state", dir, name);
+
+	/* host names and the like must not reach outside the directory */
+	for (p = path + strlen (dir) + 1; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	return path;
+}
+
+/* Checks that the mapped header describes the mapped records: as many
+ * slots as there are, a power of two of them, and used counting the
+ * records in use and leaving at least half free, so that probing always
+ * ends at a free slot */
+static int
+counter_valid (np_counter_store *st, off_t file_size)
+{
+	struct counter_header *h = st->header;
+	unsigned int i, used = 0;
+
+	if (memcmp (h->magic, COUNTER_MAGIC, sizeof COUNTER_MAGIC) ||
+	    st->size != (size_t) file_size ||
+	    h->slots != (st->size - sizeof (struct counter_header)) / sizeof (struct counter_record) ||
+	    h->slots < COUNTER_MIN_SLOTS || (h->slots & (h->slots - 1)) ||
+	    h->used > h->slots / 2)
+		return FALSE;
+
+	for (i = 0; i < h->slots; i++)
+		if (st->records[i].hash != 0)
+			used++;
+	return used == h->used;
+}
+
+/* Opens (creating if needed) and locks the state file at path. A file
+ * that is not a state file, or not a consistent one, is started over.
+ * Returns NULL on error */
+np_counter_store *
+np_counter_open (const char *path)
+{
+	np_counter_store *st;
+	struct stat sb;
+	int fresh;
+
+	if ((st = calloc (1, sizeof (np_counter_store))) == NULL)
+		return NULL;
+	if ((st->fd = open (path, O_RDWR | O_CREAT, 0600)) < 0 ||
+	    flock (st->fd, LOCK_EX) < 0 || fstat (st->fd, &sb) < 0) {
+		np_counter_close (st);
+		return NULL;
+	}
+
+	fresh = (size_t) sb.st_size < sizeof (struct counter_header);
+	if (!fresh) {
+		if (counter_map (st, (sb.st_size - sizeof (struct counter_header)) /
+		                     sizeof (struct counter_record), FALSE) == ERROR) {
+			np_counter_close (st);
+			return NULL;
+		}
+		fresh = !counter_valid (st, sb.st_size);
+	}
+	if (fresh) {
+		if (ftruncate (st->fd, 0) < 0 ||
+		    counter_map (st, COUNTER_MIN_SLOTS, TRUE) == ERROR) {
+			np_counter_close (st);
+			return NULL;
+		}
+		memcpy (st->header->magic, COUNTER_MAGIC, sizeof COUNTER_MAGIC);
+		st->header->slots = COUNTER_MIN_SLOTS;
+		st->header->used = 0;
+	}
+	return st;
+}
+
+/* Stores value as the latest sample of counter key, taken at now, and
+ * puts the per-second rate since the previous sample in rate. bits is
+ * the width of the counter, 32 or 64, or 0 to guess it from the values.
+ * 32 bit counters that went down are taken to have wrapped; a 64 bit
+ * counter does not wrap in practice, so there it means a reset */
+int
+np_counter_rate (np_counter_store *st, const char *key, unsigned long long value,
+                 int bits, const struct timeval *now, double *rate)
+{
+	struct counter_record *r;
+	unsigned long long hash = counter_hash (key), delta;
+	double elapsed;
+	int result = NP_COUNTER_OK;
+
+	r = counter_slot (st, key, hash);
+	if (r->hash == 0) {
+		if ((st->header->used + 1) * 2 > st->header->slots) {
+			if (counter_grow (st, now->tv_sec) == ERROR)
+				return NP_COUNTER_ERROR;
+			r = counter_slot (st, key, hash);
+		}
+		memset (r, 0, sizeof (struct counter_record));
+		r->hash = hash;
+		strncpy (r->key, key, sizeof r->key - 1);
+		st->header->used++;
+	}
+
+	if (r->flags & COUNTER_SAMPLE) {
+		elapsed = (now->tv_sec - r->sec) + (now->tv_usec - r->usec) / 1000000.0;
+		if (elapsed <= 0) {
+			/* nothing new since the last sample: keep it */
+			if (!(r->flags & COUNTER_RATE))
+				return NP_COUNTER_FIRST;
+			*rate = r->rate;
+			return NP_COUNTER_OK;
+		}
+
+		if (bits == 0)
+			bits = (value > 0xffffffffULL || r->value > 0xffffffffULL) ? 64 : 32;
+		if (value >= r->value)
+			delta = value - r->value;
+		else if (bits == 32 && r->value <= 0xffffffffULL) {
+			delta = 0x100000000ULL - r->value + value;
+			result = NP_COUNTER_WRAPPED;
+		}
+		else
+			result = NP_COUNTER_FIRST;
+
+		if (result != NP_COUNTER_FIRST) {
+			*rate = r->rate = delta / elapsed;
+			r->flags |= COUNTER_RATE;
+		}
+	}
+	else
+		result = NP_COUNTER_FIRST;
+
+	if (result == NP_COUNTER_FIRST)
+		r->flags &= ~COUNTER_RATE;
+	r->value = value;
+	r->sec = now->tv_sec;
+	r->usec = now->tv_usec;
+	r->flags |= COUNTER_SAMPLE;
+	return result;
+}
+
+/* Writes back and unlocks the state file */
+void
+np_counter_close (np_counter_store *st)
+{
+	if (st == NULL)
+		return;
+	if (st->header)
+		munmap (st->header, st->size);
+	if (st->fd >= 0)
+		close (st->fd);
+	free (st);
+}
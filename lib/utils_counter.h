@@ -0,0 +1,31 @@
+#ifndef _UTILS_COUNTER_
+#define _UTILS_COUNTER_
+
+/*
+ * Header file for nagios plugins utils_counter.c
+ *
+ * Keeps the previous sample of named counters in a state file, so that
+ * plugins can report per-second rates instead of raw counter values.
+ */
+
+/* where state files go unless $NAGIOS_PLUGIN_STATE_DIRECTORY says otherwise */
+#define NP_COUNTER_DIR "/var/tmp"
+
+/* samples not updated for this long are dropped when the file grows */
+#define NP_COUNTER_EXPIRE (30 * 24 * 3600)
+
+/** return codes of np_counter_rate **/
+#define NP_COUNTER_OK 0		/* rate computed */
+#define NP_COUNTER_FIRST 1	/* no usable previous sample; this one was stored */
+#define NP_COUNTER_WRAPPED 2	/* rate computed across a counter wrap */
+#define NP_COUNTER_ERROR -1
+
+typedef struct np_counter_store np_counter_store;
+
+char *np_counter_path (const char *);
+np_counter_store *np_counter_open (const char *);
+int np_counter_rate (np_counter_store *, const char *, unsigned long long,
+                     int, const struct timeval *, double *);
+void np_counter_close (np_counter_store *);
+
+#endif /* _UTILS_COUNTER_ */
@@ -33,6 +33,145 @@
 #include "common.h"
 #include "utils_disk.h"
 
+/* Chained hash table keyed on (string, length), so that prefixes of a
+   path can be looked up without copying them */
+struct np_index_entry
+{
+  const char *key;
+  size_t len;
+  unsigned int hash;
+  void *value;
+  struct np_index_entry *next;
+};
+
+struct np_index
+{
+  size_t size;			/* number of buckets, a power of two */
+  size_t count;
+  struct np_index_entry **buckets;
+};
+
+#define NP_INDEX_MIN_SIZE 16
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME 16777619U
+
+static unsigned int
+np_index_hash_step (unsigned int hash, unsigned char c)
+{
+  return (hash ^ c) * FNV_PRIME;
+}
+
+static unsigned int
+np_index_hash (const char *key, size_t len)
+{
+  unsigned int hash = FNV_OFFSET;
+  while (len--)
+    hash = np_index_hash_step (hash, (unsigned char) *key++);
+  return hash;
+}
+
+static struct np_index *
+np_index_new (size_t count)
+{
+  struct np_index *idx;
+
+  idx = (struct np_index *) malloc (sizeof *idx);
+  if (idx == NULL)
+    return NULL;
+  idx->size = NP_INDEX_MIN_SIZE;
+  while (idx->size < count)
+    idx->size <<= 1;
+  idx->count = 0;
+  idx->buckets = (struct np_index_entry **) calloc (idx->size, sizeof *idx->buckets);
+  if (idx->buckets == NULL) {
+    free (idx);
+    return NULL;
+  }
+  return idx;
+}
+
+static void
+np_index_free (struct np_index *idx)
+{
+  struct np_index_entry *e, *next;
+  size_t i;
+
+  if (idx == NULL)
+    return;
+  for (i = 0; i < idx->size; i++) {
+    for (e = idx->buckets[i]; e; e = next) {
+      next = e->next;
+      free (e);
+    }
+  }
+  free (idx->buckets);
+  free (idx);
+}
+
+static void *
+np_index_lookup (const struct np_index *idx, const char *key, size_t len, unsigned int hash)
+{
+  const struct np_index_entry *e;
+
+  for (e = idx->buckets[hash & (idx->size - 1)]; e; e = e->next) {
+    if (e->hash == hash && e->len == len && memcmp (e->key, key, len) == 0)
+      return e->value;
+  }
+  return NULL;
+}
+
+static void
+np_index_grow (struct np_index *idx)
+{
+  struct np_index_entry **buckets, *e, *next;
+  size_t size = idx->size << 1;
+  size_t i;
+
+  buckets = (struct np_index_entry **) calloc (size, sizeof *buckets);
+  if (buckets == NULL)
+    return;			/* keep going with longer chains */
+  for (i = 0; i < idx->size; i++) {
+    for (e = idx->buckets[i]; e; e = next) {
+      next = e->next;
+      e->next = buckets[e->hash & (size - 1)];
+      buckets[e->hash & (size - 1)] = e;
+    }
+  }
+  free (idx->buckets);
+  idx->buckets = buckets;
+  idx->size = size;
+}
+
+/* Adds key to the index; a key already present gets the new value.
+   Returns FALSE if out of memory */
+static int
+np_index_insert (struct np_index *idx, const char *key, void *value)
+{
+  struct np_index_entry *e;
+  size_t len = strlen (key);
+  unsigned int hash = np_index_hash (key, len);
+
+  for (e = idx->buckets[hash & (idx->size - 1)]; e; e = e->next) {
+    if (e->hash == hash && e->len == len && memcmp (e->key, key, len) == 0) {
+      e->value = value;
+      return TRUE;
+    }
+  }
+
+  e = (struct np_index_entry *) malloc (sizeof *e);
+  if (e == NULL)
+    return FALSE;
+  e->key = key;
+  e->len = len;
+  e->hash = hash;
+  e->value = value;
+  e->next = idx->buckets[hash & (idx->size - 1)];
+  idx->buckets[hash & (idx->size - 1)] = e;
+  if (++idx->count > idx->size)
+    np_index_grow (idx);
+  return TRUE;
+}
+
 void
 np_add_name (struct name_list **list, const char *name)
 {
@@ -40,6 +179,16 @@ np_add_name (struct name_list **list, const char *name)
   new_entry = (struct name_list *) malloc (sizeof *new_entry);
   new_entry->name = (char *) name;
   new_entry->next = *list;
+
+  /* An index that cannot be created or updated is dropped; lookups
+     then fall back to walking the list */
+  new_entry->index = *list ? (*list)->index : np_index_new (0);
+  if (new_entry->index && ! np_index_insert (new_entry->index, name, new_entry)) {
+    struct name_list *n;
+    np_index_free (new_entry->index);
+    for (n = new_entry; n; n = n->next)
+      n->index = NULL;
+  }
   *list = new_entry;
 }
 
@@ -107,10 +256,48 @@ np_find_parameter(struct parameter_list *list, const char *name)
   return NULL;
 }
 
+/* Index of a mount list by device name and by mount point. As in the
+   linear search this replaces, later entries win over earlier duplicates */
+struct mount_index
+{
+  struct np_index *devname;
+  struct np_index *mountdir;
+  struct mount_entry *short_dir[2];	/* last mount point of length 0 and 1 */
+};
+
+static int
+np_index_mounts (struct mount_index *mi, struct mount_entry *mount_list)
+{
+  struct mount_entry *me;
+  size_t count = 0;
+  size_t len;
+
+  for (me = mount_list; me; me = me->me_next)
+    count++;
+
+  mi->short_dir[0] = mi->short_dir[1] = NULL;
+  mi->devname = np_index_new (count);
+  mi->mountdir = np_index_new (count);
+  if (mi->devname == NULL || mi->mountdir == NULL)
+    return FALSE;
+
+  for (me = mount_list; me; me = me->me_next) {
+    if (! np_index_insert (mi->devname, me->me_devname, me) ||
+        ! np_index_insert (mi->mountdir, me->me_mountdir, me))
+      return FALSE;
+    if ((len = strlen (me->me_mountdir)) < 2)
+      mi->short_dir[len] = me;
+  }
+  return TRUE;
+}
+
 void
 np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list, int exact)
 {
   struct parameter_list *d;
+  struct mount_index mi;
+  int indexed = FALSE;
+
   for (d = desired; d; d= d->name_next) {
     if (! d->best_match) {
       struct mount_entry *me;
@@ -118,23 +305,33 @@ np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list
       size_t best_match_len = 0;
       struct mount_entry *best_match = NULL;
 
-      /* set best match if path name exactly matches a mounted device name */
-      for (me = mount_list; me; me = me->me_next) {
-        if (strcmp(me->me_devname, d->name)==0)
-          best_match = me;
+      if (! indexed) {
+        if (! np_index_mounts (&mi, mount_list))
+          die (STATE_UNKNOWN, _("failed allocating storage for '%s'\n"), "mount index");
+        indexed = TRUE;
       }
 
+      /* set best match if path name exactly matches a mounted device name */
+      best_match = np_index_lookup (mi.devname, d->name, name_len, np_index_hash (d->name, name_len));
+
       /* set best match by directory name if no match was found by devname */
       if (! best_match) {
-        for (me = mount_list; me; me = me->me_next) {
-          size_t len = strlen (me->me_mountdir);
-          if ((exact == FALSE && (best_match_len <= len && len <= name_len && 
-             (len == 1 || strncmp (me->me_mountdir, d->name, len) == 0)))
-             || (exact == TRUE && strcmp(me->me_mountdir, d->name)==0))
-          {
-            best_match = me;
-            best_match_len = len;
+        if (exact == TRUE) {
+          best_match = np_index_lookup (mi.mountdir, d->name, name_len, np_index_hash (d->name, name_len));
+        } else {
+          /* the longest mount point that is a prefix of the path; any
+             one character mount point (i.e. "/") matches everything */
+          unsigned int hash = FNV_OFFSET;
+          for (best_match_len = 1; best_match_len <= name_len; best_match_len++) {
+            hash = np_index_hash_step (hash, (unsigned char) d->name[best_match_len - 1]);
+            if (best_match_len > 1 &&
+                (me = np_index_lookup (mi.mountdir, d->name, best_match_len, hash)))
+              best_match = me;
           }
+          if (! best_match && name_len > 0)
+            best_match = mi.short_dir[1];
+          if (! best_match)
+            best_match = mi.short_dir[0];
         }
       }
 
@@ -145,6 +342,11 @@ np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list
       }
     }
   }
+
+  if (indexed) {
+    np_index_free (mi.devname);
+    np_index_free (mi.mountdir);
+  }
 }
 
 /* Returns TRUE if name is in list */
@@ -156,6 +358,10 @@ np_find_name (struct name_list *list, const char *name)
   if (list == NULL || name == NULL) {
     return FALSE;
   }
+  if (list->index) {
+    size_t len = strlen (name);
+    return np_index_lookup (list->index, name, len, np_index_hash (name, len)) ? TRUE : FALSE;
+  }
   for (n = list; n; n = n->next) {
     if (!strcmp(name, n->name)) {
       return TRUE;
@@ -167,13 +373,7 @@ np_find_name (struct name_list *list, const char *name)
 int
 np_seen_name(struct name_list *list, const char *name)
 {
-  const struct name_list *s;
-  for (s = list; s; s=s->next) {
-    if (!strcmp(s->name, name)) {
-      return TRUE;
-    }
-  }
-  return FALSE;
+  return np_find_name (list, name);
 }
 
 int
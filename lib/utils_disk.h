@@ -4,10 +4,16 @@
 #include "utils_base.h"
 #include "regex.h"
 
+/* Hash index over strings, see utils_disk.c */
+struct np_index;
+
+/* np_add_name keeps a hash index of the whole list in every node, so
+   np_find_name and np_seen_name must be given the head of the list */
 struct name_list
 {
   char *name;
   struct name_list *next;
+  struct np_index *index;
 };
 
 struct parameter_list
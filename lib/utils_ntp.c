@@ -0,0 +1,1023 @@
+/****************************************************************************
+* Utils for the NTP plugins
+*
+* License: GPL
+* Copyright (c) 2006 sean finney <seanius@seanius.net>
+* Copyright (c) 2007 nagios-plugins team
+*
+* Last Modified: $Date$
+*
+* Description:
+*
+* This file contains the NTP message handling shared by check_ntp,
+* check_ntp_time and check_ntp_peer, and a survey that keeps the UDP
+* exchanges with any number of servers in one non-blocking loop: client
+* requests for the time and control messages for the sync peers, with a
+* deadline for each host. These are tested by libtap
+*
+* License Information:
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*
+* $Id$
+*
+*****************************************************************************/
+
+#include "common.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <poll.h>
+#include "utils_ntp.h"
+
+/* how long to wait for an answer before asking again, in ms */
+#define NTP_RESEND 1000
+
+/* the frequency tolerance of a clock and the precision of our own
+ * timestamps (gettimeofday), both as in rfc5905, in seconds */
+#define NTP_PHI 15e-6
+#define NTP_LOCAL_PRECISION 1e-6
+
+/* largest control answer put together from fragments */
+#define NTP_MAX_DATA 65536
+
+/* the variables asked of each peer. Older servers don't know what
+ * jitter is, so after an error we ask for the dispersion instead,
+ * and then for everything */
+static const char *getvars[] = {
+	"stratum,offset,jitter",
+	"stratum,offset,dispersion",
+	""
+};
+
+/** messages **/
+
+/* calculate the offset of the local clock */
+double
+np_ntp_calc_offset (const ntp_message *m, const struct timeval *t)
+{
+	double client_tx, peer_rx, peer_tx, client_rx;
+
+	client_tx = NTP64asDOUBLE (m->origts);
+	peer_rx = NTP64asDOUBLE (m->rxts);
+	peer_tx = NTP64asDOUBLE (m->txts);
+	client_rx = TVasDOUBLE ((*t));
+	return (.5 * ((peer_tx - client_rx) + (peer_rx - client_tx)));
+}
+
+/* calculate the round trip delay, less the time the server held on to
+ * the request */
+double
+np_ntp_calc_delay (const ntp_message *m, const struct timeval *t)
+{
+	double delay;
+
+	delay = (TVasDOUBLE ((*t)) - NTP64asDOUBLE (m->origts)) -
+		(NTP64asDOUBLE (m->txts) - NTP64asDOUBLE (m->rxts));
+	return delay < 0 ? 0 : delay;
+}
+
+void
+np_ntp_setup_request (ntp_message *p)
+{
+	struct timeval t;
+
+	memset (p, 0, sizeof (ntp_message));
+	LI_SET (p->flags, LI_ALARM);
+	VN_SET (p->flags, 4);
+	MODE_SET (p->flags, MODE_CLIENT);
+	p->poll = 4;
+	p->precision = (int8_t) 0xfa;
+	L16 (p->rtdelay) = htons (1);
+	L16 (p->rtdisp) = htons (1);
+
+	gettimeofday (&t, NULL);
+	TVtoNTP64 (t, p->txts);
+}
+
+void
+np_ntp_setup_control_request (ntp_control_message *p, uint8_t opcode, uint16_t seq)
+{
+	memset (p, 0, sizeof (ntp_control_message));
+	LI_SET (p->flags, LI_NOWARNING);
+	VN_SET (p->flags, VN_RESERVED);
+	MODE_SET (p->flags, MODE_CONTROLMSG);
+	OP_SET (p->op, opcode);
+	p->seq = htons (seq);
+	/* Remaining fields are zero for requests */
+}
+
+/* print out a ntp packet in human readable/debuggable format */
+void
+np_ntp_print_message (const ntp_message *p)
+{
+	struct timeval ref, orig, rx, tx;
+
+	NTP64toTV (p->refts, ref);
+	NTP64toTV (p->origts, orig);
+	NTP64toTV (p->rxts, rx);
+	NTP64toTV (p->txts, tx);
+
+	printf ("packet contents:\n");
+	printf ("\tflags: 0x%.2x\n", p->flags);
+	printf ("\t  li=%d (0x%.2x)\n", LI (p->flags), p->flags & LI_MASK);
+	printf ("\t  vn=%d (0x%.2x)\n", VN (p->flags), p->flags & VN_MASK);
+	printf ("\t  mode=%d (0x%.2x)\n", MODE (p->flags), p->flags & MODE_MASK);
+	printf ("\tstratum = %d\n", p->stratum);
+	printf ("\tpoll = %g\n", pow (2, p->poll));
+	printf ("\tprecision = %g\n", pow (2, p->precision));
+	printf ("\trtdelay = %-.16g\n", NTP32asDOUBLE (p->rtdelay));
+	printf ("\trtdisp = %-.16g\n", NTP32asDOUBLE (p->rtdisp));
+	printf ("\trefid = %x\n", p->refid);
+	printf ("\trefts = %-.16g\n", NTP64asDOUBLE (p->refts));
+	printf ("\torigts = %-.16g\n", NTP64asDOUBLE (p->origts));
+	printf ("\trxts = %-.16g\n", NTP64asDOUBLE (p->rxts));
+	printf ("\ttxts = %-.16g\n", NTP64asDOUBLE (p->txts));
+}
+
+void
+np_ntp_print_control_message (const ntp_control_message *p)
+{
+	int i = 0, numpeers = 0;
+	const ntp_assoc_status_pair *peer = NULL;
+
+	printf ("control packet contents:\n");
+	printf ("\tflags: 0x%.2x , 0x%.2x\n", p->flags, p->op);
+	printf ("\t  li=%d (0x%.2x)\n", LI (p->flags), p->flags & LI_MASK);
+	printf ("\t  vn=%d (0x%.2x)\n", VN (p->flags), p->flags & VN_MASK);
+	printf ("\t  mode=%d (0x%.2x)\n", MODE (p->flags), p->flags & MODE_MASK);
+	printf ("\t  response=%d (0x%.2x)\n", (p->op & REM_RESP) > 0, p->op & REM_RESP);
+	printf ("\t  more=%d (0x%.2x)\n", (p->op & REM_MORE) > 0, p->op & REM_MORE);
+	printf ("\t  error=%d (0x%.2x)\n", (p->op & REM_ERROR) > 0, p->op & REM_ERROR);
+	printf ("\t  op=%d (0x%.2x)\n", p->op & OP_MASK, p->op & OP_MASK);
+	printf ("\tsequence: %d (0x%.2x)\n", ntohs (p->seq), ntohs (p->seq));
+	printf ("\tstatus: %d (0x%.2x)\n", ntohs (p->status), ntohs (p->status));
+	printf ("\tassoc: %d (0x%.2x)\n", ntohs (p->assoc), ntohs (p->assoc));
+	printf ("\toffset: %d (0x%.2x)\n", ntohs (p->offset), ntohs (p->offset));
+	printf ("\tcount: %d (0x%.2x)\n", ntohs (p->count), ntohs (p->count));
+	numpeers = ntohs (p->count) / (sizeof (ntp_assoc_status_pair));
+	if (p->op & REM_RESP && (p->op & OP_MASK) == OP_READSTAT) {
+		peer = (ntp_assoc_status_pair *) p->data;
+		for (i = 0; i < numpeers; i++) {
+			printf ("\tpeer id %.2x status %.2x",
+			        ntohs (peer[i].assoc), ntohs (peer[i].status));
+			if (PEER_SEL (peer[i].status) >= PEER_INCLUDED) {
+				if (PEER_SEL (peer[i].status) >= PEER_SYNCSOURCE)
+					printf (" <-- current sync source");
+				else
+					printf (" <-- current sync candidate");
+			}
+			printf ("\n");
+		}
+	}
+}
+
+/* Finds the variable name in the "name=value, name=value" list of a
+ * READVAR answer and copies its value, without any quotes, to value.
+ * Returns value, or NULL if the list has no such variable */
+char *
+np_ntp_extract_value (const char *varlist, const char *name, char *value, size_t size)
+{
+	const char *p = varlist, *key, *start, *end;
+	size_t keylen, len;
+	int quoted;
+
+	while (*p) {
+		while (*p == ',' || isspace ((unsigned char) *p))
+			p++;
+		key = p;
+		while (*p && *p != '=' && *p != ',')
+			p++;
+		keylen = p - key;
+		while (keylen > 0 && isspace ((unsigned char) key[keylen - 1]))
+			keylen--;
+
+		start = end = p;
+		if (*p == '=') {
+			for (start = ++p; *start == ' ' || *start == '\t'; start++);
+			for (p = start, quoted = 0; *p && (quoted || *p != ','); p++)
+				if (*p == '"')
+					quoted = !quoted;
+			end = p;
+			while (end > start && isspace ((unsigned char) end[-1]))
+				end--;
+			if (end - start >= 2 && *start == '"' && end[-1] == '"') {
+				start++;
+				end--;
+			}
+		}
+
+		if (keylen > 0 && keylen == strlen (name) && !strncmp (key, name, keylen)) {
+			len = end - start;
+			if (len >= size)
+				len = size - 1;
+			memcpy (value, start, len);
+			value[len] = '\0';
+			return value;
+		}
+	}
+	return NULL;
+}
+
+
+/** host lists **/
+
+/* Appends a host to the list, returning it or NULL if out of memory */
+np_ntp_host *
+np_ntp_add_host (np_ntp_host **hosts, int *nhosts, const char *name)
+{
+	np_ntp_host *tmp;
+
+	if ((tmp = realloc (*hosts, (*nhosts + 1) * sizeof (np_ntp_host))) == NULL)
+		return NULL;
+	*hosts = tmp;
+	tmp = &tmp[(*nhosts)++];
+	memset (tmp, 0, sizeof (np_ntp_host));
+	if ((tmp->name = strdup (name)) == NULL)
+		return NULL;
+	return tmp;
+}
+
+/* Adds the hosts named in file ("-" for stdin), one per line. Anything
+ * after the first word of a line, and lines starting with '#', are
+ * ignored. Returns OK, or ERROR if the file could not be read */
+int
+np_ntp_read_hosts (const char *file, np_ntp_host **hosts, int *nhosts)
+{
+	FILE *fp;
+	char line[1024], *name, *end;
+
+	if (!strcmp (file, "-"))
+		fp = stdin;
+	else if ((fp = fopen (file, "r")) == NULL)
+		return ERROR;
+
+	while (fgets (line, sizeof line, fp) != NULL) {
+		for (name = line; isspace ((unsigned char) *name); name++);
+		if (*name == '\0' || *name == '#')
+			continue;
+		for (end = name; *end && !isspace ((unsigned char) *end); end++);
+		*end = '\0';
+		if (np_ntp_add_host (hosts, nhosts, name) == NULL) {
+			if (fp != stdin)
+				fclose (fp);
+			return ERROR;
+		}
+	}
+
+	if (fp != stdin)
+		fclose (fp);
+	return OK;
+}
+
+void
+np_ntp_free_hosts (np_ntp_host *hosts, int nhosts)
+{
+	int i;
+
+	for (i = 0; i < nhosts; i++) {
+		free (hosts[i].name);
+		free (hosts[i].servers);
+		free (hosts[i].peers);
+	}
+	free (hosts);
+}
+
+
+/** survey **/
+
+/* One UDP conversation of the survey: the time requests to one address
+ * of a host, or the control messages about its peers */
+struct ntp_exchange
+{
+	np_ntp_host *host;
+	np_ntp_server *server;	/* NULL for the peers conversation */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	char addrstr[INET6_ADDRSTRLEN];
+	int sock;
+	int next;		/* the next exchange with the same address, or -1 */
+	int done;
+	int sent;		/* requests sent so far */
+	int waiting;		/* a request is in flight */
+	struct timeval due;	/* when to send the next request */
+	struct timeval deadline;	/* when to give up on the host */
+	long timeout;		/* ms from the first request to the deadline */
+	int samples;		/* time answers wanted at most */
+	long interval;		/* ms between an answer and the next request */
+	uint64_t origts;	/* the transmit time an answer has to echo */
+	uint16_t seq;		/* the sequence number of control answers */
+	int peer;		/* the peer asked for variables, or -1 for the list */
+	int getvar;		/* the variable list tried, see getvars */
+	char *data;		/* the control answer being put together */
+	size_t data_size;	/* the room in data */
+	size_t data_received;	/* bytes received so far */
+	size_t data_end;	/* the length of the answer */
+	int data_last;		/* the last fragment came, so data_end is known */
+	int data_error;		/* it came with the error bit */
+};
+
+static long
+ms_between (const struct timeval *from, const struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_usec - from->tv_usec) / 1000;
+}
+
+static void
+add_ms (struct timeval *tv, const struct timeval *from, long ms)
+{
+	tv->tv_sec = from->tv_sec + ms / 1000;
+	tv->tv_usec = from->tv_usec + (ms % 1000) * 1000;
+	if (tv->tv_usec >= 1000000) {
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+}
+
+static int
+after (const struct timeval *a, const struct timeval *b)
+{
+	return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_usec >= b->tv_usec);
+}
+
+static unsigned int
+addr_hash (const struct sockaddr_storage *ss)
+{
+	const unsigned char *p;
+	unsigned int h = 2166136261U;
+	size_t len, i;
+
+	if (ss->ss_family == AF_INET6) {
+		p = (const unsigned char *) &((const struct sockaddr_in6 *) ss)->sin6_addr;
+		len = sizeof (struct in6_addr);
+		h ^= ((const struct sockaddr_in6 *) ss)->sin6_port;
+	}
+	else {
+		p = (const unsigned char *) &((const struct sockaddr_in *) ss)->sin_addr;
+		len = sizeof (struct in_addr);
+		h ^= ((const struct sockaddr_in *) ss)->sin_port;
+	}
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static int
+same_addr (const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	const struct sockaddr_in *a4 = (const struct sockaddr_in *) a, *b4 = (const struct sockaddr_in *) b;
+	const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) a, *b6 = (const struct sockaddr_in6 *) b;
+
+	if (a->ss_family != b->ss_family)
+		return FALSE;
+	if (a->ss_family == AF_INET6)
+		return a6->sin6_port == b6->sin6_port &&
+			!memcmp (&a6->sin6_addr, &b6->sin6_addr, sizeof (struct in6_addr));
+	return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+}
+
+/* The slot for addr in the open addressing table of exchange indexes
+ * + 1; the first exchange found there chains to the others */
+static unsigned int
+addr_slot (const struct ntp_exchange *ex, const int *table, unsigned int mask,
+           const struct sockaddr_storage *addr)
+{
+	unsigned int i;
+
+	for (i = addr_hash (addr) & mask; table[i]; i = (i + 1) & mask)
+		if (same_addr (&ex[table[i] - 1].addr, addr))
+			break;
+	return i;
+}
+
+static int
+survey_socket (int family, int *socks, np_ntp_host *host)
+{
+	int *sock = &socks[family == AF_INET6], on = 1, size = 1 << 20;
+
+	if (*sock >= 0)
+		return *sock;
+	if ((*sock = socket (family, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+		snprintf (host->error, sizeof host->error, "can not create new socket: %s",
+		          strerror (errno));
+		return -1;
+	}
+	fcntl (*sock, F_SETFL, fcntl (*sock, F_GETFL) | O_NONBLOCK);
+	/* room for the answers of many servers arriving at once */
+	setsockopt (*sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+#ifdef SO_TIMESTAMP
+	setsockopt (*sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof on);
+#endif
+	return *sock;
+}
+
+static int
+add_exchange (struct ntp_exchange **ex, int *nex, np_ntp_host *host,
+              np_ntp_server *server, const struct addrinfo *ai, int *socks)
+{
+	struct ntp_exchange *tmp;
+	const void *a;
+
+	if ((tmp = realloc (*ex, (*nex + 1) * sizeof (struct ntp_exchange))) == NULL)
+		return ERROR;
+	*ex = tmp;
+	tmp = &tmp[*nex];
+	memset (tmp, 0, sizeof (struct ntp_exchange));
+	if ((tmp->sock = survey_socket (ai->ai_family, socks, host)) < 0)
+		return OK;
+
+	tmp->host = host;
+	tmp->server = server;
+	memcpy (&tmp->addr, ai->ai_addr, ai->ai_addrlen);
+	tmp->addrlen = ai->ai_addrlen;
+	tmp->next = -1;
+	tmp->peer = -1;
+	if (ai->ai_family == AF_INET6)
+		a = &((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr;
+	else
+		a = &((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+	inet_ntop (ai->ai_family, a, tmp->addrstr, sizeof tmp->addrstr);
+	if (server)
+		strcpy (server->addr, tmp->addrstr);
+	(*nex)++;
+	return OK;
+}
+
+static void
+send_request (struct ntp_exchange *ex, const struct timeval *now, int verbose)
+{
+	static uint16_t seq = 0;
+	ntp_message req;
+	ntp_control_message creq;
+	const char *getvar;
+	void *msg;
+	size_t len;
+
+	if (ex->server) {
+		np_ntp_setup_request (&req);
+		ex->origts = req.txts;
+		msg = &req;
+		len = sizeof (ntp_message);
+		if (verbose)
+			printf ("%ssending request to %s (%s)\n", ex->waiting ? "re-" : "",
+			        ex->addrstr, ex->host->name);
+	}
+	else {
+		/* a new sequence number, so that what comes back for an
+		 * earlier request is not mixed in */
+		if (++seq == 0)
+			seq++;
+		ex->seq = seq;
+		free (ex->data);
+		ex->data = NULL;
+		ex->data_size = ex->data_received = ex->data_end = 0;
+		ex->data_last = ex->data_error = FALSE;
+
+		if (ex->peer < 0) {
+			np_ntp_setup_control_request (&creq, OP_READSTAT, seq);
+			if (verbose > 1)
+				printf ("sending READSTAT request to %s (%s)\n", ex->addrstr, ex->host->name);
+		}
+		else {
+			np_ntp_setup_control_request (&creq, OP_READVAR, seq);
+			creq.assoc = ex->host->peers[ex->peer].assoc;
+			/* Putting the wanted variable names in the request
+			 * cause the server to provide _only_ the requested values.
+			 * thus reducing net traffic, guaranteeing us only a single
+			 * datagram in reply, and making intepretation much simpler
+			 */
+			getvar = getvars[ex->getvar];
+			strncpy (creq.data, getvar, MAX_CM_SIZE - 1);
+			creq.count = htons (strlen (getvar));
+			if (verbose > 1)
+				printf ("sending READVAR request for peer %.2x to %s (%s)\n",
+				        ntohs (creq.assoc), ex->addrstr, ex->host->name);
+		}
+		if (verbose > 1)
+			np_ntp_print_control_message (&creq);
+		msg = &creq;
+		len = SIZEOF_NTPCM (creq);
+	}
+
+	if (sendto (ex->sock, msg, len, 0, (struct sockaddr *) &ex->addr, ex->addrlen) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EINTR) {
+			/* the send buffer is full; try again shortly */
+			add_ms (&ex->due, now, 10);
+			return;
+		}
+		if (verbose)
+			printf ("sending to %s failed: %s\n", ex->addrstr, strerror (errno));
+		snprintf (ex->host->error, sizeof ex->host->error, "can not send to %s: %s",
+		          ex->addrstr, strerror (errno));
+		ex->done = TRUE;
+		return;
+	}
+
+	if (ex->sent++ == 0)
+		add_ms (&ex->deadline, now, ex->timeout);
+	ex->waiting = TRUE;
+	add_ms (&ex->due, now, NTP_RESEND);
+}
+
+static void
+time_reply (struct ntp_exchange *ex, const ntp_message *m, const struct timeval *stamp,
+            const struct timeval *now, int verbose)
+{
+	np_ntp_server *s = ex->server;
+	int respnum;
+
+	if (verbose > 1)
+		np_ntp_print_message (m);
+	respnum = s->num_responses++;
+	s->sample_offset[respnum] = np_ntp_calc_offset (m, stamp);
+	s->sample_delay[respnum] = np_ntp_calc_delay (m, stamp);
+	s->sample_disp[respnum] = ldexp (1., m->precision) + NTP_LOCAL_PRECISION +
+		NTP_PHI * (TVasDOUBLE ((*stamp)) - NTP64asDOUBLE (m->origts));
+	if (verbose)
+		printf ("response from %s: offset %.10g, delay %.6g\n", ex->addrstr,
+		        s->sample_offset[respnum], s->sample_delay[respnum]);
+	s->stratum = m->stratum;
+	s->rtdisp = NTP32asDOUBLE (m->rtdisp);
+	s->rtdelay = NTP32asDOUBLE (m->rtdelay);
+	s->flags = m->flags;
+	np_ntp_filter (s);
+
+	ex->waiting = FALSE;
+	if (s->num_responses >= ex->samples)
+		ex->done = TRUE;
+	else if (np_ntp_converged (s)) {
+		if (verbose)
+			printf ("offset of %s settled after %d samples\n", ex->addrstr,
+			        s->num_responses);
+		ex->done = TRUE;
+	}
+	else
+		add_ms (&ex->due, now, ex->interval);
+}
+
+/* Moves on to the next selected peer after ex->peer, if any */
+static void
+next_peer (struct ntp_exchange *ex, const struct timeval *now, int verbose)
+{
+	np_ntp_host *host = ex->host;
+
+	for (ex->peer++; ex->peer < host->npeers; ex->peer++)
+		if (host->peers[ex->peer].selected)
+			break;
+	if (ex->peer >= host->npeers) {
+		ex->done = TRUE;
+		return;
+	}
+	if (verbose)
+		printf ("Getting offset, jitter and stratum for peer %.2x\n",
+		        ntohs (host->peers[ex->peer].assoc));
+	ex->due = *now;
+}
+
+static void
+read_peers (struct ntp_exchange *ex, const struct timeval *now, int verbose)
+{
+	np_ntp_host *host = ex->host;
+	const ntp_assoc_status_pair *pairs = (const ntp_assoc_status_pair *) ex->data;
+	int i, num_candidates = 0, min_peer_sel = PEER_INCLUDED;
+
+	/* Each peer identifier is 4 bytes in the data section, which
+	 * we represent as a ntp_assoc_status_pair datatype.
+	 */
+	host->npeers = ex->data_end / sizeof (ntp_assoc_status_pair);
+	host->peers_read = TRUE;
+	if (host->npeers && (host->peers = calloc (host->npeers, sizeof (np_ntp_peer))) == NULL)
+		host->npeers = 0;
+	for (i = 0; i < host->npeers; i++) {
+		host->peers[i].assoc = pairs[i].assoc;
+		host->peers[i].status = pairs[i].status;
+	}
+
+	/* first, let's find out if we have a sync source, or if there are
+	 * at least some candidates. In the latter case we'll issue
+	 * a warning but go ahead with the check on them. */
+	for (i = 0; i < host->npeers; i++) {
+		if (PEER_SEL (host->peers[i].status) >= PEER_INCLUDED) {
+			num_candidates++;
+			if (PEER_SEL (host->peers[i].status) >= PEER_SYNCSOURCE) {
+				host->syncsource_found = TRUE;
+				min_peer_sel = PEER_SYNCSOURCE;
+			}
+		}
+	}
+	if (verbose)
+		printf ("%s: %d candidate peers available\n", host->name, num_candidates);
+	if (verbose && host->syncsource_found)
+		printf ("%s: synchronization source found\n", host->name);
+	if (verbose && !host->syncsource_found)
+		printf ("%s: warning: no synchronization source found\n", host->name);
+
+	/* Only query the current sync source. If there's no sync.peer,
+	 * query all candidates and use the best one */
+	for (i = 0; i < host->npeers; i++)
+		host->peers[i].selected = PEER_SEL (host->peers[i].status) >= min_peer_sel;
+	ex->peer = -1;
+	next_peer (ex, now, verbose);
+}
+
+static void
+read_vars (struct ntp_exchange *ex, const struct timeval *now, int verbose)
+{
+	np_ntp_peer *peer = &ex->host->peers[ex->peer];
+	char value[64], *nptr;
+
+	if (ex->data_error && ex->getvar < 2) {
+		if (verbose) {
+			if (ex->getvar == 0)
+				printf ("The command failed. This is usually caused by servers refusing the 'jitter'\nvariable. Restarting with 'dispersion'...\n");
+			else
+				printf ("Server didn't like dispersion either; will retrieve everything\n");
+		}
+		ex->getvar++;
+		ex->due = *now;
+		return;
+	}
+
+	if (verbose > 1)
+		printf ("Server responded: >>>%s<<<\n", ex->data ? ex->data : "");
+	if (!ex->data_error && ex->data) {
+		if (np_ntp_extract_value (ex->data, "offset", value, sizeof value)) {
+			peer->offset = strtod (value, &nptr) / 1000;
+			peer->have_offset = nptr != value;
+		}
+		if (np_ntp_extract_value (ex->data, ex->getvar == 1 ? "dispersion" : "jitter",
+		                          value, sizeof value)) {
+			peer->jitter = strtod (value, &nptr);
+			peer->have_jitter = nptr != value;
+		}
+		if (np_ntp_extract_value (ex->data, "stratum", value, sizeof value)) {
+			peer->stratum = strtol (value, &nptr, 10);
+			peer->have_stratum = nptr != value;
+		}
+	}
+	if (verbose) {
+		printf ("peer %.2x:", ntohs (peer->assoc));
+		if (peer->have_offset)
+			printf (" offset %.10g", peer->offset);
+		if (peer->have_jitter)
+			printf (" %s %.10g", ex->getvar == 1 ? "dispersion" : "jitter", peer->jitter);
+		if (peer->have_stratum)
+			printf (" stratum %d", peer->stratum);
+		printf ("\n");
+	}
+	next_peer (ex, now, verbose);
+}
+
+static void
+control_reply (struct ntp_exchange *ex, const ntp_control_message *m, size_t len,
+               const struct timeval *now, int verbose)
+{
+	size_t offset = ntohs (m->offset), count = ntohs (m->count), end = offset + count;
+	char *tmp;
+
+	if (verbose > 1)
+		np_ntp_print_control_message (m);
+	if (count > len - 12 || count > MAX_CM_SIZE || end > NTP_MAX_DATA)
+		return;
+
+	/* the fragments of an answer may come in any order */
+	if (end + 1 > ex->data_size) {
+		if ((tmp = realloc (ex->data, end + 1)) == NULL)
+			return;
+		memset (tmp + ex->data_size, 0, end + 1 - ex->data_size);
+		ex->data = tmp;
+		ex->data_size = end + 1;
+	}
+	memcpy (ex->data + offset, m->data, count);
+	ex->data_received += count;
+	if (m->op & REM_ERROR)
+		ex->data_error = TRUE;
+	if (!(m->op & REM_MORE) || (m->op & REM_ERROR)) {
+		ex->data_end = end;
+		ex->data_last = TRUE;
+	}
+	if (!ex->data_last || ex->data_received < ex->data_end)
+		return;
+
+	ex->waiting = FALSE;
+	if (ex->peer < 0)
+		read_peers (ex, now, verbose);
+	else
+		read_vars (ex, now, verbose);
+}
+
+/* Reads everything queued on sock and hands each answer to the exchange
+ * waiting for it */
+static void
+survey_recv (int sock, struct ntp_exchange *ex, const int *table, unsigned int mask,
+             int verbose)
+{
+	union {
+		ntp_message m;
+		ntp_control_message cm;
+		char buf[sizeof (ntp_control_message) + 4];
+	} pkt;
+	struct sockaddr_storage from;
+	struct timeval now, stamp;
+	struct msghdr hdr;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char ctrl[256];
+	ssize_t n;
+	int i, control;
+
+	for (;;) {
+		memset (&hdr, 0, sizeof hdr);
+		iov.iov_base = &pkt;
+		iov.iov_len = sizeof pkt;
+		hdr.msg_name = &from;
+		hdr.msg_namelen = sizeof from;
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = ctrl;
+		hdr.msg_controllen = sizeof ctrl;
+		n = recvmsg (sock, &hdr, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return;
+
+		/* the kernel's time of arrival, so that answers queued up
+		 * behind others do not look late */
+		gettimeofday (&now, NULL);
+		stamp = now;
+#ifdef SO_TIMESTAMP
+		for (cmsg = CMSG_FIRSTHDR (&hdr); cmsg; cmsg = CMSG_NXTHDR (&hdr, cmsg))
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP)
+				memcpy (&stamp, CMSG_DATA (cmsg), sizeof stamp);
+#endif
+
+		if (n < 12)
+			continue;
+		control = MODE (pkt.m.flags) == MODE_CONTROLMSG;
+		if (!control && n < (ssize_t) sizeof (ntp_message))
+			continue;
+		if (control && (!(pkt.cm.op & REM_RESP) || !(pkt.cm.op & OP_MASK)))
+			continue;
+
+		/* anything else is a late answer to an earlier request, or noise */
+		i = table[addr_slot (ex, table, mask, &from)] - 1;
+		for (; i >= 0; i = ex[i].next) {
+			if (ex[i].done || !ex[i].waiting)
+				continue;
+			if (!control && ex[i].server && pkt.m.origts == ex[i].origts) {
+				time_reply (&ex[i], &pkt.m, &stamp, &now, verbose);
+				break;
+			}
+			if (control && !ex[i].server && ntohs (pkt.cm.seq) == ex[i].seq &&
+			    (pkt.cm.op & OP_MASK) == (ex[i].peer < 0 ? OP_READSTAT : OP_READVAR)) {
+				control_reply (&ex[i], &pkt.cm, n, &now, verbose);
+				break;
+			}
+		}
+	}
+}
+
+/* Asks each of the hosts for what (NP_NTP_TIME and/or NP_NTP_PEERS) on
+ * port, all at once. Each host gets timeout ms from its first request;
+ * time requests are sent again interval ms after each answer until there
+ * are samples of them or the filter has converged, and any request is
+ * sent again after a second without an answer. family limits the
+ * addresses looked up, as with getaddrinfo. The results are left in the
+ * hosts */
+void
+np_ntp_survey (np_ntp_host *hosts, int nhosts, int what, int samples, int interval,
+               int family, int port, int timeout, int verbose)
+{
+	struct ntp_exchange *ex = NULL;
+	struct addrinfo hints, *ai, *ai_tmp;
+	struct pollfd ufds[2];
+	struct timeval now;
+	char service[8];
+	int socks[2] = { -1, -1 };
+	int *table = NULL;
+	int nex = 0, active, nfds, i, j, k, ga_result;
+	unsigned int mask, slot;
+	long wait;
+
+	memset (&hints, 0, sizeof (struct addrinfo));
+	hints.ai_family = family;
+	hints.ai_protocol = IPPROTO_UDP;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf (service, sizeof service, "%d", port);
+	if (samples < 1)
+		samples = 1;
+	else if (samples > NP_NTP_MAX_SAMPLES)
+		samples = NP_NTP_MAX_SAMPLES;
+
+	for (i = 0; i < nhosts; i++) {
+		ga_result = getaddrinfo (hosts[i].name, service, &hints, &ai);
+		if (ga_result != 0) {
+			snprintf (hosts[i].error, sizeof hosts[i].error,
+			          "error getting address for %s: %s", hosts[i].name,
+			          gai_strerror (ga_result));
+			continue;
+		}
+		j = nex;
+		if (what & NP_NTP_TIME) {
+			for (ai_tmp = ai; ai_tmp; ai_tmp = ai_tmp->ai_next)
+				hosts[i].nservers++;
+			hosts[i].servers = calloc (hosts[i].nservers, sizeof (np_ntp_server));
+			if (hosts[i].servers == NULL)
+				hosts[i].nservers = 0;
+			for (ai_tmp = ai, k = 0; k < hosts[i].nservers; ai_tmp = ai_tmp->ai_next, k++)
+				add_exchange (&ex, &nex, &hosts[i], &hosts[i].servers[k], ai_tmp, socks);
+		}
+		if (what & NP_NTP_PEERS)
+			add_exchange (&ex, &nex, &hosts[i], NULL, ai, socks);
+		freeaddrinfo (ai);
+		for (; j < nex; j++) {
+			ex[j].timeout = timeout;
+			ex[j].samples = samples;
+			ex[j].interval = interval;
+		}
+	}
+	if (nex == 0)
+		return;
+
+	/* answers are matched to exchanges by the address they come from */
+	for (mask = 1; mask < (unsigned int) nex * 2; mask <<= 1);
+	if ((table = calloc (mask, sizeof (int))) == NULL) {
+		for (i = 0; i < nhosts; i++)
+			snprintf (hosts[i].error, sizeof hosts[i].error, "can not allocate memory");
+		free (ex);
+		return;
+	}
+	mask--;
+	for (i = nex - 1; i >= 0; i--) {
+		slot = addr_slot (ex, table, mask, &ex[i].addr);
+		if (table[slot])
+			ex[i].next = table[slot] - 1;
+		table[slot] = i + 1;
+	}
+
+	for (nfds = 0, i = 0; i < 2; i++) {
+		if (socks[i] < 0)
+			continue;
+		ufds[nfds].fd = socks[i];
+		ufds[nfds++].events = POLLIN;
+	}
+
+	gettimeofday (&now, NULL);
+	for (i = 0; i < nex; i++)
+		ex[i].due = now;
+
+	do {
+		/* send whatever is due, give up on hosts past their deadline,
+		 * and see how long we can wait for answers */
+		gettimeofday (&now, NULL);
+		wait = NTP_RESEND;
+		for (active = 0, i = 0; i < nex; i++) {
+			if (ex[i].done)
+				continue;
+			if (ex[i].sent && after (&now, &ex[i].deadline)) {
+				if (verbose)
+					printf ("giving up on %s (%s)\n", ex[i].addrstr, ex[i].host->name);
+				ex[i].done = TRUE;
+				continue;
+			}
+			if (after (&now, &ex[i].due))
+				send_request (&ex[i], &now, verbose);
+			if (ex[i].done)
+				continue;
+			active++;
+			if (ms_between (&now, &ex[i].due) < wait)
+				wait = ms_between (&now, &ex[i].due);
+			if (ex[i].sent && ms_between (&now, &ex[i].deadline) < wait)
+				wait = ms_between (&now, &ex[i].deadline);
+		}
+		if (!active)
+			break;
+
+		for (i = 0; i < nfds; i++)
+			ufds[i].revents = 0;
+		if (poll (ufds, nfds, wait < 0 ? 0 : wait + 1) < 0 && errno != EINTR)
+			break;
+		for (i = 0; i < nfds; i++)
+			if (ufds[i].revents & POLLIN)
+				survey_recv (ufds[i].fd, ex, table, mask, verbose);
+	} while (active);
+
+	for (i = 0; i < nex; i++)
+		free (ex[i].data);
+	for (i = 0; i < 2; i++)
+		if (socks[i] >= 0)
+			close (socks[i]);
+	free (table);
+	free (ex);
+}
+
+/* The rfc5905 clock filter, over the samples of a server so far: the
+ * offset is an average weighted by halves in the order of increasing
+ * delay, so the sample of least delay counts most, the dispersion adds
+ * up the sample dispersions weighted the same way, and the jitter is the
+ * rms difference of the offsets from that of the least delay. Unlike in
+ * ntpd, the stages not filled yet do not count towards the dispersion */
+void
+np_ntp_filter (np_ntp_server *s)
+{
+	int order[NP_NTP_MAX_SAMPLES];
+	int n, i, j, k;
+	double weight = 1., wsum = 0., osum = 0., jsum = 0., first = 0.;
+
+	n = s->num_responses < NP_NTP_MAX_SAMPLES ? s->num_responses : NP_NTP_MAX_SAMPLES;
+	s->offset = s->delay = s->disp = s->jitter = 0.;
+	if (n == 0)
+		return;
+
+	/* sort by delay, the earlier sample first among equals */
+	for (i = 0; i < n; i++) {
+		for (j = i; j > 0 && s->sample_delay[order[j - 1]] > s->sample_delay[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (i = 0; i < n; i++, weight /= 2) {
+		k = order[i];
+		osum += weight * s->sample_offset[k];
+		wsum += weight;
+		s->disp += weight / 2 * s->sample_disp[k];
+		if (i == 0) {
+			s->delay = s->sample_delay[k];
+			first = s->sample_offset[k];
+		}
+		else
+			jsum += (s->sample_offset[k] - first) * (s->sample_offset[k] - first);
+	}
+	s->offset = osum / wsum;
+	if (n > 1)
+		s->jitter = sqrt (jsum / (n - 1));
+}
+
+/* whether more samples are unlikely to make the offset any better: there
+ * are a few, and they spread no more than the error bound of the one of
+ * least delay, half the delay plus its dispersion */
+int
+np_ntp_converged (const np_ntp_server *s)
+{
+	return s->num_responses >= NP_NTP_MIN_SAMPLES &&
+		s->jitter <= s->delay / 2 + s->disp;
+}
+
+/* select the "best" server from the addresses of a host that answered,
+ * and return its index. Servers that are not synchronized (the leap
+ * alarm, or no stratum) are left out; of the others the one of lowest
+ * stratum wins, and among equals the one of least root distance, the
+ * error bound of its offset as in rfc5905 */
+int
+np_ntp_best_server (const np_ntp_host *host, int verbose)
+{
+	const np_ntp_server *s;
+	double dist, best_dist = 0.;
+	int i, best = -1;
+
+	for (i = 0; i < host->nservers; i++) {
+		s = &host->servers[i];
+		if (s->num_responses == 0)
+			continue;
+		/* sort out servers with error flags */
+		if (LI (s->flags) == LI_ALARM || s->stratum == 0 || s->stratum > 15) {
+			if (verbose)
+				printf ("discarding peer %s: flags=%d, stratum=%d\n", s->addr,
+				        LI (s->flags), s->stratum);
+			continue;
+		}
+
+		dist = (s->rtdelay + s->delay) / 2 + s->rtdisp + s->disp + s->jitter;
+		if (verbose > 1)
+			printf ("peer %s: stratum %d, root distance %.6g\n", s->addr, s->stratum, dist);
+		if (best < 0 || s->stratum < host->servers[best].stratum ||
+		    (s->stratum == host->servers[best].stratum && dist < best_dist)) {
+			best = i;
+			best_dist = dist;
+		}
+	}
+
+	if (best >= 0) {
+		if (verbose > 1)
+			printf ("best server selected: peer %s\n", host->servers[best].addr);
+		return best;
+	}
+	if (verbose > 1)
+		printf ("no peers meeting synchronization criteria :(\n");
+	return -1;
+}
@@ -0,0 +1,216 @@
+#ifndef _UTILS_NTP_
+#define _UTILS_NTP_
+
+/*
+ * Header file for nagios plugins utils_ntp.c
+ *
+ * The NTP message formats shared by check_ntp, check_ntp_time and
+ * check_ntp_peer, and a survey that asks many servers for the time or
+ * for their sync peers at once, from one non-blocking loop.
+ */
+
+/* the clock filter keeps up to this many samples of each server, as
+ * many as the stages of the rfc5905 filter */
+#define NP_NTP_MAX_SAMPLES 8
+/* samples asked for by default, and the fewest a filter that has
+ * converged may stop at */
+#define NP_NTP_SAMPLES 4
+#define NP_NTP_MIN_SAMPLES 3
+
+/* max size of control message data */
+#define MAX_CM_SIZE 468
+
+/* this structure holds everything in an ntp request/response as per rfc1305 */
+typedef struct {
+	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	uint8_t stratum;     /* clock stratum */
+	int8_t poll;         /* polling interval */
+	int8_t precision;    /* precision of the local clock */
+	int32_t rtdelay;     /* total rt delay, as a fixed point num. see macros */
+	uint32_t rtdisp;     /* like above, but for max err to primary src */
+	uint32_t refid;      /* ref clock identifier */
+	uint64_t refts;      /* reference timestamp.  local time local clock */
+	uint64_t origts;     /* time at which request departed client */
+	uint64_t rxts;       /* time at which request arrived at server */
+	uint64_t txts;       /* time at which request departed server */
+} ntp_message;
+
+/* this structure holds everything in an ntp control message as per rfc1305 */
+typedef struct {
+	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	uint8_t op;          /* R,E,M bits and Opcode */
+	uint16_t seq;        /* Packet sequence */
+	uint16_t status;     /* Clock status */
+	uint16_t assoc;      /* Association */
+	uint16_t offset;     /* Similar to TCP sequence # */
+	uint16_t count;      /* # bytes of data */
+	char data[MAX_CM_SIZE]; /* ASCII data of the request */
+	                        /* NB: not necessarily NULL terminated! */
+} ntp_control_message;
+
+/* this is an association/status-word pair found in control packet reponses */
+typedef struct {
+	uint16_t assoc;
+	uint16_t status;
+} ntp_assoc_status_pair;
+
+/* bits 1,2 are the leap indicator */
+#define LI_MASK 0xc0
+#define LI(x) ((x&LI_MASK)>>6)
+#define LI_SET(x,y) do{ x |= ((y<<6)&LI_MASK); }while(0)
+/* and these are the values of the leap indicator */
+#define LI_NOWARNING 0x00
+#define LI_EXTRASEC 0x01
+#define LI_MISSINGSEC 0x02
+#define LI_ALARM 0x03
+/* bits 3,4,5 are the ntp version */
+#define VN_MASK 0x38
+#define VN(x)	((x&VN_MASK)>>3)
+#define VN_SET(x,y)	do{ x |= ((y<<3)&VN_MASK); }while(0)
+#define VN_RESERVED 0x02
+/* bits 6,7,8 are the ntp mode */
+#define MODE_MASK 0x07
+#define MODE(x) (x&MODE_MASK)
+#define MODE_SET(x,y)	do{ x |= (y&MODE_MASK); }while(0)
+/* here are some values */
+#define MODE_CLIENT 0x03
+#define MODE_SERVER 0x04
+#define MODE_CONTROLMSG 0x06
+/* In control message, bits 8-10 are R,E,M bits */
+#define REM_MASK 0xe0
+#define REM_RESP 0x80
+#define REM_ERROR 0x40
+#define REM_MORE 0x20
+/* In control message, bits 11 - 15 are opcode */
+#define OP_MASK 0x1f
+#define OP_SET(x,y)   do{ x |= (y&OP_MASK); }while(0)
+#define OP_READSTAT 0x01
+#define OP_READVAR  0x02
+/* In peer status bytes, bits 6,7,8 determine clock selection status */
+#define PEER_SEL(x) ((ntohs(x)>>8)&0x07)
+#define PEER_INCLUDED 0x04
+#define PEER_SYNCSOURCE 0x06
+
+/**
+ ** a note about the 32-bit "fixed point" numbers:
+ **
+ they are divided into halves, each being a 16-bit int in network byte order:
+ - the first 16 bits are an int on the left side of a decimal point.
+ - the second 16 bits represent a fraction n/(2^16)
+ likewise for the 64-bit "fixed point" numbers with everything doubled :)
+ **/
+
+/* macros to access the left/right 16 bits of a 32-bit ntp "fixed point"
+   number.  note that these can be used as lvalues too */
+#define L16(x) (((uint16_t*)&x)[0])
+#define R16(x) (((uint16_t*)&x)[1])
+/* macros to access the left/right 32 bits of a 64-bit ntp "fixed point"
+   number.  these too can be used as lvalues */
+#define L32(x) (((uint32_t*)&x)[0])
+#define R32(x) (((uint32_t*)&x)[1])
+
+/* ntp wants seconds since 1/1/00, epoch is 1/1/70.  this is the difference */
+#define EPOCHDIFF 0x83aa7e80UL
+
+/* extract a 32-bit ntp fixed point number into a double */
+#define NTP32asDOUBLE(x) (ntohs(L16(x)) + (double)ntohs(R16(x))/65536.0)
+
+/* likewise for a 64-bit ntp fp number */
+#define NTP64asDOUBLE(n) (double)(((uint64_t)n)?\
+                         (ntohl(L32(n))-EPOCHDIFF) + \
+                         (.00000001*(0.5+(double)(ntohl(R32(n))/42.94967296))):\
+                         0)
+
+/* convert a struct timeval to a double */
+#define TVasDOUBLE(x) (double)(x.tv_sec+(0.000001*x.tv_usec))
+
+/* convert an ntp 64-bit fp number to a struct timeval */
+#define NTP64toTV(n,t) \
+	do{ if(!n) t.tv_sec = t.tv_usec = 0; \
+	    else { \
+			t.tv_sec=ntohl(L32(n))-EPOCHDIFF; \
+			t.tv_usec=(int)(0.5+(double)(ntohl(R32(n))/4294.967296)); \
+		} \
+	}while(0)
+
+/* convert a struct timeval to an ntp 64-bit fp number */
+#define TVtoNTP64(t,n) \
+	do{ if(!t.tv_usec && !t.tv_sec) n=0x0UL; \
+		else { \
+			L32(n)=htonl(t.tv_sec + EPOCHDIFF); \
+			R32(n)=htonl((uint64_t)((4294.967296*t.tv_usec)+.5)); \
+		} \
+	} while(0)
+
+/* NTP control message header is 12 bytes, plus any data in the data
+ * field, plus null padding to the nearest 32-bit boundary per rfc.
+ */
+#define SIZEOF_NTPCM(m) (12+ntohs(m.count)+((m.count)?4-(ntohs(m.count)%4):0))
+
+/** what np_ntp_survey asks each host for **/
+#define NP_NTP_TIME 1		/* offset samples from every address of the host */
+#define NP_NTP_PEERS 2		/* the sync peers of its first address */
+
+/* results of asking one address of a host for the time. The samples
+ * are kept in the order they came; offset, delay, disp and jitter are
+ * what np_ntp_filter makes of them, all in seconds */
+typedef struct np_ntp_server
+{
+	char addr[INET6_ADDRSTRLEN];
+	int num_responses;      /* number of successfully recieved responses */
+	uint8_t stratum;        /* copied verbatim from the ntp_message */
+	double rtdelay;         /* converted from the ntp_message */
+	double rtdisp;          /* converted from the ntp_message */
+	uint8_t flags;          /* byte with leapindicator,vers,mode. see macros */
+	double sample_offset[NP_NTP_MAX_SAMPLES];
+	double sample_delay[NP_NTP_MAX_SAMPLES];  /* round trip, less the server's time */
+	double sample_disp[NP_NTP_MAX_SAMPLES];   /* precision and frequency error */
+	double offset;          /* weighted towards the samples of least delay */
+	double delay;           /* the least delay */
+	double disp;            /* the filter dispersion */
+	double jitter;          /* rms offset difference from the least delay sample */
+} np_ntp_server;
+
+/* a peer of a host, from its READSTAT list. Only the selected ones
+ * (the sync source, or else all candidates) are asked for variables */
+typedef struct np_ntp_peer
+{
+	uint16_t assoc;         /* in network byte order, like the status */
+	uint16_t status;
+	int selected;
+	int have_offset, have_jitter, have_stratum;
+	double offset;          /* seconds */
+	double jitter;          /* milliseconds, the dispersion for old servers */
+	int stratum;
+} np_ntp_peer;
+
+typedef struct np_ntp_host
+{
+	char *name;
+	char error[128];        /* why the host could not be asked at all */
+	int nservers;
+	np_ntp_server *servers;
+	int peers_read;         /* the READSTAT request was answered */
+	int syncsource_found;
+	int npeers;
+	np_ntp_peer *peers;
+} np_ntp_host;
+
+/** prototypes **/
+double np_ntp_calc_offset (const ntp_message *, const struct timeval *);
+double np_ntp_calc_delay (const ntp_message *, const struct timeval *);
+void np_ntp_setup_request (ntp_message *);
+void np_ntp_setup_control_request (ntp_control_message *, uint8_t, uint16_t);
+void np_ntp_print_message (const ntp_message *);
+void np_ntp_print_control_message (const ntp_control_message *);
+char *np_ntp_extract_value (const char *, const char *, char *, size_t);
+
+np_ntp_host *np_ntp_add_host (np_ntp_host **, int *, const char *);
+int np_ntp_read_hosts (const char *, np_ntp_host **, int *);
+void np_ntp_survey (np_ntp_host *, int, int, int, int, int, int, int, int);
+void np_ntp_filter (np_ntp_server *);
+int np_ntp_converged (const np_ntp_server *);
+int np_ntp_best_server (const np_ntp_host *, int);
+void np_ntp_free_hosts (np_ntp_host *, int);
+
+#endif /* _UTILS_NTP_ */
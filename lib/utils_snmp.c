@@ -0,0 +1,895 @@
+/****************************************************************************
+* Utils for check_snmp
+*
+* License: GPL
+* Copyright (c) 2007 nagios-plugins team
+*
+* Last Modified: $Date$
+*
+* Description:
+*
+* This file contains a minimal SNMP v1/v2c engine for check_snmp: BER
+* encoding and decoding of messages and a request/response exchange over
+* a connected UDP socket. These are tested by libtap
+*
+* License Information:
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*
+* $Id$
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_snmp.h"
+#include <ctype.h>
+#include <poll.h>
+
+/** OIDs **/
+
+/* Parses a numeric OID such as ".1.3.6.1.2.1.1.3.0"; a leading "iso"
+ * (as snmpget prints OIDs when no MIBs are loaded) stands for 1 */
+int
+np_snmp_parse_oid (const char *str, np_snmp_oid *oid)
+{
+	unsigned long long sub;
+
+	oid->len = 0;
+	if (*str == '.')
+		str++;
+	if (!strncmp (str, "iso", 3) && (str[3] == '.' || str[3] == '\0')) {
+		oid->sub[oid->len++] = 1;
+		str += 3;
+		if (*str == '.')
+			str++;
+	}
+
+	while (*str) {
+		if (!isdigit ((unsigned char) *str) || oid->len >= NP_SNMP_MAX_OID_LEN)
+			return ERROR;
+		for (sub = 0; isdigit ((unsigned char) *str); str++) {
+			sub = sub * 10 + (*str - '0');
+			if (sub > UINT_MAX)
+				return ERROR;
+		}
+		oid->sub[oid->len++] = sub;
+		if (*str == '.' && str[1] != '\0')
+			str++;
+		else if (*str != '\0')
+			return ERROR;
+	}
+
+	if (oid->len < 2 || oid->sub[0] > 2 || (oid->sub[0] < 2 && oid->sub[1] >= 40))
+		return ERROR;
+	return OK;
+}
+
+char *
+np_snmp_format_oid (const np_snmp_oid *oid, char *buf, size_t size)
+{
+	size_t i, n = 0;
+
+	if (size == 0)
+		return buf;
+	buf[0] = '\0';
+	for (i = 0; i < oid->len && n < size; i++)
+		n += snprintf (buf + n, size - n, i ? ".%u" : "%u", oid->sub[i]);
+	return buf;
+}
+
+int
+np_snmp_oid_compare (const np_snmp_oid *a, const np_snmp_oid *b)
+{
+	size_t i;
+
+	for (i = 0; i < a->len && i < b->len; i++) {
+		if (a->sub[i] != b->sub[i])
+			return a->sub[i] < b->sub[i] ? -1 : 1;
+	}
+	if (a->len == b->len)
+		return 0;
+	return a->len < b->len ? -1 : 1;
+}
+
+/* Returns TRUE if oid lies strictly below root */
+int
+np_snmp_oid_in_subtree (const np_snmp_oid *root, const np_snmp_oid *oid)
+{
+	if (oid->len <= root->len)
+		return FALSE;
+	return memcmp (root->sub, oid->sub, root->len * sizeof *root->sub) ? FALSE : TRUE;
+}
+
+/* Decodes the content octets of an OBJECT IDENTIFIER */
+int
+np_snmp_decode_oid (const unsigned char *data, size_t len, np_snmp_oid *oid)
+{
+	unsigned long long sub = 0;
+	size_t i;
+
+	oid->len = 0;
+	if (len == 0 || (data[len - 1] & 0x80))
+		return ERROR;
+	for (i = 0; i < len; i++) {
+		sub = (sub << 7) | (data[i] & 0x7f);
+		if (sub > UINT_MAX + 80ULL)
+			return ERROR;
+		if (data[i] & 0x80)
+			continue;
+		if (oid->len == 0) {
+			oid->sub[0] = sub < 40 ? 0 : sub < 80 ? 1 : 2;
+			sub -= oid->sub[0] * 40;
+			oid->len = 1;
+		}
+		if (oid->len >= NP_SNMP_MAX_OID_LEN || sub > UINT_MAX)
+			return ERROR;
+		oid->sub[oid->len++] = sub;
+		sub = 0;
+	}
+	return OK;
+}
+
+
+/** encoding **/
+
+/* Messages are built back to front, so that every length is known
+ * by the time its header is written */
+struct ber_out
+{
+	unsigned char *start;
+	unsigned char *p;
+	int overflow;
+};
+
+static void
+ber_put (struct ber_out *b, const void *data, size_t len)
+{
+	if (b->overflow || (size_t) (b->p - b->start) < len) {
+		b->overflow = TRUE;
+		return;
+	}
+	b->p -= len;
+	memcpy (b->p, data, len);
+}
+
+static void
+ber_put_header (struct ber_out *b, int tag, size_t len)
+{
+	unsigned char tmp[1 + sizeof len + 1];
+	int n = 0;
+
+	if (len < 0x80) {
+		tmp[sizeof tmp - ++n] = len;
+	} else {
+		while (len) {
+			tmp[sizeof tmp - ++n] = len & 0xff;
+			len >>= 8;
+		}
+		tmp[sizeof tmp - 1 - n] = 0x80 | n;
+		n++;
+	}
+	tmp[sizeof tmp - ++n] = tag;
+	ber_put (b, tmp + sizeof tmp - n, n);
+}
+
+static void
+ber_put_integer (struct ber_out *b, long long v)
+{
+	unsigned char tmp[8], byte;
+	int n = 0;
+
+	do {
+		byte = v & 0xff;
+		tmp[sizeof tmp - ++n] = byte;
+		v = v < 0 ? ~(~v >> 8) : v >> 8;
+	} while (!((v == 0 && !(byte & 0x80)) || (v == -1 && (byte & 0x80))));
+	ber_put (b, tmp + sizeof tmp - n, n);
+	ber_put_header (b, NP_SNMP_INTEGER, n);
+}
+
+static void
+ber_put_unsigned (struct ber_out *b, int tag, unsigned long long v)
+{
+	unsigned char tmp[9];
+	int n = 0;
+
+	do {
+		tmp[sizeof tmp - ++n] = v & 0xff;
+		v >>= 8;
+	} while (v);
+	if (tmp[sizeof tmp - n] & 0x80)
+		tmp[sizeof tmp - ++n] = 0;
+	ber_put (b, tmp + sizeof tmp - n, n);
+	ber_put_header (b, tag, n);
+}
+
+static void
+ber_put_base128 (struct ber_out *b, unsigned long long v)
+{
+	unsigned char tmp[10];
+	int n = 0;
+
+	tmp[sizeof tmp - ++n] = v & 0x7f;
+	while ((v >>= 7))
+		tmp[sizeof tmp - ++n] = 0x80 | (v & 0x7f);
+	ber_put (b, tmp + sizeof tmp - n, n);
+}
+
+static void
+ber_put_oid (struct ber_out *b, const np_snmp_oid *oid)
+{
+	unsigned char *end = b->p;
+	size_t i;
+
+	for (i = oid->len; i-- > 2; )
+		ber_put_base128 (b, oid->sub[i]);
+	ber_put_base128 (b, oid->sub[0] * 40ULL + (oid->len > 1 ? oid->sub[1] : 0));
+	ber_put_header (b, NP_SNMP_OBJECT_ID, end - b->p);
+}
+
+static void
+ber_put_value (struct ber_out *b, const np_snmp_varbind *vb)
+{
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		ber_put_integer (b, (long long) vb->number);
+		break;
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		ber_put_unsigned (b, vb->type, vb->number);
+		break;
+	case NP_SNMP_NULL:
+	case NP_SNMP_NOSUCHOBJECT:
+	case NP_SNMP_NOSUCHINSTANCE:
+	case NP_SNMP_ENDOFMIBVIEW:
+		ber_put_header (b, vb->type, 0);
+		break;
+	default:	/* OCTET STRING, OBJECT IDENTIFIER, IpAddress, Opaque */
+		ber_put (b, vb->data, vb->data_len);
+		ber_put_header (b, vb->type, vb->data_len);
+	}
+}
+
+/* Encodes pdu into buf. Returns the message length, or NP_SNMP_ERR_ENCODE */
+int
+np_snmp_encode (const np_snmp_pdu *pdu, unsigned char *buf, size_t size)
+{
+	struct ber_out b;
+	unsigned char *end;
+	size_t i, len;
+
+	b.start = buf;
+	b.p = buf + size;
+	b.overflow = FALSE;
+
+	for (i = pdu->nvb; i-- > 0; ) {
+		end = b.p;
+		ber_put_value (&b, &pdu->vb[i]);
+		ber_put_oid (&b, &pdu->vb[i].oid);
+		ber_put_header (&b, NP_SNMP_SEQUENCE, end - b.p);
+	}
+	ber_put_header (&b, NP_SNMP_SEQUENCE, buf + size - b.p);
+	ber_put_integer (&b, pdu->error_index);
+	ber_put_integer (&b, pdu->error_status);
+	ber_put_integer (&b, pdu->request_id);
+	ber_put_header (&b, pdu->type, buf + size - b.p);
+	ber_put (&b, pdu->community, pdu->community_len);
+	ber_put_header (&b, NP_SNMP_OCTET_STRING, pdu->community_len);
+	ber_put_integer (&b, pdu->version);
+	ber_put_header (&b, NP_SNMP_SEQUENCE, buf + size - b.p);
+
+	if (b.overflow || size > INT_MAX)
+		return NP_SNMP_ERR_ENCODE;
+	len = buf + size - b.p;
+	memmove (buf, b.p, len);
+	return len;
+}
+
+
+/** decoding **/
+
+struct ber_in
+{
+	const unsigned char *p;
+	const unsigned char *end;
+};
+
+/* Reads a tag and length, leaving in->p at the content octets */
+static int
+ber_get_header (struct ber_in *in, int *tag, size_t *len)
+{
+	size_t n;
+
+	if (in->end - in->p < 2)
+		return ERROR;
+	*tag = *in->p++;
+	if ((*tag & 0x1f) == 0x1f)
+		return ERROR;	/* high tag numbers are not used by SNMP */
+	n = *in->p++;
+	if (n & 0x80) {
+		n &= 0x7f;
+		/* zero is the indefinite form, which BER forbids here */
+		if (n == 0 || n > sizeof *len || n > (size_t) (in->end - in->p))
+			return ERROR;
+		for (*len = 0; n; n--)
+			*len = (*len << 8) | *in->p++;
+	} else {
+		*len = n;
+	}
+	return *len <= (size_t) (in->end - in->p) ? OK : ERROR;
+}
+
+/* Reads a constructed header and narrows sub to its contents */
+static int
+ber_get_constructed (struct ber_in *in, int *tag, struct ber_in *sub)
+{
+	size_t len;
+
+	if (ber_get_header (in, tag, &len) != OK)
+		return ERROR;
+	sub->p = in->p;
+	sub->end = in->p + len;
+	in->p += len;
+	return OK;
+}
+
+static int
+ber_get_integer (struct ber_in *in, long long *v)
+{
+	unsigned long long u;
+	size_t len;
+	int tag;
+
+	if (ber_get_header (in, &tag, &len) != OK || tag != NP_SNMP_INTEGER ||
+	    len == 0 || len > sizeof u)
+		return ERROR;
+	u = (*in->p & 0x80) ? ~0ULL : 0;
+	while (len--)
+		u = (u << 8) | *in->p++;
+	*v = (long long) u;
+	return OK;
+}
+
+static int
+ber_get_varbind (struct ber_in *in, np_snmp_varbind *vb)
+{
+	struct ber_in seq;
+	unsigned long long u;
+	size_t len, i;
+	int tag;
+
+	if (ber_get_constructed (in, &tag, &seq) != OK || tag != NP_SNMP_SEQUENCE)
+		return ERROR;
+
+	if (ber_get_header (&seq, &tag, &len) != OK || tag != NP_SNMP_OBJECT_ID ||
+	    np_snmp_decode_oid (seq.p, len, &vb->oid) != OK)
+		return ERROR;
+	seq.p += len;
+
+	if (ber_get_header (&seq, &vb->type, &len) != OK || seq.p + len != seq.end)
+		return ERROR;
+	vb->data = seq.p;
+	vb->data_len = len;
+	vb->number = 0;
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		if (len == 0 || len > sizeof u)
+			return ERROR;
+		u = (seq.p[0] & 0x80) ? ~0ULL : 0;
+		for (i = 0; i < len; i++)
+			u = (u << 8) | seq.p[i];
+		vb->number = u;
+		break;
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		/* read as unsigned even when an agent forgot the leading zero */
+		if (len == 0 || len > sizeof u + 1 || (len > sizeof u && seq.p[0]))
+			return ERROR;
+		for (u = 0, i = 0; i < len; i++)
+			u = (u << 8) | seq.p[i];
+		vb->number = u;
+		break;
+	}
+	return OK;
+}
+
+/* Decodes a message into pdu, whose vb must have room for max_vb
+ * varbinds. Strings in the result point into buf */
+int
+np_snmp_decode (const unsigned char *buf, size_t size, np_snmp_pdu *pdu)
+{
+	struct ber_in in, msg, body, list;
+	long long v;
+	size_t len;
+	int tag;
+
+	in.p = buf;
+	in.end = buf + size;
+	if (ber_get_constructed (&in, &tag, &msg) != OK || tag != NP_SNMP_SEQUENCE)
+		return NP_SNMP_ERR_DECODE;
+
+	if (ber_get_integer (&msg, &v) != OK)
+		return NP_SNMP_ERR_DECODE;
+	pdu->version = v;
+
+	if (ber_get_header (&msg, &tag, &len) != OK || tag != NP_SNMP_OCTET_STRING)
+		return NP_SNMP_ERR_DECODE;
+	pdu->community = (const char *) msg.p;
+	pdu->community_len = len;
+	msg.p += len;
+
+	if (ber_get_constructed (&msg, &pdu->type, &body) != OK ||
+	    (pdu->type & 0xf0) != 0xa0)
+		return NP_SNMP_ERR_DECODE;
+
+	if (ber_get_integer (&body, &v) != OK)
+		return NP_SNMP_ERR_DECODE;
+	pdu->request_id = v;
+	if (ber_get_integer (&body, &v) != OK)
+		return NP_SNMP_ERR_DECODE;
+	pdu->error_status = v;
+	if (ber_get_integer (&body, &v) != OK)
+		return NP_SNMP_ERR_DECODE;
+	pdu->error_index = v;
+
+	if (ber_get_constructed (&body, &tag, &list) != OK || tag != NP_SNMP_SEQUENCE)
+		return NP_SNMP_ERR_DECODE;
+	for (pdu->nvb = 0; list.p < list.end; pdu->nvb++) {
+		if (pdu->nvb >= pdu->max_vb ||
+		    ber_get_varbind (&list, &pdu->vb[pdu->nvb]) != OK)
+			return NP_SNMP_ERR_DECODE;
+	}
+	return NP_SNMP_OK;
+}
+
+
+/** exchange **/
+
+static long
+ms_since (const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday (&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+/* Sends request on the connected UDP socket sd and waits timeout
+ * seconds for the matching response, resending up to retries times.
+ * The response is decoded into response (see np_snmp_decode) from buf,
+ * which also serves to encode the request */
+int
+np_snmp_exchange (int sd, const np_snmp_pdu *request, np_snmp_pdu *response,
+                  unsigned char *buf, size_t size, int timeout, int retries)
+{
+	struct pollfd pfd;
+	struct timeval sent;
+	unsigned char *msg;
+	long remaining;
+	ssize_t n;
+	int len, try, result = NP_SNMP_ERR_TIMEOUT;
+
+	if ((len = np_snmp_encode (request, buf, size)) < 0)
+		return len;
+	if ((msg = malloc (len)) == NULL)
+		return NP_SNMP_ERR_SOCKET;
+	memcpy (msg, buf, len);
+
+	pfd.fd = sd;
+	pfd.events = POLLIN;
+
+	for (try = 0; try <= retries && result == NP_SNMP_ERR_TIMEOUT; try++) {
+		if (send (sd, msg, len, 0) < 0) {
+			result = NP_SNMP_ERR_SOCKET;
+			break;
+		}
+		gettimeofday (&sent, NULL);
+
+		while ((remaining = timeout * 1000L - ms_since (&sent)) > 0) {
+			pfd.revents = 0;
+			n = poll (&pfd, 1, remaining);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				if (n < 0)
+					result = NP_SNMP_ERR_SOCKET;
+				break;
+			}
+
+			n = recv (sd, buf, size, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				/* e.g. ECONNREFUSED after an ICMP port unreachable */
+				result = NP_SNMP_ERR_SOCKET;
+				break;
+			}
+
+			/* anything else is a late answer to an earlier try, or noise */
+			if (np_snmp_decode (buf, n, response) == NP_SNMP_OK &&
+			    response->type == NP_SNMP_RESPONSE &&
+			    response->request_id == request->request_id) {
+				result = NP_SNMP_OK;
+				break;
+			}
+		}
+	}
+
+	free (msg);
+	return result;
+}
+
+
+/* Walks the subtrees under roots[0..nroots-1] side by side, one column of
+ * a table each. SNMPv2c uses GETBULK for max_repetitions rows at a time,
+ * halving that on tooBig; SNMPv1 falls back to GETNEXT. fn is called with
+ * the root's number for every varbind found, which points into a buffer
+ * that is reused by the next request.
+ * Returns NP_SNMP_OK, one of the error codes above, or the error-status
+ * of a failed response (a positive number) */
+int
+np_snmp_walk (int sd, const np_snmp_pdu *tmpl, const np_snmp_oid *roots,
+              size_t nroots, int max_repetitions, int timeout, int retries,
+              np_snmp_walk_fn fn, void *arg)
+{
+	np_snmp_pdu request, response;
+	np_snmp_varbind *vb;
+	unsigned char *buf;
+	size_t *column, nactive, i, j;
+	int *finished, rc = NP_SNMP_OK;
+
+	if (nroots == 0)
+		return NP_SNMP_OK;
+	if (max_repetitions < 1)
+		max_repetitions = 1;
+
+	request = *tmpl;
+	request.vb = calloc (nroots, sizeof (np_snmp_varbind));
+	response.vb = calloc (nroots * max_repetitions, sizeof (np_snmp_varbind));
+	response.max_vb = nroots * max_repetitions;
+	column = calloc (nroots, sizeof (size_t));
+	finished = calloc (nroots, sizeof (int));
+	buf = malloc (NP_SNMP_MAX_MSG);
+	if (!request.vb || !response.vb || !column || !finished || !buf) {
+		rc = NP_SNMP_ERR_SOCKET;
+		nroots = 0;
+	}
+
+	for (i = 0; i < nroots; i++) {
+		request.vb[i].oid = roots[i];
+		request.vb[i].type = NP_SNMP_NULL;
+		column[i] = i;
+	}
+	nactive = nroots;
+
+	while (nactive > 0) {
+		request.nvb = nactive;
+		if (tmpl->version == NP_SNMP_V1) {
+			request.type = NP_SNMP_GETNEXT;
+			request.error_status = request.error_index = 0;
+		} else {
+			request.type = NP_SNMP_GETBULK;
+			request.error_status = 0;	/* non-repeaters */
+			request.error_index = max_repetitions;
+		}
+		request.request_id = (request.request_id + 1) & 0x7fffffff;
+
+		rc = np_snmp_exchange (sd, &request, &response, buf, NP_SNMP_MAX_MSG,
+		                       timeout, retries);
+		if (rc != NP_SNMP_OK)
+			break;
+
+		if (response.error_status == NP_SNMP_TOOBIG && max_repetitions > 1) {
+			max_repetitions = (max_repetitions + 1) / 2;
+			continue;
+		}
+		if (response.error_status == NP_SNMP_NOSUCHNAME &&
+		    tmpl->version == NP_SNMP_V1 &&
+		    response.error_index > 0 && (size_t)response.error_index <= nactive) {
+			/* SNMPv1 ends a walk with noSuchName on the column past the end */
+			finished[response.error_index - 1] = TRUE;
+			response.nvb = 0;
+		}
+		else if (response.error_status != NP_SNMP_NOERROR) {
+			rc = response.error_status;
+			break;
+		}
+		else if (response.nvb == 0) {
+			rc = NP_SNMP_ERR_DECODE;
+			break;
+		}
+
+		/* varbinds come row by row, one for each column still walking */
+		for (i = 0; i < response.nvb; i++) {
+			j = i % nactive;
+			vb = &response.vb[i];
+			if (finished[j])
+				continue;
+			if (vb->type == NP_SNMP_ENDOFMIBVIEW ||
+			    vb->type == NP_SNMP_NOSUCHOBJECT ||
+			    vb->type == NP_SNMP_NOSUCHINSTANCE ||
+			    !np_snmp_oid_in_subtree (&roots[column[j]], &vb->oid) ||
+			    np_snmp_oid_compare (&vb->oid, &request.vb[j].oid) <= 0) {
+				finished[j] = TRUE;
+				continue;
+			}
+			fn (column[j], vb, arg);
+			request.vb[j].oid = vb->oid;
+		}
+
+		/* carry on from the last OID of the columns not yet done */
+		for (i = j = 0; i < nactive; i++) {
+			if (finished[i])
+				continue;
+			request.vb[j] = request.vb[i];
+			column[j] = column[i];
+			finished[j++] = FALSE;
+		}
+		nactive = j;
+	}
+
+	free (request.vb);
+	free (response.vb);
+	free (column);
+	free (finished);
+	free (buf);
+	return rc;
+}
+
+
+/** formatting **/
+
+/* Formats the value of vb the way snmpget prints it, e.g. "Counter32: 42".
+ * Returns the length of the result */
+int
+np_snmp_format_value (const np_snmp_varbind *vb, char *buf, size_t size)
+{
+	unsigned long long t;
+	np_snmp_oid oid;
+	char oidbuf[NP_SNMP_OID_STR];
+	size_t i, n = 0;
+	int printable;
+
+	if (size == 0)
+		return 0;
+	buf[0] = '\0';
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		n = snprintf (buf, size, "INTEGER: %lld", (long long) vb->number);
+		break;
+	case NP_SNMP_COUNTER32:
+		n = snprintf (buf, size, "Counter32: %llu", vb->number);
+		break;
+	case NP_SNMP_GAUGE32:
+		n = snprintf (buf, size, "Gauge32: %llu", vb->number);
+		break;
+	case NP_SNMP_COUNTER64:
+		n = snprintf (buf, size, "Counter64: %llu", vb->number);
+		break;
+	case NP_SNMP_TIMETICKS:
+		t = vb->number;
+		n = snprintf (buf, size, "Timeticks: (%llu) ", t);
+		if (n < size && t >= 8640000)
+			n += snprintf (buf + n, size - n, "%llu %s, ", t / 8640000,
+			               t / 8640000 == 1 ? "day" : "days");
+		if (n < size)
+			n += snprintf (buf + n, size - n, "%d:%02d:%02d.%02d",
+			               (int) (t / 360000 % 24), (int) (t / 6000 % 60),
+			               (int) (t / 100 % 60), (int) (t % 100));
+		break;
+	case NP_SNMP_IPADDRESS:
+		if (vb->data_len == 4)
+			n = snprintf (buf, size, "IpAddress: %d.%d.%d.%d", vb->data[0],
+			              vb->data[1], vb->data[2], vb->data[3]);
+		else
+			n = snprintf (buf, size, "IpAddress: ?");
+		break;
+	case NP_SNMP_OBJECT_ID:
+		if (np_snmp_decode_oid (vb->data, vb->data_len, &oid) != OK)
+			n = snprintf (buf, size, "OID: ?");
+		else if (oid.sub[0] == 1)	/* as snmpget prints it without MIBs */
+			n = snprintf (buf, size, "OID: iso%s",
+			              np_snmp_format_oid (&oid, oidbuf, sizeof oidbuf) + 1);
+		else
+			n = snprintf (buf, size, "OID: %s", np_snmp_format_oid (&oid, oidbuf, sizeof oidbuf));
+		break;
+	case NP_SNMP_OCTET_STRING:
+		printable = TRUE;
+		for (i = 0; i < vb->data_len; i++) {
+			if (!isprint (vb->data[i]) && !isspace (vb->data[i])) {
+				/* a trailing NUL is common and harmless */
+				if (vb->data[i] != '\0' || i + 1 != vb->data_len)
+					printable = FALSE;
+			}
+		}
+		if (printable) {
+			i = vb->data_len;
+			if (i && vb->data[i - 1] == '\0')
+				i--;
+			n = snprintf (buf, size, "STRING: \"%.*s\"", (int) i, vb->data);
+			break;
+		}
+		/* fall through */
+	case NP_SNMP_OPAQUE:
+		n = snprintf (buf, size, "%s:", vb->type == NP_SNMP_OPAQUE ? "Opaque" : "Hex-STRING");
+		for (i = 0; i < vb->data_len && n < size; i++)
+			n += snprintf (buf + n, size - n, " %02X", vb->data[i]);
+		break;
+	case NP_SNMP_NULL:
+		n = snprintf (buf, size, "NULL");
+		break;
+	case NP_SNMP_NOSUCHOBJECT:
+		n = snprintf (buf, size, "No Such Object available on this agent at this OID");
+		break;
+	case NP_SNMP_NOSUCHINSTANCE:
+		n = snprintf (buf, size, "No Such Instance currently exists at this OID");
+		break;
+	case NP_SNMP_ENDOFMIBVIEW:
+		n = snprintf (buf, size, "No more variables left in this MIB View (It is past the end of the MIB tree)");
+		break;
+	default:
+		n = snprintf (buf, size, "Wrong Type (0x%02x)", vb->type);
+	}
+	return n < size ? n : size - 1;
+}
+
+/** snmpget output **/
+
+/* Returns the length of the "TYPE" in a "TYPE: value" at the start of
+ * text, or 0 if it has none. Types are words like "Counter32",
+ * "Hex-STRING" or "Network Address" */
+size_t
+np_snmp_text_type (const char *text, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && i < 32; i++) {
+		if (text[i] == ':')
+			return (i > 0 && i + 1 < len && text[i + 1] == ' ') ? i : 0;
+		if (!isalnum ((unsigned char) text[i]) && text[i] != '-' &&
+		    (text[i] != ' ' || i == 0))
+			return 0;
+	}
+	return 0;
+}
+
+/* Returns the length of the line at p, without its newline */
+static size_t
+text_line (const char *p)
+{
+	const char *eol = strchr (p, '\n');
+
+	return eol ? (size_t) (eol - p) : strlen (p);
+}
+
+/* Returns a pointer to delim in the len characters at p, or NULL */
+static char *
+text_find (char *p, size_t len, const char *delim, size_t delim_len)
+{
+	size_t i;
+
+	for (i = 0; i + delim_len <= len; i++)
+		if (p[i] == delim[0] && !strncmp (p + i, delim, delim_len))
+			return p + i;
+	return NULL;
+}
+
+/* Splits the next entry off the NUL terminated output of snmpget at
+ * *pos, and moves *pos past it. An entry is the OID up to delim, then
+ * either a quoted value or the rest of the line and any following lines
+ * without a delim. Looks at each character of the output a fixed
+ * number of times and copies nothing. Returns FALSE when there is no
+ * entry left */
+int
+np_snmp_text_next (char **pos, const char *delim, np_snmp_text *entry)
+{
+	size_t delim_len = strlen (delim), len;
+	char *p = *pos, *d, *end;
+
+	/* the OID and the delimiter, which may be on a line of its own */
+	for (d = NULL; *p; ) {
+		len = text_line (p);
+		if ((d = text_find (p, len, delim, delim_len)) != NULL)
+			break;
+		p += len + (p[len] == '\n');
+	}
+	if (d == NULL) {
+		*pos = p;
+		return FALSE;
+	}
+	entry->oid = *pos;
+	entry->oid_len = d - *pos;
+
+	p = d + delim_len;
+	p += strspn (p, " ");
+	entry->type = NULL;
+	entry->type_len = 0;
+
+	if (*p == '"') {
+		/* a bare quoted value ends at the quote, newlines and all */
+		entry->value = ++p;
+		end = strchr (p, '"');
+		if (end == NULL)
+			end = p + strlen (p);
+		entry->value_len = end - p;
+		p = end + strspn (end, "\"\n");
+	}
+	else {
+		entry->value = p;
+		len = text_line (p);
+		end = p + len;
+		p = end + (*end == '\n');
+		/* lines without a delimiter continue the value */
+		while (*p) {
+			len = text_line (p);
+			if (text_find (p, len, delim, delim_len))
+				break;
+			if (len)
+				end = p + len;
+			p += len + (p[len] == '\n');
+		}
+		entry->value_len = end - entry->value;
+
+		len = np_snmp_text_type (entry->value, entry->value_len);
+		if (len) {
+			entry->type = entry->value;
+			entry->type_len = len;
+			entry->value += len + 2;
+			entry->value_len -= len + 2;
+		}
+	}
+	*pos = p;
+	return TRUE;
+}
+
+const char *
+np_snmp_strerror (int err)
+{
+	switch (err) {
+	case NP_SNMP_OK:
+		return _("Success");
+	case NP_SNMP_ERR_ENCODE:
+		return _("Request too large");
+	case NP_SNMP_ERR_DECODE:
+		return _("Malformed SNMP message");
+	case NP_SNMP_ERR_TIMEOUT:
+		return _("No response");
+	case NP_SNMP_ERR_SOCKET:
+		return strerror (errno);
+	}
+	return _("Unknown error");
+}
+
+/* Names of the error-status values of RFC 1905 */
+const char *
+np_snmp_error_status (int status)
+{
+	static const char *names[] = {
+		"noError", "tooBig", "noSuchName", "badValue", "readOnly", "genErr",
+		"noAccess", "wrongType", "wrongLength", "wrongEncoding", "wrongValue",
+		"noCreation", "inconsistentValue", "resourceUnavailable", "commitFailed",
+		"undoFailed", "authorizationError", "notWritable", "inconsistentName"
+	};
+
+	if (status < 0 || (size_t) status >= sizeof names / sizeof *names)
+		return "unknown";
+	return names[status];
+}
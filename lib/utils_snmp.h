@@ -0,0 +1,124 @@
+#ifndef _UTILS_SNMP_
+#define _UTILS_SNMP_
+
+/*
+ * Header file for nagios plugins utils_snmp.c
+ *
+ * A small SNMP v1/v2c engine: BER encoding and decoding of messages
+ * and a request/response exchange over a connected UDP socket, and a
+ * parser for the output of snmpget where that is still used.
+ */
+
+/** limits **/
+#define NP_SNMP_MAX_OID_LEN 128		/* sub-identifiers in an OID */
+#define NP_SNMP_MAX_MSG 65507		/* largest UDP payload */
+#define NP_SNMP_OID_STR (NP_SNMP_MAX_OID_LEN * 11 + 1)
+
+/** protocol versions, as sent on the wire **/
+#define NP_SNMP_V1 0
+#define NP_SNMP_V2C 1
+
+/** ASN.1 and SNMP tags **/
+#define NP_SNMP_INTEGER 0x02
+#define NP_SNMP_OCTET_STRING 0x04
+#define NP_SNMP_NULL 0x05
+#define NP_SNMP_OBJECT_ID 0x06
+#define NP_SNMP_SEQUENCE 0x30
+#define NP_SNMP_IPADDRESS 0x40
+#define NP_SNMP_COUNTER32 0x41
+#define NP_SNMP_GAUGE32 0x42
+#define NP_SNMP_TIMETICKS 0x43
+#define NP_SNMP_OPAQUE 0x44
+#define NP_SNMP_COUNTER64 0x46
+#define NP_SNMP_NOSUCHOBJECT 0x80
+#define NP_SNMP_NOSUCHINSTANCE 0x81
+#define NP_SNMP_ENDOFMIBVIEW 0x82
+
+/** PDU types **/
+#define NP_SNMP_GET 0xa0
+#define NP_SNMP_GETNEXT 0xa1
+#define NP_SNMP_RESPONSE 0xa2
+#define NP_SNMP_SET 0xa3
+#define NP_SNMP_GETBULK 0xa5
+
+/** error-status values of a response **/
+#define NP_SNMP_NOERROR 0
+#define NP_SNMP_TOOBIG 1
+#define NP_SNMP_NOSUCHNAME 2
+
+/** return codes **/
+#define NP_SNMP_OK 0
+#define NP_SNMP_ERR_ENCODE -1		/* message does not fit the buffer */
+#define NP_SNMP_ERR_DECODE -2		/* malformed message */
+#define NP_SNMP_ERR_TIMEOUT -3		/* no answer after all retries */
+#define NP_SNMP_ERR_SOCKET -4		/* send or receive failed, see errno */
+
+/** types **/
+typedef struct np_snmp_oid
+{
+	size_t len;
+	unsigned int sub[NP_SNMP_MAX_OID_LEN];
+} np_snmp_oid;
+
+/* The value of a varbind. Integer types are held in number (INTEGER
+ * sign extended); other types point at their content octets in data,
+ * which after decoding is the receive buffer itself */
+typedef struct np_snmp_varbind
+{
+	np_snmp_oid oid;
+	int type;
+	unsigned long long number;
+	const unsigned char *data;
+	size_t data_len;
+} np_snmp_varbind;
+
+typedef struct np_snmp_pdu
+{
+	int version;
+	const char *community;
+	size_t community_len;
+	int type;
+	long request_id;
+	int error_status;	/* non-repeaters for GETBULK */
+	int error_index;	/* max-repetitions for GETBULK */
+	np_snmp_varbind *vb;
+	size_t nvb;
+	size_t max_vb;		/* room in vb when decoding */
+} np_snmp_pdu;
+
+/* One "OID = TYPE: value" entry of snmpget output. The members point
+ * into the output itself and are not NUL terminated */
+typedef struct np_snmp_text
+{
+	char *oid;
+	size_t oid_len;
+	char *type;		/* NULL if the value has no "TYPE: " prefix */
+	size_t type_len;
+	char *value;
+	size_t value_len;
+} np_snmp_text;
+
+/* called by np_snmp_walk for each varbind found under roots[column] */
+typedef void (*np_snmp_walk_fn) (size_t column, const np_snmp_varbind *, void *);
+
+/** prototypes **/
+int np_snmp_parse_oid (const char *, np_snmp_oid *);
+char *np_snmp_format_oid (const np_snmp_oid *, char *, size_t);
+int np_snmp_oid_compare (const np_snmp_oid *, const np_snmp_oid *);
+int np_snmp_oid_in_subtree (const np_snmp_oid *, const np_snmp_oid *);
+int np_snmp_decode_oid (const unsigned char *, size_t, np_snmp_oid *);
+
+int np_snmp_encode (const np_snmp_pdu *, unsigned char *, size_t);
+int np_snmp_decode (const unsigned char *, size_t, np_snmp_pdu *);
+int np_snmp_exchange (int, const np_snmp_pdu *, np_snmp_pdu *,
+                      unsigned char *, size_t, int, int);
+int np_snmp_walk (int, const np_snmp_pdu *, const np_snmp_oid *, size_t,
+                  int, int, int, np_snmp_walk_fn, void *);
+
+int np_snmp_format_value (const np_snmp_varbind *, char *, size_t);
+size_t np_snmp_text_type (const char *, size_t);
+int np_snmp_text_next (char **, const char *, np_snmp_text *);
+const char *np_snmp_strerror (int);
+const char *np_snmp_error_status (int);
+
+#endif /* _UTILS_SNMP_ */
@@ -70,6 +70,10 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#ifdef USE_IPV6
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#endif
 #include <arpa/inet.h>
 #include <signal.h>
 
@@ -107,19 +111,31 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 
 typedef unsigned short range_t;  /* type for get_range() -- unimplemented */
 
+/* an address of either family */
+typedef union host_addr {
+	struct sockaddr sa;
+	struct sockaddr_in sin;
+#ifdef USE_IPV6
+	struct sockaddr_in6 sin6;
+#endif
+} host_addr;
+
+/* the packet counters and rtt sums of a target are kept in the
+ * host_* arrays below, indexed by id */
 typedef struct rta_host {
-	unsigned short id;           /* id in **table, and icmp pkts */
+	unsigned int id;             /* index in table, and in icmp pkts */
 	char *name;                  /* arg used for adding this host */
+	char **aliases;              /* other names given for the same address */
+	unsigned int naliases;
 	char *msg;                   /* icmp error message, if any */
-	struct sockaddr_in saddr_in; /* the address of this host */
-	struct in_addr error_addr;   /* stores address of error replies */
-	unsigned long long time_waited; /* total time waited, in usecs */
-	unsigned int icmp_sent, icmp_recv, icmp_lost; /* counters */
-	unsigned char icmp_type, icmp_code; /* type and code from errors */
+	host_addr saddr;             /* the address of this host */
+	host_addr error_addr;        /* stores address of error replies */
 	unsigned short flags;        /* control/status flags */
 	double rta;                  /* measured RTA */
+	double rtmin, rtmax, rtp95;  /* and the spread of the rtts */
+	double jitter;               /* mean rtt difference between packets */
+	double mos;                  /* estimated Mean Opinion Score, 1 to 5 */
 	unsigned char pl;            /* measured packet loss */
-	struct rta_host *next;       /* linked list */
 } rta_host;
 
 #define FLAG_LOST_CAUSE 0x01  /* decidedly dead target. */
@@ -128,12 +144,15 @@ typedef struct rta_host {
 typedef struct threshold {
 	unsigned char pl;    /* max allowed packet loss in percent */
 	unsigned int rta;  /* roundtrip time average, microseconds */
+	unsigned int jitter;	/* microseconds, 0 if not checked */
+	double mos;	/* min allowed MOS, 0 if not checked */
 } threshold;
 
-/* the data structure */
+/* the data structure. The icmp sequence only has room for the low 16
+ * bits of the target id, so the whole id is sent along here */
 typedef struct icmp_ping_data {
 	struct timeval stime;	/* timestamp (saved in protocol struct as well) */
-	unsigned short ping_id;
+	unsigned int target_id;
 } icmp_ping_data;
 
 /* the different modes of this program are as follows:
@@ -160,6 +179,7 @@ typedef struct icmp_ping_data {
 #define HAVE_UDP 2
 #define HAVE_TCP 4
 #define HAVE_ARP 8
+#define HAVE_ICMP6 16
 
 #define MIN_PING_DATA_SIZE sizeof(struct icmp_ping_data)
 #define MAX_IP_PKT_SIZE 65536	/* (theoretical) max IP packet size */
@@ -173,19 +193,62 @@ typedef struct icmp_ping_data {
 #define TSTATE_ALIVE 0x04       /* target is alive (has answered something) */
 #define TSTATE_UNREACH 0x08
 
+/* how results are printed: one summary for all targets, a line for
+ * each target, or a Nagios passive host check result for each target */
+#define OUTPUT_SUMMARY 0
+#define OUTPUT_HOST 1
+#define OUTPUT_PASSIVE 2
+
+#define PKT_BATCH 64	/* packets per sendmmsg() or recvmmsg() call */
+
+/* the socket and sockaddr size for pinging a target */
+#define HOST_SOCK(h) ((h)->saddr.sa.sa_family == AF_INET ? icmp_sock : icmp6_sock)
+#define HOST_ADDRLEN(h) ((h)->saddr.sa.sa_family == AF_INET ? \
+						 sizeof(struct sockaddr_in) : sizeof(host_addr))
+#define MAX_REPLY_SIZE 4096
+
+/* a received packet, and when it arrived. That is the kernel's time
+ * stamp where we get one, so that the time a busy poller takes to get
+ * around to reading it doesn't count as latency */
+typedef struct icmp_reply {
+	char buf[MAX_REPLY_SIZE];
+	int len;
+	host_addr addr;
+	struct timeval stamp;
+} icmp_reply;
+
 /** prototypes **/
 void print_help (void);
 void print_usage (void);
 static u_int get_timevar(const char *);
 static u_int get_timevaldiff(struct timeval *, struct timeval *);
-static int wait_for_reply(int, u_int);
-static int recvfrom_wto(int, char *, unsigned int, struct sockaddr *, u_int *);
-static int send_icmp_ping(int, struct rta_host *);
+static int wait_for_reply(u_int);
+static int recv_replies(u_int *);
+static int recv_batch(int, int);
+static void handle_reply(icmp_reply *);
+static int send_icmp_ping(struct rta_host **, int);
 static int get_threshold(char *str, threshold *th);
+static void get_jitter_mos_thresholds(char *, int);
+static void host_stats(struct rta_host *);
+static int exceeds(struct rta_host *, threshold *);
+static char *host_perfdata(struct rta_host *, const char *);
 static void run_checks(void);
-static int add_target(char *);
-static int add_target_ip(char *, struct in_addr *);
-static int handle_random_icmp(struct icmp *, struct sockaddr_in *);
+static int add_target(char *, char *);
+static int add_target_ip(char *, host_addr *);
+static int add_target_failed(char *, const char *);
+static void add_host_alias(struct rta_host *, char *);
+static int same_addr(const host_addr *, const host_addr *);
+static u_int *addr_slot(const host_addr *);
+static struct rta_host *reply_host(u_int, u_int, int);
+static const char *addr_ntop(const host_addr *);
+static void add_targets_from_file(const char *);
+static void print_host_result(const char *, int, const char *);
+static int handle_random_icmp(struct icmp *, host_addr *);
+#ifdef USE_IPV6
+static int handle_random_icmp6(struct icmp6_hdr *, int, host_addr *);
+#endif
+static void host_error(struct rta_host *, char *, int, host_addr *);
+static int set_timestamps(int);
 static unsigned short icmp_checksum(unsigned short *, int);
 static void finish(int);
 static void crash(const char *, ...);
@@ -196,16 +259,25 @@ extern char *optarg;
 extern char **environ;
 
 /** global variables **/
-static struct rta_host **table, *cursor, *list;
+static struct rta_host *table;	/* all targets, by id */
+static u_int table_size = 0;
+static u_int *addr_hash;	/* open addressing, target id + 1 by address */
+static u_int addr_hash_size = 0;
+/* per-target counters, kept apart from the rta_host records so that
+ * sending and reply processing run over small flat arrays */
+static unsigned long long *host_time_waited; /* total time waited, in usecs */
+static unsigned int *host_sent, *host_recv, *host_lost;
+static unsigned int *host_rtts;	/* a ring of the last packets rtts for each */
 static threshold crit = {80, 500000}, warn = {40, 200000};
 static int mode, protocols, sockets, debug = 0, timeout = 10;
 static unsigned short icmp_pkt_size, icmp_data_size = DEFAULT_PING_DATA_SIZE;
 static unsigned int icmp_sent = 0, icmp_recv = 0, icmp_lost = 0;
 #define icmp_pkts_en_route (icmp_sent - (icmp_recv + icmp_lost))
-static unsigned short targets_down = 0, targets = 0, packets = 0;
+static unsigned int targets_down = 0, targets = 0;
+static unsigned short packets = 0;
 #define targets_alive (targets - targets_down)
 static unsigned int retry_interval, pkt_interval, target_interval;
-static int icmp_sock, tcp_sock, udp_sock, status = STATE_OK;
+static int icmp_sock, icmp6_sock = -1, tcp_sock, udp_sock, status = STATE_OK;
 static pid_t pid;
 static struct timezone tz;
 static struct timeval prog_start;
@@ -213,6 +285,9 @@ static unsigned long long max_completion_time = 0;
 static unsigned char ttl = 0;	/* outgoing ttl */
 static unsigned int warn_down = 1, crit_down = 1; /* host down threshold values */
 static int min_hosts_alive = -1;
+static int output_format = OUTPUT_SUMMARY;
+static int targets_unresolved = 0;
+static icmp_reply replies[PKT_BATCH];
 float pkt_backoff_factor = 1.5;
 float target_backoff_factor = 1.5;
 
@@ -291,11 +366,49 @@ get_icmp_error_msg(unsigned char icmp_type, unsigned char icmp_code)
 	return msg;
 }
 
+#ifdef USE_IPV6
+static char *
+get_icmp6_error_msg(unsigned char icmp_type, unsigned char icmp_code)
+{
+	char *msg = "unreachable";
+
+	if(debug > 1) printf("get_icmp6_error_msg(%u, %u)\n", icmp_type, icmp_code);
+	switch(icmp_type) {
+	case ICMP6_DST_UNREACH:
+		switch(icmp_code) {
+		case ICMP6_DST_UNREACH_NOROUTE: msg = "No route to destination"; break;
+		case ICMP6_DST_UNREACH_ADMIN: msg = "Communication prohibited (firewall?)"; break;
+		case ICMP6_DST_UNREACH_BEYONDSCOPE: msg = "Beyond scope of source address"; break;
+		case ICMP6_DST_UNREACH_ADDR: msg = "Address unreachable"; break;
+		case ICMP6_DST_UNREACH_NOPORT: msg = "Port unreachable (firewall?)"; break;
+		default: msg = "Invalid code"; break;
+		}
+		break;
+
+	case ICMP6_TIME_EXCEEDED:
+		switch(icmp_code) {
+		case ICMP6_TIME_EXCEED_TRANSIT: msg = "Hop limit exceeded in transit"; break;
+		case ICMP6_TIME_EXCEED_REASSEMBLY: msg = "Fragment reassembly time exceeded"; break;
+		default: msg = "Invalid code"; break;
+		}
+		break;
+
+	case ICMP6_PACKET_TOO_BIG: msg = "Packet too big"; break;
+	case ICMP6_PARAM_PROB: msg = "Bad IPv6 header"; break;
+	default: msg = ""; break;
+	}
+
+	return msg;
+}
+#endif
+
 static int
-handle_random_icmp(struct icmp *p, struct sockaddr_in *addr)
+handle_random_icmp(struct icmp *p, host_addr *addr)
 {
 	struct icmp sent_icmp;
+	struct ip sent_ip;
 	struct rta_host *host = NULL;
+	host_addr sent_to;
 	unsigned char *ptr;
 
 	if(p->icmp_type == ICMP_ECHO && p->icmp_id == pid) {
@@ -323,31 +436,99 @@ handle_random_icmp(struct icmp *p, struct sockaddr_in *addr)
 	}
 
 	/* might be for us. At least it holds the original package (according
-	 * to RFC 792). If it isn't, just ignore it */
+	 * to RFC 792), but only the first 8 bytes past its IP header, so we
+	 * find the target by the address it was sent to. If it isn't ours,
+	 * just ignore it */
+	memcpy(&sent_ip, ptr + 8, sizeof(sent_ip));
 	memcpy(&sent_icmp, ptr + 28, sizeof(sent_icmp));
+	memset(&sent_to, 0, sizeof(sent_to));
+	sent_to.sin.sin_family = AF_INET;
+	sent_to.sin.sin_addr = sent_ip.ip_dst;
 	if(sent_icmp.icmp_type != ICMP_ECHO || sent_icmp.icmp_id != pid ||
-	   sent_icmp.icmp_seq >= targets)
+	   !(host = reply_host(*addr_slot(&sent_to), sent_icmp.icmp_seq, AF_INET)))
 	{
 		if(debug) printf("Packet is no response to a packet we sent\n");
 		return 0;
 	}
 
 	/* it is indeed a response for us */
-	host = table[sent_icmp.icmp_seq];
 	if(debug) {
 		printf("Received \"%s\" from %s for ICMP ECHO sent to %s.\n",
 			   get_icmp_error_msg(p->icmp_type, p->icmp_code),
-			   inet_ntoa(addr->sin_addr), host->name);
+			   addr_ntop(addr), host->name);
+	}
+
+	/* source quench means we're sending too fast */
+	host_error(host, get_icmp_error_msg(p->icmp_type, p->icmp_code),
+			   p->icmp_type == ICMP_SOURCEQUENCH, addr);
+
+	return 0;
+}
+
+#ifdef USE_IPV6
+/* the ICMPv6 version of the above. ICMPv6 errors quote as much of the
+ * original packet as fits (RFC 4443), so the IPv6 header and our echo
+ * header are always there. Raw ICMPv6 sockets get no IPv6 header of
+ * the error itself */
+static int
+handle_random_icmp6(struct icmp6_hdr *p, int len, host_addr *addr)
+{
+	struct icmp6_hdr sent_icmp;
+	struct ip6_hdr sent_ip;
+	struct rta_host *host = NULL;
+	host_addr sent_to;
+	unsigned char *ptr;
+
+	ptr = (unsigned char *)p;
+	if(debug) printf("handle_random_icmp6(%p, %p)\n", (void *)p, (void *)addr);
+
+	/* the socket filter lets nothing else through, but anyway */
+	if(p->icmp6_type != ICMP6_DST_UNREACH && p->icmp6_type != ICMP6_TIME_EXCEEDED &&
+	   p->icmp6_type != ICMP6_PACKET_TOO_BIG && p->icmp6_type != ICMP6_PARAM_PROB)
+	{
+		return 0;
+	}
+	if(len < (int)(sizeof(*p) + sizeof(sent_ip) + sizeof(sent_icmp))) return 0;
+
+	memcpy(&sent_ip, ptr + sizeof(*p), sizeof(sent_ip));
+	memcpy(&sent_icmp, ptr + sizeof(*p) + sizeof(sent_ip), sizeof(sent_icmp));
+	memset(&sent_to, 0, sizeof(sent_to));
+	sent_to.sin6.sin6_family = AF_INET6;
+	sent_to.sin6.sin6_addr = sent_ip.ip6_dst;
+	if(sent_ip.ip6_nxt != IPPROTO_ICMPV6 ||
+	   sent_icmp.icmp6_type != ICMP6_ECHO_REQUEST || sent_icmp.icmp6_id != pid ||
+	   !(host = reply_host(*addr_slot(&sent_to), sent_icmp.icmp6_seq, AF_INET6)))
+	{
+		if(debug) printf("Packet is no response to a packet we sent\n");
+		return 0;
+	}
+
+	/* it is indeed a response for us */
+	if(debug) {
+		printf("Received \"%s\" from %s for ICMPv6 ECHO sent to %s.\n",
+			   get_icmp6_error_msg(p->icmp6_type, p->icmp6_code),
+			   addr_ntop(addr), host->name);
 	}
 
+	host_error(host, get_icmp6_error_msg(p->icmp6_type, p->icmp6_code), FALSE, addr);
+
+	return 0;
+}
+#endif
+
+/* counts a packet to host as lost to an error described by msg, which
+ * came from addr. With backoff, we slow down instead of giving up on
+ * the host */
+static void
+host_error(struct rta_host *host, char *msg, int backoff, host_addr *addr)
+{
 	icmp_lost++;
-	host->icmp_lost++;
+	host_lost[host->id]++;
 	/* don't spend time on lost hosts any more */
-	if(host->flags & FLAG_LOST_CAUSE) return 0;
+	if(host->flags & FLAG_LOST_CAUSE) return;
 
-	/* source quench means we're sending too fast, so increase the
-	 * interval and mark this packet lost */
-	if(p->icmp_type == ICMP_SOURCEQUENCH) {
+	/* increase the interval and mark this packet lost */
+	if(backoff) {
 		pkt_interval *= pkt_backoff_factor;
 		target_interval *= target_backoff_factor;
 	}
@@ -355,11 +536,8 @@ handle_random_icmp(struct icmp *p, struct sockaddr_in *addr)
 		targets_down++;
 		host->flags |= FLAG_LOST_CAUSE;
 	}
-	host->icmp_type = p->icmp_type;
-	host->icmp_code = p->icmp_code;
-	host->error_addr.s_addr = addr->sin_addr.s_addr;
-
-	return 0;
+	host->msg = msg;
+	host->error_addr = *addr;
 }
 
 int
@@ -368,9 +546,15 @@ main(int argc, char **argv)
 	int i;
 	char *ptr;
 	long int arg;
-	int icmp_sockerrno, udp_sockerrno, tcp_sockerrno;
-	int result;
-	struct rta_host *host;
+	int icmp_sockerrno, icmp6_sockerrno, udp_sockerrno, tcp_sockerrno;
+	int result, wanted;
+	u_int t;
+	char *targets_file = NULL;
+	char **host_args;
+	int host_argc = 0;
+#ifdef USE_IPV6
+	struct icmp6_filter filter;
+#endif
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -381,12 +565,18 @@ main(int argc, char **argv)
 
 	/* we only need to be setsuid when we get the sockets, so do
 	 * that before pointer magic (esp. on network data) */
-	icmp_sockerrno = udp_sockerrno = tcp_sockerrno = sockets = 0;
+	icmp_sockerrno = icmp6_sockerrno = udp_sockerrno = tcp_sockerrno = sockets = 0;
 
 	if((icmp_sock = socket(PF_INET, SOCK_RAW, IPPROTO_ICMP)) != -1)
 		sockets |= HAVE_ICMP;
 	else icmp_sockerrno = errno;
 
+#ifdef USE_IPV6
+	if((icmp6_sock = socket(PF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) != -1)
+		sockets |= HAVE_ICMP6;
+	else icmp6_sockerrno = errno;
+#endif
+
 	/* if((udp_sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) != -1) */
 	/* 	sockets |= HAVE_UDP; */
 	/* else udp_sockerrno = errno; */
@@ -414,7 +604,6 @@ main(int argc, char **argv)
 
 	/* now set defaults. Use progname to set them initially (allows for
 	 * superfast check_host program when target host is up */
-	cursor = list = NULL;
 	table = NULL;
 
 	mode = MODE_RTA;
@@ -444,9 +633,14 @@ main(int argc, char **argv)
 		packets = 5;
 	}
 
+	/* -H names are only resolved once all options are known, as -4, -6,
+	 * -o and -P decide how */
+	if(!(host_args = malloc(argc * sizeof(char *))))
+		crash("main(): failed to malloc the host list");
+
 	/* parse the arguments */
 	for(i = 1; i < argc; i++) {
-		while((arg = getopt(argc, argv, "vhVw:c:n:p:t:H:i:b:I:l:m:")) != EOF) {
+		while((arg = getopt(argc, argv, "vhVw:c:n:p:t:H:i:b:I:l:m:f:oP46J:M:")) != EOF) {
 			switch(arg) {
 			case 'v':
 				debug++;
@@ -466,16 +660,43 @@ main(int argc, char **argv)
 			case 'c':
 				get_threshold(optarg, &crit);
 				break;
+			case 'J':
+			case 'M':
+				get_jitter_mos_thresholds(optarg, arg);
+				break;
 			case 'n':
 			case 'p':
-				packets = strtoul(optarg, NULL, 0);
+				/* the loss and the rtt ring are per packet, so 0 won't do */
+				if(!is_intpos(optarg) || atoi(optarg) > 20)
+					usage2(_("Number of packets must be between 1 and 20"), optarg);
+				packets = atoi(optarg);
 				break;
 			case 't':
 				timeout = strtoul(optarg, NULL, 0);
 				if(!timeout) timeout = 10;
 				break;
 			case 'H':
-				add_target(optarg);
+				host_args[host_argc++] = optarg;
+				break;
+			case 'f':
+				targets_file = optarg;
+				break;
+			case 'o':
+				if(output_format == OUTPUT_SUMMARY) output_format = OUTPUT_HOST;
+				break;
+			case 'P':
+				output_format = OUTPUT_PASSIVE;
+				break;
+			case '4':
+				address_family = AF_INET;
+				break;
+			case '6':
+#ifdef USE_IPV6
+				address_family = AF_INET6;
+#else
+				errno = 0;
+				crash("IPv6 support not available");
+#endif
 				break;
 			case 'l':
 				ttl = (unsigned char)strtoul(optarg, NULL, 0);
@@ -499,18 +720,43 @@ main(int argc, char **argv)
 		}
 	}
 
+	for(i = 0; i < host_argc; i++)
+		add_target(host_args[i], NULL);
+	free(host_args);
 	argv = &argv[optind];
 	while(*argv) {
-		add_target(*argv);
+		add_target(*argv, NULL);
 		argv++;
 	}
+	if(targets_file) add_targets_from_file(targets_file);
+	if(!targets && output_format != OUTPUT_SUMMARY) {
+		/* results for names that failed to resolve are printed already */
+		exit(STATE_UNKNOWN);
+	}
 	if(!targets) {
 		errno = 0;
 		crash("No hosts to check");
 		exit(3);
 	}
 
-	if(!sockets) {
+	/* complain about the sockets we need but didn't get, and close
+	 * the ones we don't need */
+	for(wanted = 0, t = 0; t < targets; t++)
+		wanted |= table[t].saddr.sa.sa_family == AF_INET ? HAVE_ICMP : HAVE_ICMP6;
+	if(!(wanted & HAVE_ICMP) && icmp_sock != -1) {
+		close(icmp_sock);
+		icmp_sock = -1;
+	}
+	if(!(wanted & HAVE_ICMP6) && icmp6_sock != -1) {
+		close(icmp6_sock);
+		icmp6_sock = -1;
+	}
+	if(wanted & HAVE_ICMP6 && icmp6_sock == -1) {
+		errno = icmp6_sockerrno;
+		crash("Failed to obtain ICMPv6 socket");
+		return -1;
+	}
+	if(wanted & HAVE_ICMP) {
 		if(icmp_sock == -1) {
 			errno = icmp_sockerrno;
 			crash("Failed to obtain ICMP socket");
@@ -529,14 +775,42 @@ main(int argc, char **argv)
 	}
 	if(!ttl) ttl = 64;
 
-	if(icmp_sock) {
+	if(icmp_sock != -1) {
 		result = setsockopt(icmp_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
 		if(debug) {
 			if(result == -1) printf("setsockopt failed\n");
 			else printf("ttl set to %u\n", ttl);
 		}
+
+		result = set_timestamps(icmp_sock);
+		if(debug && result == -1) printf("no kernel timestamps, timing replies ourselves\n");
 	}
 
+#ifdef USE_IPV6
+	if(icmp6_sock != -1) {
+		i = ttl;
+		result = setsockopt(icmp6_sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &i, sizeof(i));
+		if(debug) {
+			if(result == -1) printf("setsockopt failed\n");
+			else printf("hop limit set to %u\n", ttl);
+		}
+
+		/* echo replies and errors only, not the neighbour discovery
+		 * and router chatter on the link */
+		ICMP6_FILTER_SETBLOCKALL(&filter);
+		ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB, &filter);
+		result = setsockopt(icmp6_sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+		if(debug && result == -1) printf("setting the ICMPv6 filter failed\n");
+
+		result = set_timestamps(icmp6_sock);
+		if(debug && result == -1) printf("no kernel timestamps, timing replies ourselves\n");
+	}
+#endif
+
 	/* stupid users should be able to give whatever thresholds they want
 	 * (nothing will break if they do), but some anal plugin maintainer
 	 * will probably add some printf() thing here later, so it might be
@@ -544,6 +818,8 @@ main(int argc, char **argv)
 	if(warn.pl > crit.pl) warn.pl = crit.pl;
 	if(warn.rta > crit.rta) warn.rta = crit.rta;
 	if(warn_down > crit_down) crit_down = warn_down;
+	if(crit.jitter && warn.jitter > crit.jitter) warn.jitter = crit.jitter;
+	if(warn.mos < crit.mos) warn.mos = crit.mos;
 
 	signal(SIGINT, finish);
 	signal(SIGHUP, finish);
@@ -555,8 +831,13 @@ main(int argc, char **argv)
 	/* make sure we don't wait any longer than necessary */
 	gettimeofday(&prog_start, &tz);
 	max_completion_time =
-		((targets * packets * pkt_interval) + (targets * target_interval)) +
-		(targets * packets * crit.rta) + crit.rta;
+		(((unsigned long long)targets * packets * pkt_interval) +
+		 ((unsigned long long)targets * target_interval)) +
+		((unsigned long long)targets * packets * crit.rta) + crit.rta;
+	/* with thousands of targets that is far beyond the timeout. Every
+	 * round waits for its replies instead (see run_checks()) */
+	if(output_format != OUTPUT_SUMMARY)
+		max_completion_time = (unsigned long long)timeout * 1000000;
 
 	if(debug) {
 		printf("packets: %u, targets: %u\n"
@@ -594,25 +875,18 @@ main(int argc, char **argv)
 			   icmp_pkt_size, timeout);
 	}
 
-	if(packets > 20) {
-		errno = 0;
-		crash("packets is > 20 (%d)", packets);
-	}
-
 	if(min_hosts_alive < -1) {
 		errno = 0;
 		crash("minimum alive hosts is negative (%i)", min_hosts_alive);
 	}
 
-	host = list;
-	table = malloc(sizeof(struct rta_host **) * (argc - 1));
-	i = 0;
-	while(host) {
-		host->id = i;
-		table[i] = host;
-		host = host->next;
-		i++;
-	}
+	host_time_waited = calloc(targets, sizeof(unsigned long long));
+	host_sent = calloc(targets, sizeof(unsigned int));
+	host_recv = calloc(targets, sizeof(unsigned int));
+	host_lost = calloc(targets, sizeof(unsigned int));
+	host_rtts = calloc((size_t)targets * packets, sizeof(unsigned int));
+	if(!host_time_waited || !host_sent || !host_recv || !host_lost || !host_rtts)
+		crash("main(): failed to malloc the target counters");
 
 	run_checks();
 
@@ -625,33 +899,50 @@ main(int argc, char **argv)
 static void
 run_checks()
 {
-	u_int i, t, result;
+	u_int i, t, n, batch, result;
 	u_int final_wait, time_passed;
+	struct rta_host *hosts[PKT_BATCH];
+
+	/* targets are sent to PKT_BATCH at a time, unless they are to be
+	 * spaced out by target_interval */
+	batch = target_interval ? 1 : PKT_BATCH;
 
 	/* this loop might actually violate the pkt_interval or target_interval
 	 * settings, but only if there aren't any packets on the wire which
 	 * indicates that the target can handle an increased packet rate */
 	for(i = 0; i < packets; i++) {
-		for(t = 0; t < targets; t++) {
+		for(t = 0; t < targets; ) {
 			/* don't send useless packets */
 			if(!targets_alive) finish(0);
-			if(table[t]->flags & FLAG_LOST_CAUSE) {
-				if(debug) printf("%s is a lost cause. not sending any more\n",
-								 table[t]->name);
-				continue;
+			for(n = 0; t < targets && n < batch; t++) {
+				if(table[t].flags & FLAG_LOST_CAUSE) {
+					if(debug) printf("%s is a lost cause. not sending any more\n",
+									 table[t].name);
+					continue;
+				}
+				hosts[n++] = &table[t];
 			}
-			
-			/* we're still in the game, so send next packet */
-			(void)send_icmp_ping(icmp_sock, table[t]);
-			result = wait_for_reply(icmp_sock, target_interval);
+
+			/* we're still in the game, so send next packets */
+			if(n) (void)send_icmp_ping(hosts, n);
+			result = wait_for_reply(target_interval);
 		}
-		result = wait_for_reply(icmp_sock, pkt_interval * targets);
+		/* with a result per target, pkt_interval is the time between
+		 * rounds; every target has been sent to once in the meantime */
+		if(output_format != OUTPUT_SUMMARY)
+			result = wait_for_reply(pkt_interval);
+		else
+			result = wait_for_reply(pkt_interval * targets);
 	}
 
 	if(icmp_pkts_en_route && targets_alive) {
 		time_passed = get_timevaldiff(NULL, NULL);
 		final_wait = max_completion_time - time_passed;
 
+		/* anything slower than crit.rta is critical anyway */
+		if(output_format != OUTPUT_SUMMARY && final_wait > crit.rta)
+			final_wait = crit.rta;
+
 		if(debug) {
 			printf("time_passed: %u  final_wait: %u  max_completion_time: %llu\n",
 				   time_passed, final_wait, max_completion_time);
@@ -665,37 +956,30 @@ run_checks()
 		 * haven't yet */
 		if(debug) printf("Waiting for %u micro-seconds (%0.3f msecs)\n",
 						 final_wait, (float)final_wait / 1000);
-		result = wait_for_reply(icmp_sock, final_wait);
+		result = wait_for_reply(final_wait);
 	}
 }
 
-/* response structure:
- * ip header   : 20 bytes
- * icmp header : 28 bytes
- * icmp echo reply : the rest
- */
 static int
-wait_for_reply(int sock, u_int t)
+wait_for_reply(u_int t)
 {
-	int n, hlen;
-	static char buf[4096];
-	struct sockaddr_in resp_addr;
-	struct ip *ip;
-	struct icmp icp;
-	struct rta_host *host;
-	struct icmp_ping_data data;
-	struct timeval wait_start, now;
+	int n, j;
+	struct timeval wait_start;
 	u_int tdiff, i, per_pkt_wait;
 
-	/* if we can't listen or don't have anything to listen to, just return */
-	if(!t || !icmp_pkts_en_route) return 0;
+	/* if we don't have anything to listen to, just return */
+	if(!icmp_pkts_en_route) return 0;
 
 	gettimeofday(&wait_start, &tz);
 
 	i = t;
 	per_pkt_wait = t / icmp_pkts_en_route;
-	while(icmp_pkts_en_route && get_timevaldiff(&wait_start, NULL) < i) {
-		t = per_pkt_wait;
+	if(!per_pkt_wait) per_pkt_wait = 1;
+	while(icmp_pkts_en_route) {
+		/* once the time is up, only take what is queued already, so
+		 * that replies don't pile up while we send to many targets */
+		tdiff = get_timevaldiff(&wait_start, NULL);
+		t = tdiff < i ? per_pkt_wait : 0;
 
 		/* wrap up if all targets are declared dead */
 		if(!targets_alive ||
@@ -706,23 +990,64 @@ wait_for_reply(int sock, u_int t)
 		}
 
 		/* reap responses until we hit a timeout */
-		n = recvfrom_wto(sock, buf, sizeof(buf),
-						 (struct sockaddr *)&resp_addr, &t);
+		n = recv_replies(&t);
 		if(!n) {
+			if(tdiff >= i) break;
 			if(debug > 1) {
-				printf("recvfrom_wto() timed out during a %u usecs wait\n",
+				printf("recv_replies() timed out during a %u usecs wait\n",
 					   per_pkt_wait);
 			}
 			continue;	/* timeout for this one, so keep trying */
 		}
 		if(n < 0) {
-			if(debug) printf("recvfrom_wto() returned errors\n");
+			if(debug) printf("recv_replies() returned errors\n");
 			return n;
 		}
 
-		ip = (struct ip *)buf;
+		for(j = 0; j < n; j++) handle_reply(&replies[j]);
+	}
+
+	return 0;
+}
+
+/* response structure:
+ * ip header   : 20 bytes (not on ICMPv6 sockets)
+ * icmp header : 28 bytes
+ * icmp echo reply : the rest
+ */
+static void
+handle_reply(icmp_reply *reply)
+{
+	int hlen;
+	struct ip *ip = NULL;
+	struct icmp icp;
+#ifdef USE_IPV6
+	struct icmp6_hdr icp6;
+#endif
+	struct rta_host *host;
+	struct icmp_ping_data data;
+	u_int tdiff, seq;
+
+#ifdef USE_IPV6
+	if(reply->addr.sa.sa_family == AF_INET6) {
+		if(debug > 1) printf("received %u bytes from %s\n",
+						 reply->len, addr_ntop(&reply->addr));
+
+		if(reply->len < (int)sizeof(icp6)) return;
+		memcpy(&icp6, reply->buf, sizeof(icp6));
+		if(icp6.icmp6_type != ICMP6_ECHO_REPLY || icp6.icmp6_id != pid) {
+			handle_random_icmp6((struct icmp6_hdr *)reply->buf, reply->len, &reply->addr);
+			return;
+		}
+		hlen = 0;
+		seq = icp6.icmp6_seq;
+	}
+	else
+#endif
+	{
+		ip = (struct ip *)reply->buf;
 		if(debug > 1) printf("received %u bytes from %s\n",
-						 ntohs(ip->ip_len), inet_ntoa(resp_addr.sin_addr));
+						 ntohs(ip->ip_len), addr_ntop(&reply->addr));
 
 /* obsolete. alpha on tru64 provides the necessary defines, but isn't broken */
 /* #if defined( __alpha__ ) && __STDC__ && !defined( __GLIBC__ ) */
@@ -734,156 +1059,308 @@ wait_for_reply(int sock, u_int t)
 		hlen = ip->ip_hl << 2;
 /* #endif */
 
-		if(n < (hlen + ICMP_MINLEN)) {
+		if(reply->len < (hlen + ICMP_MINLEN)) {
 			crash("received packet too short for ICMP (%d bytes, expected %d) from %s\n",
-				  n, hlen + icmp_pkt_size, inet_ntoa(resp_addr.sin_addr));
+				  reply->len, hlen + icmp_pkt_size, addr_ntop(&reply->addr));
 		}
-		/* else if(debug) { */
-		/* 	printf("ip header size: %u, packet size: %u (expected %u, %u)\n", */
-		/* 		   hlen, ntohs(ip->ip_len) - hlen, */
-		/* 		   sizeof(struct ip), icmp_pkt_size); */
-		/* } */
 
 		/* check the response */
-		memcpy(&icp, buf + hlen, sizeof(icp));
+		memcpy(&icp, reply->buf + hlen, sizeof(icp));
 
 		if(icp.icmp_id != pid) {
-			handle_random_icmp(&icp, &resp_addr);
-			continue;
+			handle_random_icmp((struct icmp *)(reply->buf + hlen), &reply->addr);
+			return;
 		}
 
-		if(icp.icmp_type != ICMP_ECHOREPLY || icp.icmp_seq >= targets) {
+		if(icp.icmp_type != ICMP_ECHOREPLY) {
 			if(debug > 2) printf("not a proper ICMP_ECHOREPLY\n");
-			handle_random_icmp(&icp, &resp_addr);
-			continue;
+			handle_random_icmp((struct icmp *)(reply->buf + hlen), &reply->addr);
+			return;
 		}
+		seq = icp.icmp_seq;
+	}
 
-		/* this is indeed a valid response */
-		memcpy(&data, icp.icmp_data, sizeof(data));
+	/* both echo headers are ICMP_MINLEN bytes */
+	memcpy(&data, reply->buf + hlen + ICMP_MINLEN, sizeof(data));
+	if(reply->len < hlen + ICMP_MINLEN + (int)sizeof(data) ||
+	   !(host = reply_host(data.target_id + 1, seq, reply->addr.sa.sa_family)))
+	{
+		if(debug) printf("echo reply from %s for no target of ours\n",
+						 addr_ntop(&reply->addr));
+		return;
+	}
 
-		host = table[icp.icmp_seq];
-		gettimeofday(&now, &tz);
-		tdiff = get_timevaldiff(&data.stime, &now);
+	/* this is indeed a valid response */
+	tdiff = get_timevaldiff(&data.stime, &reply->stamp);
 
-		host->time_waited += tdiff;
-		host->icmp_recv++;
-		icmp_recv++;
+	host_time_waited[host->id] += tdiff;
+	host_rtts[host->id * packets + host_recv[host->id] % packets] = tdiff;
+	host_recv[host->id]++;
+	icmp_recv++;
 
-		if(debug) {
-			printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u\n",
-				   (float)tdiff / 1000, inet_ntoa(resp_addr.sin_addr),
-				   ttl, ip->ip_ttl);
-		}
-
-		/* if we're in hostcheck mode, exit with limited printouts */
-		if(mode == MODE_HOSTCHECK) {
-			printf("OK - %s responds to ICMP. Packet %u, rta %0.3fms|"
-				   "pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
-				   host->name, icmp_recv, (float)tdiff / 1000,
-				   icmp_recv, packets, (float)tdiff / 1000,
-				   (float)warn.rta / 1000, (float)crit.rta / 1000);
-			exit(STATE_OK);
-		}
+	if(debug) {
+		printf("%0.3f ms rtt from %s, outgoing ttl: %u",
+			   (float)tdiff / 1000, addr_ntop(&reply->addr), ttl);
+		if(ip) printf(", incoming ttl: %u", ip->ip_ttl);
+		printf("\n");
 	}
 
-	return 0;
+	/* if we're in hostcheck mode, exit with limited printouts */
+	if(mode == MODE_HOSTCHECK) {
+		printf("OK - %s responds to ICMP. Packet %u, rta %0.3fms|"
+			   "pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
+			   host->name, icmp_recv, (float)tdiff / 1000,
+			   icmp_recv, packets, (float)tdiff / 1000,
+			   (float)warn.rta / 1000, (float)crit.rta / 1000);
+		exit(STATE_OK);
+	}
 }
 
-/* the ping functions */
+/* the ping functions. Sends a packet to each of the n (at most
+ * PKT_BATCH) hosts, with a single sendmmsg() per address family where
+ * we have it. Returns the number of packets sent */
 static int
-send_icmp_ping(int sock, struct rta_host *host)
+send_icmp_ping(struct rta_host **hosts, int n)
 {
-	static union {
-		char *buf; /* re-use so we prevent leaks */
-		struct icmp *icp;
-		u_short *cksum_in;
-	} packet = { NULL };
-	long int len;
+	static char *bufs = NULL;	/* re-use so we prevent leaks */
+	static size_t stride;
+	static struct iovec iov[PKT_BATCH];
+#ifdef HAVE_SENDMMSG
+	static struct mmsghdr msgs[PKT_BATCH];
+	int idx[PKT_BATCH], j, k, m, family;
+#endif
+	struct icmp *icp;
+#ifdef USE_IPV6
+	struct icmp6_hdr *icp6;
+#endif
 	struct icmp_ping_data data;
 	struct timeval tv;
-	struct sockaddr *addr;
+	int i, len, sent = 0;
 
-	if(sock == -1) {
-		errno = 0;
-		crash("Attempt to send on bogus socket");
-		return -1;
-	}
-	addr = (struct sockaddr *)&host->saddr_in;
-
-	if(!packet.buf) {
-		if (!(packet.buf = malloc(icmp_pkt_size))) {
+	if(!bufs) {
+		/* keep each packet aligned for struct icmp */
+		stride = (icmp_pkt_size + 7) & ~7;
+		if (!(bufs = malloc(stride * PKT_BATCH))) {
 			crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
-				  icmp_pkt_size);
+				  stride * PKT_BATCH);
 			return -1;	/* might be reached if we're in debug mode */
 		}
 	}
-	memset(packet.buf, 0, icmp_pkt_size);
+	if(n > PKT_BATCH) n = PKT_BATCH;
 
 	if((gettimeofday(&tv, &tz)) == -1) return -1;
 
-	data.ping_id = 10; /* host->icmp.icmp_sent; */
-	memcpy(&data.stime, &tv, sizeof(tv));
-	memcpy(&packet.icp->icmp_data, &data, sizeof(data));
-	packet.icp->icmp_type = ICMP_ECHO;
-	packet.icp->icmp_code = 0;
-	packet.icp->icmp_cksum = 0;
-	packet.icp->icmp_id = pid;
-	packet.icp->icmp_seq = host->id;
-	packet.icp->icmp_cksum = icmp_checksum(packet.cksum_in, icmp_pkt_size);
-
-	len = sendto(sock, packet.buf, icmp_pkt_size, 0, (struct sockaddr *)addr,
-				 sizeof(struct sockaddr));
-
-	if(len < 0 || (unsigned int)len != icmp_pkt_size) {
-		if(debug) printf("Failed to send ping to %s\n",
-						 inet_ntoa(host->saddr_in.sin_addr));
-		return -1;
+	for(i = 0; i < n; i++) {
+		icp = (struct icmp *)(bufs + i * stride);
+		memset(icp, 0, icmp_pkt_size);
+
+		data.target_id = hosts[i]->id;
+		memcpy(&data.stime, &tv, sizeof(tv));
+		memcpy(&icp->icmp_data, &data, sizeof(data));
+		iov[i].iov_base = icp;
+		iov[i].iov_len = icmp_pkt_size;
+
+#ifdef USE_IPV6
+		/* the data goes in the same place, and the kernel does the
+		 * checksum, which covers a pseudo header for ICMPv6 */
+		if(hosts[i]->saddr.sa.sa_family == AF_INET6) {
+			icp6 = (struct icmp6_hdr *)icp;
+			icp6->icmp6_type = ICMP6_ECHO_REQUEST;
+			icp6->icmp6_code = 0;
+			icp6->icmp6_id = pid;
+			icp6->icmp6_seq = hosts[i]->id & 0xffff;
+			continue;
+		}
+#endif
+		icp->icmp_type = ICMP_ECHO;
+		icp->icmp_code = 0;
+		icp->icmp_cksum = 0;
+		icp->icmp_id = pid;
+		icp->icmp_seq = hosts[i]->id & 0xffff;
+		icp->icmp_cksum = icmp_checksum((unsigned short *)icp, icmp_pkt_size);
 	}
 
-	icmp_sent++;
-	host->icmp_sent++;
+#ifdef HAVE_SENDMMSG
+	for(k = 0; k < 2; k++) {
+		/* first the IPv4 targets, then the IPv6 ones */
+		family = k ? AF_INET6 : AF_INET;
+		for(i = m = 0; i < n; i++) {
+			if(hosts[i]->saddr.sa.sa_family != family) continue;
+			msgs[m].msg_hdr.msg_name = &hosts[i]->saddr;
+			msgs[m].msg_hdr.msg_namelen = HOST_ADDRLEN(hosts[i]);
+			msgs[m].msg_hdr.msg_iov = &iov[i];
+			msgs[m].msg_hdr.msg_iovlen = 1;
+			idx[m++] = i;
+		}
 
-	return 0;
+		/* sendmmsg() stops at a packet it can't send, so skip that one */
+		for(i = 0; i < m; ) {
+			len = sendmmsg(k ? icmp6_sock : icmp_sock, &msgs[i], m - i, 0);
+			if(len <= 0) {
+				if(debug) printf("Failed to send ping to %s\n",
+								 addr_ntop(&hosts[idx[i]]->saddr));
+				i++;
+				continue;
+			}
+			for(j = 0; j < len; j++, i++) {
+				icmp_sent++;
+				host_sent[hosts[idx[i]]->id]++;
+				sent++;
+			}
+		}
+	}
+#else
+	for(i = 0; i < n; i++) {
+		len = sendto(HOST_SOCK(hosts[i]), iov[i].iov_base, icmp_pkt_size, 0,
+					 &hosts[i]->saddr.sa, HOST_ADDRLEN(hosts[i]));
+
+		if(len < 0 || (unsigned int)len != icmp_pkt_size) {
+			if(debug) printf("Failed to send ping to %s\n",
+							 addr_ntop(&hosts[i]->saddr));
+			continue;
+		}
+
+		icmp_sent++;
+		host_sent[hosts[i]->id]++;
+		sent++;
+	}
+#endif
+
+	return sent;
 }
 
+#ifdef HAVE_RECVMMSG
+static struct mmsghdr rx_msgs[PKT_BATCH];
+# define RX_HDR(i) (&rx_msgs[i].msg_hdr)
+#else
+static struct msghdr rx_msgs[PKT_BATCH];
+# define RX_HDR(i) (&rx_msgs[i])
+#endif
+
+/* Waits at most *timo usecs (0 only polls) for replies on either
+ * socket, and receives as many as are queued, up to PKT_BATCH, into
+ * replies[]. *timo is set to the time waited. Returns the number of
+ * replies, 0 on timeout */
 static int
-recvfrom_wto(int sock, char *buf, unsigned int len, struct sockaddr *saddr,
-			 u_int *timo)
+recv_replies(u_int *timo)
 {
-	u_int slen;
-	int n;
+	static struct iovec iov[PKT_BATCH];
+	static union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct timeval))];
+	} control[PKT_BATCH];
+	struct msghdr *msg;
+	struct cmsghdr *cmsg;
+#ifdef SCM_TIMESTAMPNS
+	struct timespec ts;
+#endif
+	int i, n, got;
 	struct timeval to, then, now;
 	fd_set rd, wr;
 
-	if(!*timo) {
-		if(debug) printf("*timo is not\n");
-		return 0;
-	}
-
 	to.tv_sec = *timo / 1000000;
 	to.tv_usec = (*timo - (to.tv_sec * 1000000));
 
 	FD_ZERO(&rd);
 	FD_ZERO(&wr);
-	FD_SET(sock, &rd);
+	if(icmp_sock != -1) FD_SET(icmp_sock, &rd);
+	if(icmp6_sock != -1) FD_SET(icmp6_sock, &rd);
 	errno = 0;
 	gettimeofday(&then, &tz);
-	n = select(sock + 1, &rd, &wr, NULL, &to);
-	if(n < 0) crash("select() in recvfrom_wto");
+	n = select(max(icmp_sock, icmp6_sock) + 1, &rd, &wr, NULL, &to);
+	if(n < 0) crash("select() in recv_replies");
 	gettimeofday(&now, &tz);
 	*timo = get_timevaldiff(&then, &now);
 
 	if(!n) return 0;				/* timeout */
 
-	slen = sizeof(struct sockaddr);
+	for(i = 0; i < PKT_BATCH; i++) {
+		msg = RX_HDR(i);
+		iov[i].iov_base = replies[i].buf;
+		iov[i].iov_len = sizeof(replies[i].buf);
+		msg->msg_name = &replies[i].addr;
+		msg->msg_namelen = sizeof(replies[i].addr);
+		msg->msg_iov = &iov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = control[i].buf;
+		msg->msg_controllen = sizeof(control[i].buf);
+		msg->msg_flags = 0;
+	}
 
-	return recvfrom(sock, buf, len, 0, saddr, &slen);
+	n = 0;
+	if(icmp_sock != -1 && FD_ISSET(icmp_sock, &rd)) {
+		if((got = recv_batch(icmp_sock, n)) < 0) return -1;
+		n += got;
+	}
+	/* if that filled the batch, the next call gets to these */
+	if(icmp6_sock != -1 && FD_ISSET(icmp6_sock, &rd) && n < PKT_BATCH) {
+		if((got = recv_batch(icmp6_sock, n)) < 0) return -1;
+		n += got;
+	}
+
+	/* when the kernel doesn't stamp them, replies arrived about now */
+	gettimeofday(&now, &tz);
+	for(i = 0; i < n; i++) {
+		replies[i].stamp = now;
+		msg = RX_HDR(i);
+		for(cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+			if(cmsg->cmsg_level != SOL_SOCKET) continue;
+#ifdef SCM_TIMESTAMPNS
+			if(cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				replies[i].stamp.tv_sec = ts.tv_sec;
+				replies[i].stamp.tv_usec = ts.tv_nsec / 1000;
+			}
+#endif
+#ifdef SCM_TIMESTAMP
+			if(cmsg->cmsg_type == SCM_TIMESTAMP)
+				memcpy(&replies[i].stamp, CMSG_DATA(cmsg), sizeof(struct timeval));
+#endif
+		}
+	}
+
+	return n;
+}
+
+/* receives what is queued on sock, up to the end of replies[], from
+ * replies[first] on. Returns the number of packets received */
+static int
+recv_batch(int sock, int first)
+{
+	int n;
+#ifdef HAVE_RECVMMSG
+	int i;
+
+	n = recvmmsg(sock, &rx_msgs[first], PKT_BATCH - first, MSG_DONTWAIT, NULL);
+	for(i = 0; i < n; i++) replies[first + i].len = rx_msgs[first + i].msg_len;
+#else
+	replies[first].len = n = recvmsg(sock, RX_HDR(first), MSG_DONTWAIT);
+	if(n > 0) n = 1;
+#endif
+	if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) n = 0;
+
+	return n;
+}
+
+/* has the kernel stamp replies on sock as they arrive */
+static int
+set_timestamps(int sock)
+{
+	int on = 1;
+
+#if defined(SO_TIMESTAMPNS)
+	return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#elif defined(SO_TIMESTAMP)
+	return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#else
+	return -1;
+#endif
 }
 
 static void
 finish(int sig)
 {
-	u_int i = 0;
+	u_int i = 0, t, u;
 	unsigned char pl;
 	double rta;
 	struct rta_host *host;
@@ -891,11 +1368,13 @@ finish(int sig)
 	{"OK", "WARNING", "CRITICAL", "UNKNOWN", "DEPENDENT"};
 	int hosts_ok = 0;
 	int hosts_warn = 0;
+	char *text;
 
 	alarm(0);
 	if(debug > 1) printf("finish(%d) called\n", sig);
 
 	if(icmp_sock != -1) close(icmp_sock);
+	if(icmp6_sock != -1) close(icmp6_sock);
 	if(udp_sock != -1) close(udp_sock);
 	if(tcp_sock != -1) close(tcp_sock);
 
@@ -906,9 +1385,9 @@ finish(int sig)
 	}
 
 	/* iterate thrice to calculate values, give output, and print perfparse */
-	host = list;
-	while(host) {
-		if(!host->icmp_recv) {
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
+		if(!host_recv[t]) {
 			/* rta 0 is ofcourse not entirely correct, but will still show up
 			 * conspicuosly as missing entries in perfparse and cacti */
 			pl = 100;
@@ -918,23 +1397,22 @@ finish(int sig)
 			if(!(host->flags & FLAG_LOST_CAUSE) && targets_alive) targets_down++;
 		}
 		else {
-			pl = ((host->icmp_sent - host->icmp_recv) * 100) / host->icmp_sent;
-			rta = (double)host->time_waited / host->icmp_recv;
+			pl = ((host_sent[t] - host_recv[t]) * 100) / host_sent[t];
+			rta = (double)host_time_waited[t] / host_recv[t];
 		}
 		host->pl = pl;
 		host->rta = rta;
-		if(pl >= crit.pl || rta >= crit.rta) {
+		host_stats(host);
+		if(exceeds(host, &crit)) {
 			status = STATE_CRITICAL;
 		}
-		else if(!status && (pl >= warn.pl || rta >= warn.rta)) {
+		else if(!status && exceeds(host, &warn)) {
 			status = STATE_WARNING;
 			hosts_warn++;
 		}
 		else {
 			hosts_ok++;
 		}
-
-		host = host->next;
 	}
 	/* this is inevitable */
 	if(!targets_alive) status = STATE_CRITICAL;
@@ -942,23 +1420,58 @@ finish(int sig)
 		if(hosts_ok >= min_hosts_alive) status = STATE_OK;
 		else if((hosts_ok + hosts_warn) >= min_hosts_alive) status = STATE_WARNING;
 	}
+
+	/* a result of its own for every target, and the worst as exit code */
+	if(output_format != OUTPUT_SUMMARY) {
+		for(t = 0; t < targets; t++) {
+			host = &table[t];
+			if(!host_recv[t] && host->flags & FLAG_LOST_CAUSE) {
+				asprintf(&text, "%s @ %s. rta nan, lost 100%%",
+						 host->msg, addr_ntop(&host->error_addr));
+			}
+			else if(!host_recv[t]) {
+				asprintf(&text, "rta nan, lost 100%%");
+			}
+			else {
+				asprintf(&text, "rta %0.3fms, lost %u%%", host->rta / 1000, host->pl);
+				if(warn.jitter || crit.jitter)
+					asprintf(&text, "%s, jitter %0.3fms", text, host->jitter / 1000);
+				if(warn.mos || crit.mos)
+					asprintf(&text, "%s, mos %0.1f", text, host->mos);
+			}
+			asprintf(&text, "%s|%s", text, host_perfdata(host, ""));
+
+			if(!host_recv[t] || exceeds(host, &crit))
+				i = STATE_CRITICAL;
+			else if(exceeds(host, &warn))
+				i = STATE_WARNING;
+			else
+				i = STATE_OK;
+			print_host_result(host->name, i, text);
+			for(u = 0; u < host->naliases; u++)
+				print_host_result(host->aliases[u], i, text);
+			free(text);
+		}
+		if(targets_unresolved) status = max_state_alt(status, STATE_UNKNOWN);
+		exit(status);
+	}
+
 	printf("%s - ", status_string[status]);
 
-	host = list;
-	while(host) {
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
 		if(debug) puts("");
 		if(i) {
 			if(i < targets) printf(" :: ");
 			else printf("\n");
 		}
 		i++;
-		if(!host->icmp_recv) {
+		if(!host_recv[t]) {
 			status = STATE_CRITICAL;
 			if(host->flags & FLAG_LOST_CAUSE) {
 				printf("%s: %s @ %s. rta nan, lost %d%%",
 					   host->name,
-					   get_icmp_error_msg(host->icmp_type, host->icmp_code),
-					   inet_ntoa(host->error_addr),
+					   host->msg, addr_ntop(&host->error_addr),
 					   100);
 			}
 			else { /* not marked as lost cause, so we have no flags for it */
@@ -968,24 +1481,17 @@ finish(int sig)
 		else {	/* !icmp_recv */
 			printf("%s: rta %0.3fms, lost %u%%",
 				   host->name, host->rta / 1000, host->pl);
+			if(warn.jitter || crit.jitter) printf(", jitter %0.3fms", host->jitter / 1000);
+			if(warn.mos || crit.mos) printf(", mos %0.1f", host->mos);
 		}
-
-		host = host->next;
 	}
 
 	/* iterate once more for pretty perfparse output */
 	printf("|");
-	i = 0;
-	host = list;
-	while(host) {
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
 		if(debug) puts("");
-		printf("%srta=%0.3fms;%0.3f;%0.3f;0; %spl=%u%%;%u;%u;; ",
-			   (targets > 1) ? host->name : "",
-			   host->rta / 1000, (float)warn.rta / 1000, (float)crit.rta / 1000,
-			   (targets > 1) ? host->name : "",
-			   host->pl, warn.pl, crit.pl);
-
-		host = host->next;
+		printf("%s ", host_perfdata(host, (targets > 1) ? host->name : ""));
 	}
 
 	if(min_hosts_alive > -1) {
@@ -1001,6 +1507,78 @@ finish(int sig)
 	exit(status);
 }
 
+/* works out the rtt spread, jitter and MOS of host from its ring of
+ * rtts, in one pass plus a sort of the (at most 20) rtts for p95 */
+static void
+host_stats(struct rta_host *host)
+{
+	u_int rtts[20], rtt, prev = 0, n, first, i, j;
+	double jitter = 0, latency, r;
+
+	n = host_recv[host->id];
+	first = n > packets ? n % packets : 0;
+	if(n > packets) n = packets;
+
+	host->rtmin = host->rtmax = host->rtp95 = host->jitter = 0;
+	for(i = 0; i < n; i++) {
+		rtt = host_rtts[host->id * packets + (first + i) % packets];
+		if(!i || rtt < host->rtmin) host->rtmin = rtt;
+		if(rtt > host->rtmax) host->rtmax = rtt;
+		if(i) jitter += rtt > prev ? rtt - prev : prev - rtt;
+		prev = rtt;
+
+		/* insertion sort as we go */
+		for(j = i; j > 0 && rtts[j - 1] > rtt; j--) rtts[j] = rtts[j - 1];
+		rtts[j] = rtt;
+	}
+	if(n > 1) host->jitter = jitter / (n - 1);
+	if(n) host->rtp95 = rtts[(95 * n + 99) / 100 - 1];	/* nearest rank */
+
+	/* the simplified E-model (ITU-T G.107) that VoIP monitors use: the
+	 * R factor from latency, jitter and loss, mapped to a MOS */
+	latency = host->rta / 1000 + host->jitter * 2 / 1000 + 10;
+	if(latency < 160) r = 93.2 - latency / 40;
+	else r = 93.2 - (latency - 120) / 10;
+	r -= host->pl * 2.5;
+	if(r < 0) r = 0;
+	host->mos = 1 + 0.035 * r + 0.000007 * r * (r - 60) * (100 - r);
+}
+
+/* TRUE if one of host's values reaches threshold th */
+static int
+exceeds(struct rta_host *host, threshold *th)
+{
+	return host->pl >= th->pl || host->rta >= th->rta ||
+		(th->jitter && host->jitter >= th->jitter) ||
+		(th->mos && host->mos <= th->mos);
+}
+
+/* the perfdata of host, with labels starting with prefix */
+static char *
+host_perfdata(struct rta_host *host, const char *prefix)
+{
+	static char *perf = NULL;
+	char wj[16] = "", cj[16] = "", wm[16] = "", cm[16] = "";
+
+	if(warn.jitter) snprintf(wj, sizeof(wj), "%0.3f", (float)warn.jitter / 1000);
+	if(crit.jitter) snprintf(cj, sizeof(cj), "%0.3f", (float)crit.jitter / 1000);
+	/* low scores are the bad ones */
+	if(warn.mos) snprintf(wm, sizeof(wm), "%0.2f:", warn.mos);
+	if(crit.mos) snprintf(cm, sizeof(cm), "%0.2f:", crit.mos);
+
+	free(perf);
+	asprintf(&perf, "%srta=%0.3fms;%0.3f;%0.3f;0; %spl=%u%%;%u;%u;; "
+			 "%srtmin=%0.3fms;;;0; %srtmax=%0.3fms;;;0; %srtp95=%0.3fms;;;0; "
+			 "%sjitter=%0.3fms;%s;%s;0; %smos=%0.2f;%s;%s;1;5",
+			 prefix, host->rta / 1000, (float)warn.rta / 1000, (float)crit.rta / 1000,
+			 prefix, host->pl, warn.pl, crit.pl,
+			 prefix, host->rtmin / 1000, prefix, host->rtmax / 1000,
+			 prefix, host->rtp95 / 1000,
+			 prefix, host->jitter / 1000, wj, cj, prefix, host->mos, wm, cm);
+
+	return perf;
+}
+
 static u_int
 get_timevaldiff(struct timeval *early, struct timeval *later)
 {
@@ -1014,7 +1592,7 @@ get_timevaldiff(struct timeval *early, struct timeval *later)
 	if(!early) early = &prog_start;
 
 	/* if early > later we return 0 so as to indicate a timeout */
-	if(early->tv_sec > early->tv_sec ||
+	if(early->tv_sec > later->tv_sec ||
 	   (early->tv_sec == later->tv_sec && early->tv_usec > later->tv_usec))
 	{
 		return 0;
@@ -1027,88 +1605,271 @@ get_timevaldiff(struct timeval *early, struct timeval *later)
 }
 
 static int
-add_target_ip(char *arg, struct in_addr *in)
+same_addr(const host_addr *a, const host_addr *b)
+{
+	if(a->sa.sa_family != b->sa.sa_family) return FALSE;
+#ifdef USE_IPV6
+	if(a->sa.sa_family == AF_INET6)
+		return !memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof(struct in6_addr));
+#endif
+	return a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+}
+
+/* returns addr as text, in one of two buffers so that a printf() can
+ * show two addresses */
+static const char *
+addr_ntop(const host_addr *addr)
+{
+	static char buf[2][INET6_ADDRSTRLEN];
+	static int i = 0;
+
+	i = !i;
+#ifdef USE_IPV6
+	if(addr->sa.sa_family == AF_INET6)
+		return inet_ntop(AF_INET6, &addr->sin6.sin6_addr, buf[i], sizeof(buf[i]));
+#endif
+	return inet_ntop(AF_INET, &addr->sin.sin_addr, buf[i], sizeof(buf[i]));
+}
+
+/* returns the slot of addr in addr_hash, which holds the id + 1 of
+ * the target with that address, or 0 if there is none */
+static u_int *
+addr_slot(const host_addr *addr)
+{
+	u_int h, mask = addr_hash_size - 1;
+#ifdef USE_IPV6
+	u_int w[4];
+#endif
+
+	if(!addr_hash_size) return &addr_hash_size;	/* no targets, so 0 */
+
+	/* neighbouring addresses differ in the last bits */
+#ifdef USE_IPV6
+	if(addr->sa.sa_family == AF_INET6) {
+		memcpy(w, &addr->sin6.sin6_addr, sizeof(w));
+		h = ntohl(w[0] ^ w[1] ^ w[2] ^ w[3]);
+	}
+	else
+#endif
+	h = ntohl(addr->sin.sin_addr.s_addr);
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	for(h &= mask; addr_hash[h]; h = (h + 1) & mask) {
+		if(same_addr(&table[addr_hash[h] - 1].saddr, addr)) break;
+	}
+
+	return &addr_hash[h];
+}
+
+/* returns the target with id + 1 as given, if it has an address of
+ * family and the icmp sequence of the packet matches it. Anything else
+ * isn't a reply to us */
+static struct rta_host *
+reply_host(u_int id, u_int seq, int family)
+{
+	struct rta_host *host;
+
+	if(!id || id > targets) return NULL;
+	host = &table[id - 1];
+	if((host->id & 0xffff) != seq || host->saddr.sa.sa_family != family)
+		return NULL;
+
+	return host;
+}
+
+static int
+add_target_ip(char *arg, host_addr *addr)
 {
 	struct rta_host *host;
+	u_int *slot, i;
 
 	/* disregard obviously stupid addresses */
-	if(in->s_addr == INADDR_NONE || in->s_addr == INADDR_ANY)
+	if(addr->sa.sa_family == AF_INET &&
+	   (addr->sin.sin_addr.s_addr == INADDR_NONE ||
+		addr->sin.sin_addr.s_addr == INADDR_ANY))
+		return -1;
+#ifdef USE_IPV6
+	if(addr->sa.sa_family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&addr->sin6.sin6_addr))
 		return -1;
+#endif
 
 	/* no point in adding two identical IP's, so don't. ;) */
-	host = list;
-	while(host) {
-		if(host->saddr_in.sin_addr.s_addr == in->s_addr) {
-			if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
-			return -1;
+	if(*addr_slot(addr)) {
+		if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
+		/* but every name still wants its own result line */
+		if(output_format != OUTPUT_SUMMARY)
+			add_host_alias(&table[*addr_slot(addr) - 1], arg);
+		return 1;
+	}
+
+	/* grow the table and rehash, keeping the hash at most half full */
+	if(targets == table_size) {
+		table_size = table_size ? table_size * 2 : 64;
+		table = realloc(table, table_size * sizeof(struct rta_host));
+		free(addr_hash);
+		addr_hash_size = table_size * 2;
+		addr_hash = calloc(addr_hash_size, sizeof(u_int));
+		if(!table || !addr_hash) {
+			crash("add_target_ip(%s, %s): failed to malloc room for %u targets",
+				  arg, addr_ntop(addr), table_size);
 		}
-		host = host->next;
+		for(i = 0; i < targets; i++)
+			*addr_slot(&table[i].saddr) = i + 1;
 	}
 
 	/* add the fresh ip */
-	host = malloc(sizeof(struct rta_host));
-	if(!host) {
-		crash("add_target_ip(%s, %s): malloc(%d) failed",
-			  arg, inet_ntoa(*in), sizeof(struct rta_host));
-	}
+	host = &table[targets];
 	memset(host, 0, sizeof(struct rta_host));
+	host->id = targets;
 
 	/* set the values. use calling name for output */
 	host->name = strdup(arg);
+	host->saddr = *addr;
 
-	/* fill out the sockaddr_in struct */
-	host->saddr_in.sin_family = AF_INET;
-	host->saddr_in.sin_addr.s_addr = in->s_addr;
+	slot = addr_slot(addr);
+	*slot = ++targets;
 
-	if(!list) list = cursor = host;
-	else cursor->next = host;
+	return 0;
+}
 
-	cursor = host;
-	targets++;
+/* in mass mode, reports a target we can't ping as UNKNOWN */
+static int
+add_target_failed(char *name, const char *text)
+{
+	if(output_format == OUTPUT_SUMMARY) return -1;
 
-	return 0;
+	/* one bad name in a list of thousands is no reason to stop */
+	print_host_result(name, STATE_UNKNOWN, text);
+	targets_unresolved++;
+	return -1;
+}
+
+/* makes host's results also be reported for name, unless it has it already */
+static void
+add_host_alias(struct rta_host *host, char *name)
+{
+	u_int i;
+
+	if(!strcmp(host->name, name)) return;
+	for(i = 0; i < host->naliases; i++)
+		if(!strcmp(host->aliases[i], name)) return;
+
+	host->aliases = realloc(host->aliases, (host->naliases + 1) * sizeof(char *));
+	if(!host->aliases || !(host->aliases[host->naliases] = strdup(name)))
+		crash("add_host_alias(%s): failed to malloc", name);
+	host->naliases++;
 }
 
-/* wrapper for add_target_ip */
+/* wrapper for add_target_ip. The target is reported as name if given */
 static int
-add_target(char *arg)
+add_target(char *arg, char *name)
 {
-	int i;
-	struct hostent *he;
-	struct in_addr *in, ip;
+	struct addrinfo hints, *res, *ai;
+	host_addr addr;
+	int added = 0;
+
+	if(!name) name = arg;
 
 	/* don't resolve if we don't have to */
-	if((ip.s_addr = inet_addr(arg)) != INADDR_NONE) {
+	memset(&addr, 0, sizeof(addr));
+	if(address_family != AF_INET6 && inet_pton(AF_INET, arg, &addr.sin.sin_addr) == 1) {
 		/* don't add all ip's if we were given a specific one */
-		return add_target_ip(arg, &ip);
-		/* he = gethostbyaddr((char *)in, sizeof(struct in_addr), AF_INET); */
-		/* if(!he) return add_target_ip(arg, in); */
+		addr.sin.sin_family = AF_INET;
+		if(add_target_ip(name, &addr) < 0)
+			return add_target_failed(name, "Invalid address");
+		return 0;
 	}
-	else {
-		errno = 0;
-		he = gethostbyname(arg);
-		if(!he) {
-			errno = 0;
-			crash("Failed to resolve %s", arg);
-			return -1;
-		}
+#ifdef USE_IPV6
+	if(address_family != AF_INET && inet_pton(AF_INET6, arg, &addr.sin6.sin6_addr) == 1) {
+		addr.sin6.sin6_family = AF_INET6;
+		if(add_target_ip(name, &addr) < 0)
+			return add_target_failed(name, "Invalid address");
+		return 0;
 	}
+#endif
 
-	/* possibly add all the IP's as targets */
-	for(i = 0; he->h_addr_list[i]; i++) {
-		in = (struct in_addr *)he->h_addr_list[i];
-		add_target_ip(arg, in);
+	/* one result per address */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	errno = 0;
+	if(getaddrinfo(arg, NULL, &hints, &res)) {
+		if(output_format != OUTPUT_SUMMARY)
+			return add_target_failed(name, "Failed to resolve host");
+		errno = 0;
+		crash("Failed to resolve %s", arg);
+		return -1;
+	}
 
-		/* this is silly, but it works */
-		if(mode == MODE_HOSTCHECK || mode == MODE_ALL) {
-			printf("mode: %d\n", mode);
+	/* possibly add all the IP's as targets. Otherwise a name with
+	 * addresses of both families is pinged over IPv4, as it always
+	 * was, unless -6 says not to */
+	for(ai = res; ai; ai = ai->ai_next) {
+		if(mode != MODE_HOSTCHECK && mode != MODE_ALL && ai->ai_family != AF_INET)
 			continue;
-		}
-		break;
+		if(ai->ai_addrlen > sizeof(addr)) continue;
+		memset(&addr, 0, sizeof(addr));
+		memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+		if(add_target_ip(name, &addr) >= 0) added++;
+		if(mode != MODE_HOSTCHECK && mode != MODE_ALL) break;
+	}
+	if(!ai && mode != MODE_HOSTCHECK && mode != MODE_ALL &&
+	   res->ai_addrlen <= sizeof(addr))
+	{
+		/* no IPv4 address, so the first of the others */
+		memset(&addr, 0, sizeof(addr));
+		memcpy(&addr, res->ai_addr, res->ai_addrlen);
+		if(add_target_ip(name, &addr) >= 0) added++;
 	}
+	freeaddrinfo(res);
 
+	if(!added) return add_target_failed(name, "No usable address");
 	return 0;
 }
+
+/* reads targets from file, "-" for stdin, one per line as "address" or
+ * "address name", where name is what results are reported for. Empty
+ * lines and lines starting with # are skipped */
+static void
+add_targets_from_file(const char *file)
+{
+	FILE *fp;
+	char line[1024], *addr, *name;
+
+	if(!strcmp(file, "-")) fp = stdin;
+	else if(!(fp = fopen(file, "r"))) crash("Failed to open %s", file);
+
+	while(fgets(line, sizeof(line), fp)) {
+		addr = strtok(line, " \t\r\n");
+		if(!addr || *addr == '#') continue;
+		name = strtok(NULL, " \t\r\n");
+		add_target(addr, name);
+	}
+
+	if(fp != stdin) fclose(fp);
+}
+
+/* prints the result for one target, as a plugin output line or as a
+ * passive host check result for the Nagios command file */
+static void
+print_host_result(const char *name, int state, const char *text)
+{
+	char *status_string[] =
+	{"OK", "WARNING", "CRITICAL", "UNKNOWN", "DEPENDENT"};
+
+	if(output_format == OUTPUT_PASSIVE) {
+		/* host states are 0 (UP) and 1 (DOWN), not plugin states */
+		printf("[%lu] PROCESS_HOST_CHECK_RESULT;%s;%d;%s - %s\n",
+			   (unsigned long)time(NULL), name,
+			   (state == STATE_OK || state == STATE_WARNING) ? 0 : 1,
+			   status_string[state], text);
+	}
+	else {
+		printf("%s: %s - %s\n", name, status_string[state], text);
+	}
+}
+
 /*
  * u = micro
  * m = milli
@@ -1187,6 +1948,30 @@ get_threshold(char *str, threshold *th)
 	return 0;
 }
 
+/* parses "warn,crit" for the jitter (opt J) or MOS (opt M) thresholds.
+ * A single value is used for both */
+static void
+get_jitter_mos_thresholds(char *str, int opt)
+{
+	char *p;
+
+	if((p = strchr(str, ','))) *p++ = '\0';
+	else p = str;
+
+	if(opt == 'J') {
+		warn.jitter = get_timevar(str);
+		crit.jitter = get_timevar(p);
+	}
+	else {
+		warn.mos = strtod(str, NULL);
+		crit.mos = strtod(p, NULL);
+		if(warn.mos < 1 || warn.mos > 5 || crit.mos < 1 || crit.mos > 5) {
+			errno = 0;
+			crash("MOS thresholds must be between 1 and 5");
+		}
+	}
+}
+
 unsigned short
 icmp_checksum(unsigned short *p, int n)
 {
@@ -1231,6 +2016,10 @@ print_help(void)
   printf (" %s\n", "-c");
   printf ("    %s", _("critical threshold (currently "));
   printf ("%0.3fms,%u%%)\n", (float)crit.rta, crit.pl);
+  printf (" %s\n", "-J");
+  printf ("    %s\n", _("jitter thresholds, warn,crit (not checked by default)"));
+  printf (" %s\n", "-M");
+  printf ("    %s\n", _("minimum MOS thresholds, warn,crit (not checked by default)"));
   printf (" %s\n", "-n");
   printf ("    %s", _("number of packets to send (currently "));
   printf ("%u)\n",packets);
@@ -1249,6 +2038,17 @@ print_help(void)
   printf (" %s\n", "-t");
   printf ("    %s",_("timeout value (seconds, currently  "));
   printf ("%u)\n", timeout);
+  printf (" %s\n", "-f");
+  printf ("    %s\n", _("read targets from a file (- for stdin), one \"address [name]\" per line"));
+  printf (" %s\n", "-o");
+  printf ("    %s\n", _("print a result line for each target instead of one summary"));
+  printf (" %s\n", "-P");
+  printf ("    %s\n", _("print a PROCESS_HOST_CHECK_RESULT line for the Nagios command file"));
+  printf ("    %s\n", _("for each target (implies -o)"));
+  printf (" %s\n", "-4");
+  printf ("    %s\n", _("only ping IPv4 addresses of named targets"));
+  printf (" %s\n", "-6");
+  printf ("    %s\n", _("only ping IPv6 addresses of named targets"));
   printf (" %s\n", "-b");
   printf ("    %s\n", _("icmp packet size (currenly ignored)"));
   printf (" %s\n", "-v");
@@ -1256,10 +2056,20 @@ print_help(void)
 
   printf ("\n");
 	printf ("%s\n\n", _("The -H switch is optional. Naming a host (or several) to check is not."));
+  printf ("%s\n", _("With -o or -P, thousands of hosts can be checked from one process, e.g. every"));
+  printf ("%s\n", _("minute from cron with -f hosts.txt -P >> nagios.cmd. The exit code is then the"));
+  printf ("%s\n", _("worst state of all targets, and -i is the time between rounds of packets."));
+  printf ("%s\n\n", _("Names that fail to resolve get an UNKNOWN result instead of stopping the check."));
+  printf ("%s\n", _("IPv6 targets are pinged with ICMPv6, in the same run as IPv4 ones. A name with"));
+  printf ("%s\n\n", _("addresses of both kinds is pinged over IPv4 unless -6 is given."));
   printf ("%s\n", _("Threshold format for -w and -c is 200.25,60% for 200.25 msec RTA and 60%"));
   printf ("%s\n", _("packet loss.  The default values should work well for most users."));
   printf ("%s\n", _("You can specify different RTA factors using the standardized abbreviations"));
   printf ("%s\n\n", _("us (microseconds), ms (milliseconds, default) or just plain s for seconds."));
+  printf ("%s\n", _("Jitter is the mean difference in RTT between one packet and the next, and"));
+  printf ("%s\n", _("takes the same units, e.g. -J 20,40. The MOS is estimated from RTA, jitter"));
+  printf ("%s\n", _("and packet loss with the E-model, from 1 (bad) to 4.4 (best), e.g. -M 3.6,3.1."));
+  printf ("%s\n\n", _("Min, max and 95th percentile RTT, jitter and MOS are always in the perfdata."));
 /* -d not yet implemented */
 /*  printf ("%s\n", _("Threshold format for -d is warn,crit.  12,14 means WARNING if >= 12 hops"));
   printf ("%s\n", _("are spent and CRITICAL if >= 14 hops are spent."));
@@ -1281,4 +2091,5 @@ print_usage (void)
 {
   printf (_("Usage:"));
   printf(" %s [options] [-H] host1 host2 hostn\n", progname);
+  printf(" %s [options] [-o|-P] -f targets_file\n", progname);
 }
@@ -57,6 +57,9 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 # include <limits.h>
 #endif
 #include "regex.h"
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 
 /* If nonzero, show inode information. */
@@ -113,9 +116,60 @@ enum
 {
   SYNC_OPTION = CHAR_MAX + 1,
   NO_SYNC_OPTION,
-  BLOCK_SIZE_OPTION
+  BLOCK_SIZE_OPTION,
+  MOUNT_TIMEOUT_STATE
+};
+
+/* What the main loop needs from a selected path */
+enum
+{
+  PATH_SKIP,
+  PATH_STAT,
+  PATH_USAGE
+};
+
+/* Seconds each filesystem gets to answer stat/statvfs; 0 means timeout_interval */
+static int mount_timeout = 0;
+
+/* State reported for filesystems that do not answer within mount_timeout */
+static int mount_timeout_state = STATE_CRITICAL;
+
+#ifdef HAVE_PTHREAD
+/* Filesystems are statted by a pool of worker threads so that a hung
+   (typically NFS) mount only holds up its own result. A worker that is
+   still busy past its deadline is abandoned and a fresh one is started
+   in its place; the stuck thread goes away with the process. */
+#define DISK_WORKERS 8
+
+enum
+{
+  JOB_QUEUED,
+  JOB_RUNNING,
+  JOB_DONE,
+  JOB_ABANDONED
+};
+
+struct mount_job
+{
+  struct parameter_list *path;
+  char *mountdir;
+  char *devname;
+  int action;
+  int state;
+  int stat_errno;
+  struct fs_usage fsu;
+  struct timeval deadline;
 };
 
+static struct mount_job *jobs = NULL;
+static int job_count = 0;
+static int job_next = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+void start_mount_jobs (void);
+#endif
+
 #ifdef _AIX
  #pragma alloca
 #endif
@@ -131,6 +185,8 @@ void print_help (void);
 void print_usage (void);
 double calculate_percent(uintmax_t, uintmax_t);
 void stat_path (struct parameter_list *p);
+int path_action (struct parameter_list *p);
+int mount_usage (struct parameter_list *p, int action, struct fs_usage *fsp);
 
 double w_dfp = -1.0;
 double c_dfp = -1.0;
@@ -176,6 +232,7 @@ main (int argc, char **argv)
   double warning_high_tide;
   double critical_high_tide;
   int temp_result;
+  int stuck_mounts = 0;
 
   struct mount_entry *me;
   struct fs_usage fsp, tmpfsp;
@@ -222,7 +279,14 @@ main (int argc, char **argv)
 
     temp_list = temp_list->name_next;
   }
-  
+
+  if (mount_timeout == 0)
+    mount_timeout = timeout_interval;
+
+#ifdef HAVE_PTHREAD
+  start_mount_jobs ();
+#endif
+
   /* Process for every path in list */
   for (path = path_select_list; path; path=path->name_next) {
 
@@ -242,6 +306,11 @@ main (int argc, char **argv)
 
     /* Remove filesystems already seen */
     if (np_seen_name(seen, me->me_mountdir)) {
+      /* the filesystem has been reported, but the path itself must still be accessible */
+      if (path_action (path) != PATH_SKIP && mount_usage (path, PATH_STAT, &tmpfsp) != OK) {
+        stuck_mounts++;
+        asprintf (&output, _("%s %s timed out after %ds;"), output, path->name, mount_timeout);
+      }
       continue;
     } else {
       if (path->group != NULL) {
@@ -257,8 +326,12 @@ main (int argc, char **argv)
         for (temp_list = path_select_list; temp_list; temp_list=temp_list->name_next) {
           if (temp_list->group && ! (strcmp(temp_list->group, path->group))) {
             
-            stat_path(path);
-            get_fs_usage (temp_list->best_match->me_mountdir, temp_list->best_match->me_devname, &tmpfsp);
+            if (mount_usage (temp_list, PATH_USAGE, &tmpfsp) != OK) {
+              stuck_mounts++;
+              asprintf (&output, _("%s %s timed out after %ds;"), output, temp_list->name, mount_timeout);
+              np_add_name(&seen, temp_list->best_match->me_mountdir);
+              continue;
+            }
 
             /* possibly differing blocksizes if disks are grouped. Calculating average */
             fsp.fsu_blocksize = (fsp.fsu_blocksize * fsp.fsu_blocks + tmpfsp.fsu_blocksize * tmpfsp.fsu_blocks) / \
@@ -283,26 +356,20 @@ main (int argc, char **argv)
     }
 
     if (path->group == NULL) {
-      /* Skip remote filesystems if we're not interested in them */
-      if (me->me_remote && show_local_fs) {
-        if (stat_remote_fs)
-          stat_path(path);
-        continue;
-      /* Skip pseudo fs's if we haven't asked for all fs's */
-      } else if (me->me_dummy && !show_all_fs) {
+      temp_result = path_action (path);
+      if (temp_result == PATH_SKIP)
         continue;
-      /* Skip excluded fstypes */
-      } else if (fs_exclude_list && np_find_name (fs_exclude_list, me->me_type)) {
-        continue;
-      /* Skip excluded fs's */  
-      } else if (dp_exclude_list && 
-               (np_find_name (dp_exclude_list, me->me_devname) ||
-                np_find_name (dp_exclude_list, me->me_mountdir))) {
+
+      if (mount_usage (path, temp_result, &fsp) != OK) {
+        stuck_mounts++;
+        asprintf (&output, _("%s %s timed out after %ds;"), output,
+                  display_mntp ? me->me_devname : me->me_mountdir, mount_timeout);
         continue;
       }
 
-      stat_path(path);
-      get_fs_usage (me->me_mountdir, me->me_devname, &fsp);
+      /* Remote filesystems are only statted with -L */
+      if (temp_result == PATH_STAT)
+        continue;
     }
 
     if (fsp.fsu_blocks && strcmp ("none", me->me_mountdir)) {
@@ -421,6 +488,10 @@ main (int argc, char **argv)
   if (verbose > 2)
     asprintf (&output, "%s%s", output, details);
 
+  /* max_state would let an OK filesystem hide an UNKNOWN timeout */
+  if (stuck_mounts)
+    result = max_state_alt (result, mount_timeout_state);
+
 
   printf ("DISK %s%s%s|%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, output, perf);
   return result;
@@ -470,6 +541,8 @@ process_arguments (int argc, char **argv)
   int option = 0;
   static struct option longopts[] = {
     {"timeout", required_argument, 0, 't'},
+    {"mount-timeout", required_argument, 0, 'T'},
+    {"mount-timeout-state", required_argument, 0, MOUNT_TIMEOUT_STATE},
     {"warning", required_argument, 0, 'w'},
     {"critical", required_argument, 0, 'c'},
     {"iwarning", required_argument, 0, 'W'},
@@ -515,7 +588,7 @@ process_arguments (int argc, char **argv)
       strcpy (argv[c], "-t");
 
   while (1) {
-    c = getopt_long (argc, argv, "+?VqhveCt:c:w:K:W:u:p:x:X:mklLg:R:r:i:I:MEA", longopts, &option);
+    c = getopt_long (argc, argv, "+?VqhveCt:T:c:w:K:W:u:p:x:X:mklLg:R:r:i:I:MEA", longopts, &option);
 
     if (c == -1 || c == EOF)
       break;
@@ -530,6 +603,20 @@ process_arguments (int argc, char **argv)
         usage2 (_("Timeout interval must be a positive integer"), optarg);
       }
 
+    case 'T':                 /* per filesystem timeout */
+      if (!is_intpos (optarg))
+        usage2 (_("Mount timeout must be a positive integer"), optarg);
+      mount_timeout = atoi (optarg);
+      break;
+    case MOUNT_TIMEOUT_STATE:
+      if (!strcasecmp (optarg, "unknown"))
+        mount_timeout_state = STATE_UNKNOWN;
+      else if (!strcasecmp (optarg, "critical"))
+        mount_timeout_state = STATE_CRITICAL;
+      else
+        usage4 (_("Mount timeout state must be one of unknown, critical"));
+      break;
+
     /* See comments for 'c' */
     case 'w':                 /* warning threshold */
       if (strstr(optarg, "%")) {
@@ -637,8 +724,7 @@ process_arguments (int argc, char **argv)
       }
       se->group = group;
       set_all_thresholds(se);
-      np_set_best_match(se, mount_list, exact_match);
-      stat_path(se);
+      /* best matches are looked up for all paths at once, see below */
       path_selected = TRUE;
       break;
     case 'x':                 /* exclude path or partition */
@@ -678,6 +764,7 @@ process_arguments (int argc, char **argv)
         die (STATE_UNKNOWN, "DISK %s: %s - %s\n",_("UNKNOWN"), _("Could not compile regular expression"), errbuf);
       }
 
+      np_set_best_match(path_select_list, mount_list, exact_match);
       temp_list = path_select_list;
 
       previous = NULL;
@@ -945,6 +1032,11 @@ print_help (void)
   printf (" %s\n", "-i, --ignore-ereg-path=PATH, --ignore-ereg-partition=PARTITION");
   printf ("    %s\n", _("Regular expression to ignore selected path or partition (may be repeated)"));
   printf (_(UT_TIMEOUT), DEFAULT_SOCKET_TIMEOUT);
+  printf (" %s\n", "-T, --mount-timeout=INTEGER");
+  printf ("    %s\n", _("Seconds to wait for each filesystem to answer (default: the --timeout value)"));
+  printf ("    %s\n", _("Filesystems are checked in parallel, so one hung mount does not hold up the others"));
+  printf (" %s\n", "--mount-timeout-state=STATE");
+  printf ("    %s\n", _("Status for filesystems that do not answer in time: unknown or critical (default: critical)"));
   printf (" %s\n", "-u, --units=STRING");
   printf ("    %s\n", _("Choose bytes, kB, MB, GB, TB (default: MB)"));
   printf (_(UT_VERBOSE));
@@ -970,7 +1062,7 @@ print_usage (void)
   printf (_("Usage:"));
   printf (" %s -w limit -c limit [-W limit] [-K limit] {-p path | -x device}\n", progname);
   printf ("[-C] [-E] [-e] [-g group ] [-k] [-l] [-M] [-m] [-R path ] [-r path ]\n");
-  printf ("[-t timeout] [-u unit] [-v] [-X type]\n");
+  printf ("[-t timeout] [-T mount timeout] [-u unit] [-v] [-X type]\n");
 }
 
 void
@@ -986,3 +1078,193 @@ stat_path (struct parameter_list *p)
     die (STATE_CRITICAL, _("%s %s: %s\n"), p->name, _("is not accessible"), strerror(errno));
   }
 }
+
+/* Decide whether the main loop skips a path, only stats it or also needs its usage */
+int
+path_action (struct parameter_list *p)
+{
+  struct mount_entry *me = p->best_match;
+
+  if (p->group != NULL)
+    return PATH_USAGE;
+
+  /* Skip remote filesystems if we're not interested in them */
+  if (me->me_remote && show_local_fs)
+    return stat_remote_fs ? PATH_STAT : PATH_SKIP;
+  /* Skip pseudo fs's if we haven't asked for all fs's */
+  if (me->me_dummy && !show_all_fs)
+    return PATH_SKIP;
+  /* Skip excluded fstypes */
+  if (fs_exclude_list && np_find_name (fs_exclude_list, me->me_type))
+    return PATH_SKIP;
+  /* Skip excluded fs's */
+  if (dp_exclude_list &&
+      (np_find_name (dp_exclude_list, me->me_devname) ||
+       np_find_name (dp_exclude_list, me->me_mountdir)))
+    return PATH_SKIP;
+
+  return PATH_USAGE;
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+mount_worker (void *arg)
+{
+  struct mount_job *job;
+  struct fs_usage fsu;
+  struct timeval now;
+  int stat_errno;
+  struct stat sb;
+
+  for (;;) {
+    pthread_mutex_lock (&job_lock);
+    if (job_next >= job_count) {
+      pthread_mutex_unlock (&job_lock);
+      return NULL;
+    }
+    job = &jobs[job_next++];
+    gettimeofday (&now, NULL);
+    job->deadline.tv_sec = now.tv_sec + mount_timeout;
+    job->deadline.tv_usec = now.tv_usec;
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock (&job_lock);
+
+    memset (&fsu, 0, sizeof fsu);
+    stat_errno = 0;
+    if (stat (job->path->name, &sb))
+      stat_errno = errno;
+    else if (job->action == PATH_USAGE)
+      get_fs_usage (job->mountdir, job->devname, &fsu);
+
+    pthread_mutex_lock (&job_lock);
+    if (job->state == JOB_ABANDONED) {
+      /* someone else has taken over this worker's slot */
+      pthread_mutex_unlock (&job_lock);
+      return NULL;
+    }
+    job->stat_errno = stat_errno;
+    job->fsu = fsu;
+    job->state = JOB_DONE;
+    pthread_cond_broadcast (&job_done);
+    pthread_mutex_unlock (&job_lock);
+  }
+}
+
+static void
+start_mount_worker (void)
+{
+  pthread_t tid;
+  pthread_attr_t attr;
+  int err;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  if ((err = pthread_create (&tid, &attr, mount_worker, NULL)) != 0 && verbose > 3)
+    printf ("could not start filesystem worker: %s\n", strerror (err));
+  pthread_attr_destroy (&attr);
+}
+
+/* Queue every path the main loop will look at and start the workers */
+void
+start_mount_jobs (void)
+{
+  struct parameter_list *p;
+  int action, i;
+
+  for (p = path_select_list; p; p = p->name_next)
+    job_count++;
+  jobs = calloc (job_count, sizeof *jobs);
+  if (job_count && jobs == NULL)
+    die (STATE_UNKNOWN, _("failed allocating storage for '%s'\n"), "jobs");
+
+  job_count = 0;
+  for (p = path_select_list; p; p = p->name_next) {
+    if ((action = path_action (p)) == PATH_SKIP)
+      continue;
+    jobs[job_count].path = p;
+    jobs[job_count].mountdir = p->best_match->me_mountdir;
+    jobs[job_count].devname = p->best_match->me_devname;
+    jobs[job_count].action = action;
+    jobs[job_count].state = JOB_QUEUED;
+    job_count++;
+  }
+
+  for (i = 0; i < job_count && i < DISK_WORKERS; i++)
+    start_mount_worker ();
+}
+
+/* Abandon running jobs past their deadline, replacing their worker, and
+   return the earliest deadline still pending in *next. Called locked. */
+static void
+reap_mount_jobs (struct timespec *next)
+{
+  struct timeval now;
+  int i;
+
+  gettimeofday (&now, NULL);
+  next->tv_sec = now.tv_sec + 1;
+  next->tv_nsec = now.tv_usec * 1000;
+
+  for (i = 0; i < job_count; i++) {
+    if (jobs[i].state != JOB_RUNNING)
+      continue;
+    if (timercmp (&jobs[i].deadline, &now, <=)) {
+      if (verbose > 3)
+        printf ("%s did not answer within %ds\n", jobs[i].path->name, mount_timeout);
+      jobs[i].state = JOB_ABANDONED;
+      start_mount_worker ();
+    } else if (jobs[i].deadline.tv_sec < next->tv_sec ||
+               (jobs[i].deadline.tv_sec == next->tv_sec &&
+                jobs[i].deadline.tv_usec * 1000 < next->tv_nsec)) {
+      next->tv_sec = jobs[i].deadline.tv_sec;
+      next->tv_nsec = jobs[i].deadline.tv_usec * 1000;
+    }
+  }
+}
+#endif
+
+/* Stat the path and, for PATH_USAGE, fetch its filesystem usage.
+   Returns ERROR if the filesystem did not answer within mount_timeout. */
+int
+mount_usage (struct parameter_list *p, int action, struct fs_usage *fsp)
+{
+#ifdef HAVE_PTHREAD
+  struct mount_job *job = NULL;
+  struct timespec next;
+  int i;
+
+  for (i = 0; i < job_count; i++) {
+    if (jobs[i].path == p) {
+      job = &jobs[i];
+      break;
+    }
+  }
+
+  if (job != NULL) {
+    pthread_mutex_lock (&job_lock);
+    while (job->state != JOB_DONE && job->state != JOB_ABANDONED) {
+      reap_mount_jobs (&next);
+      if (job->state == JOB_ABANDONED)
+        break;
+      pthread_cond_timedwait (&job_done, &job_lock, &next);
+    }
+    pthread_mutex_unlock (&job_lock);
+
+    if (job->state == JOB_ABANDONED)
+      return ERROR;
+    if (job->stat_errno) {
+      printf("DISK %s - ", _("CRITICAL"));
+      die (STATE_CRITICAL, _("%s %s: %s\n"), p->name, _("is not accessible"), strerror(job->stat_errno));
+    }
+    *fsp = job->fsu;
+    return OK;
+  }
+#endif
+
+  stat_path (p);
+  if (action == PATH_USAGE) {
+    memset (fsp, 0, sizeof *fsp);
+    get_fs_usage (p->best_match->me_mountdir, p->best_match->me_devname, fsp);
+  }
+  return OK;
+}
@@ -50,9 +50,51 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "utils.h"
 #include "base64.h"
 
+#include <stdarg.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #define INPUT_DELIMITER ";"
 
 #define HTTP_EXPECT "HTTP/1."
+
+/* The response read so far, NUL-terminated.  When the body is streamed
+   through the -s/-r matcher, only the headers and a small window of the
+   body are kept in DATA, and SIZE keeps counting every byte received. */
+typedef struct page_buffer {
+  char *data;
+  size_t len;       /* bytes held in data */
+  size_t alloc;
+  size_t size;      /* bytes received */
+  size_t body;      /* offset of the body, 0 until the headers are complete */
+  size_t body_len;  /* body bytes received, after chunked decoding */
+  long content_length;  /* -1 if the body is delimited otherwise */
+  int chunk_state;  /* CHUNK_NONE unless the body is chunked */
+  size_t chunk_left;
+  char chunk_line[64];  /* partial chunk size or trailer line */
+  size_t chunk_line_len;
+  int complete;     /* TRUE once the whole framed response has been read */
+  int keep_alive;   /* TRUE if the server leaves the connection open */
+  int streamed;     /* TRUE if the body went through page_scan() */
+  int matched;      /* TRUE once the streamed body matched -s or -r */
+  size_t line_scanned;  /* bytes of the partial line known to hold no newline */
+  int match_error;  /* regexec() error code, 0 if none */
+} page_buffer;
+
+enum {
+  CHUNK_NONE,
+  CHUNK_SIZE,
+  CHUNK_DATA,
+  CHUNK_DATA_END,
+  CHUNK_TRAILER,
+  CHUNK_DONE
+};
+
 enum {
   MAX_IPV4_HOSTLENGTH = 255,
   HTTP_PORT = 80,
@@ -123,10 +165,20 @@ int max_depth = 15;
 char *http_method;
 char *http_post_data;
 char *http_content_type;
-char buffer[MAX_INPUT_BUFFER];
+long max_body_size = -1;
+int keep_alive = FALSE;
+int conn_open = FALSE;
+char *conn_address;
+int conn_port;
+int conn_ssl;
+char *batch_file = NULL;
+char *ssl_session_cache = NULL;
+int batch_concurrency = 100;
 
 int process_arguments (int, char **);
 int check_http (void);
+static int check_response (page_buffer *, int, double, char **, char **, char **);
+int check_batch (void);
 void redir (char *pos, char *status_line);
 int server_type_check(const char *type);
 int server_port_check(int ssl_flag);
@@ -153,11 +205,19 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  /* each target of a batch keeps its own deadline, see check_batch() */
+  if (batch_file)
+    return check_batch ();
+
   if (display_html == TRUE)
     printf ("<A HREF=\"%s://%s:%d%s\" target=\"_blank\">", 
       use_ssl ? "https" : "http", host_name ? host_name : server_address,
       server_port, server_url);
 
+  /* a kept-alive connection may have been closed by the time we reuse it */
+  if (keep_alive)
+    signal (SIGPIPE, SIG_IGN);
+
   /* initialize alarm signal handling, set socket timeout, start timer */
   (void) signal (SIGALRM, socket_timeout_alarm_handler);
   (void) alarm (socket_timeout);
@@ -176,7 +236,12 @@ process_arguments (int argc, char **argv)
   int c = 1;
 
   enum {
-    INVERT_REGEX = CHAR_MAX + 1
+    INVERT_REGEX = CHAR_MAX + 1,
+    MAX_BODY_SIZE,
+    KEEP_ALIVE,
+    BATCH_FILE,
+    BATCH_CONCURRENCY,
+    SSL_SESSION_CACHE
   };
 
   int option = 0;
@@ -205,6 +270,11 @@ process_arguments (int argc, char **argv)
     {"content-type", required_argument, 0, 'T'},
     {"pagesize", required_argument, 0, 'm'},
     {"invert-regex", no_argument, NULL, INVERT_REGEX},
+    {"max-body-size", required_argument, NULL, MAX_BODY_SIZE},
+    {"keep-alive", no_argument, NULL, KEEP_ALIVE},
+    {"batch", required_argument, NULL, BATCH_FILE},
+    {"batch-concurrency", required_argument, NULL, BATCH_CONCURRENCY},
+    {"ssl-session-cache", required_argument, NULL, SSL_SESSION_CACHE},
     {"use-ipv4", no_argument, 0, '4'},
     {"use-ipv6", no_argument, 0, '6'},
     {0, 0, 0, 0}
@@ -374,6 +444,29 @@ process_arguments (int argc, char **argv)
     case INVERT_REGEX:
       invert_regex = 1;
       break;
+    case MAX_BODY_SIZE:
+      if (!is_intnonneg (optarg))
+        usage2 (_("Maximum body size must be a non-negative integer"), optarg);
+      max_body_size = atol (optarg);
+      break;
+    case KEEP_ALIVE:
+      keep_alive = TRUE;
+      break;
+    case BATCH_FILE:
+      batch_file = optarg;
+      break;
+    case BATCH_CONCURRENCY:
+      if (!is_intpos (optarg))
+        usage2 (_("Batch concurrency must be a positive integer"), optarg);
+      batch_concurrency = atoi (optarg);
+      break;
+    case SSL_SESSION_CACHE:
+#ifdef HAVE_SSL
+      ssl_session_cache = optarg;
+#else
+      usage4 (_("Invalid option - SSL is not available"));
+#endif
+      break;
     case '4':
       address_family = AF_INET;
       break;
@@ -441,7 +534,15 @@ process_arguments (int argc, char **argv)
   if (host_name == NULL && c < argc)
     host_name = strdup (argv[c++]);
 
-  if (server_address == NULL) {
+  if (batch_file) {
+    if (onredirect == STATE_DEPENDENT)
+      usage4 (_("Redirects cannot be followed in batch mode"));
+#ifdef HAVE_SSL
+    if (check_cert == TRUE)
+      usage4 (_("Certificates cannot be checked in batch mode"));
+#endif
+  }
+  else if (server_address == NULL) {
     if (host_name == NULL)
       usage4 (_("You must specify a server address or host name"));
     else
@@ -459,22 +560,288 @@ process_arguments (int argc, char **argv)
 
 
 
-/* Returns 1 if we're done processing the document body; 0 to keep going */
-static int
-document_headers_done (char *full_page)
+/* Returns the offset of the document body in PAGE, or 0 if we haven't
+   read the end of the headers yet */
+static size_t
+document_body_offset (const char *page)
 {
   const char *body;
 
-  for (body = full_page; *body; body++) {
-    if (!strncmp (body, "\n\n", 2) || !strncmp (body, "\n\r\n", 3))
+  for (body = page; *body; body++) {
+    if (!strncmp (body, "\n\n", 2))
+      return body - page + 2;
+    if (!strncmp (body, "\n\r\n", 3))
+      return body - page + 3;
+  }
+  return 0;
+}
+
+/* Makes room for at least MAX_INPUT_BUFFER more bytes in PAGE.  The buffer
+   grows geometrically, so reading a page costs time linear in its size. */
+static void
+page_reserve (page_buffer *page)
+{
+  if (page->alloc - page->len > MAX_INPUT_BUFFER)
+    return;
+  page->alloc = page->alloc ? page->alloc * 2 : 4 * MAX_INPUT_BUFFER;
+  page->data = realloc (page->data, page->alloc);
+  if (page->data == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate page\n"));
+}
+
+/* Runs the -s or -r match over the part of the body held in PAGE and
+   discards what can no longer be part of a match.  A string can only
+   continue in its last strlen-1 bytes; a regex compiled with REG_NEWLINE
+   cannot match across lines, so only the last partial line is kept, whole
+   however long it gets, and matched once it ends.  If FINAL is set no more
+   data will follow.  Sets page->matched and returns it. */
+static int
+page_scan (page_buffer *page, int final)
+{
+  char *window = page->data + page->body;
+  size_t keep;
+  char *eol, *p;
+  char c;
+  int result;
+
+  if (page->matched || page->match_error)
+    return page->matched;
+
+  if (strlen (string_expect)) {
+    if (strstr (window, string_expect))
+      return page->matched = TRUE;
+    keep = min (strlen (string_expect) - 1, page->len - page->body);
+  }
+  else {
+    /* only look for a newline in what came since the last scan */
+    eol = NULL;
+    if (final)
+      eol = page->data + page->len - 1;
+    else
+      for (p = page->data + page->len; p > window + page->line_scanned; p--)
+        if (p[-1] == '\n') {
+          eol = p - 1;
+          break;
+        }
+    if (eol != NULL && eol >= window) {
+      c = eol[1];
+      eol[1] = 0;
+      result = regexec (&preg, window, REGS, pmatch, 0);
+      eol[1] = c;
+      if (result == 0)
+        return page->matched = TRUE;
+      if (result != REG_NOMATCH)
+        page->match_error = result;
+      keep = page->data + page->len - (eol + 1);
+    }
+    else
+      keep = page->len - page->body;
+  }
+
+  memmove (window, page->data + page->len - keep, keep);
+  page->len = page->body + keep;
+  page->data[page->len] = 0;
+  page->line_scanned = keep;
+  return FALSE;
+}
+
+/* Returns the value of header FIELD if the line at S is that header */
+static const char *
+header_value (const char *s, const char *field)
+{
+  size_t n = strlen (field);
+
+  if (strncasecmp (s, field, n) || s[n] != ':')
+    return NULL;
+  for (s += n + 1; *s == ' ' || *s == '\t'; s++)
+    ;
+  return s;
+}
+
+/* Finds how the body following the headers in PAGE is delimited, and
+   whether the server keeps the connection open afterwards */
+static void
+page_parse_headers (page_buffer *page)
+{
+  const char *s = page->data;
+  const char *end = page->data + page->body;
+  const char *value;
+  int status = 0;
+  int http11;
+
+  http11 = !strncmp (s, "HTTP/1.1", 8);
+  if (strlen (s) > 9)
+    status = atoi (s + 9);
+  page->keep_alive = http11;
+  page->content_length = -1;
+
+  for (s += strcspn (s, "\n") + 1; s < end; s += strcspn (s, "\n") + 1) {
+    if ((value = header_value (s, "Content-Length")))
+      page->content_length = atol (value);
+    else if ((value = header_value (s, "Transfer-Encoding")) &&
+             !strncasecmp (value, "chunked", 7))
+      page->chunk_state = CHUNK_SIZE;
+    else if ((value = header_value (s, "Connection"))) {
+      if (!strncasecmp (value, "close", 5))
+        page->keep_alive = FALSE;
+      else if (!strncasecmp (value, "keep-alive", 10))
+        page->keep_alive = TRUE;
+    }
+  }
+
+  if ((status >= 100 && status < 200) || status == 204 || status == 304)
+    page->content_length = 0;
+  if (page->chunk_state != CHUNK_NONE)
+    page->content_length = -1;
+  else if (page->content_length < 0)
+    page->keep_alive = FALSE;  /* the body ends when the connection does */
+  if (page->content_length == 0)
+    page->complete = TRUE;
+}
+
+/* Collects a line of the chunked coding from the N bytes at IN.  Returns
+   the number of bytes used, and sets *EOL once the line is complete. */
+static size_t
+chunk_line (page_buffer *page, const char *in, size_t n, int *eol)
+{
+  const char *nl = memchr (in, '\n', n);
+  size_t used = nl ? (size_t)(nl - in) + 1 : n;
+  size_t room = sizeof (page->chunk_line) - 1 - page->chunk_line_len;
+
+  /* chunk extensions are of no interest, so long lines are cut short */
+  memcpy (page->chunk_line + page->chunk_line_len, in, min (used, room));
+  page->chunk_line_len += min (used, room);
+  page->chunk_line[page->chunk_line_len] = 0;
+  *eol = (nl != NULL);
+  return used;
+}
+
+/* Decodes the N chunked bytes at the end of PAGE in place, leaving the
+   chunk data appended to the body */
+static void
+page_dechunk (page_buffer *page, size_t n)
+{
+  char *in = page->data + page->len;
+  char *out = in;
+  size_t used;
+  int eol;
+
+  while (n > 0) {
+    switch (page->chunk_state) {
+    case CHUNK_SIZE:
+    case CHUNK_TRAILER:
+      used = chunk_line (page, in, n, &eol);
+      in += used;
+      n -= used;
+      if (!eol)
+        break;
+      if (page->chunk_state == CHUNK_SIZE) {
+        page->chunk_left = strtoul (page->chunk_line, NULL, 16);
+        page->chunk_state = page->chunk_left ? CHUNK_DATA : CHUNK_TRAILER;
+      }
+      else if (page->chunk_line[strspn (page->chunk_line, "\r\n")] == 0) {
+        page->chunk_state = CHUNK_DONE;
+        page->complete = TRUE;
+      }
+      page->chunk_line_len = 0;
+      break;
+    case CHUNK_DATA:
+      used = min (n, page->chunk_left);
+      memmove (out, in, used);
+      out += used;
+      in += used;
+      n -= used;
+      if ((page->chunk_left -= used) == 0)
+        page->chunk_state = CHUNK_DATA_END;
+      break;
+    case CHUNK_DATA_END:
+      if (*in == '\n')
+        page->chunk_state = CHUNK_SIZE;
+      in++;
+      n--;
       break;
+    default:
+      /* nothing may follow the last chunk as we never pipeline requests */
+      page->keep_alive = FALSE;
+      n = 0;
+      break;
+    }
+  }
+
+  page->body_len += out - (page->data + page->len);
+  page->len = out - page->data;
+  page->data[page->len] = 0;
+}
+
+/* Accounts for N bytes just read to the end of PAGE.  Returns 1 if we're
+   done reading the document; 0 to keep going */
+static int
+page_received (page_buffer *page, size_t n)
+{
+  size_t excess;
+  int done = 0;
+
+  page->size += n;
+
+  if (page->body == 0) {
+    page->len += n;
+    page->data[page->len] = 0;
+    page->body = document_body_offset (page->data);
+    if (page->body == 0)
+      return 0;
+    page_parse_headers (page);
+    /* a regex that may span lines needs the whole body at once */
+    page->streamed = !no_body &&
+      (strlen (string_expect) || (strlen (regexp) && (cflags & REG_NEWLINE)));
+    /* what followed the headers is the start of the body */
+    n = page->len - page->body;
+    page->len = page->body;
+  }
+
+  if (no_body) {
+    page->data[page->body - 1] = 0;
+    return 1;
+  }
+
+  if (page->chunk_state != CHUNK_NONE)
+    page_dechunk (page, n);
+  else {
+    if (page->content_length >= 0 &&
+        page->body_len + n >= (size_t)page->content_length) {
+      if (page->body_len + n > (size_t)page->content_length)
+        page->keep_alive = FALSE;
+      n = page->content_length - page->body_len;
+      page->complete = TRUE;
+    }
+    page->len += n;
+    page->body_len += n;
+    page->data[page->len] = 0;
+  }
+
+  if (max_body_size >= 0 && page->body_len >= (size_t)max_body_size) {
+    if (verbose)
+      printf (_("Body size limit of %ld bytes reached, truncating\n"), max_body_size);
+    excess = page->body_len - max_body_size;
+    page->len -= excess;
+    page->size -= excess;
+    page->body_len = max_body_size;
+    page->data[page->len] = 0;
+    page->complete = FALSE;  /* the rest of the body is left unread */
+    done = 1;
   }
 
-  if (!*body)
-    return 0;  /* haven't read end of headers yet */
+  /* no need to read on once the outcome of the match is known */
+  if (page->streamed && (page_scan (page, done || page->complete) || page->match_error))
+    return 1;
+  return done || page->complete;
+}
 
-  full_page[body - full_page] = 0;
-  return 1;
+/* Called once no more data will be read */
+static void
+page_complete (page_buffer *page)
+{
+  if (page->streamed)
+    page_scan (page, TRUE);
 }
 
 static time_t
@@ -570,12 +937,13 @@ parse_time_string (const char *string)
 
 
 
-static void
-check_document_dates (const char *headers)
+static int
+check_document_dates (const char *headers, char **msg)
 {
   const char *s;
   char *server_date = 0;
   char *document_date = 0;
+  int result = STATE_OK;
 
   s = headers;
   while (*s) {
@@ -626,34 +994,41 @@ check_document_dates (const char *headers)
 
   /* Done parsing the body.  Now check the dates we (hopefully) parsed.  */
   if (!server_date || !*server_date) {
-    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Server date unknown\n"));
+    asprintf (msg, _("HTTP UNKNOWN - Server date unknown\n"));
+    result = STATE_UNKNOWN;
   } else if (!document_date || !*document_date) {
-    die (STATE_CRITICAL, _("HTTP CRITICAL - Document modification date unknown\n"));
+    asprintf (msg, _("HTTP CRITICAL - Document modification date unknown\n"));
+    result = STATE_CRITICAL;
   } else {
     time_t srv_data = parse_time_string (server_date);
     time_t doc_data = parse_time_string (document_date);
 
     if (srv_data <= 0) {
-      die (STATE_CRITICAL, _("HTTP CRITICAL - Server date \"%100s\" unparsable"), server_date);
+      asprintf (msg, _("HTTP CRITICAL - Server date \"%100s\" unparsable"), server_date);
+      result = STATE_CRITICAL;
     } else if (doc_data <= 0) {
-      die (STATE_CRITICAL, _("HTTP CRITICAL - Document date \"%100s\" unparsable"), document_date);
+      asprintf (msg, _("HTTP CRITICAL - Document date \"%100s\" unparsable"), document_date);
+      result = STATE_CRITICAL;
     } else if (doc_data > srv_data + 30) {
-      die (STATE_CRITICAL, _("HTTP CRITICAL - Document is %d seconds in the future\n"), (int)doc_data - (int)srv_data);
+      asprintf (msg, _("HTTP CRITICAL - Document is %d seconds in the future\n"), (int)doc_data - (int)srv_data);
+      result = STATE_CRITICAL;
     } else if (doc_data < srv_data - maximum_age) {
     int n = (srv_data - doc_data);
     if (n > (60 * 60 * 24 * 2))
-      die (STATE_CRITICAL,
+      asprintf (msg,
         _("HTTP CRITICAL - Last modified %.1f days ago\n"),
         ((float) n) / (60 * 60 * 24));
   else
-    die (STATE_CRITICAL,
+    asprintf (msg,
         _("HTTP CRITICAL - Last modified %d:%02d:%02d ago\n"),
         n / (60 * 60), (n / 60) % 60, n % 60);
+      result = STATE_CRITICAL;
     }
-
-    free (server_date);
-    free (document_date);
   }
+
+  free (server_date);
+  free (document_date);
+  return result;
 }
 
 int
@@ -706,63 +1081,42 @@ get_content_length (const char *headers)
   return (content_length);
 }
 
-int
-check_http (void)
+/* Builds the request sent for URL, with the Host header set to VHOST if
+   that is not NULL.  The result is malloc'd. */
+static char *
+http_request (const char *url, const char *vhost)
 {
-  char *msg;
-  char *status_line;
-  char *status_code;
-  char *header;
-  char *page;
-  char *auth;
-  int http_status;
-  int i = 0;
-  size_t pagesize = 0;
-  char *full_page;
   char *buf;
+  char *auth;
+  char *opt;
   char *pos;
-  long microsec;
-  double elapsed_time;
-  int page_len = 0;
-  int result = STATE_UNKNOWN;
-
-  /* try to connect to the host at the given port number */
-  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
-    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
-#ifdef HAVE_SSL
-  if (use_ssl == TRUE) {
-    np_net_ssl_init(sd);
-    if (check_cert == TRUE) {
-      result = np_net_ssl_check_cert(days_till_exp);
-      np_net_ssl_cleanup();
-      if(sd) close(sd);
-      return result;
-    }
-  }
-#endif /* HAVE_SSL */
+  int i;
 
-  asprintf (&buf, "%s %s HTTP/1.0\r\n%s\r\n", http_method, server_url, user_agent);
+  asprintf (&buf, "%s %s HTTP/1.%d\r\n%s\r\n", http_method, url,
+            keep_alive ? 1 : 0, user_agent);
 
   /* tell HTTP/1.1 servers not to keep the connection alive */
-  asprintf (&buf, "%sConnection: close\r\n", buf);
+  if (!keep_alive)
+    asprintf (&buf, "%sConnection: close\r\n", buf);
 
   /* optionally send the host header info */
-  if (host_name)
-    asprintf (&buf, "%sHost: %s\r\n", buf, host_name);
-
-  /* optionally send any other header tag */
-  if (http_opt_headers_count) {
-    for (i = 0; i < http_opt_headers_count ; i++) {
-      for ((pos = strtok(http_opt_headers[i], INPUT_DELIMITER)); pos; (pos = strtok(NULL, INPUT_DELIMITER)))
-        asprintf (&buf, "%s%s\r\n", buf, pos);
-    }
-    free(http_opt_headers);
+  if (vhost)
+    asprintf (&buf, "%sHost: %s\r\n", buf, vhost);
+
+  /* optionally send any other header tag; work on a copy since strtok
+     modifies its argument and a batch sends the headers more than once */
+  for (i = 0; i < http_opt_headers_count; i++) {
+    opt = strdup (http_opt_headers[i]);
+    for ((pos = strtok(opt, INPUT_DELIMITER)); pos; (pos = strtok(NULL, INPUT_DELIMITER)))
+      asprintf (&buf, "%s%s\r\n", buf, pos);
+    free (opt);
   }
 
   /* optionally send the authentication info */
   if (strlen(user_auth)) {
     auth = base64 (user_auth, strlen (user_auth));
     asprintf (&buf, "%sAuthorization: Basic %s\r\n", buf, auth);
+    free (auth);
   }
 
   /* either send http POST data */
@@ -781,20 +1135,95 @@ check_http (void)
     asprintf (&buf, "%s%s", buf, CRLF);
   }
 
-  if (verbose) printf ("%s\n", buf);
-  my_send (buf, strlen (buf));
+  return buf;
+}
+
+/* Closes the connection to the server */
+static void
+http_close (void)
+{
+#ifdef HAVE_SSL
+  np_net_ssl_cleanup();
+#endif
+  if(sd) close(sd);
+  conn_open = FALSE;
+}
 
-  /* fetch the page */
-  full_page = strdup("");
-  while ((i = my_recv (buffer, MAX_INPUT_BUFFER-1)) > 0) {
-    buffer[i] = '\0';
-    asprintf (&full_page, "%s%s", full_page, buffer);
-    pagesize += i;
+int
+check_http (void)
+{
+  char *msg;
+  char *status_line;
+  char *header;
+  int i = 0;
+  page_buffer page;
+  char *buf;
+  long microsec;
+  double elapsed_time;
+  int result = STATE_UNKNOWN;
+  int reused;
+
+  /* a connection kept open by the previous request is only any use if this
+     one (a redirect) goes to the same server */
+  if (conn_open && (strcmp (conn_address, server_address) ||
+                    conn_port != server_port || conn_ssl != use_ssl))
+    http_close ();
+
+  for (;;) {
+    reused = conn_open;
+    if (!conn_open) {
+      /* try to connect to the host at the given port number */
+      if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+        die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+#ifdef HAVE_SSL
+      if (use_ssl == TRUE) {
+        if (ssl_session_cache)
+          np_net_ssl_session_cache (ssl_session_cache, server_address, server_port);
+        np_net_ssl_init(sd);
+        if (check_cert == TRUE) {
+          result = np_net_ssl_check_cert(days_till_exp);
+          np_net_ssl_cleanup();
+          if(sd) close(sd);
+          return result;
+        }
+      }
+#endif /* HAVE_SSL */
+      conn_open = TRUE;
+      free (conn_address);
+      conn_address = strdup (server_address);
+      conn_port = server_port;
+      conn_ssl = use_ssl;
+    }
+    else if (verbose)
+      printf (_("Reusing connection to %s:%d\n"), server_address, server_port);
+
+    buf = http_request (server_url, host_name ? host_name :
+                        (keep_alive ? server_address : NULL));
+
+    if (verbose) printf ("%s\n", buf);
+    my_send (buf, strlen (buf));
+    free (buf);
+
+    /* fetch the page */
+    memset (&page, 0, sizeof (page));
+    for (;;) {
+      page_reserve (&page);
+      if ((i = my_recv (page.data + page.len, page.alloc - page.len - 1)) <= 0)
+        break;
+      if (page_received (&page, i)) {
+        i = 0;
+        break;
+      }
+    }
 
-                if (no_body && document_headers_done (full_page)) {
-                  i = 0;
-                  break;
-                }
+    if (!reused || page.size > 0)
+      break;
+
+    /* the server closed the kept-alive connection in the meantime */
+    if (verbose)
+      printf (_("Connection closed by server, reconnecting\n"));
+    http_close ();
+    free (page.data);
   }
 
   if (i < 0 && errno != ECONNRESET) {
@@ -820,38 +1249,68 @@ check_http (void)
   }
 
   /* return a CRITICAL status if we couldn't read any data */
-  if (pagesize == (size_t) 0)
+  if (page.size == (size_t) 0)
     die (STATE_CRITICAL, _("HTTP CRITICAL - No data received from host\n"));
+  page_complete (&page);
 
-  /* close the connection */
-#ifdef HAVE_SSL
-  np_net_ssl_cleanup();
-#endif
-  if(sd) close(sd);
+  /* close the connection, unless a redirect may use it again */
+  if (!(keep_alive && page.complete && page.keep_alive))
+    http_close ();
 
   /* reset the alarm */
   alarm (0);
 
-  /* leave full_page untouched so we can free it later */
-  page = full_page;
-
   if (verbose)
     printf ("%s://%s:%d%s is %d characters\n",
       use_ssl ? "https" : "http", server_address,
-      server_port, server_url, (int)pagesize);
+      server_port, server_url, (int)page.size);
+
+  microsec = deltime (tv);
+  elapsed_time = (double)microsec / 1.0e6;
+
+  result = check_response (&page, server_port, elapsed_time,
+                           &status_line, &header, &msg);
+  if (result == STATE_DEPENDENT)
+    redir (header, status_line);
+
+  die (result, "%s", msg);
+  return STATE_UNKNOWN;
+}
+
+
+
+/* Checks the complete response FULL_PAGE received from PORT against the
+   thresholds and expectations given on the command line.  Its data is
+   modified in place: STATUS_LINE and HEADER are set to point into it.
+   Returns the state and sets MSG to the plugin output, or returns
+   STATE_DEPENDENT if the redirect in HEADER should be followed. */
+static int
+check_response (page_buffer *full_page, int port, double elapsed_time,
+                char **status_line, char **header, char **msg)
+{
+  char *status_code;
+  char *page;
+  char *pos;
+  size_t pagesize = full_page->size;
+  int http_status;
+  int page_len = 0;
+  int result;
+
+  /* leave full_page untouched so we can free it later */
+  page = full_page->data;
 
   /* find status line and null-terminate it */
-  status_line = page;
+  *status_line = page;
   page += (size_t) strcspn (page, "\r\n");
   pos = page;
   page += (size_t) strspn (page, "\r\n");
-  status_line[strcspn(status_line, "\r\n")] = 0;
-  strip (status_line);
+  (*status_line)[strcspn(*status_line, "\r\n")] = 0;
+  strip (*status_line);
   if (verbose)
-    printf ("STATUS: %s\n", status_line);
+    printf ("STATUS: %s\n", *status_line);
 
   /* find header info and null-terminate it */
-  header = page;
+  *header = page;
   while (strcspn (page, "\r\n") > 0) {
     page += (size_t) strcspn (page, "\r\n");
     pos = page;
@@ -862,140 +1321,141 @@ check_http (void)
       page += (size_t) 1;
   }
   page += (size_t) strspn (page, "\r\n");
-  header[pos - header] = 0;
+  (*header)[pos - *header] = 0;
   if (verbose)
-    printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", header,
+    printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", *header,
                 (no_body ? "  [[ skipped ]]" : page));
 
   /* make sure the status line matches the response we are looking for */
-  if (!strstr (status_line, server_expect)) {
-    if (server_port == HTTP_PORT)
-      asprintf (&msg,
-                _("Invalid HTTP response received from host\n"));
+  if (!strstr (*status_line, server_expect)) {
+    if (port == HTTP_PORT)
+      asprintf (msg,
+                _("HTTP CRITICAL - Invalid HTTP response received from host\n"));
     else
-      asprintf (&msg,
-                _("Invalid HTTP response received from host on port %d\n"),
-                server_port);
-    die (STATE_CRITICAL, "HTTP CRITICAL - %s", msg);
+      asprintf (msg,
+                _("HTTP CRITICAL - Invalid HTTP response received from host on port %d\n"),
+                port);
+    return STATE_CRITICAL;
   }
 
   /* Exit here if server_expect was set by user and not default */
   if ( server_expect_yn  )  {
-    asprintf (&msg,
-              _("HTTP OK: Status line output matched \"%s\"\n"),
-              server_expect);
     if (verbose)
-      printf ("%s\n",msg);
+      printf (_("HTTP OK: Status line output matched \"%s\"\n"), server_expect);
   }
   else {
     /* Status-Line = HTTP-Version SP Status-Code SP Reason-Phrase CRLF */
     /* HTTP-Version   = "HTTP" "/" 1*DIGIT "." 1*DIGIT */
     /* Status-Code = 3 DIGITS */
 
-    status_code = strchr (status_line, ' ') + sizeof (char);
-    if (strspn (status_code, "1234567890") != 3)
-      die (STATE_CRITICAL, _("HTTP CRITICAL: Invalid Status Line (%s)\n"), status_line);
+    status_code = strchr (*status_line, ' ') + sizeof (char);
+    if (strspn (status_code, "1234567890") != 3) {
+      asprintf (msg, _("HTTP CRITICAL: Invalid Status Line (%s)\n"), *status_line);
+      return STATE_CRITICAL;
+    }
 
     http_status = atoi (status_code);
 
     /* check the return code */
 
-    if (http_status >= 600 || http_status < 100)
-      die (STATE_CRITICAL, _("HTTP CRITICAL: Invalid Status (%s)\n"), status_line);
+    if (http_status >= 600 || http_status < 100) {
+      asprintf (msg, _("HTTP CRITICAL: Invalid Status (%s)\n"), *status_line);
+      return STATE_CRITICAL;
+    }
 
     /* server errors result in a critical state */
-    else if (http_status >= 500)
-      die (STATE_CRITICAL, _("HTTP CRITICAL: %s\n"), status_line);
+    else if (http_status >= 500) {
+      asprintf (msg, _("HTTP CRITICAL: %s\n"), *status_line);
+      return STATE_CRITICAL;
+    }
 
     /* client errors result in a warning state */
-    else if (http_status >= 400)
-      die (STATE_WARNING, _("HTTP WARNING: %s\n"), status_line);
+    else if (http_status >= 400) {
+      asprintf (msg, _("HTTP WARNING: %s\n"), *status_line);
+      return STATE_WARNING;
+    }
 
     /* check redirected page if specified */
     else if (http_status >= 300) {
 
       if (onredirect == STATE_DEPENDENT)
-        redir (header, status_line);
-      else if (onredirect == STATE_UNKNOWN)
-        printf (_("HTTP UNKNOWN"));
-      else if (onredirect == STATE_OK)
-        printf (_("HTTP OK"));
-      else if (onredirect == STATE_WARNING)
-        printf (_("HTTP WARNING"));
-      else if (onredirect == STATE_CRITICAL)
-        printf (_("HTTP CRITICAL"));
-      microsec = deltime (tv);
-      elapsed_time = (double)microsec / 1.0e6;
-      die (onredirect,
-           _(" - %s - %.3f second response time %s|%s %s\n"),
-           status_line, elapsed_time, 
-           (display_html ? "</A>" : ""),
-           perfd_time (elapsed_time), perfd_size (pagesize));
+        return STATE_DEPENDENT;
+      asprintf (msg, _("HTTP %s - %s - %.3f second response time %s|%s %s\n"),
+                state_text (onredirect), *status_line, elapsed_time,
+                (display_html ? "</A>" : ""),
+                perfd_time (elapsed_time), perfd_size (pagesize));
+      return onredirect;
     } /* end if (http_status >= 300) */
 
   } /* end else (server_expect_yn)  */
     
         if (maximum_age >= 0) {
-          check_document_dates (header);
+          result = check_document_dates (*header, msg);
+          if (result != STATE_OK)
+            return result;
         }
 
   /* check elapsed time */
-  microsec = deltime (tv);
-  elapsed_time = (double)microsec / 1.0e6;
-  asprintf (&msg,
-            _(" - %s - %.3f second response time %s|%s %s\n"),
-            status_line, elapsed_time, 
-            (display_html ? "</A>" : ""),
-            perfd_time (elapsed_time), perfd_size (pagesize));
-  if (check_critical_time == TRUE && elapsed_time > critical_time)
-    die (STATE_CRITICAL, "HTTP %s: %s", _("CRITICAL"), msg);
-  if (check_warning_time == TRUE && elapsed_time > warning_time)
-    die (STATE_WARNING, "HTTP %s: %s", _("WARNING"), msg);
+  if (check_critical_time == TRUE && elapsed_time > critical_time) {
+    asprintf (msg, _("HTTP %s:  - %s - %.3f second response time %s|%s %s\n"),
+              _("CRITICAL"), *status_line, elapsed_time,
+              (display_html ? "</A>" : ""),
+              perfd_time (elapsed_time), perfd_size (pagesize));
+    return STATE_CRITICAL;
+  }
+  if (check_warning_time == TRUE && elapsed_time > warning_time) {
+    asprintf (msg, _("HTTP %s:  - %s - %.3f second response time %s|%s %s\n"),
+              _("WARNING"), *status_line, elapsed_time,
+              (display_html ? "</A>" : ""),
+              perfd_time (elapsed_time), perfd_size (pagesize));
+    return STATE_WARNING;
+  }
 
   /* Page and Header content checks go here */
   /* these checks should be last */
 
   if (strlen (string_expect)) {
-    if (strstr (page, string_expect)) {
-      printf (_("HTTP OK %s - %.3f second response time %s|%s %s\n"),
-              status_line, elapsed_time,
-              (display_html ? "</A>" : ""),
-              perfd_time (elapsed_time), perfd_size (pagesize));
-      exit (STATE_OK);
+    if (full_page->streamed ? full_page->matched : strstr (page, string_expect) != NULL) {
+      asprintf (msg, _("HTTP OK %s - %.3f second response time %s|%s %s\n"),
+                *status_line, elapsed_time,
+                (display_html ? "</A>" : ""),
+                perfd_time (elapsed_time), perfd_size (pagesize));
+      return STATE_OK;
     }
     else {
-      printf (_("HTTP CRITICAL - string not found%s|%s %s\n"),
-              (display_html ? "</A>" : ""),
-              perfd_time (elapsed_time), perfd_size (pagesize));
-      exit (STATE_CRITICAL);
+      asprintf (msg, _("HTTP CRITICAL - string not found%s|%s %s\n"),
+                (display_html ? "</A>" : ""),
+                perfd_time (elapsed_time), perfd_size (pagesize));
+      return STATE_CRITICAL;
     }
   }
 
   if (strlen (regexp)) {
-    errcode = regexec (&preg, page, REGS, pmatch, 0);
+    if (!full_page->streamed)
+      errcode = regexec (&preg, page, REGS, pmatch, 0);
+    else if (full_page->match_error)
+      errcode = full_page->match_error;
+    else
+      errcode = full_page->matched ? 0 : REG_NOMATCH;
     if ((errcode == 0 && invert_regex == 0) || (errcode == REG_NOMATCH && invert_regex == 1)) {
-      printf (_("HTTP OK %s - %.3f second response time %s|%s %s\n"),
-              status_line, elapsed_time,
-              (display_html ? "</A>" : ""),
-              perfd_time (elapsed_time), perfd_size (pagesize));
-      exit (STATE_OK);
+      asprintf (msg, _("HTTP OK %s - %.3f second response time %s|%s %s\n"),
+                *status_line, elapsed_time,
+                (display_html ? "</A>" : ""),
+                perfd_time (elapsed_time), perfd_size (pagesize));
+      return STATE_OK;
     }
     else if ((errcode == REG_NOMATCH && invert_regex == 0) || (errcode == 0 && invert_regex == 1)) {
-      if (invert_regex == 0) 
-        msg = strdup(_("pattern not found"));
-      else 
-        msg = strdup(_("pattern found"));
-      printf (("%s - %s%s|%s %s\n"),
-        _("HTTP CRITICAL"),
-        msg,
-        (display_html ? "</A>" : ""),
-        perfd_time (elapsed_time), perfd_size (pagesize));
-      exit (STATE_CRITICAL);
+      asprintf (msg, ("%s - %s%s|%s %s\n"),
+                _("HTTP CRITICAL"),
+                (invert_regex == 0 ? _("pattern not found") : _("pattern found")),
+                (display_html ? "</A>" : ""),
+                perfd_time (elapsed_time), perfd_size (pagesize));
+      return STATE_CRITICAL;
     }
     else {
       regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
-      printf (_("HTTP CRITICAL - Execute Error: %s\n"), errbuf);
-      exit (STATE_CRITICAL);
+      asprintf (msg, _("HTTP CRITICAL - Execute Error: %s\n"), errbuf);
+      return STATE_CRITICAL;
     }
   }
 
@@ -1003,21 +1463,20 @@ check_http (void)
   /* page_len = get_content_length(header); */
   page_len = pagesize;
   if ((max_page_len > 0) && (page_len > max_page_len)) {
-    printf (_("HTTP WARNING: page size %d too large%s|%s\n"),
-      page_len, (display_html ? "</A>" : ""), perfd_size (page_len) );
-    exit (STATE_WARNING);
+    asprintf (msg, _("HTTP WARNING: page size %d too large%s|%s\n"),
+              page_len, (display_html ? "</A>" : ""), perfd_size (page_len) );
+    return STATE_WARNING;
   } else if ((min_page_len > 0) && (page_len < min_page_len)) {
-    printf (_("HTTP WARNING: page size %d too small%s|%s\n"),
-      page_len, (display_html ? "</A>" : ""), perfd_size (page_len) );
-    exit (STATE_WARNING);
+    asprintf (msg, _("HTTP WARNING: page size %d too small%s|%s\n"),
+              page_len, (display_html ? "</A>" : ""), perfd_size (page_len) );
+    return STATE_WARNING;
   }
   /* We only get here if all tests have been passed */
-  asprintf (&msg, _("HTTP OK %s - %d bytes in %.3f seconds %s|%s %s\n"),
-            status_line, page_len, elapsed_time,
+  asprintf (msg, _("HTTP OK %s - %d bytes in %.3f seconds %s|%s %s\n"),
+            *status_line, page_len, elapsed_time,
             (display_html ? "</A>" : ""),
             perfd_time (elapsed_time), perfd_size (page_len));
-  die (STATE_OK, "%s", msg);
-  return STATE_UNKNOWN;
+  return STATE_OK;
 }
 
 
@@ -1190,6 +1649,767 @@ server_port_check (int ssl_flag)
     return HTTP_PORT;
 }
 
+/*
+ * Batch mode: check many targets from one process.  Every target runs the
+ * same connect/send/receive sequence as check_http(), but on a non-blocking
+ * socket multiplexed with epoll (or poll where epoll is not available), and
+ * its response is judged by check_response().  One result line is printed
+ * per target as it completes.
+ */
+
+enum {
+  TARGET_RESOLVING,
+  TARGET_CONNECTING,
+  TARGET_SENDING,
+  TARGET_RECEIVING,
+  TARGET_DONE
+};
+
+enum {
+  LOOKUP_QUEUED,
+  LOOKUP_RUNNING,
+  LOOKUP_DONE,
+  LOOKUP_ABANDONED    /* past its deadline, the resolver was replaced */
+};
+
+/* the address lookup shared by all targets on one address and port */
+typedef struct batch_lookup {
+  char *address;
+  int port;
+  int state;
+  int error;                /* getaddrinfo() result */
+  struct addrinfo *res;
+  struct timeval deadline;
+} batch_lookup;
+
+typedef struct http_target {
+  char *name;               /* the target as written in the batch file */
+  char *host_name;          /* sent in the Host header */
+  char *server_address;     /* what we connect to */
+  char *server_url;
+  int server_port;
+  batch_lookup *lookup;
+  int sd;
+  int state;
+  char *request;
+  size_t request_len;
+  size_t sent;
+  page_buffer page;
+  int reused;               /* TRUE if sd was left open by an earlier target */
+  struct timeval start;
+} http_target;
+
+/* a kept-alive connection waiting for the next target */
+typedef struct idle_connection {
+  const char *address;
+  int port;
+  int sd;
+} idle_connection;
+
+static int batch_result = STATE_OK;
+static idle_connection *batch_idle;
+static int batch_nidle = 0;
+
+static int batch_park (http_target *);
+#ifdef HAVE_SYS_EPOLL_H
+static int batch_epfd = -1;
+#endif
+
+/* Lookups are queued in file order, one per address and port, and run
+   by BATCH_RESOLVERS threads ahead of the targets that need them.  A
+   resolver that finishes one writes a byte to lookup_pipe to wake up the
+   event loop. */
+#define BATCH_RESOLVERS 8
+
+static batch_lookup *lookups;
+static int lookup_count = 0;
+#ifdef HAVE_PTHREAD
+static int lookup_next = 0;       /* first lookup not started yet */
+static int lookup_reaped = 0;     /* first lookup that may still be running */
+static int lookup_pipe[2] = { -1, -1 };
+static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Parses a batch file line of the form "[http://]HOST[:PORT][/PATH] [ADDRESS]".
+   Returns FALSE if the line should be skipped. */
+static int
+batch_parse_target (char *line, http_target *t)
+{
+  char *url_field;
+  char *addr_field;
+  char *uri;
+  char *addr;
+  char *url;
+  char type[6];
+  int port = 0;
+  int port_given = FALSE;
+
+  line[strcspn (line, "\r\n")] = 0;
+  url_field = strtok (line, " \t");
+  if (url_field == NULL || url_field[0] == '#')
+    return FALSE;
+  addr_field = strtok (NULL, " \t");
+
+  memset (t, 0, sizeof (*t));
+  t->name = strdup (url_field);
+  t->sd = -1;
+
+  if (strstr (url_field, "://"))
+    uri = strdup (url_field);
+  else
+    asprintf (&uri, "%s://%s", use_ssl ? "https" : "http", url_field);
+
+  addr = malloc (MAX_IPV4_HOSTLENGTH + 1);
+  url = malloc (strlen (uri) + 2);
+  if (addr == NULL || url == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate target\n"));
+
+  url[0] = '/';
+  if (sscanf (uri, HD1, type, addr, &port, url + 1) == 4)
+    port_given = TRUE;
+  else if (sscanf (uri, HD2, type, addr, url + 1) == 3)
+    ;
+  else {
+    /* no path: -u applies, which may be longer than the line */
+    free (url);
+    url = strdup (server_url);
+    if (sscanf (uri, HD3, type, addr, &port) == 3)
+      port_given = TRUE;
+    else if (sscanf (uri, HD4, type, addr) != 2) {
+      free (uri);
+      free (addr);
+      free (url);
+      return TRUE;  /* reported as unparsable by batch_start() */
+    }
+  }
+  free (uri);
+
+  /* a port out of range is reported by batch_start() */
+  if (!port_given)
+    port = server_type_check (type) ? HTTPS_PORT : server_port;
+
+  t->host_name = addr;
+  t->server_address = strdup (addr_field ? addr_field : addr);
+  t->server_url = url;
+  t->server_port = port;
+  if (server_type_check (type))
+    t->state = TARGET_DONE;  /* reported as unsupported by batch_start() */
+  return TRUE;
+}
+
+/* Prints the result line for T and releases its resources */
+static int
+batch_finish (http_target *t, int result, char *msg)
+{
+  /* closing also removes the socket from the epoll set */
+  if (t->sd >= 0 && !(keep_alive && t->page.complete && t->page.keep_alive &&
+                      batch_park (t)))
+    close (t->sd);
+  t->sd = -1;
+  t->state = TARGET_DONE;
+
+  msg[strcspn (msg, "\n")] = 0;
+  printf ("%s\t%d\t%s\n", t->name, result, msg);
+  fflush (stdout);
+  batch_result = max_state (batch_result, result);
+
+  free (msg);
+  free (t->request);
+  free (t->page.data);
+  t->request = t->page.data = NULL;
+  return result;
+}
+
+static int
+batch_fail (http_target *t, int result, const char *fmt, ...)
+{
+  va_list ap;
+  char msg[MAX_INPUT_BUFFER];
+
+  va_start (ap, fmt);
+  vsnprintf (msg, sizeof (msg), fmt, ap);
+  va_end (ap);
+  return batch_finish (t, result, strdup (msg));
+}
+
+/* Asks to be woken up when T can make progress in its current state */
+static void
+batch_watch (http_target *t, int op)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = (t->state == TARGET_RECEIVING) ? EPOLLIN : EPOLLOUT;
+  ev.data.ptr = t;
+  if (epoll_ctl (batch_epfd, op, t->sd, &ev) != 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - epoll_ctl failed: %s\n"), strerror (errno));
+#endif
+}
+
+/* Starts the non-blocking connect for T.  Returns FALSE if T has already
+   been finished. */
+static int
+batch_connect (http_target *t)
+{
+  struct addrinfo *res = t->lookup->res;
+  int result;
+
+  /* only the first address is tried, there is no time for a fallback */
+  t->sd = socket (res->ai_family, SOCK_STREAM, res->ai_protocol);
+  if (t->sd < 0)
+    return (batch_fail (t, STATE_UNKNOWN, _("HTTP UNKNOWN - Socket creation failed")), FALSE);
+  fcntl (t->sd, F_SETFL, fcntl (t->sd, F_GETFL) | O_NONBLOCK);
+  result = connect (t->sd, res->ai_addr, res->ai_addrlen);
+  if (result < 0 && errno != EINPROGRESS)
+    return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket: %s"),
+                        strerror (errno)), FALSE);
+
+  t->state = TARGET_CONNECTING;
+#ifdef HAVE_SYS_EPOLL_H
+  batch_watch (t, EPOLL_CTL_ADD);
+#endif
+  return TRUE;
+}
+
+/* Keeps the connection of the finished target T open for a later target
+   on the same address and port.  Returns FALSE if there is no room. */
+static int
+batch_park (http_target *t)
+{
+  if (batch_nidle == batch_concurrency)
+    return FALSE;
+#ifdef HAVE_SYS_EPOLL_H
+  epoll_ctl (batch_epfd, EPOLL_CTL_DEL, t->sd, NULL);
+#endif
+  batch_idle[batch_nidle].address = t->server_address;
+  batch_idle[batch_nidle].port = t->server_port;
+  batch_idle[batch_nidle++].sd = t->sd;
+  return TRUE;
+}
+
+/* Hands T an idle connection to its address and port, if there is one */
+static int
+batch_reuse (http_target *t)
+{
+  int i;
+
+  for (i = 0; i < batch_nidle; i++)
+    if (batch_idle[i].port == t->server_port &&
+        !strcmp (batch_idle[i].address, t->server_address))
+      break;
+  if (i == batch_nidle)
+    return FALSE;
+
+  t->sd = batch_idle[i].sd;
+  batch_idle[i] = batch_idle[--batch_nidle];
+  t->reused = TRUE;
+  t->state = TARGET_SENDING;
+#ifdef HAVE_SYS_EPOLL_H
+  batch_watch (t, EPOLL_CTL_ADD);
+#endif
+  return TRUE;
+}
+
+/* The server closed the idle connection T was given: start over on a
+   new one */
+static int
+batch_retry (http_target *t)
+{
+  if (verbose)
+    printf (_("%s: connection closed by server, reconnecting\n"), t->name);
+  close (t->sd);
+  t->sd = -1;
+  t->reused = FALSE;
+  t->sent = 0;
+  free (t->page.data);
+  memset (&t->page, 0, sizeof (t->page));
+  return batch_connect (t);
+}
+
+/* Looks up the address of L.  Called without lookup_lock held. */
+static int
+batch_lookup_run (batch_lookup *l, struct addrinfo **res)
+{
+  struct addrinfo hints;
+  char port_str[6];
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = address_family;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  snprintf (port_str, sizeof (port_str), "%d", l->port);
+  *res = NULL;
+  return getaddrinfo (l->address, port_str, &hints, res);
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+batch_resolver (void *arg)
+{
+  batch_lookup *l;
+  struct addrinfo *res;
+  struct timeval now;
+  int error;
+
+  for (;;) {
+    pthread_mutex_lock (&lookup_lock);
+    if (lookup_next >= lookup_count) {
+      pthread_mutex_unlock (&lookup_lock);
+      return NULL;
+    }
+    l = &lookups[lookup_next++];
+    gettimeofday (&now, NULL);
+    l->deadline.tv_sec = now.tv_sec + socket_timeout;
+    l->deadline.tv_usec = now.tv_usec;
+    l->state = LOOKUP_RUNNING;
+    pthread_mutex_unlock (&lookup_lock);
+
+    error = batch_lookup_run (l, &res);
+
+    pthread_mutex_lock (&lookup_lock);
+    if (l->state == LOOKUP_ABANDONED) {
+      /* another resolver has taken over this one's place */
+      pthread_mutex_unlock (&lookup_lock);
+      if (res)
+        freeaddrinfo (res);
+      return NULL;
+    }
+    l->error = error;
+    l->res = res;
+    l->state = LOOKUP_DONE;
+    pthread_mutex_unlock (&lookup_lock);
+
+    /* a full pipe wakes up the event loop just as well */
+    if (write (lookup_pipe[1], "", 1) < 0 && errno != EAGAIN)
+      return NULL;
+  }
+}
+
+static int
+batch_start_resolver (void)
+{
+  pthread_t tid;
+  pthread_attr_t attr;
+  int err;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  if ((err = pthread_create (&tid, &attr, batch_resolver, NULL)) != 0 && verbose)
+    printf (_("could not start resolver: %s\n"), strerror (err));
+  pthread_attr_destroy (&attr);
+  return err;
+}
+
+/* Abandons the lookups past their deadline, replacing their resolver.
+   Returns the number abandoned. */
+static int
+batch_reap_lookups (void)
+{
+  struct timeval now;
+  int i, abandoned = 0;
+
+  gettimeofday (&now, NULL);
+  pthread_mutex_lock (&lookup_lock);
+  for (i = lookup_reaped; i < lookup_next; i++) {
+    if (lookups[i].state == LOOKUP_RUNNING && timercmp (&lookups[i].deadline, &now, <=)) {
+      if (verbose)
+        printf (_("%s did not resolve within %d seconds\n"), lookups[i].address, socket_timeout);
+      lookups[i].state = LOOKUP_ABANDONED;
+      batch_start_resolver ();
+      abandoned++;
+    }
+    if (i == lookup_reaped && lookups[i].state != LOOKUP_RUNNING)
+      lookup_reaped++;
+  }
+  pthread_mutex_unlock (&lookup_lock);
+  return abandoned;
+}
+#endif
+
+/* Gives every target the lookup of its address and port, one per pair
+   across the whole list, and starts resolving them in file order */
+static void
+batch_queue_lookups (http_target *targets, int ntargets)
+{
+  unsigned int *slots, size, h;
+  http_target *t;
+  batch_lookup *l;
+  const char *c;
+  int i;
+
+  for (size = 64; size < 2 * (unsigned int)ntargets; size *= 2)
+    ;
+  slots = calloc (size, sizeof (unsigned int));
+  lookups = calloc (ntargets, sizeof (batch_lookup));
+  if (slots == NULL || lookups == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate lookups\n"));
+
+  for (i = 0; i < ntargets; i++) {
+    t = &targets[i];
+    if (t->host_name == NULL || t->state == TARGET_DONE ||
+        t->server_port < 1 || t->server_port > MAX_PORT)
+      continue;
+    for (h = t->server_port, c = t->server_address; *c; c++)
+      h = h * 31 + (unsigned char)*c;
+    for (h &= size - 1; slots[h]; h = (h + 1) & (size - 1)) {
+      l = &lookups[slots[h] - 1];
+      if (l->port == t->server_port && !strcmp (l->address, t->server_address))
+        break;
+    }
+    if (slots[h] == 0) {
+      l = &lookups[lookup_count];
+      l->address = strdup (t->server_address);
+      l->port = t->server_port;
+      l->state = LOOKUP_QUEUED;
+      slots[h] = ++lookup_count;
+    }
+    t->lookup = l;
+  }
+  free (slots);
+
+#ifdef HAVE_PTHREAD
+  if (pipe (lookup_pipe) != 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not create pipe: %s\n"), strerror (errno));
+  fcntl (lookup_pipe[0], F_SETFL, fcntl (lookup_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl (lookup_pipe[1], F_SETFL, fcntl (lookup_pipe[1], F_GETFL) | O_NONBLOCK);
+  for (i = 0; i < lookup_count && i < BATCH_RESOLVERS; i++)
+    if (batch_start_resolver () != 0 && i == 0)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not start resolver\n"));
+#endif
+}
+
+/* Releases the lookups no resolver is working on any more */
+static void
+batch_free_lookups (void)
+{
+  int i, busy = 0;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&lookup_lock);
+#endif
+  for (i = 0; i < lookup_count; i++) {
+    if (lookups[i].state == LOOKUP_RUNNING || lookups[i].state == LOOKUP_ABANDONED) {
+      busy++;
+      continue;
+    }
+    if (lookups[i].res)
+      freeaddrinfo (lookups[i].res);
+    free (lookups[i].address);
+    /* keeps an idle resolver from starting it */
+    lookups[i].state = LOOKUP_DONE;
+    lookups[i].res = NULL;
+  }
+#ifdef HAVE_PTHREAD
+  lookup_next = lookup_count;
+  pthread_mutex_unlock (&lookup_lock);
+#endif
+  if (busy == 0)
+    free (lookups);
+}
+
+/* Returns the state of L.  Without threads, the lookup is made here. */
+static int
+batch_lookup_state (batch_lookup *l)
+{
+#ifdef HAVE_PTHREAD
+  int state;
+
+  pthread_mutex_lock (&lookup_lock);
+  state = l->state;
+  pthread_mutex_unlock (&lookup_lock);
+  return state;
+#else
+  if (l->state == LOOKUP_QUEUED) {
+    l->error = batch_lookup_run (l, &l->res);
+    l->state = LOOKUP_DONE;
+  }
+  return l->state;
+#endif
+}
+
+/* Connects T once its address is known.  Returns FALSE if T has been
+   finished. */
+static int
+batch_resolved (http_target *t)
+{
+  switch (batch_lookup_state (t->lookup)) {
+  case LOOKUP_DONE:
+    if (t->lookup->error != 0)
+      return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - Unable to resolve %s: %s"),
+                          t->server_address, gai_strerror (t->lookup->error)), FALSE);
+    return batch_connect (t);
+  case LOOKUP_ABANDONED:
+    return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - Unable to resolve %s within %d seconds"),
+                        t->server_address, socket_timeout), FALSE);
+  default:
+    t->state = TARGET_RESOLVING;
+    return TRUE;
+  }
+}
+
+/* Starts checking T.  Returns FALSE if T has already been finished. */
+static int
+batch_start (http_target *t)
+{
+  gettimeofday (&t->start, NULL);
+
+  if (t->host_name == NULL)
+    return (batch_fail (t, STATE_UNKNOWN, _("HTTP UNKNOWN - Could not parse target")), FALSE);
+  if (t->state == TARGET_DONE)
+    return (batch_fail (t, STATE_UNKNOWN, _("HTTP UNKNOWN - SSL is not supported in batch mode")), FALSE);
+  if (t->server_port < 1 || t->server_port > MAX_PORT)
+    return (batch_fail (t, STATE_UNKNOWN, _("HTTP UNKNOWN - Port %d is out of range"),
+                        t->server_port), FALSE);
+
+  t->request = http_request (t->server_url, t->host_name);
+  t->request_len = strlen (t->request);
+
+  if (keep_alive && batch_reuse (t))
+    return TRUE;
+  return batch_resolved (t);
+}
+
+/* Advances T after its socket became ready.  Returns FALSE once T is done. */
+static int
+batch_step (http_target *t)
+{
+  char *status_line;
+  char *header;
+  char *msg;
+  int err = 0;
+  socklen_t len = sizeof (err);
+  ssize_t i;
+  int result;
+
+  switch (t->state) {
+  case TARGET_CONNECTING:
+    if (getsockopt (t->sd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+      err = errno;
+    if (err != 0)
+      return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket: %s"),
+                          strerror (err)), FALSE);
+    t->state = TARGET_SENDING;
+    /* fall through */
+
+  case TARGET_SENDING:
+    while (t->sent < t->request_len) {
+      i = send (t->sd, t->request + t->sent, t->request_len - t->sent, 0);
+      if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return TRUE;
+      if (i < 0 && t->reused)
+        return batch_retry (t);
+      if (i < 0)
+        return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - Error on send: %s"),
+                            strerror (errno)), FALSE);
+      t->sent += i;
+    }
+    t->state = TARGET_RECEIVING;
+#ifdef HAVE_SYS_EPOLL_H
+    batch_watch (t, EPOLL_CTL_MOD);
+#endif
+    return TRUE;
+
+  case TARGET_RECEIVING:
+    for (;;) {
+      page_reserve (&t->page);
+      i = read (t->sd, t->page.data + t->page.len, t->page.alloc - t->page.len - 1);
+      if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return TRUE;
+      if (i <= 0 && t->reused && t->page.size == 0)
+        return batch_retry (t);
+      if (i < 0 && errno != ECONNRESET)
+        return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - Error on receive")), FALSE);
+      if (i <= 0) {
+        page_complete (&t->page);
+        break;
+      }
+      if (page_received (&t->page, i))
+        break;
+    }
+
+    if (t->page.size == 0)
+      return (batch_fail (t, STATE_CRITICAL, _("HTTP CRITICAL - No data received from host")), FALSE);
+
+    result = check_response (&t->page, t->server_port,
+                             (double)deltime (t->start) / 1.0e6,
+                             &status_line, &header, &msg);
+    batch_finish (t, result, msg);
+    return FALSE;
+  }
+
+  return FALSE;
+}
+
+/* Reads the targets, runs up to batch_concurrency of them at a time and
+   returns the worst state seen */
+int
+check_batch (void)
+{
+  http_target *targets = NULL;
+  http_target *t;
+  FILE *fp;
+  char line[MAX_INPUT_BUFFER];
+  int ntargets = 0;
+  int next = 0;     /* first target not started yet */
+  int oldest = 0;   /* first target that may still be running */
+  int active = 0;
+  int timeout_ms;
+  int i, n;
+  long waited;
+#ifdef HAVE_PTHREAD
+  int resolved = FALSE;   /* a lookup finished since the last scan */
+  char drain[64];
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event *events;
+# ifdef HAVE_PTHREAD
+  struct epoll_event ev;
+# endif
+#else
+  struct pollfd *pfds;
+  http_target **ready;
+#endif
+
+  if (!strcmp (batch_file, "-"))
+    fp = stdin;
+  else if ((fp = fopen (batch_file, "r")) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot open batch file %s: %s\n"),
+         batch_file, strerror (errno));
+
+  while (fgets (line, sizeof (line), fp)) {
+    if (ntargets % 256 == 0) {
+      targets = realloc (targets, (ntargets + 256) * sizeof (http_target));
+      if (targets == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate targets\n"));
+    }
+    if (batch_parse_target (line, &targets[ntargets]))
+      ntargets++;
+  }
+  if (fp != stdin)
+    fclose (fp);
+  if (ntargets == 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - No targets in batch file %s\n"), batch_file);
+
+  /* a peer closing early must not kill the whole batch */
+  signal (SIGPIPE, SIG_IGN);
+
+  batch_queue_lookups (targets, ntargets);
+
+#ifdef HAVE_SYS_EPOLL_H
+  if ((batch_epfd = epoll_create (batch_concurrency)) < 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - epoll_create failed: %s\n"), strerror (errno));
+# ifdef HAVE_PTHREAD
+  /* the resolvers' wake-up call, told apart from the targets by NULL */
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl (batch_epfd, EPOLL_CTL_ADD, lookup_pipe[0], &ev) != 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - epoll_ctl failed: %s\n"), strerror (errno));
+# endif
+  events = malloc (batch_concurrency * sizeof (struct epoll_event));
+  if (events == NULL)
+#else
+  pfds = malloc ((batch_concurrency + 1) * sizeof (struct pollfd));
+  ready = malloc ((batch_concurrency + 1) * sizeof (http_target *));
+  if (pfds == NULL || ready == NULL)
+#endif
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate event buffer\n"));
+  if ((batch_idle = malloc (batch_concurrency * sizeof (idle_connection))) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate connection pool\n"));
+
+  while (oldest < ntargets) {
+    while (active < batch_concurrency && next < ntargets)
+      if (batch_start (&targets[next++]))
+        active++;
+
+#ifdef HAVE_PTHREAD
+    /* connect the targets whose address has come in */
+    if (batch_reap_lookups () || resolved) {
+      resolved = FALSE;
+      for (i = oldest; i < next; i++)
+        if (targets[i].state == TARGET_RESOLVING && !batch_resolved (&targets[i]))
+          active--;
+      continue;
+    }
+#endif
+
+    /* targets start in file order with the same timeout, so the oldest one
+       still running always has the nearest deadline */
+    while (oldest < next && targets[oldest].state == TARGET_DONE)
+      oldest++;
+    if (oldest == next)
+      continue;
+    waited = deltime (targets[oldest].start) / 1000;
+    if (waited >= (long)socket_timeout * 1000) {
+      if (targets[oldest].state == TARGET_RESOLVING)
+        batch_fail (&targets[oldest], STATE_CRITICAL,
+                    _("HTTP CRITICAL - Unable to resolve %s within %d seconds"),
+                    targets[oldest].server_address, socket_timeout);
+      else
+        batch_fail (&targets[oldest], STATE_CRITICAL,
+                    _("HTTP CRITICAL - Socket timeout after %d seconds"), socket_timeout);
+      active--;
+      continue;
+    }
+    timeout_ms = (int)((long)socket_timeout * 1000 - waited);
+
+#ifdef HAVE_SYS_EPOLL_H
+    n = epoll_wait (batch_epfd, events, batch_concurrency, timeout_ms);
+    for (i = 0; i < n; i++) {
+      t = events[i].data.ptr;
+#else
+    n = 0;
+# ifdef HAVE_PTHREAD
+    pfds[n].fd = lookup_pipe[0];
+    pfds[n].events = POLLIN;
+    ready[n++] = NULL;
+# endif
+    for (i = oldest; i < next; i++) {
+      if (targets[i].state == TARGET_DONE || targets[i].state == TARGET_RESOLVING)
+        continue;
+      pfds[n].fd = targets[i].sd;
+      pfds[n].events = (targets[i].state == TARGET_RECEIVING) ? POLLIN : POLLOUT;
+      ready[n++] = &targets[i];
+    }
+    n = poll (pfds, n, timeout_ms) > 0 ? n : 0;
+    for (i = 0; i < n; i++) {
+      if (pfds[i].revents == 0)
+        continue;
+      t = ready[i];
+#endif
+#ifdef HAVE_PTHREAD
+      if (t == NULL) {
+        while (read (lookup_pipe[0], drain, sizeof (drain)) > 0)
+          ;
+        resolved = TRUE;
+        continue;
+      }
+#endif
+      if (!batch_step (t)) {
+        active--;
+        if (verbose)
+          printf (_("%s finished after %.3f seconds\n"), t->name,
+                  (double)deltime (t->start) / 1.0e6);
+      }
+    }
+  }
+
+  for (i = 0; i < batch_nidle; i++)
+    close (batch_idle[i].sd);
+  batch_free_lookups ();
+  for (i = 0; i < ntargets; i++) {
+    free (targets[i].name);
+    free (targets[i].host_name);
+    free (targets[i].server_address);
+    free (targets[i].server_url);
+  }
+  free (targets);
+  return batch_result;
+}
+
+
+
 char *perfd_time (double elapsed_time)
 {
   return fperfdata ("time", elapsed_time, "s",
@@ -1248,6 +2468,9 @@ print_help (void)
   printf (" %s\n", "-C, --certificate=INTEGER");
   printf ("   %s\n", _("Minimum number of days a certificate has to be valid. Port defaults to 443"));
   printf ("   %s\n", _("(when this option is used the url is not checked.)\n"));
+  printf (" %s\n", "--ssl-session-cache=FILE");
+  printf ("   %s\n", _("Save SSL sessions in FILE and resume them on later runs (OpenSSL only)."));
+  printf ("   %s\n", _("FILE may be shared with check_tcp and check_smtp"));
 #endif
 
   printf (" %s\n", "-e, --expect=STRING");
@@ -1255,7 +2478,7 @@ print_help (void)
   printf ("%s)\n", HTTP_EXPECT);
   printf ("    %s\n", _("If specified skips all other status line logic (ex: 3xx, 4xx, 5xx processing)"));
   printf (" %s\n", "-s, --string=STRING");
-  printf ("    %s\n", _("String to expect in the content"));
+  printf ("    %s\n", _("String to expect in the content (reading stops as soon as it is found)"));
   printf (" %s\n", "-u, --url=PATH");
   printf ("    %s\n", _("URL to GET or POST (default: /)"));
   printf (" %s\n", "-P, --post=STRING");
@@ -1263,6 +2486,12 @@ print_help (void)
   printf (" %s\n", "-N, --no-body");
   printf ("    %s\n", _("Don't wait for document body: stop reading after headers."));
   printf ("    %s\n", _("(Note that this still does an HTTP GET or POST, not a HEAD.)"));
+  printf (" %s\n", "--max-body-size=BYTES");
+  printf ("    %s\n", _("Stop reading the document body after BYTES; checks use what was read"));
+  printf (" %s\n", "--keep-alive");
+  printf ("    %s\n", _("Send HTTP/1.1 requests and keep the connection (and SSL session) open to"));
+  printf ("    %s\n", _("follow redirects to the same server, or check batch targets on the same"));
+  printf ("    %s\n", _("address and port"));
   printf (" %s\n", "-M, --max-age=SECONDS");
   printf ("    %s\n", _("Warn if document is more than SECONDS old. the number can also be of"));
   printf ("    %s\n", _("the form \"10m\" for minutes, \"10h\" for hours, or \"10d\" for days."));
@@ -1271,6 +2500,7 @@ print_help (void)
 
   printf (" %s\n", "-l, --linespan");
   printf ("    %s\n", _("Allow regex to span newlines (must precede -r or -R)"));
+  printf ("    %s\n", _("The whole page is then kept in memory instead of matched as it arrives"));
   printf (" %s\n", "-r, --regex, --ereg=STRING");
   printf ("    %s\n", _("Search page for regex STRING"));
   printf (" %s\n", "-R, --eregi=STRING");
@@ -1290,6 +2520,14 @@ print_help (void)
   printf ("    %s\n", _("How to handle redirected pages"));
   printf (" %s\n", "-m, --pagesize=INTEGER<:INTEGER>");
   printf ("    %s\n", _("Minimum page size required (bytes) : Maximum page size required (bytes)"));
+  printf (" %s\n", "--batch=FILE");
+  printf ("    %s\n", _("Check every target listed in FILE (- for stdin) from this one process."));
+  printf ("    %s\n", _("Each line is \"[http://]HOST[:PORT][/PATH] [ADDRESS]\"; all other options"));
+  printf ("    %s\n", _("apply to every target. One \"TARGET<tab>STATE<tab>OUTPUT\" line is printed"));
+  printf ("    %s\n", _("per target and the worst state is returned. The timeout applies per target,"));
+  printf ("    %s\n", _("including the lookup of its address."));
+  printf (" %s\n", "--batch-concurrency=INTEGER");
+  printf ("    %s\n", _("Maximum number of batch targets checked at the same time (default: 100)"));
 
   printf (_(UT_WARN_CRIT));
 
@@ -1338,5 +2576,7 @@ print_usage (void)
   printf ("       [-a auth] [-f <ok | warn | critcal | follow>] [-e <expect>]\n");
   printf ("       [-s string] [-l] [-r <regex> | -R <case-insensitive regex>] [-P string]\n");
   printf ("       [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>] [-A string]\n");
-  printf ("       [-k string] [-S] [-C <age>] [-T <content-type>]\n");
+  printf ("       [-k string] [-S] [-C <age>] [-T <content-type>] [--max-body-size=<bytes>]\n");
+  printf ("       [--keep-alive] [--ssl-session-cache=<file>]\n");
+  printf ("       [--batch=<file> [--batch-concurrency=<count>]]\n");
 }
@@ -37,6 +37,7 @@
 
 #include "common.h"
 #include "utils.h"
+#include "utils_counter.h"
 
 const char *progname = "check_mrtgtraf";
 const char *revision = "$Revision: 1861 $";
@@ -45,12 +46,16 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 
 int process_arguments (int, char **);
 int validate_arguments (void);
+int counter_rates (unsigned long long, unsigned long long, time_t,
+                   unsigned long *, unsigned long *);
+const char *aggregation (void);
 void print_help(void);
 void print_usage(void);
 
 char *log_file = NULL;
 int expire_minutes = -1;
 int use_average = TRUE;
+int use_counters = FALSE;
 unsigned long incoming_warning_threshold = 0L;
 unsigned long incoming_critical_threshold = 0L;
 unsigned long outgoing_warning_threshold = 0L;
@@ -78,6 +83,9 @@ main (int argc, char **argv)
 	double adjusted_outgoing_rate = 0.0;
 	char incoming_speed_rating[8];
 	char outgoing_speed_rating[8];
+	unsigned long long incoming_counter = 0;
+	unsigned long long outgoing_counter = 0;
+	unsigned long counter_timestamp = 0L;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -96,9 +104,14 @@ main (int argc, char **argv)
 
 		line++;
 
-		/* skip the first line of the log file */
-		if (line == 1)
+		/* the first line holds the interface counters at the last run */
+		if (line == 1) {
+			if (use_counters == TRUE &&
+			    sscanf (input_buffer, "%lu %llu %llu", &counter_timestamp,
+			            &incoming_counter, &outgoing_counter) != 3)
+				usage4 (_("Unable to process MRTG log file"));
 			continue;
+		}
 
 		/* break out of read loop */
 		/* if we've passed the number of entries we want to read */
@@ -129,10 +142,23 @@ main (int argc, char **argv)
 	/* close the log file */
 	fclose (fp);
 
-	/* if we couldn't read enough data, return an unknown error */
-	if (line <= 2)
+	/* if we couldn't read enough data, return an unknown error; the
+	 * counters only need the first line */
+	if (use_counters == TRUE ? line < 1 : line <= 2)
 		usage4 (_("Unable to process MRTG log file"));
 
+	/* rates from the counters instead of MRTG's own averages */
+	if (use_counters == TRUE) {
+		timestamp = counter_timestamp;
+		if (counter_rates (incoming_counter, outgoing_counter, timestamp,
+		                   &average_incoming_rate, &average_outgoing_rate) == NP_COUNTER_FIRST) {
+			printf (_("Traffic OK - %s\n"), _("No previous counter sample, rates are checked from the next run on"));
+			return STATE_OK;
+		}
+		maximum_incoming_rate = average_incoming_rate;
+		maximum_outgoing_rate = average_outgoing_rate;
+	}
+
 	/* make sure the MRTG data isn't too old */
 	time (&current_time);
 	if ((expire_minutes > 0) &&
@@ -196,8 +222,8 @@ main (int argc, char **argv)
 	}
 
 	asprintf (&error_message, _("%s. In = %0.1f %s, %s. Out = %0.1f %s|%s %s\n"),
-	          (use_average == TRUE) ? _("Avg") : _("Max"), adjusted_incoming_rate,
-	          incoming_speed_rating, (use_average == TRUE) ? _("Avg") : _("Max"),
+	          aggregation (), adjusted_incoming_rate,
+	          incoming_speed_rating, aggregation (),
 	          adjusted_outgoing_rate, outgoing_speed_rating,
 	          fperfdata("in", adjusted_incoming_rate, incoming_speed_rating,
 	                   (int)incoming_warning_threshold, incoming_warning_threshold,
@@ -215,12 +241,71 @@ main (int argc, char **argv)
 
 
 
+/* Turns the counters of the log into rates since the counters we saw
+ * on the last run, which are kept in a state file */
+int
+counter_rates (unsigned long long incoming_counter, unsigned long long outgoing_counter,
+               time_t timestamp, unsigned long *incoming_rate, unsigned long *outgoing_rate)
+{
+	np_counter_store *st;
+	struct timeval now;
+	char *path, *key;
+	double rate = 0;
+	int in_result, out_result = NP_COUNTER_ERROR;
+
+	if ((path = np_counter_path (progname)) == NULL ||
+	    (st = np_counter_open (path)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open counter state file %s: %s\n"),
+		     path ? path : progname, strerror (errno));
+
+	/* the time MRTG read the counters, not now */
+	now.tv_sec = timestamp;
+	now.tv_usec = 0;
+
+	/* rate is only set when one was computed (OK or WRAPPED) */
+	asprintf (&key, "%s:in", log_file);
+	in_result = np_counter_rate (st, key, incoming_counter, 0, &now, &rate);
+	if (in_result == NP_COUNTER_OK || in_result == NP_COUNTER_WRAPPED)
+		*incoming_rate = (unsigned long) (rate + 0.5);
+	free (key);
+	if (in_result != NP_COUNTER_ERROR) {
+		asprintf (&key, "%s:out", log_file);
+		out_result = np_counter_rate (st, key, outgoing_counter, 0, &now, &rate);
+		if (out_result == NP_COUNTER_OK || out_result == NP_COUNTER_WRAPPED)
+			*outgoing_rate = (unsigned long) (rate + 0.5);
+		free (key);
+	}
+	np_counter_close (st);
+
+	if (in_result == NP_COUNTER_ERROR || out_result == NP_COUNTER_ERROR)
+		die (STATE_UNKNOWN, _("Cannot update counter state file %s\n"), path);
+	if (in_result == NP_COUNTER_FIRST || out_result == NP_COUNTER_FIRST)
+		return NP_COUNTER_FIRST;
+	return NP_COUNTER_OK;
+}
+
+
+
+const char *
+aggregation (void)
+{
+	if (use_counters == TRUE)
+		return _("Rate");
+	return (use_average == TRUE) ? _("Avg") : _("Max");
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
 
+	enum {
+		COUNTERS = CHAR_MAX + 1
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"logfile", required_argument, 0, 'F'},
@@ -229,6 +314,7 @@ process_arguments (int argc, char **argv)
 		{"variable", required_argument, 0, 'v'},
 		{"critical", required_argument, 0, 'c'},
 		{"warning", required_argument, 0, 'w'},
+		{"rate", no_argument, 0, COUNTERS},
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -266,6 +352,9 @@ process_arguments (int argc, char **argv)
 			else
 				use_average = TRUE;
 			break;
+		case COUNTERS:	/* rates from the counters, not MRTG's averages */
+			use_counters = TRUE;
+			break;
 		case 'c':									/* warning threshold */
 			sscanf (optarg, "%lu,%lu", &incoming_critical_threshold,
 							&outgoing_critical_threshold);
@@ -357,6 +446,10 @@ print_help (void)
   printf ("    %s\n", _("Minutes after which log expires"));
   printf (" %s\n", "-a, --aggregation=(AVG|MAX)");
   printf ("    %s\n", _("Test average or maximum"));
+  printf (" %s\n", "--rate");
+  printf ("    %s\n", _("Test the rate since the last run, from the counters in the first line of"));
+  printf ("    %s\n", _("the log, instead of the rates MRTG computed. The counters of the last run"));
+  printf ("    %s %s)\n", _("are kept in $NAGIOS_PLUGIN_STATE_DIRECTORY (default"), NP_COUNTER_DIR);
   printf (" %s\n", "-w, --warning");
   printf ("    %s\n", _("Warning threshold pair <incoming>,<outgoing>"));
   printf (" %s\n", "-c, --critical");
@@ -381,5 +474,5 @@ print_usage (void)
 {
 	printf (_("Usage"));
   printf (" %s -F <log_file> -a <AVG | MAX> -v <variable> -w <warning_pair>",progname);
-  printf ("-c <critical_pair> [-e expire_minutes] [-t timeout] [-v]\n");
+  printf ("-c <critical_pair> [-e expire_minutes] [-t timeout] [-v] [--rate]\n");
 }
@@ -45,46 +45,51 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "common.h"
 #include "runcmd.h"
 #include "utils.h"
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#if defined( __linux__ )
+#include <dirent.h>
+#include <fcntl.h>
+#endif
 
 int process_arguments (int, char **);
+int scan_ps (const char *);
+#if defined( __linux__ )
+int proc_matches (int, const char *, const char *);
+int proc_daemon (int, const char *);
+int read_lock_file (const char *);
+int scan_proc (const char *);
+#endif
+unsigned long parse_time (const char *, const char *, const char **);
+unsigned long status_log_time (const char *, size_t);
+unsigned long status_log_time_stream (FILE *);
 void print_help (void);
 void print_usage (void);
 
 char *status_log = NULL;
 char *process_string = NULL;
+char *lock_file = NULL;
 int expire_minutes = 0;
 
+/* the Nagios daemon itself, when it could be told apart */
+pid_t daemon_pid = 0;
+unsigned long long daemon_start = 0;	/* jiffies after boot */
+long daemon_uptime = 0;		/* seconds */
+long daemon_rss = 0;		/* kB */
+
 int verbose = 0;
 
 int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
-	char input_buffer[MAX_INPUT_BUFFER];
 	unsigned long latest_entry_time = 0L;
-	unsigned long temp_entry_time = 0L;
 	int proc_entries = 0;
 	time_t current_time;
-	char *temp_ptr;
 	FILE *fp;
-	int procuid = 0;
-	int procpid = 0;
-	int procppid = 0;
-	int procvsz = 0;
-	int procrss = 0;
-	float procpcpu = 0;
-	char procstat[8];
-#ifdef PS_USES_PROCETIME
-	char procetime[MAX_INPUT_BUFFER];
-#endif /* PS_USES_PROCETIME */
-	char procprog[MAX_INPUT_BUFFER];
-	char *procargs;
-	int pos, cols;
-	int expected_cols = PS_COLS - 1;
-	const char *zombie = "Z";
-	char *temp_string;
-	output chld_out, chld_err;
-	size_t i;
+	struct stat st;
+	void *map;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -107,26 +112,108 @@ main (int argc, char **argv)
 		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot open status log for reading!"));
 	}
 
-	/* get the date/time of the last item updated in the log */
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-		if ((temp_ptr = strstr (input_buffer, "created=")) != NULL) {
-			temp_entry_time = strtoul (temp_ptr + 8, NULL, 10);
-			latest_entry_time = temp_entry_time;
-			break;
-		} else if ((temp_ptr = strtok (input_buffer, "]")) != NULL) {
-			temp_entry_time = strtoul (temp_ptr + 1, NULL, 10);
-			if (temp_entry_time > latest_entry_time)
-				latest_entry_time = temp_entry_time;
-		}
+	/* get the date/time of the last item updated in the log. The
+	 * status log can be hundreds of MB, so map it and only look at its
+	 * ends; read it all only where it can't be mapped (a pipe, say) */
+	if (fstat (fileno (fp), &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0 &&
+	    (map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fileno (fp), 0)) != MAP_FAILED) {
+		latest_entry_time = status_log_time (map, st.st_size);
+		munmap (map, st.st_size);
+	}
+	else {
+		latest_entry_time = status_log_time_stream (fp);
 	}
 	fclose (fp);
 
+#if defined( __linux__ )
+	/* look for the Nagios process ourselves if /proc is mounted: the one
+	 * named in the lock file if it's still there, or else all of them */
+	if (access ("/proc/self/stat", R_OK) == 0)
+		proc_entries = scan_proc (argv[0]);
+	else
+#endif
+		proc_entries = scan_ps (argv[0]);
+
+	/* reset the alarm handler */
+	alarm (0);
+
+	if (proc_entries == 0) {
+		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Could not locate a running Nagios process!"));
+	}
+
+	if (latest_entry_time == 0L) {
+		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot parse Nagios log file for valid time"));
+	}
+
+	time (&current_time);
+	if ((int)(current_time - latest_entry_time) > (expire_minutes * 60)) {
+		result = STATE_WARNING;
+	} else {
+		result = STATE_OK;
+	}
+
+	printf ("NAGIOS %s: ", (result == STATE_OK) ? _("OK") : _("WARNING"));
+	printf (ngettext ("%d process", "%d processes", proc_entries), proc_entries);
+	printf (", ");
+	printf (
+	  ngettext ("status log updated %d second ago", 
+	    "status log updated %d seconds ago", 
+	    (int) (current_time - latest_entry_time) ),
+	    (int) (current_time - latest_entry_time) );
+	if (daemon_pid > 0)
+		printf ("|%s %s", perfdata ("uptime", daemon_uptime, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+		        perfdata ("rss", daemon_rss, "KB", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+	printf ("\n");
+
+	return result;
+}
+
+
+
+/* strtoul for the mapped log, which need not end in a newline: the
+ * number at p, stopping at end. *next is left after the last digit */
+unsigned long
+parse_time (const char *p, const char *end, const char **next)
+{
+	unsigned long t = 0L;
+
+	for (; p < end && isdigit ((int)*p); p++)
+		t = t * 10 + (*p - '0');
+	*next = p;
+	return t;
+}
+
+
+
+/* Count the Nagios processes in the output of PS_COMMAND */
+int
+scan_ps (const char *self)
+{
+	int procuid = 0;
+	int procpid = 0;
+	int procppid = 0;
+	int procvsz = 0;
+	int procrss = 0;
+	float procpcpu = 0;
+	char procstat[8];
+#ifdef PS_USES_PROCETIME
+	char procetime[MAX_INPUT_BUFFER];
+#endif /* PS_USES_PROCETIME */
+	char procprog[MAX_INPUT_BUFFER];
+	char *procargs;
+	int pos, cols;
+	int expected_cols = PS_COLS - 1;
+	const char *zombie = "Z";
+	char *temp_string;
+	output chld_out, chld_err;
+	size_t i;
+	int proc_entries = 0;
+
 	if (verbose >= 2)
 		printf("command: %s\n", PS_COMMAND);
 
 	/* run the command to check for the Nagios process.. */
-	if((result = np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0)) != 0)
-		result = STATE_WARNING;
+	np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0);
 
 	/* count the number of matching Nagios processes... */
 	for(i = 0; i < chld_out.lines; i++) {
@@ -151,7 +238,7 @@ main (int argc, char **argv)
 			}
 
 			/* May get empty procargs */
-			if (!strstr(procargs, argv[0]) && strstr(procargs, process_string) && strcmp(procargs,"")) {
+			if (!strstr(procargs, self) && strstr(procargs, process_string) && strcmp(procargs,"")) {
 				proc_entries++;
 				if (verbose >= 2) {
 					printf (_("Found process: %s %s\n"), procprog, procargs);
@@ -160,39 +247,242 @@ main (int argc, char **argv)
 		}
 	}
 
-	/* If we get anything on stderr, at least set warning */
-	if(chld_err.buflen)
-		result = max_state (result, STATE_WARNING);
+	return proc_entries;
+}
 
-	/* reset the alarm handler */
-	alarm (0);
 
-	if (proc_entries == 0) {
-		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Could not locate a running Nagios process!"));
+
+#if defined( __linux__ )
+/* Whether process pid (a name in /proc, open as dfd) is Nagios: its
+ * arguments have process_string in them, as in the ps output, or its
+ * executable is process_string, however it was started */
+int
+proc_matches (int dfd, const char *pid, const char *self)
+{
+	char path[NAME_MAX + 16];
+	char args[MAX_INPUT_BUFFER];
+	int fd, n, i;
+
+	snprintf (path, sizeof (path), "%s/cmdline", pid);
+	if ((fd = openat (dfd, path, O_RDONLY)) < 0)
+		return FALSE;
+	n = read (fd, args, sizeof (args) - 1);
+	close (fd);
+	/* kernel threads have no arguments */
+	if (n <= 0)
+		return FALSE;
+	/* arguments are NUL separated */
+	for (i = 0; i < n; i++)
+		if (args[i] == '\0')
+			args[i] = ' ';
+	while (n > 0 && args[n - 1] == ' ')
+		n--;
+	args[n] = '\0';
+
+	if (!strstr (args, self) && strstr (args, process_string)) {
+		if (verbose >= 2)
+			printf (_("Found process: %s %s\n"), pid, args);
+		return TRUE;
 	}
 
-	if (latest_entry_time == 0L) {
-		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot parse Nagios log file for valid time"));
+	/* only worth a look if it's a path. Other users' processes can't
+	 * be looked at, but then their arguments did not match either */
+	if (process_string[0] == '/') {
+		snprintf (path, sizeof (path), "%s/exe", pid);
+		if ((n = readlinkat (dfd, path, args, sizeof (args) - 1)) > 0) {
+			args[n] = '\0';
+			if (!strcmp (args, process_string)) {
+				if (verbose >= 2)
+					printf (_("Found process: %s %s\n"), pid, args);
+				return TRUE;
+			}
+		}
 	}
+	return FALSE;
+}
 
-	time (&current_time);
-	if ((int)(current_time - latest_entry_time) > (expire_minutes * 60)) {
-		result = STATE_WARNING;
-	} else {
-		result = STATE_OK;
+
+
+/* Take process pid for the daemon, with its uptime and RSS from its
+ * stat, unless the one taken so far started earlier */
+int
+proc_daemon (int dfd, const char *pid)
+{
+	char path[NAME_MAX + 16];
+	char buf[1024];
+	char *p;
+	unsigned long long starttime;
+	double uptime = 0;
+	FILE *fp;
+	int fd, n, i;
+
+	snprintf (path, sizeof (path), "%s/stat", pid);
+	if ((fd = openat (dfd, path, O_RDONLY)) < 0)
+		return ERROR;
+	n = read (fd, buf, sizeof (buf) - 1);
+	close (fd);
+	if (n <= 0)
+		return ERROR;
+	buf[n] = '\0';
+
+	/* the command name may contain anything, so start after the last
+	 * ')'; then come the state and the ppid, starttime is the 20th field
+	 * after it, vsize and rss follow */
+	if ((p = strrchr (buf, ')')) == NULL || p[1] != ' ')
+		return ERROR;
+	p += 3;
+	for (i = 0; i < 18; i++)
+		strtoll (p, &p, 10);
+	starttime = strtoull (p, &p, 10);
+	if (daemon_pid > 0 && starttime >= daemon_start)
+		return OK;
+	strtoull (p, &p, 10);
+	daemon_rss = strtol (p, &p, 10) * (sysconf (_SC_PAGESIZE) / 1024);
+	daemon_start = starttime;
+
+	if ((fp = fopen ("/proc/uptime", "r")) != NULL) {
+		if (fscanf (fp, "%lf", &uptime) != 1)
+			uptime = 0;
+		fclose (fp);
 	}
+	daemon_uptime = uptime - starttime / sysconf (_SC_CLK_TCK);
+	if (daemon_uptime < 0)
+		daemon_uptime = 0;
+	daemon_pid = atoi (pid);
+	return OK;
+}
 
-	printf ("NAGIOS %s: ", (result == STATE_OK) ? _("OK") : _("WARNING"));
-	printf (ngettext ("%d process", "%d processes", proc_entries), proc_entries);
-	printf (", ");
-	printf (
-	  ngettext ("status log updated %d second ago", 
-	    "status log updated %d seconds ago", 
-	    (int) (current_time - latest_entry_time) ),
-	    (int) (current_time - latest_entry_time) );
-	printf ("\n");
 
-	return result;
+
+/* The pid in the Nagios lock file, or 0 */
+int
+read_lock_file (const char *file)
+{
+	FILE *fp;
+	int pid = 0;
+
+	if ((fp = fopen (file, "r")) == NULL) {
+		if (verbose)
+			printf (_("Cannot read lock file %s: %s\n"), file, strerror (errno));
+		return 0;
+	}
+	if (fscanf (fp, "%d", &pid) != 1 || pid < 1)
+		pid = 0;
+	fclose (fp);
+	return pid;
+}
+
+
+
+/* Count the Nagios processes in /proc rather than running ps. With a lock
+ * file that names one still running, that's the one; otherwise every
+ * process is checked, reading only its arguments. The oldest of them is
+ * taken for the daemon, as the others are its children running checks */
+int
+scan_proc (const char *self)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char pid[32];
+	int dfd, proc_entries = 0;
+
+	if (verbose >= 2)
+		printf ("command: %s\n", "/proc");
+
+	if ((dir = opendir ("/proc")) == NULL)
+		die (STATE_UNKNOWN, _("Could not read /proc: %s\n"), strerror (errno));
+	dfd = dirfd (dir);
+
+	if (lock_file != NULL) {
+		snprintf (pid, sizeof (pid), "%d", read_lock_file (lock_file));
+		if (strcmp (pid, "0") && proc_matches (dfd, pid, self) &&
+		    proc_daemon (dfd, pid) == OK) {
+			closedir (dir);
+			return 1;
+		}
+		if (verbose)
+			printf (_("Lock file %s names no running Nagios, looking at all processes\n"),
+			        lock_file);
+	}
+
+	while ((ent = readdir (dir)) != NULL) {
+		if (ent->d_name[0] < '1' || ent->d_name[0] > '9')
+			continue;
+		if (atoi (ent->d_name) == getpid ())
+			continue;
+		/* processes may exit while we look at them */
+		if (!proc_matches (dfd, ent->d_name, self))
+			continue;
+		proc_entries++;
+		proc_daemon (dfd, ent->d_name);
+	}
+
+	closedir (dir);
+	return proc_entries;
+}
+#endif /* defined(__linux__) */
+
+
+
+/* The time the status log was written. status.dat (Nagios 2 and later)
+ * says so in the created= line of its first block; status.log (Nagios 1)
+ * and nagios.log have lines starting with [timestamp], the newest last.
+ * So look in the first block, and then backwards from the end for the
+ * last [timestamp] line, stopping at the first match either way */
+unsigned long
+status_log_time (const char *log, size_t size)
+{
+	const char *end = log + size, *line, *eol, *p, *q;
+	unsigned long t;
+
+	for (line = log; line < end; line = eol + 1) {
+		if ((eol = memchr (line, '\n', end - line)) == NULL)
+			eol = end;
+		/* the end of the first block, or a log after all */
+		if (*line == '}' || *line == '[')
+			break;
+		for (p = line; p + 8 <= eol; p++)
+			if (*p == 'c' && !strncmp (p, "created=", 8))
+				return parse_time (p + 8, eol, &q);
+	}
+
+	for (eol = end; eol > log; eol = line) {
+		/* find the start of the line before eol */
+		for (line = eol - 1; line > log && line[-1] != '\n'; line--)
+			;
+		if (eol - line > 2 && line[0] == '[' && isdigit ((int)line[1])) {
+			t = parse_time (line + 1, eol, &q);
+			if (q < eol && *q == ']')
+				return t;
+		}
+	}
+	return 0L;
+}
+
+
+
+/* The same, the way it used to be done for all logs: reading through
+ * it all for the first created=, or else the newest [timestamp] */
+unsigned long
+status_log_time_stream (FILE *fp)
+{
+	char input_buffer[MAX_INPUT_BUFFER];
+	unsigned long latest_entry_time = 0L;
+	unsigned long temp_entry_time = 0L;
+	char *temp_ptr;
+
+	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		if ((temp_ptr = strstr (input_buffer, "created=")) != NULL) {
+			temp_entry_time = strtoul (temp_ptr + 8, NULL, 10);
+			latest_entry_time = temp_entry_time;
+			break;
+		} else if ((temp_ptr = strtok (input_buffer, "]")) != NULL) {
+			temp_entry_time = strtoul (temp_ptr + 1, NULL, 10);
+			if (temp_entry_time > latest_entry_time)
+				latest_entry_time = temp_entry_time;
+		}
+	}
+	return latest_entry_time;
 }
 
 
@@ -208,6 +498,7 @@ process_arguments (int argc, char **argv)
 		{"filename", required_argument, 0, 'F'},
 		{"expires", required_argument, 0, 'e'},
 		{"command", required_argument, 0, 'C'},
+		{"lockfile", required_argument, 0, 'L'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
@@ -229,7 +520,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVvF:C:e:", longopts, &option);
+		c = getopt_long (argc, argv, "+hVvF:C:L:e:", longopts, &option);
 
 		if (c == -1 || c == EOF || c == 1)
 			break;
@@ -247,6 +538,9 @@ process_arguments (int argc, char **argv)
 		case 'C':									/* command */
 			process_string = optarg;
 			break;
+		case 'L':									/* lock file */
+			lock_file = optarg;
+			break;
 		case 'e':									/* expiry time */
 			if (is_intnonneg (optarg))
 				expire_minutes = atoi (optarg);
@@ -298,8 +592,15 @@ print_help (void)
   printf ("    %s\n", _("Minutes aging after which logfile is considered stale"));
   printf (" %s\n", "-C, --command=STRING");
   printf ("    %s\n", _("Substring to search for in process arguments"));
+  printf (" %s\n", "-L, --lockfile=FILE");
+  printf ("    %s\n", _("Nagios lock file (lock_file in nagios.cfg) naming the daemon's pid"));
   printf (_(UT_VERBOSE));
   printf ("\n");
+  printf ("%s\n", _("On Linux, the processes are looked for in /proc rather than with ps: the one"));
+  printf ("%s\n", _("in the lock file if it's there, or else those whose arguments contain the"));
+  printf ("%s\n", _("command string, or whose executable it is. The uptime and RSS of the daemon"));
+  printf ("%s\n", _("are then given as perfdata."));
+  printf ("\n");
   printf ("%s\n", _("Examples:"));
   printf (" %s\n", "check_nagios -e 5 -F /usr/local/nagios/var/status.log -C /usr/local/nagios/bin/nagios");
   printf (_(UT_SUPPORT));
@@ -312,4 +613,5 @@ print_usage (void)
 {
   printf (_("Usage:"));
 	printf ("%s -F <status log file> -e <expire_minutes> -C <process_string>\n", progname);
+	printf ("       [-L <lock file>]\n");
 }
@@ -44,6 +44,7 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "common.h"
 #include "netutils.h"
 #include "utils.h"
+#include "utils_counter.h"
 
 enum checkvars {
 	CHECK_NONE,
@@ -75,6 +76,7 @@ int check_warning_value=FALSE;
 int check_critical_value=FALSE;
 enum checkvars vars_to_check = CHECK_NONE;
 int show_all=FALSE;
+int counter_rate=FALSE;
 
 char recv_buffer[MAX_INPUT_BUFFER];
 
@@ -82,6 +84,7 @@ void fetch_data (const char* address, int port, const char* sendb);
 int process_arguments(int, char **);
 void preparelist(char *string);
 int strtoularray(unsigned long *array, char *string, const char *delim);
+int rate_of_counter(const char *counter, double *value);
 void print_help(void);
 void print_usage(void);
 
@@ -325,6 +328,11 @@ int main(int argc, char **argv){
 	  		fetch_data (server_address, server_port, send_buffer);
 	  		counter_value = atof (recv_buffer);
 
+			if (counter_rate == TRUE && !rate_of_counter (value_list, &counter_value)) {
+				output_message = strdup (_("No previous sample of this counter, rates are checked from the next run on"));
+				return_code = STATE_OK;
+				break;
+			}
 
 	  		if (description == NULL)
 	    		asprintf (&output_message, "%.f", counter_value);
@@ -449,6 +457,10 @@ int main(int argc, char **argv){
 int process_arguments(int argc, char **argv){
 	int c;
 
+	enum {
+		COUNTER_RATE = CHAR_MAX + 1
+	};
+
 	int option = 0;
 	static struct option longopts[] =
 	{ 
@@ -458,6 +470,7 @@ int process_arguments(int argc, char **argv){
 		{"warning",  required_argument,0,'w'},
 		{"variable", required_argument,0,'v'},
 		{"hostname", required_argument,0,'H'},
+		{"rate",     no_argument,      0,COUNTER_RATE},
 		{"version",  no_argument,      0,'V'},
 		{"help",     no_argument,      0,'h'},
 		{0,0,0,0}
@@ -547,6 +560,9 @@ int process_arguments(int argc, char **argv){
 				critical_value=strtoul(optarg,NULL,10);
 				check_critical_value=TRUE;
 				break;
+			case COUNTER_RATE: /* COUNTER as a rate per second */
+				counter_rate = TRUE;
+				break;
 			case 'd': /* Display select for services */
 				if (!strcmp(optarg,"SHOWALL"))
 					show_all = TRUE;
@@ -570,6 +586,35 @@ int process_arguments(int argc, char **argv){
 
 
 
+/* Replaces value by its rate per second since the last run, from the
+ * sample kept in a state file per server. Returns FALSE if there was no
+ * previous sample to compare with */
+int rate_of_counter(const char *counter, double *value) {
+	np_counter_store *st;
+	struct timeval now;
+	char *name, *path;
+	double rate = 0;
+	int result;
+
+	asprintf (&name, "%s_%s_%d", progname, server_address, server_port);
+	if ((path = np_counter_path (name)) == NULL || (st = np_counter_open (path)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open counter state file %s: %s\n"),
+		     path ? path : name, strerror (errno));
+
+	gettimeofday (&now, NULL);
+	result = np_counter_rate (st, counter, (unsigned long long) (*value + 0.5), 0, &now, &rate);
+	np_counter_close (st);
+
+	if (result == NP_COUNTER_ERROR)
+		die (STATE_UNKNOWN, _("Cannot update counter state file %s\n"), path);
+	if (result == NP_COUNTER_FIRST)
+		return FALSE;
+	*value = rate;
+	return TRUE;
+}
+
+
+
 void fetch_data (const char *address, int port, const char *sendb) {
 	int result;
 
@@ -686,7 +731,9 @@ void print_help(void)
   printf ("  %s\n", _("-l \"\\\\<performance object>\\\\counter\",\"<description>"));
   printf ("  %s\n", _("The <description> parameter is optional and is given to a printf "));
   printf ("  %s\n", _("output command which requires a float parameter."));
-  printf ("  %s\n\n", _("If <description> does not include \"%%\", it is used as a label."));
+  printf ("  %s\n", _("If <description> does not include \"%%\", it is used as a label."));
+  printf ("  %s\n", _("With --rate, raw counters are checked as a rate per second since the"));
+  printf ("  %s %s).\n\n", _("last run, kept in $NAGIOS_PLUGIN_STATE_DIRECTORY (default"), NP_COUNTER_DIR);
   printf ("  %s\n", _("Some examples:"));
   printf ("  %s\n", "\"Paging file usage is %%.2f %%%%\"");
   printf ("  %s\n\n", "\"%%.f %%%% paging file used.\"");
@@ -706,5 +753,5 @@ void print_usage(void)
 {
   printf (_("Usage:"));
 	printf ("%s -H host -v variable [-p port] [-w warning] [-c critical]",progname);
-  printf ("[-l params] [-d SHOWALL] [-t timeout]\n");
+  printf ("[-l params] [-d SHOWALL] [-t timeout] [--rate]\n");
 }
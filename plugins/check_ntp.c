@@ -44,8 +44,12 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "common.h"
 #include "netutils.h"
 #include "utils.h"
+#include "utils_ntp.h"
 
 static char *server_address=NULL;
+static int port=123;
+static int samples=NP_NTP_SAMPLES;
+static int interval=0;
 static int verbose=0;
 static short do_offset=0;
 static char *owarn="60";
@@ -60,593 +64,66 @@ thresholds *jitter_thresholds = NULL;
 void print_help (void);
 void print_usage (void);
 
-/* number of times to perform each request to get a good average. */
-#define AVG_NUM 4
-
-/* max size of control message data */
-#define MAX_CM_SIZE 468
-
-/* this structure holds everything in an ntp request/response as per rfc1305 */
-typedef struct {
-	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
-	uint8_t stratum;     /* clock stratum */
-	int8_t poll;         /* polling interval */
-	int8_t precision;    /* precision of the local clock */
-	int32_t rtdelay;     /* total rt delay, as a fixed point num. see macros */
-	uint32_t rtdisp;     /* like above, but for max err to primary src */
-	uint32_t refid;      /* ref clock identifier */
-	uint64_t refts;      /* reference timestamp.  local time local clock */
-	uint64_t origts;     /* time at which request departed client */
-	uint64_t rxts;       /* time at which request arrived at server */
-	uint64_t txts;       /* time at which request departed server */
-} ntp_message;
-
-/* this structure holds data about results from querying offset from a peer */
-typedef struct {
-	time_t waiting;         /* ts set when we started waiting for a response */ 
-	int num_responses;      /* number of successfully recieved responses */
-	uint8_t stratum;        /* copied verbatim from the ntp_message */
-	double rtdelay;         /* converted from the ntp_message */
-	double rtdisp;          /* converted from the ntp_message */
-	double offset[AVG_NUM]; /* offsets from each response */
-	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
-} ntp_server_results;
-
-/* this structure holds everything in an ntp control message as per rfc1305 */
-typedef struct {
-	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
-	uint8_t op;          /* R,E,M bits and Opcode */
-	uint16_t seq;        /* Packet sequence */
-	uint16_t status;     /* Clock status */
-	uint16_t assoc;      /* Association */
-	uint16_t offset;     /* Similar to TCP sequence # */
-	uint16_t count;      /* # bytes of data */
-	char data[MAX_CM_SIZE]; /* ASCII data of the request */
-	                        /* NB: not necessarily NULL terminated! */
-} ntp_control_message;
-
-/* this is an association/status-word pair found in control packet reponses */
-typedef struct {
-	uint16_t assoc;
-	uint16_t status;
-} ntp_assoc_status_pair;
-
-/* bits 1,2 are the leap indicator */
-#define LI_MASK 0xc0
-#define LI(x) ((x&LI_MASK)>>6)
-#define LI_SET(x,y) do{ x |= ((y<<6)&LI_MASK); }while(0)
-/* and these are the values of the leap indicator */
-#define LI_NOWARNING 0x00
-#define LI_EXTRASEC 0x01
-#define LI_MISSINGSEC 0x02
-#define LI_ALARM 0x03
-/* bits 3,4,5 are the ntp version */
-#define VN_MASK 0x38
-#define VN(x)	((x&VN_MASK)>>3)
-#define VN_SET(x,y)	do{ x |= ((y<<3)&VN_MASK); }while(0)
-#define VN_RESERVED 0x02
-/* bits 6,7,8 are the ntp mode */
-#define MODE_MASK 0x07
-#define MODE(x) (x&MODE_MASK)
-#define MODE_SET(x,y)	do{ x |= (y&MODE_MASK); }while(0)
-/* here are some values */
-#define MODE_CLIENT 0x03
-#define MODE_CONTROLMSG 0x06
-/* In control message, bits 8-10 are R,E,M bits */
-#define REM_MASK 0xe0
-#define REM_RESP 0x80
-#define REM_ERROR 0x40
-#define REM_MORE 0x20
-/* In control message, bits 11 - 15 are opcode */
-#define OP_MASK 0x1f
-#define OP_SET(x,y)   do{ x |= (y&OP_MASK); }while(0)
-#define OP_READSTAT 0x01
-#define OP_READVAR  0x02
-/* In peer status bytes, bits 6,7,8 determine clock selection status */
-#define PEER_SEL(x) ((ntohs(x)>>8)&0x07)
-#define PEER_INCLUDED 0x04
-#define PEER_SYNCSOURCE 0x06
-
-/**
- ** a note about the 32-bit "fixed point" numbers:
- **
- they are divided into halves, each being a 16-bit int in network byte order:
- - the first 16 bits are an int on the left side of a decimal point.
- - the second 16 bits represent a fraction n/(2^16)
- likewise for the 64-bit "fixed point" numbers with everything doubled :) 
- **/
-
-/* macros to access the left/right 16 bits of a 32-bit ntp "fixed point"
-   number.  note that these can be used as lvalues too */
-#define L16(x) (((uint16_t*)&x)[0])
-#define R16(x) (((uint16_t*)&x)[1])
-/* macros to access the left/right 32 bits of a 64-bit ntp "fixed point"
-   number.  these too can be used as lvalues */
-#define L32(x) (((uint32_t*)&x)[0])
-#define R32(x) (((uint32_t*)&x)[1])
-
-/* ntp wants seconds since 1/1/00, epoch is 1/1/70.  this is the difference */
-#define EPOCHDIFF 0x83aa7e80UL
-
-/* extract a 32-bit ntp fixed point number into a double */
-#define NTP32asDOUBLE(x) (ntohs(L16(x)) + (double)ntohs(R16(x))/65536.0)
-
-/* likewise for a 64-bit ntp fp number */
-#define NTP64asDOUBLE(n) (double)(((uint64_t)n)?\
-                         (ntohl(L32(n))-EPOCHDIFF) + \
-                         (.00000001*(0.5+(double)(ntohl(R32(n))/42.94967296))):\
-                         0)
-
-/* convert a struct timeval to a double */
-#define TVasDOUBLE(x) (double)(x.tv_sec+(0.000001*x.tv_usec))
-
-/* convert an ntp 64-bit fp number to a struct timeval */
-#define NTP64toTV(n,t) \
-	do{ if(!n) t.tv_sec = t.tv_usec = 0; \
-	    else { \
-			t.tv_sec=ntohl(L32(n))-EPOCHDIFF; \
-			t.tv_usec=(int)(0.5+(double)(ntohl(R32(n))/4294.967296)); \
-		} \
-	}while(0)
-
-/* convert a struct timeval to an ntp 64-bit fp number */
-#define TVtoNTP64(t,n) \
-	do{ if(!t.tv_usec && !t.tv_sec) n=0x0UL; \
-		else { \
-			L32(n)=htonl(t.tv_sec + EPOCHDIFF); \
-			R32(n)=htonl((uint64_t)((4294.967296*t.tv_usec)+.5)); \
-		} \
-	} while(0)
-
-/* NTP control message header is 12 bytes, plus any data in the data
- * field, plus null padding to the nearest 32-bit boundary per rfc.
- */
-#define SIZEOF_NTPCM(m) (12+ntohs(m.count)+((m.count)?4-(ntohs(m.count)%4):0))
-
-/* finally, a little helper or two for debugging: */
-#define DBG(x) do{if(verbose>1){ x; }}while(0);
-#define PRINTSOCKADDR(x) \
-	do{ \
-		printf("%u.%u.%u.%u", (x>>24)&0xff, (x>>16)&0xff, (x>>8)&0xff, x&0xff);\
-	}while(0);
-
-/* calculate the offset of the local clock */
-static inline double calc_offset(const ntp_message *m, const struct timeval *t){
-	double client_tx, peer_rx, peer_tx, client_rx;
-	client_tx = NTP64asDOUBLE(m->origts);
-	peer_rx = NTP64asDOUBLE(m->rxts);
-	peer_tx = NTP64asDOUBLE(m->txts);
-	client_rx=TVasDOUBLE((*t));
-	return (.5*((peer_tx-client_rx)+(peer_rx-client_tx)));
-}
-
-/* print out a ntp packet in human readable/debuggable format */
-void print_ntp_message(const ntp_message *p){
-	struct timeval ref, orig, rx, tx;
-
-	NTP64toTV(p->refts,ref);
-	NTP64toTV(p->origts,orig);
-	NTP64toTV(p->rxts,rx);
-	NTP64toTV(p->txts,tx);
-
-	printf("packet contents:\n");
-	printf("\tflags: 0x%.2x\n", p->flags);
-	printf("\t  li=%d (0x%.2x)\n", LI(p->flags), p->flags&LI_MASK);
-	printf("\t  vn=%d (0x%.2x)\n", VN(p->flags), p->flags&VN_MASK);
-	printf("\t  mode=%d (0x%.2x)\n", MODE(p->flags), p->flags&MODE_MASK);
-	printf("\tstratum = %d\n", p->stratum);
-	printf("\tpoll = %g\n", pow(2, p->poll));
-	printf("\tprecision = %g\n", pow(2, p->precision));
-	printf("\trtdelay = %-.16g\n", NTP32asDOUBLE(p->rtdelay));
-	printf("\trtdisp = %-.16g\n", NTP32asDOUBLE(p->rtdisp));
-	printf("\trefid = %x\n", p->refid);
-	printf("\trefts = %-.16g\n", NTP64asDOUBLE(p->refts));
-	printf("\torigts = %-.16g\n", NTP64asDOUBLE(p->origts));
-	printf("\trxts = %-.16g\n", NTP64asDOUBLE(p->rxts));
-	printf("\ttxts = %-.16g\n", NTP64asDOUBLE(p->txts));
-}
-
-void print_ntp_control_message(const ntp_control_message *p){
-	int i=0, numpeers=0;
-	const ntp_assoc_status_pair *peer=NULL;
-
-	printf("control packet contents:\n");
-	printf("\tflags: 0x%.2x , 0x%.2x\n", p->flags, p->op);
-	printf("\t  li=%d (0x%.2x)\n", LI(p->flags), p->flags&LI_MASK);
-	printf("\t  vn=%d (0x%.2x)\n", VN(p->flags), p->flags&VN_MASK);
-	printf("\t  mode=%d (0x%.2x)\n", MODE(p->flags), p->flags&MODE_MASK);
-	printf("\t  response=%d (0x%.2x)\n", (p->op&REM_RESP)>0, p->op&REM_RESP);
-	printf("\t  more=%d (0x%.2x)\n", (p->op&REM_MORE)>0, p->op&REM_MORE);
-	printf("\t  error=%d (0x%.2x)\n", (p->op&REM_ERROR)>0, p->op&REM_ERROR);
-	printf("\t  op=%d (0x%.2x)\n", p->op&OP_MASK, p->op&OP_MASK);
-	printf("\tsequence: %d (0x%.2x)\n", ntohs(p->seq), ntohs(p->seq));
-	printf("\tstatus: %d (0x%.2x)\n", ntohs(p->status), ntohs(p->status));
-	printf("\tassoc: %d (0x%.2x)\n", ntohs(p->assoc), ntohs(p->assoc));
-	printf("\toffset: %d (0x%.2x)\n", ntohs(p->offset), ntohs(p->offset));
-	printf("\tcount: %d (0x%.2x)\n", ntohs(p->count), ntohs(p->count));
-	numpeers=ntohs(p->count)/(sizeof(ntp_assoc_status_pair));
-	if(p->op&REM_RESP && p->op&OP_READSTAT){
-		peer=(ntp_assoc_status_pair*)p->data;
-		for(i=0;i<numpeers;i++){
-			printf("\tpeer id %.2x status %.2x", 
-			       ntohs(peer[i].assoc), ntohs(peer[i].status));
-			if (PEER_SEL(peer[i].status) >= PEER_INCLUDED){
-				if(PEER_SEL(peer[i].status) >= PEER_SYNCSOURCE){
-					printf(" <-- current sync source");
-				} else {
-					printf(" <-- current sync candidate");
-				}
-			}
-			printf("\n");
-		}
-	}
-}
-
-void setup_request(ntp_message *p){
-	struct timeval t;
-
-	memset(p, 0, sizeof(ntp_message));
-	LI_SET(p->flags, LI_ALARM);
-	VN_SET(p->flags, 4);
-	MODE_SET(p->flags, MODE_CLIENT);
-	p->poll=4;
-	p->precision=(int8_t)0xfa;
-	L16(p->rtdelay)=htons(1);
-	L16(p->rtdisp)=htons(1);
-
-	gettimeofday(&t, NULL);
-	TVtoNTP64(t,p->txts);
-}
-
-/* select the "best" server from a list of servers, and return its index.
- * this is done by filtering servers based on stratum, dispersion, and
- * finally round-trip delay. */
-int best_offset_server(const ntp_server_results *slist, int nservers){
-	int i=0, j=0, cserver=0, candidates[5], csize=0;
-
-	/* for each server */
-	for(cserver=0; cserver<nservers; cserver++){
-		/* sort out servers with error flags */
-		if ( LI(slist[cserver].flags) != LI_NOWARNING ){
-			if (verbose) printf("discarding peer id %d: flags=%d\n", cserver, LI(slist[cserver].flags));
-			break;
-		}
-
-		/* compare it to each of the servers already in the candidate list */
-		for(i=0; i<csize; i++){
-			/* does it have an equal or better stratum? */
-			if(slist[cserver].stratum <= slist[i].stratum){
-				/* does it have an equal or better dispersion? */
-				if(slist[cserver].rtdisp <= slist[i].rtdisp){
-					/* does it have a better rtdelay? */
-					if(slist[cserver].rtdelay < slist[i].rtdelay){
-						break;
-					}
-				}
-			}
-		}
-
-		/* if we haven't reached the current list's end, move everyone
-		 * over one to the right, and insert the new candidate */
-		if(i<csize){
-			for(j=5; j>i; j--){
-				candidates[j]=candidates[j-1];
-			}
-		}
-		/* regardless, if they should be on the list... */
-		if(i<5) {
-			candidates[i]=cserver;
-			if(csize<5) csize++;
-		/* otherwise discard the server */
-		} else {
-			DBG(printf("discarding peer id %d\n", cserver));
-		}
-	}
-
-	if(csize>0) {
-		DBG(printf("best server selected: peer %d\n", candidates[0]));
-		return candidates[0];
-	} else {
-		DBG(printf("no peers meeting synchronization criteria :(\n"));
-		return -1;
-	}
-}
-
-/* do everything we need to get the total average offset
- * - we use a certain amount of parallelization with poll() to ensure
- *   we don't waste time sitting around waiting for single packets. 
- * - we also "manually" handle resolving host names and connecting, because
- *   we have to do it in a way that our lazy macros don't handle currently :( */
-double offset_request(const char *host, int *status){
-	int i=0, j=0, ga_result=0, num_hosts=0, *socklist=NULL, respnum=0;
-	int servers_completed=0, one_written=0, one_read=0, servers_readable=0, best_index=-1;
-	time_t now_time=0, start_ts=0;
-	ntp_message *req=NULL;
-	double avg_offset=0.;
-	struct timeval recv_time;
-	struct addrinfo *ai=NULL, *ai_tmp=NULL, hints;
-	struct pollfd *ufds=NULL;
-	ntp_server_results *servers=NULL;
-
-	/* setup hints to only return results from getaddrinfo that we'd like */
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = address_family;
-	hints.ai_protocol = IPPROTO_UDP;
-	hints.ai_socktype = SOCK_DGRAM;
-
-	/* fill in ai with the list of hosts resolved by the host name */
-	ga_result = getaddrinfo(host, "123", &hints, &ai);
-	if(ga_result!=0){
-		die(STATE_UNKNOWN, "error getting address for %s: %s\n",
-		    host, gai_strerror(ga_result));
-	}
+/* get the offset from what the survey found: the clock filter of
+ * the answers of the "best" address of the host */
+double offset_request(const np_ntp_host *host, int *status){
+	int i, one_read=0, best_index=-1;
+	double offset=0.;
 
-	/* count the number of returned hosts, and allocate stuff accordingly */
-	for(ai_tmp=ai; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){ num_hosts++; }
-	req=(ntp_message*)malloc(sizeof(ntp_message)*num_hosts);
-	if(req==NULL) die(STATE_UNKNOWN, "can not allocate ntp message array");
-	socklist=(int*)malloc(sizeof(int)*num_hosts);
-	if(socklist==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
-	ufds=(struct pollfd*)malloc(sizeof(struct pollfd)*num_hosts);
-	if(ufds==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
-	servers=(ntp_server_results*)malloc(sizeof(ntp_server_results)*num_hosts);
-	if(servers==NULL) die(STATE_UNKNOWN, "can not allocate server array");
-	memset(servers, 0, sizeof(ntp_server_results)*num_hosts);
-
-	/* setup each socket for writing, and the corresponding struct pollfd */
-	ai_tmp=ai;
-	for(i=0;ai_tmp;i++){
-		socklist[i]=socket(ai_tmp->ai_family, SOCK_DGRAM, IPPROTO_UDP);
-		if(socklist[i] == -1) {
-			perror(NULL);
-			die(STATE_UNKNOWN, "can not create new socket");
-		}
-		if(connect(socklist[i], ai_tmp->ai_addr, ai_tmp->ai_addrlen)){
-			die(STATE_UNKNOWN, "can't create socket connection");
-		} else {
-			ufds[i].fd=socklist[i];
-			ufds[i].events=POLLIN;
-			ufds[i].revents=0;
-		}
-		ai_tmp = ai_tmp->ai_next;
+	if(host->error[0])
+		die(STATE_UNKNOWN, "%s\n", host->error);
+	for(i=0; i<host->nservers; i++){
+		if(host->servers[i].num_responses) one_read=1;
 	}
-
-	/* now do AVG_NUM checks to each host.  we stop before timeout/2 seconds
-	 * have passed in order to ensure post-processing and jitter time. */
-	now_time=start_ts=time(NULL);
-	while(servers_completed<num_hosts && now_time-start_ts <= socket_timeout/2){
-		/* loop through each server and find each one which hasn't
-		 * been touched in the past second or so and is still lacking
-		 * some responses.  for each of these servers, send a new request,
-		 * and update the "waiting" timestamp with the current time. */
-		one_written=0;
-		now_time=time(NULL);
-
-		for(i=0; i<num_hosts; i++){
-			if(servers[i].waiting<now_time && servers[i].num_responses<AVG_NUM){
-				if(verbose && servers[i].waiting != 0) printf("re-");
-				if(verbose) printf("sending request to peer %d\n", i);
-				setup_request(&req[i]);
-				write(socklist[i], &req[i], sizeof(ntp_message));
-				servers[i].waiting=now_time;
-				one_written=1;
-				break;
-			}
-		}
-
-		/* quickly poll for any sockets with pending data */
-		servers_readable=poll(ufds, num_hosts, 100);
-		if(servers_readable==-1){
-			perror("polling ntp sockets");
-			die(STATE_UNKNOWN, "communication errors");
-		}
-
-		/* read from any sockets with pending data */
-		for(i=0; servers_readable && i<num_hosts; i++){
-			if(ufds[i].revents&POLLIN && servers[i].num_responses < AVG_NUM){
-				if(verbose) {
-					printf("response from peer %d: ", i);
-				}
-
-				read(ufds[i].fd, &req[i], sizeof(ntp_message));
-				gettimeofday(&recv_time, NULL);
-				DBG(print_ntp_message(&req[i]));
-				respnum=servers[i].num_responses++;
-				servers[i].offset[respnum]=calc_offset(&req[i], &recv_time);
-				if(verbose) {
-					printf("offset %.10g\n", servers[i].offset[respnum]);
-				}
-				servers[i].stratum=req[i].stratum;
-				servers[i].rtdisp=NTP32asDOUBLE(req[i].rtdisp);
-				servers[i].rtdelay=NTP32asDOUBLE(req[i].rtdelay);
-				servers[i].waiting=0;
-				servers[i].flags=req[i].flags;
-				servers_readable--;
-				one_read = 1;
-				if(servers[i].num_responses==AVG_NUM) servers_completed++;
-			}
-		}
-		/* lather, rinse, repeat. */
-	}
-
 	if (one_read == 0) {
 		die(STATE_CRITICAL, "NTP CRITICAL: No response from NTP server\n");
 	}
 
 	/* now, pick the best server from the list */
-	best_index=best_offset_server(servers, num_hosts);
+	best_index=np_ntp_best_server(host, verbose);
 	if(best_index < 0){
 		*status=STATE_UNKNOWN;
 	} else {
-		/* finally, calculate the average offset */
-		for(i=0; i<servers[best_index].num_responses;i++){
-			avg_offset+=servers[best_index].offset[j];
-		}
-		avg_offset/=servers[best_index].num_responses;
+		/* finally, the offset the clock filter made of its samples */
+		offset=host->servers[best_index].offset;
 	}
 
-	/* cleanup */
-	/* FIXME: Not closing the socket to avoid re-use of the local port
-	 * which can cause old NTP packets to be read instead of NTP control
-	 * pactets in jitter_request(). THERE MUST BE ANOTHER WAY...
-	 * for(j=0; j<num_hosts; j++){ close(socklist[j]); } */
-	free(socklist);
-	free(ufds);
-	free(servers);
-	free(req);
-	freeaddrinfo(ai);
-
-	if(verbose) printf("overall average offset: %.10g\n", avg_offset);
-	return avg_offset;
+	if(verbose) printf("filtered offset: %.10g\n", offset);
+	return offset;
 }
 
-void
-setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
-	memset(p, 0, sizeof(ntp_control_message));
-	LI_SET(p->flags, LI_NOWARNING);
-	VN_SET(p->flags, VN_RESERVED);
-	MODE_SET(p->flags, MODE_CONTROLMSG);
-	OP_SET(p->op, opcode);
-	p->seq = htons(seq);
-	/* Remaining fields are zero for requests */
-}
+/* get the average jitter of the peers asked by the survey: the sync
+ * source, or if there's none, all the candidates */
+double jitter_request(const np_ntp_host *host, int *status){
+	int i, num_selected=0, num_valid=0;
+	double rval = 0.0;
 
-/* XXX handle responses with the error bit set */
-double jitter_request(const char *host, int *status){
-	int conn=-1, i, npeers=0, num_candidates=0, syncsource_found=0;
-	int run=0, min_peer_sel=PEER_INCLUDED, num_selected=0, num_valid=0;
-	int peers_size=0, peer_offset=0;
-	ntp_assoc_status_pair *peers=NULL;
-	ntp_control_message req;
-	const char *getvar = "jitter";
-	double rval = 0.0, jitter = -1.0;
-	char *startofvalue=NULL, *nptr=NULL;
-	void *tmp;
-
-	/* Long-winded explanation:
-	 * Getting the jitter requires a number of steps:
-	 * 1) Send a READSTAT request.
-	 * 2) Interpret the READSTAT reply
-	 *  a) The data section contains a list of peer identifiers (16 bits)
-	 *     and associated status words (16 bits)
-	 *  b) We want the value of 0x06 in the SEL (peer selection) value,
-	 *     which means "current synchronizatin source".  If that's missing,
-	 *     we take anything better than 0x04 (see the rfc for details) but
-	 *     set a minimum of warning.
-	 * 3) Send a READVAR request for information on each peer identified
-	 *    in 2b greater than the minimum selection value.
-	 * 4) Extract the jitter value from the data[] (it's ASCII)
-	 */
-	my_udp_connect(server_address, 123, &conn);
-
-	/* keep sending requests until the server stops setting the
-	 * REM_MORE bit, though usually this is only 1 packet. */
-	do{
-		setup_control_request(&req, OP_READSTAT, 1);
-		DBG(printf("sending READSTAT request"));
-		write(conn, &req, SIZEOF_NTPCM(req));
-		DBG(print_ntp_control_message(&req));
-		/* Attempt to read the largest size packet possible */
-		req.count=htons(MAX_CM_SIZE);
-		DBG(printf("recieving READSTAT response"))
-		read(conn, &req, SIZEOF_NTPCM(req));
-		DBG(print_ntp_control_message(&req));
-		/* Each peer identifier is 4 bytes in the data section, which
-	 	 * we represent as a ntp_assoc_status_pair datatype.
-	 	 */
-		peers_size+=ntohs(req.count);
-		if((tmp=realloc(peers, peers_size)) == NULL)
-			free(peers), die(STATE_UNKNOWN, "can not (re)allocate 'peers' buffer\n");
-		peers=tmp;
-		memcpy((void*)((ptrdiff_t)peers+peer_offset), (void*)req.data, ntohs(req.count));
-		npeers=peers_size/sizeof(ntp_assoc_status_pair);
-		peer_offset+=ntohs(req.count);
-	} while(req.op&REM_MORE);
-
-	/* first, let's find out if we have a sync source, or if there are
-	 * at least some candidates.  in the case of the latter we'll issue
-	 * a warning but go ahead with the check on them. */
-	for (i = 0; i < npeers; i++){
-		if (PEER_SEL(peers[i].status) >= PEER_INCLUDED){
-			num_candidates++;
-			if(PEER_SEL(peers[i].status) >= PEER_SYNCSOURCE){
-				syncsource_found=1;
-				min_peer_sel=PEER_SYNCSOURCE;
-			}
-		}
-	}
-	if(verbose) printf("%d candiate peers available\n", num_candidates);
-	if(verbose && syncsource_found) printf("synchronization source found\n");
-	if(! syncsource_found){
+	if(!host->peers_read){
+		if(verbose) printf("no answer to the READSTAT request\n");
 		*status = STATE_UNKNOWN;
-		if(verbose) printf("warning: no synchronization source found\n");
+		return -1.0;
 	}
+	if(!host->syncsource_found)
+		*status = STATE_UNKNOWN;
 
-
-	for (run=0; run<AVG_NUM; run++){
-		if(verbose) printf("jitter run %d of %d\n", run+1, AVG_NUM);
-		for (i = 0; i < npeers; i++){
-			/* Only query this server if it is the current sync source */
-			if (PEER_SEL(peers[i].status) >= min_peer_sel){
-				num_selected++;
-				setup_control_request(&req, OP_READVAR, 2);
-				req.assoc = peers[i].assoc;
-				/* By spec, putting the variable name "jitter"  in the request
-				 * should cause the server to provide _only_ the jitter value.
-				 * thus reducing net traffic, guaranteeing us only a single
-				 * datagram in reply, and making intepretation much simpler
-				 */
-				/* Older servers doesn't know what jitter is, so if we get an
-				 * error on the first pass we redo it with "dispersion" */
-				strncpy(req.data, getvar, MAX_CM_SIZE-1);
-				req.count = htons(strlen(getvar));
-				DBG(printf("sending READVAR request...\n"));
-				write(conn, &req, SIZEOF_NTPCM(req));
-				DBG(print_ntp_control_message(&req));
-
-				req.count = htons(MAX_CM_SIZE);
-				DBG(printf("recieving READVAR response...\n"));
-				read(conn, &req, SIZEOF_NTPCM(req));
-				DBG(print_ntp_control_message(&req));
-
-				if(req.op&REM_ERROR && strstr(getvar, "jitter")) {
-					if(verbose) printf("The 'jitter' command failed (old ntp server?)\nRestarting with 'dispersion'...\n");
-					getvar = "dispersion";
-					num_selected--;
-					i--;
-					continue;
-				}
-
-				/* get to the float value */
-				if(verbose) {
-					printf("parsing jitter from peer %.2x: ", ntohs(peers[i].assoc));
-				}
-				startofvalue = strchr(req.data, '=');
-				if(startofvalue != NULL) {
-					startofvalue++;
-					jitter = strtod(startofvalue, &nptr);
-				}
-				if(startofvalue == NULL || startofvalue==nptr){
-					printf("warning: unable to read server jitter response.\n");
-					*status = STATE_UNKNOWN;
-				} else {
-					if(verbose) printf("%g\n", jitter);
-					num_valid++;
-					rval += jitter;
-				}
-			}
-		}
-		if(verbose){
-			printf("jitter parsed from %d/%d peers\n", num_valid, num_selected);
+	for (i = 0; i < host->npeers; i++){
+		if(!host->peers[i].selected)
+			continue;
+		num_selected++;
+		if(!host->peers[i].have_jitter){
+			printf("warning: unable to read server jitter response.\n");
+			*status = STATE_UNKNOWN;
+		} else {
+			num_valid++;
+			rval += host->peers[i].jitter;
 		}
 	}
+	if(verbose){
+		printf("jitter parsed from %d/%d peers\n", num_valid, num_selected);
+	}
 
-	rval = num_valid ? rval / num_valid : -1.0;
-
-	close(conn);
-	if(peers!=NULL) free(peers);
 	/* If we return -1.0, it means no synchronization source was found */
-	return rval;
+	return num_valid ? rval / num_valid : -1.0;
 }
 
 int process_arguments(int argc, char **argv){
@@ -664,6 +141,9 @@ int process_arguments(int argc, char **argv){
 		{"jcrit", required_argument, 0, 'k'},
 		{"timeout", required_argument, 0, 't'},
 		{"hostname", required_argument, 0, 'H'},
+		{"port", required_argument, 0, 'p'},
+		{"samples", required_argument, 0, 'n'},
+		{"interval", required_argument, 0, 'i'},
 		{0, 0, 0, 0}
 	};
 
@@ -672,7 +152,7 @@ int process_arguments(int argc, char **argv){
 		usage ("\n");
 
 	while (1) {
-		c = getopt_long (argc, argv, "Vhv46w:c:j:k:t:H:", longopts, &option);
+		c = getopt_long (argc, argv, "Vhv46w:c:j:k:t:H:p:n:i:", longopts, &option);
 		if (c == -1 || c == EOF || c == 1)
 			break;
 
@@ -709,6 +189,18 @@ int process_arguments(int argc, char **argv){
 				usage2(_("Invalid hostname/address"), optarg);
 			server_address = strdup(optarg);
 			break;
+		case 'p':
+			if (!is_intpos(optarg) || (port = atoi(optarg)) > 65535)
+				usage2(_("Port must be a positive integer"), optarg);
+			break;
+		case 'n':
+			if (!is_intpos(optarg) || (samples = atoi(optarg)) > NP_NTP_MAX_SAMPLES)
+				usage2(_("Samples must be a positive integer up to 8"), optarg);
+			break;
+		case 'i':
+			if (!is_intnonneg(optarg) || (interval = atoi(optarg)) > 999)
+				usage2(_("Interval must be an integer between 0 and 999 (ms)"), optarg);
+			break;
 		case 't':
 			socket_timeout=atoi(optarg);
 			break;
@@ -756,6 +248,8 @@ int main(int argc, char *argv[]){
 	int result, offset_result, jitter_result;
 	double offset=0, jitter=0;
 	char *result_line, *perfdata_line;
+	np_ntp_host *hosts=NULL;
+	int nhosts=0;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -775,7 +269,19 @@ int main(int argc, char *argv[]){
 	/* set socket timeout */
 	alarm (socket_timeout);
 
-	offset = offset_request(server_address, &offset_result);
+	/* If not told to check the jitter, we don't even send control
+	 * packets for it. The jitter is checked using NTP control packets,
+	 * which not all servers recognize.  Trying to check the jitter on
+	 * OpenNTPD (for example) will result in an error.
+	 * We stop before timeout/2 seconds have passed in order to ensure
+	 * post-processing time. */
+	if(np_ntp_add_host(&hosts, &nhosts, server_address) == NULL)
+		die(STATE_UNKNOWN, _("Could not allocate memory for the host list\n"));
+	np_ntp_survey(hosts, nhosts, NP_NTP_TIME | (do_jitter ? NP_NTP_PEERS : 0),
+	              samples, interval, address_family, port,
+	              socket_timeout*1000/2, verbose);
+
+	offset = offset_request(&hosts[0], &offset_result);
 	/* check_ntp used to always return CRITICAL if offset_result == STATE_UNKNOWN.
 	 * Now we'll only do that is the offset thresholds were set */
 	if (do_offset && offset_result == STATE_UNKNOWN) {
@@ -784,13 +290,8 @@ int main(int argc, char *argv[]){
 		result = get_status(fabs(offset), offset_thresholds);
 	}
 
-	/* If not told to check the jitter, we don't even send packets.
-	 * jitter is checked using NTP control packets, which not all
-	 * servers recognize.  Trying to check the jitter on OpenNTPD
-	 * (for example) will result in an error
-	 */
 	if(do_jitter){
-		jitter=jitter_request(server_address, &jitter_result);
+		jitter=jitter_request(&hosts[0], &jitter_result);
 		result = max_state_alt(result, get_status(jitter, jitter_thresholds));
 		/* -1 indicates that we couldn't calculate the jitter
 		 * Only overrides STATE_OK from the offset */
@@ -826,6 +327,7 @@ int main(int argc, char *argv[]){
 	}
 	printf("%s|%s\n", result_line, perfdata_line);
 
+	np_ntp_free_hosts(hosts, nhosts);
 	if(server_address!=NULL) free(server_address);
 	return result;
 }
@@ -845,6 +347,11 @@ void print_help(void){
 	print_usage();
 	printf (_(UT_HELP_VRSN));
 	printf (_(UT_HOST_PORT), 'p', "123");
+	printf (" %s\n", "-n, --samples=INTEGER");
+	printf ("    %s", _("Time samples to take of each server at most (default: "));
+	printf ("%d)\n", NP_NTP_SAMPLES);
+	printf (" %s\n", "-i, --interval=INTEGER");
+	printf ("    %s\n", _("Milliseconds to wait after each answer before the next request (default: 0)"));
 	printf (" %s\n", "-w, --warning=THRESHOLD");
 	printf ("    %s\n", _("Offset to result in warning status (seconds)"));
 	printf (" %s\n", "-c, --critical=THRESHOLD");
@@ -877,5 +384,6 @@ void
 print_usage(void)
 {
   printf (_("Usage:"));
-  printf(" %s -H <host> [-w <warn>] [-c <crit>] [-j <warn>] [-k <crit>] [-v verbose]\n", progname);
+  printf(" %s -H <host> [-w <warn>] [-c <crit>] [-j <warn>] [-k <crit>]\n", progname);
+  printf("       [-n <samples>] [-i <interval>] [-v verbose]\n");
 }
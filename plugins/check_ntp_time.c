@@ -48,8 +48,14 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "common.h"
 #include "netutils.h"
 #include "utils.h"
-
-static char *server_address=NULL;
+#include "utils_ntp.h"
+
+static np_ntp_host *hosts=NULL;
+static int nhosts=0;
+static int survey=0;
+static int port=123;
+static int samples=NP_NTP_SAMPLES;
+static int interval=0;
 static int verbose=0;
 static int quiet=0;
 static char *owarn="60";
@@ -57,389 +63,63 @@ static char *ocrit="120";
 
 int process_arguments (int, char **);
 thresholds *offset_thresholds = NULL;
+char *perfd_offset (double);
 void print_help (void);
 void print_usage (void);
 
-/* number of times to perform each request to get a good average. */
-#define AVG_NUM 4
-
-/* max size of control message data */
-#define MAX_CM_SIZE 468
-
-/* this structure holds everything in an ntp request/response as per rfc1305 */
-typedef struct {
-	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
-	uint8_t stratum;     /* clock stratum */
-	int8_t poll;         /* polling interval */
-	int8_t precision;    /* precision of the local clock */
-	int32_t rtdelay;     /* total rt delay, as a fixed point num. see macros */
-	uint32_t rtdisp;     /* like above, but for max err to primary src */
-	uint32_t refid;      /* ref clock identifier */
-	uint64_t refts;      /* reference timestamp.  local time local clock */
-	uint64_t origts;     /* time at which request departed client */
-	uint64_t rxts;       /* time at which request arrived at server */
-	uint64_t txts;       /* time at which request departed server */
-} ntp_message;
-
-/* this structure holds data about results from querying offset from a peer */
-typedef struct {
-	time_t waiting;         /* ts set when we started waiting for a response */ 
-	int num_responses;      /* number of successfully recieved responses */
-	uint8_t stratum;        /* copied verbatim from the ntp_message */
-	double rtdelay;         /* converted from the ntp_message */
-	double rtdisp;          /* converted from the ntp_message */
-	double offset[AVG_NUM]; /* offsets from each response */
-	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
-} ntp_server_results;
-
-/* bits 1,2 are the leap indicator */
-#define LI_MASK 0xc0
-#define LI(x) ((x&LI_MASK)>>6)
-#define LI_SET(x,y) do{ x |= ((y<<6)&LI_MASK); }while(0)
-/* and these are the values of the leap indicator */
-#define LI_NOWARNING 0x00
-#define LI_EXTRASEC 0x01
-#define LI_MISSINGSEC 0x02
-#define LI_ALARM 0x03
-/* bits 3,4,5 are the ntp version */
-#define VN_MASK 0x38
-#define VN(x)	((x&VN_MASK)>>3)
-#define VN_SET(x,y)	do{ x |= ((y<<3)&VN_MASK); }while(0)
-#define VN_RESERVED 0x02
-/* bits 6,7,8 are the ntp mode */
-#define MODE_MASK 0x07
-#define MODE(x) (x&MODE_MASK)
-#define MODE_SET(x,y)	do{ x |= (y&MODE_MASK); }while(0)
-/* here are some values */
-#define MODE_CLIENT 0x03
-#define MODE_CONTROLMSG 0x06
-/* In control message, bits 8-10 are R,E,M bits */
-#define REM_MASK 0xe0
-#define REM_RESP 0x80
-#define REM_ERROR 0x40
-#define REM_MORE 0x20
-/* In control message, bits 11 - 15 are opcode */
-#define OP_MASK 0x1f
-#define OP_SET(x,y)   do{ x |= (y&OP_MASK); }while(0)
-#define OP_READSTAT 0x01
-#define OP_READVAR  0x02
-/* In peer status bytes, bits 6,7,8 determine clock selection status */
-#define PEER_SEL(x) ((ntohs(x)>>8)&0x07)
-#define PEER_INCLUDED 0x04
-#define PEER_SYNCSOURCE 0x06
-
-/**
- ** a note about the 32-bit "fixed point" numbers:
- **
- they are divided into halves, each being a 16-bit int in network byte order:
- - the first 16 bits are an int on the left side of a decimal point.
- - the second 16 bits represent a fraction n/(2^16)
- likewise for the 64-bit "fixed point" numbers with everything doubled :) 
- **/
-
-/* macros to access the left/right 16 bits of a 32-bit ntp "fixed point"
-   number.  note that these can be used as lvalues too */
-#define L16(x) (((uint16_t*)&x)[0])
-#define R16(x) (((uint16_t*)&x)[1])
-/* macros to access the left/right 32 bits of a 64-bit ntp "fixed point"
-   number.  these too can be used as lvalues */
-#define L32(x) (((uint32_t*)&x)[0])
-#define R32(x) (((uint32_t*)&x)[1])
-
-/* ntp wants seconds since 1/1/00, epoch is 1/1/70.  this is the difference */
-#define EPOCHDIFF 0x83aa7e80UL
-
-/* extract a 32-bit ntp fixed point number into a double */
-#define NTP32asDOUBLE(x) (ntohs(L16(x)) + (double)ntohs(R16(x))/65536.0)
-
-/* likewise for a 64-bit ntp fp number */
-#define NTP64asDOUBLE(n) (double)(((uint64_t)n)?\
-                         (ntohl(L32(n))-EPOCHDIFF) + \
-                         (.00000001*(0.5+(double)(ntohl(R32(n))/42.94967296))):\
-                         0)
-
-/* convert a struct timeval to a double */
-#define TVasDOUBLE(x) (double)(x.tv_sec+(0.000001*x.tv_usec))
-
-/* convert an ntp 64-bit fp number to a struct timeval */
-#define NTP64toTV(n,t) \
-	do{ if(!n) t.tv_sec = t.tv_usec = 0; \
-	    else { \
-			t.tv_sec=ntohl(L32(n))-EPOCHDIFF; \
-			t.tv_usec=(int)(0.5+(double)(ntohl(R32(n))/4294.967296)); \
-		} \
-	}while(0)
-
-/* convert a struct timeval to an ntp 64-bit fp number */
-#define TVtoNTP64(t,n) \
-	do{ if(!t.tv_usec && !t.tv_sec) n=0x0UL; \
-		else { \
-			L32(n)=htonl(t.tv_sec + EPOCHDIFF); \
-			R32(n)=htonl((uint64_t)((4294.967296*t.tv_usec)+.5)); \
-		} \
-	} while(0)
-
-/* NTP control message header is 12 bytes, plus any data in the data
- * field, plus null padding to the nearest 32-bit boundary per rfc.
- */
-#define SIZEOF_NTPCM(m) (12+ntohs(m.count)+((m.count)?4-(ntohs(m.count)%4):0))
-
-/* finally, a little helper or two for debugging: */
-#define DBG(x) do{if(verbose>1){ x; }}while(0);
-#define PRINTSOCKADDR(x) \
-	do{ \
-		printf("%u.%u.%u.%u", (x>>24)&0xff, (x>>16)&0xff, (x>>8)&0xff, x&0xff);\
-	}while(0);
-
-/* calculate the offset of the local clock */
-static inline double calc_offset(const ntp_message *m, const struct timeval *t){
-	double client_tx, peer_rx, peer_tx, client_rx;
-	client_tx = NTP64asDOUBLE(m->origts);
-	peer_rx = NTP64asDOUBLE(m->rxts);
-	peer_tx = NTP64asDOUBLE(m->txts);
-	client_rx=TVasDOUBLE((*t));
-	return (.5*((peer_tx-client_rx)+(peer_rx-client_tx)));
-}
-
-/* print out a ntp packet in human readable/debuggable format */
-void print_ntp_message(const ntp_message *p){
-	struct timeval ref, orig, rx, tx;
-
-	NTP64toTV(p->refts,ref);
-	NTP64toTV(p->origts,orig);
-	NTP64toTV(p->rxts,rx);
-	NTP64toTV(p->txts,tx);
-
-	printf("packet contents:\n");
-	printf("\tflags: 0x%.2x\n", p->flags);
-	printf("\t  li=%d (0x%.2x)\n", LI(p->flags), p->flags&LI_MASK);
-	printf("\t  vn=%d (0x%.2x)\n", VN(p->flags), p->flags&VN_MASK);
-	printf("\t  mode=%d (0x%.2x)\n", MODE(p->flags), p->flags&MODE_MASK);
-	printf("\tstratum = %d\n", p->stratum);
-	printf("\tpoll = %g\n", pow(2, p->poll));
-	printf("\tprecision = %g\n", pow(2, p->precision));
-	printf("\trtdelay = %-.16g\n", NTP32asDOUBLE(p->rtdelay));
-	printf("\trtdisp = %-.16g\n", NTP32asDOUBLE(p->rtdisp));
-	printf("\trefid = %x\n", p->refid);
-	printf("\trefts = %-.16g\n", NTP64asDOUBLE(p->refts));
-	printf("\torigts = %-.16g\n", NTP64asDOUBLE(p->origts));
-	printf("\trxts = %-.16g\n", NTP64asDOUBLE(p->rxts));
-	printf("\ttxts = %-.16g\n", NTP64asDOUBLE(p->txts));
-}
-
-void setup_request(ntp_message *p){
-	struct timeval t;
-
-	memset(p, 0, sizeof(ntp_message));
-	LI_SET(p->flags, LI_ALARM);
-	VN_SET(p->flags, 4);
-	MODE_SET(p->flags, MODE_CLIENT);
-	p->poll=4;
-	p->precision=(int8_t)0xfa;
-	L16(p->rtdelay)=htons(1);
-	L16(p->rtdisp)=htons(1);
-
-	gettimeofday(&t, NULL);
-	TVtoNTP64(t,p->txts);
-}
-
-/* select the "best" server from a list of servers, and return its index.
- * this is done by filtering servers based on stratum, dispersion, and
- * finally round-trip delay. */
-int best_offset_server(const ntp_server_results *slist, int nservers){
-	int i=0, j=0, cserver=0, candidates[5], csize=0;
-
-	/* for each server */
-	for(cserver=0; cserver<nservers; cserver++){
-		/* sort out servers with error flags */
-		if ( LI(slist[cserver].flags) != LI_NOWARNING ){
-			if (verbose) printf("discarding peer id %d: flags=%d\n", cserver, LI(slist[cserver].flags));
-			break;
-		}
-
-		/* compare it to each of the servers already in the candidate list */
-		for(i=0; i<csize; i++){
-			/* does it have an equal or better stratum? */
-			if(slist[cserver].stratum <= slist[i].stratum){
-				/* does it have an equal or better dispersion? */
-				if(slist[cserver].rtdisp <= slist[i].rtdisp){
-					/* does it have a better rtdelay? */
-					if(slist[cserver].rtdelay < slist[i].rtdelay){
-						break;
-					}
-				}
-			}
-		}
-
-		/* if we haven't reached the current list's end, move everyone
-		 * over one to the right, and insert the new candidate */
-		if(i<csize){
-			for(j=5; j>i; j--){
-				candidates[j]=candidates[j-1];
-			}
-		}
-		/* regardless, if they should be on the list... */
-		if(i<5) {
-			candidates[i]=cserver;
-			if(csize<5) csize++;
-		/* otherwise discard the server */
-		} else {
-			DBG(printf("discarding peer id %d\n", cserver));
-		}
-	}
+/* work out the state of one host from the survey, and its output */
+int offset_result(const np_ntp_host *host, char **result_line, char **perfdata_line){
+	int i, result, best_index=-1, one_read=0;
+	double offset=0;
 
-	if(csize>0) {
-		DBG(printf("best server selected: peer %d\n", candidates[0]));
-		return candidates[0];
-	} else {
-		DBG(printf("no peers meeting synchronization criteria :(\n"));
-		return -1;
+	/* no perfdata at all when there's nothing to go by */
+	*perfdata_line = NULL;
+	if(host->error[0]){
+		asprintf(result_line, "%s %s", _("NTP UNKNOWN:"), host->error);
+		return STATE_UNKNOWN;
 	}
-}
-
-/* do everything we need to get the total average offset
- * - we use a certain amount of parallelization with poll() to ensure
- *   we don't waste time sitting around waiting for single packets. 
- * - we also "manually" handle resolving host names and connecting, because
- *   we have to do it in a way that our lazy macros don't handle currently :( */
-double offset_request(const char *host, int *status){
-	int i=0, j=0, ga_result=0, num_hosts=0, *socklist=NULL, respnum=0;
-	int servers_completed=0, one_written=0, one_read=0, servers_readable=0, best_index=-1;
-	time_t now_time=0, start_ts=0;
-	ntp_message *req=NULL;
-	double avg_offset=0.;
-	struct timeval recv_time;
-	struct addrinfo *ai=NULL, *ai_tmp=NULL, hints;
-	struct pollfd *ufds=NULL;
-	ntp_server_results *servers=NULL;
-
-	/* setup hints to only return results from getaddrinfo that we'd like */
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = address_family;
-	hints.ai_protocol = IPPROTO_UDP;
-	hints.ai_socktype = SOCK_DGRAM;
-
-	/* fill in ai with the list of hosts resolved by the host name */
-	ga_result = getaddrinfo(host, "123", &hints, &ai);
-	if(ga_result!=0){
-		die(STATE_UNKNOWN, "error getting address for %s: %s\n",
-		    host, gai_strerror(ga_result));
+	for(i=0; i<host->nservers; i++){
+		if(host->servers[i].num_responses) one_read=1;
 	}
-
-	/* count the number of returned hosts, and allocate stuff accordingly */
-	for(ai_tmp=ai; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){ num_hosts++; }
-	req=(ntp_message*)malloc(sizeof(ntp_message)*num_hosts);
-	if(req==NULL) die(STATE_UNKNOWN, "can not allocate ntp message array");
-	socklist=(int*)malloc(sizeof(int)*num_hosts);
-	if(socklist==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
-	ufds=(struct pollfd*)malloc(sizeof(struct pollfd)*num_hosts);
-	if(ufds==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
-	servers=(ntp_server_results*)malloc(sizeof(ntp_server_results)*num_hosts);
-	if(servers==NULL) die(STATE_UNKNOWN, "can not allocate server array");
-	memset(servers, 0, sizeof(ntp_server_results)*num_hosts);
-
-	/* setup each socket for writing, and the corresponding struct pollfd */
-	ai_tmp=ai;
-	for(i=0;ai_tmp;i++){
-		socklist[i]=socket(ai_tmp->ai_family, SOCK_DGRAM, IPPROTO_UDP);
-		if(socklist[i] == -1) {
-			perror(NULL);
-			die(STATE_UNKNOWN, "can not create new socket");
-		}
-		if(connect(socklist[i], ai_tmp->ai_addr, ai_tmp->ai_addrlen)){
-			die(STATE_UNKNOWN, "can't create socket connection");
-		} else {
-			ufds[i].fd=socklist[i];
-			ufds[i].events=POLLIN;
-			ufds[i].revents=0;
-		}
-		ai_tmp = ai_tmp->ai_next;
+	if(one_read == 0){
+		asprintf(result_line, "%s %s", _("NTP CRITICAL:"), _("No response from NTP server"));
+		return STATE_CRITICAL;
 	}
+	*perfdata_line = "";
 
-	/* now do AVG_NUM checks to each host. We stop before timeout/2 seconds
-	 * have passed in order to ensure post-processing and jitter time. */
-	now_time=start_ts=time(NULL);
-	while(servers_completed<num_hosts && now_time-start_ts <= socket_timeout/2){
-		/* loop through each server and find each one which hasn't
-		 * been touched in the past second or so and is still lacking
-		 * some responses. For each of these servers, send a new request,
-		 * and update the "waiting" timestamp with the current time. */
-		one_written=0;
-		now_time=time(NULL);
-
-		for(i=0; i<num_hosts; i++){
-			if(servers[i].waiting<now_time && servers[i].num_responses<AVG_NUM){
-				if(verbose && servers[i].waiting != 0) printf("re-");
-				if(verbose) printf("sending request to peer %d\n", i);
-				setup_request(&req[i]);
-				write(socklist[i], &req[i], sizeof(ntp_message));
-				servers[i].waiting=now_time;
-				one_written=1;
-				break;
-			}
-		}
-
-		/* quickly poll for any sockets with pending data */
-		servers_readable=poll(ufds, num_hosts, 100);
-		if(servers_readable==-1){
-			perror("polling ntp sockets");
-			die(STATE_UNKNOWN, "communication errors");
-		}
-
-		/* read from any sockets with pending data */
-		for(i=0; servers_readable && i<num_hosts; i++){
-			if(ufds[i].revents&POLLIN && servers[i].num_responses < AVG_NUM){
-				if(verbose) {
-					printf("response from peer %d: ", i);
-				}
-
-				read(ufds[i].fd, &req[i], sizeof(ntp_message));
-				gettimeofday(&recv_time, NULL);
-				DBG(print_ntp_message(&req[i]));
-				respnum=servers[i].num_responses++;
-				servers[i].offset[respnum]=calc_offset(&req[i], &recv_time);
-				if(verbose) {
-					printf("offset %.10g\n", servers[i].offset[respnum]);
-				}
-				servers[i].stratum=req[i].stratum;
-				servers[i].rtdisp=NTP32asDOUBLE(req[i].rtdisp);
-				servers[i].rtdelay=NTP32asDOUBLE(req[i].rtdelay);
-				servers[i].waiting=0;
-				servers[i].flags=req[i].flags;
-				servers_readable--;
-				one_read = 1;
-				if(servers[i].num_responses==AVG_NUM) servers_completed++;
-			}
-		}
-		/* lather, rinse, repeat. */
+	/* now, pick the best server from the list */
+	best_index=np_ntp_best_server(host, verbose);
+	if(best_index < 0){
+		result = (quiet == 1 ? STATE_UNKNOWN : STATE_CRITICAL);
+	} else {
+		/* finally, the offset the clock filter made of its samples */
+		offset=host->servers[best_index].offset;
+		if(verbose) printf("filtered offset: %.10g (jitter %.6g, delay %.6g)\n", offset,
+		                   host->servers[best_index].jitter, host->servers[best_index].delay);
+		result = get_status(fabs(offset), offset_thresholds);
 	}
 
-	if (one_read == 0) {
-		die(STATE_CRITICAL, "NTP CRITICAL: No response from NTP server\n");
+	switch (result) {
+		case STATE_CRITICAL :
+			asprintf(result_line, _("NTP CRITICAL:"));
+			break;
+		case STATE_WARNING :
+			asprintf(result_line, _("NTP WARNING:"));
+			break;
+		case STATE_OK :
+			asprintf(result_line, _("NTP OK:"));
+			break;
+		default :
+			asprintf(result_line, _("NTP UNKNOWN:"));
+			break;
 	}
-
-	/* now, pick the best server from the list */
-	best_index=best_offset_server(servers, num_hosts);
 	if(best_index < 0){
-		*status=STATE_UNKNOWN;
+		asprintf(result_line, "%s %s", *result_line, _("Offset unknown"));
 	} else {
-		/* finally, calculate the average offset */
-		for(i=0; i<servers[best_index].num_responses;i++){
-			avg_offset+=servers[best_index].offset[j];
-		}
-		avg_offset/=servers[best_index].num_responses;
+		asprintf(result_line, "%s %s %.10g secs", *result_line, _("Offset"), offset);
+		asprintf(perfdata_line, "%s", perfd_offset(offset));
 	}
-
-	/* cleanup */
-	for(j=0; j<num_hosts; j++){ close(socklist[j]); }
-	free(socklist);
-	free(ufds);
-	free(servers);
-	free(req);
-	freeaddrinfo(ai);
-
-	if(verbose) printf("overall average offset: %.10g\n", avg_offset);
-	return avg_offset;
+	return result;
 }
 
 int process_arguments(int argc, char **argv){
@@ -456,6 +136,10 @@ int process_arguments(int argc, char **argv){
 		{"critical", required_argument, 0, 'c'},
 		{"timeout", required_argument, 0, 't'},
 		{"hostname", required_argument, 0, 'H'},
+		{"port", required_argument, 0, 'p'},
+		{"samples", required_argument, 0, 'n'},
+		{"interval", required_argument, 0, 'i'},
+		{"hostfile", required_argument, 0, 'f'},
 		{0, 0, 0, 0}
 	};
 
@@ -464,7 +148,7 @@ int process_arguments(int argc, char **argv){
 		usage ("\n");
 
 	while (1) {
-		c = getopt_long (argc, argv, "Vhv46qw:c:t:H:", longopts, &option);
+		c = getopt_long (argc, argv, "Vhv46qw:c:t:H:p:n:i:f:", longopts, &option);
 		if (c == -1 || c == EOF || c == 1)
 			break;
 
@@ -492,7 +176,25 @@ int process_arguments(int argc, char **argv){
 		case 'H':
 			if(is_host(optarg) == FALSE)
 				usage2(_("Invalid hostname/address"), optarg);
-			server_address = strdup(optarg);
+			if(np_ntp_add_host(&hosts, &nhosts, optarg) == NULL)
+				die(STATE_UNKNOWN, _("Could not allocate memory for the host list\n"));
+			break;
+		case 'f':
+			if(np_ntp_read_hosts(optarg, &hosts, &nhosts) == ERROR)
+				die(STATE_UNKNOWN, _("Could not read hosts from %s: %s\n"), optarg, strerror(errno));
+			survey = 1;
+			break;
+		case 'p':
+			if (!is_intpos(optarg) || (port = atoi(optarg)) > 65535)
+				usage2(_("Port must be a positive integer"), optarg);
+			break;
+		case 'n':
+			if (!is_intpos(optarg) || (samples = atoi(optarg)) > NP_NTP_MAX_SAMPLES)
+				usage2(_("Samples must be a positive integer up to 8"), optarg);
+			break;
+		case 'i':
+			if (!is_intnonneg(optarg) || (interval = atoi(optarg)) > 999)
+				usage2(_("Interval must be an integer between 0 and 999 (ms)"), optarg);
 			break;
 		case 't':
 			socket_timeout=atoi(optarg);
@@ -514,9 +216,10 @@ int process_arguments(int argc, char **argv){
 		}
 	}
 
-	if(server_address == NULL){
+	if(nhosts == 0){
 		usage4(_("Hostname was not supplied"));
 	}
+	if(nhosts > 1) survey = 1;
 
 	return 0;
 }
@@ -530,15 +233,14 @@ char *perfd_offset (double offset)
 }
 
 int main(int argc, char *argv[]){
-	int result, offset_result;
-	double offset=0;
+	int i, result, host_result;
 	char *result_line, *perfdata_line;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
 	textdomain (PACKAGE);
 
-	result = offset_result = STATE_OK;
+	result = STATE_OK;
 
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
@@ -551,37 +253,24 @@ int main(int argc, char *argv[]){
 	/* set socket timeout */
 	alarm (socket_timeout);
 
-	offset = offset_request(server_address, &offset_result);
-	if (offset_result == STATE_UNKNOWN) {
-		result = (quiet == 1 ? STATE_UNKNOWN : STATE_CRITICAL);
-	} else {
-		result = get_status(fabs(offset), offset_thresholds);
-	}
-
-	switch (result) {
-		case STATE_CRITICAL :
-			asprintf(&result_line, _("NTP CRITICAL:"));
-			break;
-		case STATE_WARNING :
-			asprintf(&result_line, _("NTP WARNING:"));
-			break;
-		case STATE_OK :
-			asprintf(&result_line, _("NTP OK:"));
-			break;
-		default :
-			asprintf(&result_line, _("NTP UNKNOWN:"));
-			break;
-	}
-	if(offset_result == STATE_UNKNOWN){
-		asprintf(&result_line, "%s %s", result_line, _("Offset unknown"));
-		asprintf(&perfdata_line, "");
-	} else {
-		asprintf(&result_line, "%s %s %.10g secs", result_line, _("Offset"), offset);
-		asprintf(&perfdata_line, "%s", perfd_offset(offset));
+	/* ask all the hosts at once. We stop before timeout/2 seconds
+	 * have passed in order to ensure post-processing and jitter time. */
+	np_ntp_survey(hosts, nhosts, NP_NTP_TIME, samples, interval,
+	              address_family, port, socket_timeout*1000/2, verbose);
+
+	/* in a survey, one line for each host, and the worst state */
+	for(i=0; i<nhosts; i++){
+		host_result = offset_result(&hosts[i], &result_line, &perfdata_line);
+		result = (i == 0 ? host_result : max_state_alt(result, host_result));
+		if(survey)
+			printf("%s: ", hosts[i].name);
+		if(perfdata_line)
+			printf("%s|%s\n", result_line, perfdata_line);
+		else
+			printf("%s\n", result_line);
 	}
-	printf("%s|%s\n", result_line, perfdata_line);
 
-	if(server_address!=NULL) free(server_address);
+	np_ntp_free_hosts(hosts, nhosts);
 	return result;
 }
 
@@ -598,6 +287,13 @@ void print_help(void){
 	print_usage();
 	printf (_(UT_HELP_VRSN));
 	printf (_(UT_HOST_PORT), 'p', "123");
+	printf (" %s\n", "-n, --samples=INTEGER");
+	printf ("    %s", _("Time samples to take of each server at most (default: "));
+	printf ("%d)\n", NP_NTP_SAMPLES);
+	printf (" %s\n", "-i, --interval=INTEGER");
+	printf ("    %s\n", _("Milliseconds to wait after each answer before the next request (default: 0)"));
+	printf (" %s\n", "-f, --hostfile=FILE");
+	printf ("    %s\n", _("Check the hosts named in FILE (- for stdin), one per line, as with -H"));
 	printf (" %s\n", "-q, --quiet");
 	printf ("    %s\n", _("Returns UNKNOWN instead of CRITICAL if offset cannot be found"));
 	printf (" %s\n", "-w, --warning=THRESHOLD");
@@ -614,6 +310,13 @@ void print_help(void){
 	printf(" %s\n\n", _("external libraries."));
 	printf(" %s\n", _("If you'd rather want to monitor an NTP server, please use"));
 	printf(" %s\n\n", _("check_ntp_peer."));
+	printf(" %s\n", _("Given more than one -H, or -f, all the servers are asked at once and there"));
+	printf(" %s\n", _("is a result line for each of them. The exit code is then the worst state"));
+	printf(" %s\n\n", _("of all of them."));
+	printf(" %s\n", _("The offset of a server is weighted towards its answers of least round"));
+	printf(" %s\n", _("trip delay, as the NTP clock filter does. Sampling stops before -n"));
+	printf(" %s\n", _("answers once they agree within the error of the best one; on lossy or"));
+	printf(" %s\n\n", _("congested links, a larger -n and some -i make for a steadier offset."));
 
 	printf(" %s\n", _("See:"));
 	printf(" %s\n", ("http://nagiosplug.sourceforge.net/developer-guidelines.html#THRESHOLDFORMAT"));
@@ -622,6 +325,8 @@ void print_help(void){
 	printf("\n");
 	printf("%s\n", _("Examples:"));
 	printf("  %s\n", ("./check_ntp_time -H ntpserv -w 0.5 -c 1"));
+	printf("  %s\n", ("./check_ntp_time -f ntpservers.txt -w 0.5 -c 1"));
+	printf("  %s\n", ("./check_ntp_time -H ntpserv -w 0.5 -c 1 -n 8 -i 200"));
 
 	printf (_(UT_SUPPORT));
 }
@@ -630,7 +335,8 @@ void
 print_usage(void)
 {
 	printf (_("Usage:"));
-	printf(" %s -H <host> [-w <warn>] [-c <crit>] [-W <warn>] [-C <crit>]\n", progname);
-	printf("       [-j <warn>] [-k <crit>] [-v verbose]\n");
+	printf(" %s -H <host> [-H <host> ...] [-f <file>] [-p <port>] [-w <warn>]\n", progname);
+	printf("       [-c <crit>] [-n <samples>] [-i <interval>] [-q] [-4|-6] [-t <timeout>]\n");
+	printf("       [-v verbose]\n");
 }
 
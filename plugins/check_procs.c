@@ -46,11 +46,21 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "utils.h"
 
 #include <pwd.h>
+#if defined( __linux__ )
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
 
 int process_arguments (int, char **);
 int validate_arguments (void);
 int check_thresholds (int);
 int convert_to_seconds (char *); 
+int check_process (pid_t, int, pid_t, int, int, float, char *, int, char *, char *);
+int scan_ps (void);
+#if defined( __linux__ )
+int scan_proc (void);
+#endif
 void print_help (void);
 void print_usage (void);
 
@@ -93,17 +103,168 @@ char *args;
 char *fmt;
 char *fails;
 char tmp[MAX_INPUT_BUFFER];
+pid_t mypid = 0;
+
+int found = 0; /* counter for number of processes in the process table */
+int procs = 0; /* counter for number of processes meeting filter criteria */
+int warn = 0; /* number of processes in warn state */
+int crit = 0; /* number of processes in crit state */
 
 
 
 int
 main (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
+
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+	setlocale(LC_NUMERIC, "POSIX");
+
+	asprintf (&metric_name, "PROCS");
+	metric = METRIC_PROCS;
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* get our pid */
+	mypid = getpid();
+
+	/* Set signal handling and alarm timeout */
+	if (signal (SIGALRM, popen_timeout_alarm_handler) == SIG_ERR) {
+		usage4 (_("Cannot catch SIGALRM"));
+	}
+	alarm (timeout_interval);
+
+#if defined( __linux__ )
+	/* read the process table ourselves if /proc is mounted */
+	if (access ("/proc/self/stat", R_OK) == 0)
+		result = scan_proc ();
+	else
+#endif
+		result = scan_ps ();
+
+	if (found == 0) {							/* no process lines parsed so return STATE_UNKNOWN */
+		printf (_("Unable to read output\n"));
+		return result;
+	}
+
+	if ( result == STATE_UNKNOWN ) 
+		result = STATE_OK;
+
+	/* Needed if procs found, but none match filter */
+	if ( metric == METRIC_PROCS ) {
+		result = max_state (result, check_thresholds (procs) );
+	}
+
+	if ( result == STATE_OK ) {
+		printf ("%s %s: ", metric_name, _("OK"));
+	} else if (result == STATE_WARNING) {
+		printf ("%s %s: ", metric_name, _("WARNING"));
+		if ( metric != METRIC_PROCS ) {
+			printf (_("%d warn out of "), warn);
+		}
+	} else if (result == STATE_CRITICAL) {
+		printf ("%s %s: ", metric_name, _("CRITICAL"));
+		if (metric != METRIC_PROCS) {
+			printf (_("%d crit, %d warn out of "), crit, warn);
+		}
+	} 
+	printf (ngettext ("%d process", "%d processes", (unsigned long) procs), procs);
+	
+	if (strcmp(fmt,"") != 0) {
+		printf (_(" with %s"), fmt);
+	}
+
+	if ( verbose >= 1 && strcmp(fails,"") )
+		printf (" [%s]", fails);
+
+	printf ("\n");
+	return result;
+}
+
+
+
+/* Apply the filters to one process and check it against the thresholds.
+ * Returns the state of the process for the VSZ, RSS, CPU and ELAPSED
+ * metrics, STATE_OK otherwise */
+int
+check_process (pid_t procpid, int procuid, pid_t procppid, int procvsz,
+               int procrss, float procpcpu, char *procstat, int procseconds,
+               char *procprog, char *procargs)
+{
+	int resultsum = 0; /* bitmask of the filter criteria met by a process */
+	int i = STATE_OK;
+
+	if (verbose >= 3)
+		printf ("proc#=%d uid=%d vsz=%d rss=%d pid=%d ppid=%d pcpu=%.2f stat=%s etime=%d prog=%s args=%s\n", 
+			procs, procuid, procvsz, procrss,
+			procpid, procppid, procpcpu, procstat, 
+			procseconds, procprog, procargs);
+
+	/* Ignore self */
+	if (mypid == procpid) return STATE_OK;
+
+	if ((options & STAT) && (strstr (statopts, procstat)))
+		resultsum |= STAT;
+	if ((options & ARGS) && procargs && (strstr (procargs, args) != NULL))
+		resultsum |= ARGS;
+	if ((options & PROG) && procprog && (strcmp (prog, procprog) == 0))
+		resultsum |= PROG;
+	if ((options & PPID) && (procppid == ppid))
+		resultsum |= PPID;
+	if ((options & USER) && (procuid == uid))
+		resultsum |= USER;
+	if ((options & VSZ)  && (procvsz >= vsz))
+		resultsum |= VSZ;
+	if ((options & RSS)  && (procrss >= rss))
+		resultsum |= RSS;
+	if ((options & PCPU)  && (procpcpu >= pcpu))
+		resultsum |= PCPU;
+
+	found++;
+
+	/* Next line if filters not matched */
+	if (!(options == resultsum || options == ALL))
+		return STATE_OK;
+
+	procs++;
+
+	if (metric == METRIC_VSZ)
+		i = check_thresholds (procvsz);
+	else if (metric == METRIC_RSS)
+		i = check_thresholds (procrss);
+	/* TODO? float thresholds for --metric=CPU */
+	else if (metric == METRIC_CPU)
+		i = check_thresholds ((int)procpcpu); 
+	else if (metric == METRIC_ELAPSED)
+		i = check_thresholds (procseconds);
+
+	if (metric != METRIC_PROCS) {
+		if (i == STATE_WARNING) {
+			warn++;
+			asprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
+		}
+		if (i == STATE_CRITICAL) {
+			crit++;
+			asprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
+		}
+	}
+
+	return i;
+}
+
+
+
+/* get the process table from PS_COMMAND */
+int
+scan_ps (void)
 {
 	char *input_buffer;
 	char *input_line;
 	char *procprog;
 
-	pid_t mypid = 0;
 	int procuid = 0;
 	pid_t procpid = 0;
 	pid_t procppid = 0;
@@ -117,47 +278,22 @@ main (int argc, char **argv)
 
 	const char *zombie = "Z";
 
-	int resultsum = 0; /* bitmask of the filter criteria met by a process */
-	int found = 0; /* counter for number of lines returned in `ps` output */
-	int procs = 0; /* counter for number of processes meeting filter criteria */
 	int pos; /* number of spaces before 'args' in `ps` output */
 	int cols; /* number of columns in ps output */
 	int expected_cols = PS_COLS - 1;
-	int warn = 0; /* number of processes in warn state */
-	int crit = 0; /* number of processes in crit state */
-	int i = 0;
+	int i;
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-	setlocale(LC_NUMERIC, "POSIX");
-
 	input_buffer = malloc (MAX_INPUT_BUFFER);
 	procprog = malloc (MAX_INPUT_BUFFER);
 
-	asprintf (&metric_name, "PROCS");
-	metric = METRIC_PROCS;
-
-	if (process_arguments (argc, argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	/* get our pid */
-	mypid = getpid();
-
-	/* Set signal handling and alarm timeout */
-	if (signal (SIGALRM, popen_timeout_alarm_handler) == SIG_ERR) {
-		usage4 (_("Cannot catch SIGALRM"));
-	}
-	alarm (timeout_interval);
-
 	if (verbose >= 2)
 		printf (_("CMD: %s\n"), PS_COMMAND);
 
 	child_process = spopen (PS_COMMAND);
 	if (child_process == NULL) {
 		printf (_("Could not open pipe: %s\n"), PS_COMMAND);
-		return STATE_UNKNOWN;
+		exit (STATE_UNKNOWN);
 	}
 
 	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
@@ -189,7 +325,6 @@ main (int argc, char **argv)
 			cols = expected_cols;
 		}
 		if ( cols >= expected_cols ) {
-			resultsum = 0;
 			asprintf (&procargs, "%s", input_line + pos);
 			strip (procargs);
 
@@ -199,62 +334,10 @@ main (int argc, char **argv)
 			/* we need to convert the elapsed time to seconds */
 			procseconds = convert_to_seconds(procetime);
 
-			if (verbose >= 3)
-				printf ("proc#=%d uid=%d vsz=%d rss=%d pid=%d ppid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n", 
-					procs, procuid, procvsz, procrss,
-					procpid, procppid, procpcpu, procstat, 
-					procetime, procprog, procargs);
-
-			/* Ignore self */
-			if (mypid == procpid) continue;
-
-			if ((options & STAT) && (strstr (statopts, procstat)))
-				resultsum |= STAT;
-			if ((options & ARGS) && procargs && (strstr (procargs, args) != NULL))
-				resultsum |= ARGS;
-			if ((options & PROG) && procprog && (strcmp (prog, procprog) == 0))
-				resultsum |= PROG;
-			if ((options & PPID) && (procppid == ppid))
-				resultsum |= PPID;
-			if ((options & USER) && (procuid == uid))
-				resultsum |= USER;
-			if ((options & VSZ)  && (procvsz >= vsz))
-				resultsum |= VSZ;
-			if ((options & RSS)  && (procrss >= rss))
-				resultsum |= RSS;
-			if ((options & PCPU)  && (procpcpu >= pcpu))
-				resultsum |= PCPU;
-
-			found++;
-
-			/* Next line if filters not matched */
-			if (!(options == resultsum || options == ALL))
-				continue;
-
-			procs++;
-
-			if (metric == METRIC_VSZ)
-				i = check_thresholds (procvsz);
-			else if (metric == METRIC_RSS)
-				i = check_thresholds (procrss);
-			/* TODO? float thresholds for --metric=CPU */
-			else if (metric == METRIC_CPU)
-				i = check_thresholds ((int)procpcpu); 
-			else if (metric == METRIC_ELAPSED)
-				i = check_thresholds (procseconds);
-
-			if (metric != METRIC_PROCS) {
-				if (i == STATE_WARNING) {
-					warn++;
-					asprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
-					result = max_state (result, i);
-				}
-				if (i == STATE_CRITICAL) {
-					crit++;
-					asprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
-					result = max_state (result, i);
-				}
-			}
+			i = check_process (procpid, procuid, procppid, procvsz, procrss,
+			                   procpcpu, procstat, procseconds, procprog, procargs);
+			if (i == STATE_WARNING || i == STATE_CRITICAL)
+				result = max_state (result, i);
 		} 
 		/* This should not happen */
 		else if (verbose) {
@@ -278,44 +361,165 @@ main (int argc, char **argv)
 		result = max_state (result, STATE_WARNING);
 	}
 
-	if (found == 0) {							/* no process lines parsed so return STATE_UNKNOWN */
-		printf (_("Unable to read output\n"));
-		return result;
+	return result;
+}
+
+
+
+#if defined( __linux__ )
+/* fields of /proc/<pid>/stat following the state, in order */
+enum {
+	PROC_PPID, PROC_PGRP, PROC_SESSION, PROC_TTY_NR, PROC_TPGID,
+	PROC_FLAGS, PROC_MINFLT, PROC_CMINFLT, PROC_MAJFLT, PROC_CMAJFLT,
+	PROC_UTIME, PROC_STIME, PROC_CUTIME, PROC_CSTIME, PROC_PRIORITY,
+	PROC_NICE, PROC_NUM_THREADS, PROC_ITREALVALUE, PROC_STARTTIME,
+	PROC_VSIZE, PROC_RSS,
+	PROC_FIELDS
+};
+
+/* Parse the next numeric field of a /proc stat line. Fields are separated
+ * by a space and hold nothing but an optional sign and digits */
+static char *
+proc_field (char *p, long long *value)
+{
+	long long v = 0;
+	int neg = 0;
+
+	while (*p == ' ')
+		p++;
+	if (*p == '-') {
+		neg = 1;
+		p++;
 	}
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
 
-	if ( result == STATE_UNKNOWN ) 
-		result = STATE_OK;
+	*value = neg ? -v : v;
+	return p;
+}
 
-	/* Needed if procs found, but none match filter */
-	if ( metric == METRIC_PROCS ) {
-		result = max_state (result, check_thresholds (procs) );
+/* Read the process table straight from /proc rather than running ps.
+ * Only the stat file is needed for everything but the argument list,
+ * which is only read when a filter or -vvv wants it. The values are
+ * derived the way procps does, so filters behave as they would on ps output */
+int
+scan_proc (void)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	FILE *fp;
+	char path[NAME_MAX + 16];
+	char buf[1024];
+	char procstat[8];
+	char *procprog;
+	char *procargs;
+	char *p, *q;
+	long long field[PROC_FIELDS];
+	double uptime = 0;
+	long long procseconds;
+	float procpcpu;
+	long hz = sysconf (_SC_CLK_TCK);
+	long pagekb = sysconf (_SC_PAGESIZE) / 1024;
+	int want_args = (options & ARGS) || verbose >= 3;
+	int dfd, fd, n, i;
+	int result = STATE_UNKNOWN;
+
+	if (verbose >= 2)
+		printf (_("CMD: %s\n"), "/proc");
+
+	if ((fp = fopen ("/proc/uptime", "r")) != NULL) {
+		if (fscanf (fp, "%lf", &uptime) != 1)
+			uptime = 0;
+		fclose (fp);
 	}
 
-	if ( result == STATE_OK ) {
-		printf ("%s %s: ", metric_name, _("OK"));
-	} else if (result == STATE_WARNING) {
-		printf ("%s %s: ", metric_name, _("WARNING"));
-		if ( metric != METRIC_PROCS ) {
-			printf (_("%d warn out of "), warn);
-		}
-	} else if (result == STATE_CRITICAL) {
-		printf ("%s %s: ", metric_name, _("CRITICAL"));
-		if (metric != METRIC_PROCS) {
-			printf (_("%d crit, %d warn out of "), crit, warn);
+	procargs = malloc (MAX_INPUT_BUFFER);
+	if ((dir = opendir ("/proc")) == NULL || procargs == NULL)
+		die (STATE_UNKNOWN, _("Could not read /proc: %s\n"), strerror (errno));
+	dfd = dirfd (dir);
+
+	while ((ent = readdir (dir)) != NULL) {
+		if (ent->d_name[0] < '1' || ent->d_name[0] > '9')
+			continue;
+
+		/* processes may exit while we look at them, so skip anything
+		 * which has disappeared instead of treating it as an error */
+		snprintf (path, sizeof (path), "%s/stat", ent->d_name);
+		if ((fd = openat (dfd, path, O_RDONLY)) < 0)
+			continue;
+		n = read (fd, buf, sizeof (buf) - 1);
+		close (fd);
+		if (n <= 0 || fstatat (dfd, ent->d_name, &st, 0) < 0)
+			continue;
+		buf[n] = '\0';
+
+		/* the command name may contain anything, including ") " */
+		if ((p = strchr (buf, '(')) == NULL || (q = strrchr (p, ')')) == NULL ||
+		    q[1] != ' ' || q[2] == '\0')
+			continue;
+		*q = '\0';
+		procprog = p + 1;
+
+		p = q + 3;
+		for (i = 0; i < PROC_FIELDS; i++)
+			p = proc_field (p, &field[i]);
+
+		/* the same flags as ps' "stat" column, less L */
+		i = 0;
+		procstat[i++] = q[2];
+		if (field[PROC_NICE] < 0)
+			procstat[i++] = '<';
+		else if (field[PROC_NICE] > 0)
+			procstat[i++] = 'N';
+		if (field[PROC_SESSION] == atoi (buf))
+			procstat[i++] = 's';
+		if (field[PROC_NUM_THREADS] > 1)
+			procstat[i++] = 'l';
+		if (field[PROC_PGRP] == field[PROC_TPGID])
+			procstat[i++] = '+';
+		procstat[i] = '\0';
+
+		/* ps works in whole seconds and tenths of a percent */
+		procseconds = uptime - field[PROC_STARTTIME] / hz;
+		if (procseconds < 0)
+			procseconds = 0;
+		procpcpu = 0;
+		if (procseconds > 0)
+			procpcpu = (float)((field[PROC_UTIME] + field[PROC_STIME]) * 1000 / hz / procseconds) / 10;
+
+		procargs[0] = '\0';
+		if (want_args) {
+			snprintf (path, sizeof (path), "%s/cmdline", ent->d_name);
+			n = 0;
+			if ((fd = openat (dfd, path, O_RDONLY)) >= 0) {
+				n = read (fd, procargs, MAX_INPUT_BUFFER - 1);
+				close (fd);
+			}
+			/* arguments are NUL separated; kernel threads have none */
+			for (i = 0; i < n; i++)
+				if (procargs[i] == '\0')
+					procargs[i] = ' ';
+			while (n > 0 && procargs[n - 1] == ' ')
+				n--;
+			if (n > 0)
+				procargs[n] = '\0';
+			else
+				snprintf (procargs, MAX_INPUT_BUFFER, "[%s]", procprog);
 		}
-	} 
-	printf (ngettext ("%d process", "%d processes", (unsigned long) procs), procs);
-	
-	if (strcmp(fmt,"") != 0) {
-		printf (_(" with %s"), fmt);
-	}
 
-	if ( verbose >= 1 && strcmp(fails,"") )
-		printf (" [%s]", fails);
+		i = check_process (atoi (buf), st.st_uid, field[PROC_PPID],
+		                   field[PROC_VSIZE] / 1024, field[PROC_RSS] * pagekb,
+		                   procpcpu, procstat, procseconds, procprog, procargs);
+		if (i == STATE_WARNING || i == STATE_CRITICAL)
+			result = max_state (result, i);
+	}
 
-	printf ("\n");
+	closedir (dir);
+	free (procargs);
 	return result;
 }
+#endif /* defined(__linux__) */
 
 
 
@@ -73,11 +73,24 @@ enum {
 
 #define EHLO_SUPPORTS_STARTTLS 1
 
+/* the parts of the conversation timed for the perfdata */
+enum {
+	PHASE_CONNECT,
+	PHASE_BANNER,
+	PHASE_HELO,
+	PHASE_TLS,
+	PHASE_COMMANDS,
+	PHASES
+};
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 void smtp_quit(void);
+int smtp_pipeline(const char *, int, int);
+int check_response(int, int);
+void end_phase(int);
 int recvline(char *, size_t);
 int recvlines(char *, size_t);
 int my_close(void);
@@ -114,10 +127,18 @@ int check_critical_time = FALSE;
 int verbose = 0;
 int use_ssl = FALSE;
 short use_ehlo = FALSE;
+int use_pipelining = FALSE;
 short ssl_established = 0;
+char *ssl_session_cache = NULL;
 char *localhostname = NULL;
 int sd;
 char buffer[MAX_INPUT_BUFFER];
+const char *phase_names[PHASES] = {
+	"time_connect", "time_banner", "time_helo", "time_tls", "time_commands"
+};
+double phase_time[PHASES];
+int phase_done[PHASES];
+struct timeval phase_start;
 enum {
   TCP_PROTOCOL = 1,
   UDP_PROTOCOL = 2,
@@ -128,13 +149,16 @@ int
 main (int argc, char **argv)
 {
 	short supports_tls=FALSE;
-	int n = 0;
+	short supports_pipelining=FALSE;
+	short quit_sent=FALSE;
+	int n = 0, i;
 	double elapsed_time;
 	long microsec;
 	int result = STATE_UNKNOWN;
 	char *cmd_str = NULL;
 	char *helocmd = NULL;
 	char *error_msg = "";
+	char *perf = NULL;
 	struct timeval tv;
 
 	setlocale (LC_ALL, "");
@@ -178,11 +202,13 @@ main (int argc, char **argv)
 
 	/* start timer */
 	gettimeofday (&tv, NULL);
+	phase_start = tv;
 
 	/* try to connect to the host at the given port number */
 	result = my_tcp_connect (server_address, server_port, &sd);
 
 	if (result == STATE_OK) { /* we connected */
+		end_phase (PHASE_CONNECT);
 
 		/* watch for the SMTP connection string and */
 		/* return a WARNING status if we couldn't read any data */
@@ -205,6 +231,7 @@ main (int argc, char **argv)
 				result = STATE_WARNING;
 			}
 		}
+		end_phase (PHASE_BANNER);
 
 		/* send the HELO/EHLO command */
 		send(sd, helocmd, strlen(helocmd), 0);
@@ -218,7 +245,12 @@ main (int argc, char **argv)
 			   strstr(buffer, "250-STARTTLS") != NULL){
 				supports_tls=TRUE;
 			}
+			if(strstr(buffer, "250 PIPELINING") != NULL ||
+			   strstr(buffer, "250-PIPELINING") != NULL){
+				supports_pipelining=TRUE;
+			}
 		}
+		end_phase (PHASE_HELO);
 
 		if(use_ssl && ! supports_tls){
 			printf(_("WARNING - TLS not supported by server\n"));
@@ -237,6 +269,8 @@ main (int argc, char **argv)
 		    smtp_quit();
 		    return STATE_UNKNOWN;
 		  }
+		  if (ssl_session_cache)
+		    np_net_ssl_session_cache (ssl_session_cache, server_address, server_port);
 		  result = np_net_ssl_init(sd);
 		  if(result != STATE_OK) {
 		    printf (_("CRITICAL - Cannot create SSL context.\n"));
@@ -273,6 +307,10 @@ main (int argc, char **argv)
 		if (verbose) {
 			printf("%s", buffer);
 		}
+		/* what we learnt before TLS doesn't count, see above */
+		supports_pipelining = (strstr(buffer, "250 PIPELINING") != NULL ||
+		                       strstr(buffer, "250-PIPELINING") != NULL);
+		end_phase (PHASE_TLS);
 
 #  ifdef USE_OPENSSL
 		  if ( check_cert ) {
@@ -297,41 +335,26 @@ main (int argc, char **argv)
 		 * You can disable sending mail_command with '--nocommand'
 		 * Use the -f option to provide a FROM address
 		 */
-		if (smtp_use_dummycmd) {
-		  my_send(cmd_str, strlen(cmd_str));
-		  if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
-		    printf("%s", buffer);
+		if (use_pipelining && supports_pipelining) {
+			/* QUIT can go along too, unless AUTH is still to come */
+			result = smtp_pipeline (cmd_str, authtype == NULL, result);
+			quit_sent = (authtype == NULL);
 		}
+		else {
+			if (smtp_use_dummycmd) {
+			  my_send(cmd_str, strlen(cmd_str));
+			  if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
+			    printf("%s", buffer);
+			}
 
-		while (n < ncommands) {
-			asprintf (&cmd_str, "%s%s", commands[n], "\r\n");
-			my_send(cmd_str, strlen(cmd_str));
-			if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
-				printf("%s", buffer);
-			strip (buffer);
-			if (n < nresponses) {
-				cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
-				errcode = regcomp (&preg, responses[n], cflags);
-				if (errcode != 0) {
-					regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
-					printf (_("Could Not Compile Regular Expression"));
-					return ERROR;
-				}
-				excode = regexec (&preg, buffer, 10, pmatch, eflags);
-				if (excode == 0) {
-					result = STATE_OK;
-				}
-				else if (excode == REG_NOMATCH) {
-					result = STATE_WARNING;
-					printf (_("SMTP %s - Invalid response '%s' to command '%s'\n"), state_text (result), buffer, commands[n]);
-				}
-				else {
-					regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
-					printf (_("Execute Error: %s\n"), errbuf);
-					result = STATE_UNKNOWN;
-				}
+			for (i = 0; i < ncommands; i++) {
+				asprintf (&cmd_str, "%s%s", commands[i], "\r\n");
+				my_send(cmd_str, strlen(cmd_str));
+				if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
+					printf("%s", buffer);
+				strip (buffer);
+				result = check_response (i, result);
 			}
-			n++;
 		}
 
 		if (authtype != NULL) {
@@ -418,7 +441,9 @@ main (int argc, char **argv)
 		}
 
 		/* tell the server we're done */
-		smtp_quit();
+		if (!quit_sent)
+			smtp_quit();
+		end_phase (PHASE_COMMANDS);
 
 		/* finally close the connection */
 		close (sd);
@@ -437,15 +462,22 @@ main (int argc, char **argv)
 			result = STATE_WARNING;
 	}
 
+	perf = fperfdata ("time", elapsed_time, "s",
+		(int)check_warning_time, warning_time,
+		(int)check_critical_time, critical_time,
+		TRUE, 0, FALSE, 0);
+	for (i = 0; i < PHASES; i++)
+		if (phase_done[i])
+			asprintf (&perf, "%s %s", perf,
+			          fperfdata (phase_names[i], phase_time[i], "s",
+			                     FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+
 	printf (_("SMTP %s - %s%.3f sec. response time%s%s|%s\n"),
 			state_text (result),
 			error_msg,
 			elapsed_time,
 			verbose?", ":"", verbose?buffer:"",
-			fperfdata ("time", elapsed_time, "s",
-				(int)check_warning_time, warning_time,
-				(int)check_critical_time, critical_time,
-				TRUE, 0, FALSE, 0));
+			perf);
 
 	return result;
 }
@@ -458,6 +490,11 @@ process_arguments (int argc, char **argv)
 {
 	int c;
 
+	enum {
+		SSL_SESSION_CACHE = CHAR_MAX + 1,
+		PIPELINING
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
@@ -481,6 +518,8 @@ process_arguments (int argc, char **argv)
 		{"help", no_argument, 0, 'h'},
 		{"starttls",no_argument,0,'S'},
 		{"certificate",required_argument,0,'D'},
+		{"ssl-session-cache",required_argument,0,SSL_SESSION_CACHE},
+		{"pipelining",no_argument,0,PIPELINING},
 		{0, 0, 0, 0}
 	};
 
@@ -608,6 +647,17 @@ process_arguments (int argc, char **argv)
 				usage (_("SSL support not available - install OpenSSL and recompile"));
 #endif
 			break;
+		case SSL_SESSION_CACHE:
+#ifdef HAVE_SSL
+			ssl_session_cache = optarg;
+#else
+			usage (_("SSL support not available - install OpenSSL and recompile"));
+#endif
+			break;
+		case PIPELINING:
+			use_pipelining = TRUE;
+			use_ehlo = TRUE;
+			break;
 		case '4':
 			address_family = AF_INET;
 			break;
@@ -687,6 +737,107 @@ smtp_quit(void)
 }
 
 
+/*
+ * Check the response to commands[n], stripped in buffer, against
+ * responses[n] if one was given.  Returns the new result, or result if
+ * there was nothing to check.
+ */
+int
+check_response(int n, int result)
+{
+	if (n >= nresponses)
+		return result;
+
+	cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
+	errcode = regcomp (&preg, responses[n], cflags);
+	if (errcode != 0) {
+		regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+		printf (_("Could Not Compile Regular Expression"));
+		exit (ERROR);
+	}
+	excode = regexec (&preg, buffer, 10, pmatch, eflags);
+	if (excode == 0) {
+		result = STATE_OK;
+	}
+	else if (excode == REG_NOMATCH) {
+		result = STATE_WARNING;
+		printf (_("SMTP %s - Invalid response '%s' to command '%s'\n"), state_text (result), buffer, commands[n]);
+	}
+	else {
+		regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
+		printf (_("Execute Error: %s\n"), errbuf);
+		result = STATE_UNKNOWN;
+	}
+	regfree (&preg);
+	return result;
+}
+
+
+/*
+ * Send the MAIL command (if any), the -C commands and, if quit is set,
+ * QUIT to a server that supports PIPELINING.  They go in groups as RFC
+ * 2920 allows: MAIL, RCPT and RSET may be followed by more commands in
+ * the same write, anything else ends the group, as its response may
+ * decide what the client does next.  The responses of a group are then
+ * read in order and checked like those of commands sent one at a time.
+ */
+int
+smtp_pipeline(const char *mail_cmd, int quit, int result)
+{
+	int total = smtp_use_dummycmd + ncommands + (quit ? 1 : 0);
+	int first, last, k, cmd;
+	char *batch, *line;
+
+	for (first = 0; first < total; first = last) {
+		batch = strdup ("");
+		for (last = first; last < total; ) {
+			/* the k-th command of the conversation, and its -C index */
+			k = last++;
+			cmd = k - smtp_use_dummycmd;
+			if (k < smtp_use_dummycmd)
+				line = strdup (mail_cmd);
+			else if (cmd < ncommands)
+				asprintf (&line, "%s%s", commands[cmd], "\r\n");
+			else
+				line = strdup (SMTP_QUIT);
+			asprintf (&batch, "%s%s", batch, line);
+			if (strncasecmp (line, "MAIL ", 5) && strncasecmp (line, "RCPT ", 5) &&
+			    strncasecmp (line, "RSET", 4))
+				break;
+		}
+		if (verbose)
+			printf (_("sent %d commands at once:\n%s"), last - first, batch);
+		if (my_send (batch, strlen (batch)) <= 0)
+			return result;
+
+		for (k = first; k < last; k++) {
+			if (recvlines (buffer, MAX_INPUT_BUFFER) <= 0) {
+				if (verbose)
+					printf ("%s\n", _("recv() failed in pipelined responses"));
+				buffer[0] = '\0';
+			}
+			else if (verbose)
+				printf ("%s", buffer);
+			strip (buffer);
+			cmd = k - smtp_use_dummycmd;
+			if (cmd >= 0 && cmd < ncommands)
+				result = check_response (cmd, result);
+		}
+	}
+	return result;
+}
+
+
+/* end a phase of the conversation, timed from the end of the last one */
+void
+end_phase(int phase)
+{
+	phase_time[phase] = (double)deltime (phase_start) / 1.0e6;
+	phase_done[phase] = TRUE;
+	gettimeofday (&phase_start, NULL);
+}
+
+
 /*
  * Receive one line, copy it into buf and nul-terminate it.  Returns the
  * number of bytes written to buf (excluding the '\0') or 0 on EOF or <0 on
@@ -788,11 +939,17 @@ print_help (void)
   printf ("    %s\n", _("Expected response to command (may be used repeatedly)"));
   printf (" %s\n", "-f, --from=STRING");
   printf ("    %s\n", _("FROM-address to include in MAIL command, required by Exchange 2000")),
+  printf (" %s\n", "--pipelining");
+  printf ("    %s\n", _("Use EHLO and, if the server supports PIPELINING, send the MAIL command,"));
+  printf ("    %s\n", _("the -C commands and QUIT in as few writes as RFC 2920 allows"));
 #ifdef HAVE_SSL
   printf (" %s\n", "-D, --certificate=INTEGER");
   printf ("    %s\n", _("Minimum number of days a certificate has to be valid."));
   printf (" %s\n", "-S, --starttls");
   printf ("    %s\n", _("Use STARTTLS for the connection."));
+  printf (" %s\n", "--ssl-session-cache=FILE");
+  printf ("    %s\n", _("Save SSL sessions in FILE and resume them on later runs (OpenSSL only)."));
+  printf ("    %s\n", _("FILE may be shared with check_http and check_tcp"));
 #endif
 
 	printf (" %s\n", "-A, --authtype=STRING");
@@ -813,6 +970,10 @@ print_help (void)
   printf ("%s\n", _("STATE_CRITICAL, other errors return STATE_UNKNOWN.  Successful"));
   printf ("%s\n", _("connects, but incorrect reponse messages from the host result in"));
   printf ("%s\n", _("STATE_WARNING return values."));
+	printf("\n");
+  printf ("%s\n", _("Besides the total time, the perfdata has the time taken by each part of"));
+  printf ("%s\n", _("the conversation: time_connect, time_banner, time_helo, time_tls (with -S)"));
+  printf ("%s\n", _("and time_commands (MAIL, -C, AUTH and QUIT)."));
 
 	printf (_(UT_SUPPORT));
 }
@@ -825,6 +986,6 @@ print_usage (void)
   printf (_("Usage:"));
 	printf ("%s -H host [-p port] [-e expect] [-C command] [-f from addr]", progname);
   printf ("[-A authtype -U authuser -P authpass] [-w warn] [-c crit] [-t timeout]\n");
-  printf ("[-S] [-D days] [-n] [-v] [-4|-6]\n");
+  printf ("[-S] [-D days] [--ssl-session-cache=file] [--pipelining] [-n] [-v] [-4|-6]\n");
 }
 
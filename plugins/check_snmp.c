@@ -41,7 +41,10 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 
 #include "common.h"
 #include "utils.h"
+#include "netutils.h"
 #include "popen.h"
+#include "utils_snmp.h"
+#include "utils_counter.h"
 
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
@@ -49,6 +52,7 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #define DEFAULT_PROTOCOL "1"
 #define DEFAULT_TIMEOUT 1
 #define DEFAULT_RETRIES 5
+#define DEFAULT_MAX_REPETITIONS 16
 #define DEFAULT_AUTH_PROTOCOL "MD5"
 #define DEFAULT_DELIMITER "="
 #define DEFAULT_OUTPUT_DELIMITER " "
@@ -77,12 +81,19 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #define WARN_NE 262144
 #define WARN_RANGE 524288
 
-#define MAX_OIDS 8
 #define MAX_DELIM_LENGTH 8
 
 int process_arguments (int, char **);
 int validate_arguments (void);
 char *clarify_message (char *);
+struct oid_check *get_check (size_t);
+char *snmp_show_value (char *, size_t, char *);
+int snmp_native_query (void);
+int snmp_table_query (void);
+void table_collect (size_t, const np_snmp_varbind *, void *);
+int table_cell_compare (const void *, const void *);
+int snmp_command_query (void);
+void snmp_counter_rates (int);
 int check_num (int);
 int llu_getll (unsigned long long *, char *);
 int llu_getul (unsigned long long *, char *);
@@ -124,19 +135,57 @@ size_t nunits = 0;
 size_t unitv_size = 8;
 int verbose = FALSE;
 int usesnmpgetnext = FALSE;
-unsigned long long lower_warn_lim[MAX_OIDS];
-unsigned long long upper_warn_lim[MAX_OIDS];
-unsigned long long lower_crit_lim[MAX_OIDS];
-unsigned long long upper_crit_lim[MAX_OIDS];
-unsigned long long response_value[MAX_OIDS];
 int check_warning_value = FALSE;
 int check_critical_value = FALSE;
 int retries = 0;
-unsigned long long eval_method[MAX_OIDS];
 char *delimiter;
 char *output_delim;
 char *miblist = NULL;
 int needmibs = FALSE;
+char *cl_hidden_auth = NULL;
+int command_failed = FALSE;
+
+/* one value received from the agent */
+struct snmp_value {
+	char *name;	/* the OID as reported back */
+	char *response;	/* the value, formatted the way snmpget prints it */
+	char *show;	/* response without its datatype indicator */
+	char type[8];	/* "c" for counters, appended to the perfdata */
+	int numeric;	/* TRUE if number holds the value */
+	unsigned long long number;
+	size_t check;	/* the -o OID, and so the thresholds, this belongs to */
+	char *index;	/* the row, in --table mode */
+	int no_rate;	/* first sample of a counter in --rate mode */
+};
+struct snmp_value *values = NULL;
+
+/* a value found by a --table walk, before it is sorted into its row */
+struct table_cell {
+	np_snmp_oid index;
+	struct snmp_value value;
+};
+struct table_walk {
+	const np_snmp_oid *columns;
+	struct table_cell *cells;
+	size_t ncells;
+	size_t cells_size;
+};
+int table_mode = FALSE;
+int rate_mode = FALSE;
+
+void snmp_set_value (struct snmp_value *, const np_snmp_varbind *);
+
+/* what to test for one OID, and the value it was tested with */
+struct oid_check {
+	unsigned long long eval_method;
+	unsigned long long lower_warn_lim;
+	unsigned long long upper_warn_lim;
+	unsigned long long lower_crit_lim;
+	unsigned long long upper_crit_lim;
+	unsigned long long response_value;
+};
+struct oid_check *checks = NULL;
+size_t nchecks = 0;
 
 
 int
@@ -144,35 +193,25 @@ main (int argc, char **argv)
 {
 	int i = 0;
 	int iresult = STATE_UNKNOWN;
-	int found = 0;
 	int result = STATE_DEPENDENT;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char *command_line = NULL;
-	char *cl_hidden_auth = NULL;
-	char *response = NULL;
+	int found = 0;
+	size_t c;
 	char *outbuff;
-	char *output;
-	char *ptr = NULL;
 	char *p2 = NULL;
 	char *show = NULL;
-	char type[8] = "";
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
 	textdomain (PACKAGE);
 
-	labels = malloc (labels_size);
-	unitv = malloc (unitv_size);
-	for (i = 0; i < MAX_OIDS; i++)
-		eval_method[i] = CHECK_UNDEF;
-	i = 0;
+	labels = malloc (labels_size * sizeof (char *));
+	unitv = malloc (unitv_size * sizeof (char *));
 
 	oid = strdup ("");
 	label = strdup ("SNMP");
 	units = strdup ("");
 	port = strdup (DEFAULT_PORT);
 	outbuff = strdup ("");
-	output = strdup ("");
 	delimiter = strdup (" = ");
 	output_delim = strdup (DEFAULT_OUTPUT_DELIMITER);
 	/* miblist = strdup (DEFAULT_MIBLIST); */
@@ -182,142 +221,72 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-	/* create the command line to execute */
-		if(usesnmpgetnext == TRUE) {
-		asprintf(&command_line, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
-			PATH_TO_SNMPGETNEXT, timeout_interval, retries, miblist, proto,
-			authpriv, server_address, port, oid);
-		asprintf(&cl_hidden_auth, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
-			PATH_TO_SNMPGETNEXT, timeout_interval, retries, miblist, proto,
-			"[authpriv]", server_address, port, oid);
-	}else{
-
-		asprintf (&command_line, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
-			PATH_TO_SNMPGET, timeout_interval, retries, miblist, proto,
-			authpriv, server_address, port, oid);
-		asprintf(&cl_hidden_auth, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
-			PATH_TO_SNMPGET, timeout_interval, retries, miblist, proto,
-			"[authpriv]", server_address, port, oid);
-	}
-	
-	if (verbose)
-		printf ("%s\n", command_line);
-	
-
-	/* run the command */
-	child_process = spopen (command_line);
-	if (child_process == NULL) {
-		printf (_("Could not open pipe: %s\n"), cl_hidden_auth);
-		exit (STATE_UNKNOWN);
-	}
-
-#if 0		/* Removed May 29, 2007 */
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), cl_hidden_auth);
-	}
+	/* v1 and v2c requests for numeric OIDs are answered by our own SNMP
+	 * engine; everything else still needs the net-snmp tools */
+	if (table_mode && (needmibs == TRUE || strcmp (proto, "3") == 0))
+		usage4 (_("--table needs numeric OIDs and SNMP version 1 or 2c"));
+	else if (table_mode)
+		found = snmp_table_query ();
+	else if (needmibs == FALSE && strcmp (proto, "3"))
+		found = snmp_native_query ();
+	else
+#ifdef PATH_TO_SNMPGET
+		found = snmp_command_query ();
+#else
+		die (STATE_UNKNOWN, _("%s problem - MIB names and SNMPv3 require snmpget, which was not found at build time\n"),
+			label);
 #endif
 
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process))
-		asprintf (&output, "%s%s", output, input_buffer);
-
-	if (verbose)
-		printf ("%s\n", output);
+	if (found == 0)
+		die (STATE_UNKNOWN,
+			_("%s problem - No data received from host\nCMD: %s\n"),
+			label,
+			cl_hidden_auth);
 
-	ptr = output;
+	if (rate_mode)
+		snmp_counter_rates (found);
 
 	strncat(perfstr, "| ", sizeof(perfstr)-strlen(perfstr)-1);
-	while (ptr) {
-		char *foo;
-		unsigned int copylen;
-
-		foo = strstr (ptr, delimiter);
-		copylen = foo-ptr;
-		if (copylen > sizeof(perfstr)-strlen(perfstr)-1)
-			copylen = sizeof(perfstr)-strlen(perfstr)-1;
-		strncat(perfstr, ptr, copylen);
-		ptr = foo; 
-
-		if (ptr == NULL)
-			break;
-
-		ptr += strlen (delimiter);
-		ptr += strspn (ptr, " ");
-
-		found++;
-
-		if (ptr[0] == '"') {
-			ptr++;
-			response = strpcpy (response, ptr, "\"");
-			ptr = strpbrk (ptr, "\"");
-			ptr += strspn (ptr, "\"\n");
-		}
-		else {
-			response = strpcpy (response, ptr, "\n");
-			ptr = strpbrk (ptr, "\n");
-			ptr += strspn (ptr, "\n");
-			while
-				(strstr (ptr, delimiter) &&
-				 strstr (ptr, "\n") && strstr (ptr, "\n") < strstr (ptr, delimiter)) {
-				response = strpcat (response, ptr, "\n");
-				ptr = strpbrk (ptr, "\n");
-			}
-			if (ptr && strstr (ptr, delimiter) == NULL) {
-				asprintf (&response, "%s%s", response, ptr);
-				ptr = NULL;
-			}
-		}
-
-		/* We strip out the datatype indicator for PHBs */
-
-		/* Clean up type array - Sol10 does not necessarily zero it out */
-		bzero(type, sizeof(type));
-
-		if (strstr (response, "Gauge: "))
-			show = strstr (response, "Gauge: ") + 7;
-		else if (strstr (response, "Gauge32: "))
-			show = strstr (response, "Gauge32: ") + 9;
-		else if (strstr (response, "Counter32: ")) {
-			show = strstr (response, "Counter32: ") + 11;
-			strcpy(type, "c");
-		}
-		else if (strstr (response, "Counter64: ")) {
-			show = strstr (response, "Counter64: ") + 11;
-			strcpy(type, "c");
-		}
-		else if (strstr (response, "INTEGER: "))
-			show = strstr (response, "INTEGER: ") + 9;
-		else if (strstr (response, "STRING: "))
-			show = strstr (response, "STRING: ") + 8;
-		else
-			show = response;
+	for (i = 0; i < found; i++) {
+		/* OIDs without thresholds are only checked for presence */
+		c = values[i].check;
+		get_check (c);
+		show = values[i].show;
 		p2 = show;
 
 		iresult = STATE_DEPENDENT;
 
+		/* Nothing to compare until the counter has been seen twice */
+		if (values[i].no_rate)
+			iresult = STATE_OK;
+
 		/* Process this block for integer comparisons */
-		if (eval_method[i] & CRIT_GT ||
-		    eval_method[i] & CRIT_LT ||
-		    eval_method[i] & CRIT_GE ||
-		    eval_method[i] & CRIT_LE ||
-		    eval_method[i] & CRIT_EQ ||
-		    eval_method[i] & CRIT_NE ||
-		    eval_method[i] & WARN_GT ||
-		    eval_method[i] & WARN_LT ||
-		    eval_method[i] & WARN_GE ||
-		    eval_method[i] & WARN_LE ||
-		    eval_method[i] & WARN_EQ ||
-		    eval_method[i] & WARN_NE) {
-			p2 = strpbrk (p2, "0123456789");
-			if (p2 == NULL) 
-				die (STATE_UNKNOWN,_("No valid data returned"));
-			response_value[i] = strtoul (p2, NULL, 10);
-			iresult = check_num (i);
-			asprintf (&show, "%llu", response_value[i]);
+		else if (checks[c].eval_method & CRIT_GT ||
+		    checks[c].eval_method & CRIT_LT ||
+		    checks[c].eval_method & CRIT_GE ||
+		    checks[c].eval_method & CRIT_LE ||
+		    checks[c].eval_method & CRIT_EQ ||
+		    checks[c].eval_method & CRIT_NE ||
+		    checks[c].eval_method & WARN_GT ||
+		    checks[c].eval_method & WARN_LT ||
+		    checks[c].eval_method & WARN_GE ||
+		    checks[c].eval_method & WARN_LE ||
+		    checks[c].eval_method & WARN_EQ ||
+		    checks[c].eval_method & WARN_NE) {
+			if (values[i].numeric)
+				checks[c].response_value = values[i].number;
+			else {
+				p2 = strpbrk (p2, "0123456789");
+				if (p2 == NULL) 
+					die (STATE_UNKNOWN,_("No valid data returned"));
+				checks[c].response_value = strtoul (p2, NULL, 10);
+			}
+			iresult = check_num (c);
+			asprintf (&show, "%llu", checks[c].response_value);
 		}
 
 		/* Process this block for string matching */
-		else if (eval_method[i] & CRIT_STRING) {
+		else if (checks[c].eval_method & CRIT_STRING) {
 			if (strcmp (show, string_value))
 				iresult = STATE_CRITICAL;
 			else
@@ -325,8 +294,8 @@ main (int argc, char **argv)
 		}
 
 		/* Process this block for regex matching */
-		else if (eval_method[i] & CRIT_REGEX) {
-			excode = regexec (&preg, response, 10, pmatch, eflags);
+		else if (checks[c].eval_method & CRIT_REGEX) {
+			excode = regexec (&preg, values[i].response, 10, pmatch, eflags);
 			if (excode == 0) {
 				iresult = STATE_OK;
 			}
@@ -342,11 +311,11 @@ main (int argc, char **argv)
 
 		/* Process this block for existence-nonexistence checks */
 		else {
-			if (eval_method[i] & CRIT_PRESENT)
+			if (checks[c].eval_method & CRIT_PRESENT)
 				iresult = STATE_CRITICAL;
-			else if (eval_method[i] & WARN_PRESENT)
+			else if (checks[c].eval_method & WARN_PRESENT)
 				iresult = STATE_WARNING;
-			else if (response && iresult == STATE_DEPENDENT) 
+			else if (values[i].response && iresult == STATE_DEPENDENT) 
 				iresult = STATE_OK;
 		}
 
@@ -354,33 +323,480 @@ main (int argc, char **argv)
 		result = max_state (result, iresult);
 
 		/* Prepend a label for this OID if there is one */
-		if (nlabels > (size_t)1 && (size_t)i < nlabels && labels[i] != NULL)
+		if (values[i].index)
+			asprintf (&outbuff, "%s%s%s[%s] %s%s%s", outbuff,
+				(i == 0) ? " " : output_delim,
+				(nlabels > (size_t)1 && c < nlabels && labels[c] != NULL) ? labels[c] : "",
+				values[i].index, mark (iresult), show, mark (iresult));
+		else if (nlabels > (size_t)1 && c < nlabels && labels[c] != NULL)
 			asprintf (&outbuff, "%s%s%s %s%s%s", outbuff,
 				(i == 0) ? " " : output_delim,
-				labels[i], mark (iresult), show, mark (iresult));
+				labels[c], mark (iresult), show, mark (iresult));
 		else
 			asprintf (&outbuff, "%s%s%s%s%s", outbuff, (i == 0) ? " " : output_delim,
 				mark (iresult), show, mark (iresult));
 
 		/* Append a unit string for this OID if there is one */
-		if (nunits > (size_t)0 && (size_t)i < nunits && unitv[i] != NULL)
-			asprintf (&outbuff, "%s %s", outbuff, unitv[i]);
-
-		i++;
+		if (nunits > (size_t)0 && c < nunits && unitv[c] != NULL)
+			asprintf (&outbuff, "%s %s", outbuff, unitv[c]);
 
+		if (values[i].no_rate)
+			continue;
+		strncat(perfstr, values[i].name, sizeof(perfstr)-strlen(perfstr)-1);
 		strncat(perfstr, "=", sizeof(perfstr)-strlen(perfstr)-1);
 		strncat(perfstr, show, sizeof(perfstr)-strlen(perfstr)-1);
-		if (type)
-			strncat(perfstr, type, sizeof(perfstr)-strlen(perfstr)-1);
+		strncat(perfstr, values[i].type, sizeof(perfstr)-strlen(perfstr)-1);
 		strncat(perfstr, " ", sizeof(perfstr)-strlen(perfstr)-1);
+	}
 
-	}	/* end while (ptr) */
+	if (command_failed) {
+		if (result == STATE_OK)
+			result = STATE_UNKNOWN;
+		asprintf (&outbuff, "%s (%s)", outbuff, _("snmpget returned an error status"));
+	}
 
-	if (found == 0)
-		die (STATE_UNKNOWN,
-			_("%s problem - No data received from host\nCMD: %s\n"),
-			label,
-			cl_hidden_auth);
+/* 	if (nunits == 1 || i == 1) */
+/* 		printf ("%s %s -%s %s\n", label, state_text (result), outbuff, units); */
+/* 	else */
+	printf ("%s %s -%s %s \n", label, state_text (result), outbuff, perfstr);
+
+	return result;
+}
+
+
+
+/* Returns a pointer past the datatype indicator of response, the first
+ * type_len characters, which we strip for PHBs; counters are tagged "c"
+ * in type for the perfdata */
+char *
+snmp_show_value (char *response, size_t type_len, char *type)
+{
+	static const char *stripped[] = {
+		"Gauge", "Gauge32", "Counter32", "Counter64", "INTEGER", "STRING",
+		"Hex-STRING", NULL
+	};
+	int i;
+
+	/* Clean up type array - Sol10 does not necessarily zero it out */
+	bzero(type, 8);
+
+	if (type_len == 0)
+		return response;
+	if (!strncmp (response, "Counter", 7) && type_len == 9)
+		strcpy(type, "c");
+	for (i = 0; stripped[i]; i++)
+		if (strlen (stripped[i]) == type_len && !strncmp (response, stripped[i], type_len))
+			return response + type_len + 2;
+	return response;
+}
+
+
+
+/* Replaces counter values by their rate per second since the last run,
+ * which is kept in a state file per agent */
+void
+snmp_counter_rates (int found)
+{
+	np_counter_store *st;
+	struct timeval now;
+	unsigned long long counter;
+	double rate;
+	char *name, *path;
+	int i, bits;
+
+	asprintf (&name, "check_snmp_%s_%s", server_address, port);
+	if ((path = np_counter_path (name)) == NULL ||
+	    (st = np_counter_open (path)) == NULL)
+		die (STATE_UNKNOWN, _("%s problem - Cannot open counter state file %s: %s\n"),
+			label, path ? path : name, strerror (errno));
+	gettimeofday (&now, NULL);
+
+	for (i = 0; i < found; i++) {
+		if (strcmp (values[i].type, "c"))
+			continue;
+		bits = strstr (values[i].response, "Counter64: ") ? 64 : 32;
+		counter = values[i].numeric ? values[i].number : strtoull (values[i].show, NULL, 10);
+
+		switch (np_counter_rate (st, values[i].name, counter, bits, &now, &rate)) {
+		case NP_COUNTER_ERROR:
+			die (STATE_UNKNOWN, _("%s problem - Cannot update counter state file %s\n"),
+				label, path);
+		case NP_COUNTER_FIRST:
+			values[i].no_rate = TRUE;
+			values[i].show = _("no rate yet");
+			break;
+		default:
+			if (verbose)
+				printf ("%s: %llu -> %.2f/s\n", values[i].name, counter, rate);
+			values[i].number = (unsigned long long) (rate + 0.5);
+			values[i].numeric = TRUE;
+			asprintf (&values[i].show, "%llu", values[i].number);
+			/* a rate is a gauge */
+			values[i].type[0] = '\0';
+		}
+	}
+	np_counter_close (st);
+}
+
+
+
+/* Fills in value from a varbind of the response */
+void
+snmp_set_value (struct snmp_value *value, const np_snmp_varbind *vb)
+{
+	char text[MAX_INPUT_BUFFER], name[NP_SNMP_OID_STR];
+
+	np_snmp_format_oid (&vb->oid, name, sizeof (name));
+	/* snmpget prints the iso node by name even without MIBs */
+	if (name[0] == '1' && (name[1] == '.' || name[1] == '\0'))
+		asprintf (&value->name, "iso%s", name + 1);
+	else
+		value->name = strdup (name);
+
+	np_snmp_format_value (vb, text, sizeof (text));
+	value->response = strdup (text);
+	value->show = snmp_show_value (value->response,
+		np_snmp_text_type (value->response, strlen (value->response)), value->type);
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		/* negative values are left to the text parser, as before */
+		value->numeric = ((long long)vb->number >= 0);
+		break;
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		value->numeric = TRUE;
+		break;
+	default:
+		value->numeric = FALSE;
+	}
+	value->number = vb->number;
+}
+
+
+
+/* Queries all OIDs with as few GET (or GETNEXT) requests of our own as
+ * the agent accepts: everything goes into one PDU, which is split in
+ * halves whenever the agent answers tooBig.
+ * Returns the number of values received */
+int
+snmp_native_query (void)
+{
+	np_snmp_pdu request, response;
+	np_snmp_varbind *vbs, *vb;
+	unsigned char *buf;
+	char *oids, *ptr, name[NP_SNMP_OID_STR];
+	size_t i, n = 0, done = 0, batch;
+	struct snmp_value *value;
+	int sd, rc;
+
+	/* -o options were joined with spaces; count them for the varbind list */
+	oids = strdup (oid);
+	for (ptr = strtok (oids, " "); ptr; ptr = strtok (NULL, " "))
+		n++;
+	if (n == 0)
+		usage4 (_("No OIDs specified"));
+
+	vbs = calloc (n, sizeof (np_snmp_varbind));
+	response.vb = calloc (n, sizeof (np_snmp_varbind));
+	values = calloc (n, sizeof (struct snmp_value));
+	buf = malloc (NP_SNMP_MAX_MSG);
+	if (vbs == NULL || response.vb == NULL || values == NULL || buf == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for %d OIDs\n"), (int)n);
+
+	strcpy (oids, oid);
+	for (i = 0, ptr = strtok (oids, " "); ptr; ptr = strtok (NULL, " "), i++) {
+		if (np_snmp_parse_oid (ptr, &vbs[i].oid) == ERROR)
+			usage2 (_("Invalid OID"), ptr);
+		vbs[i].type = NP_SNMP_NULL;
+	}
+
+	request.version = strcmp (proto, "2c") ? NP_SNMP_V1 : NP_SNMP_V2C;
+	request.community = community;
+	request.community_len = strlen (community);
+	request.type = usesnmpgetnext ? NP_SNMP_GETNEXT : NP_SNMP_GET;
+	request.request_id = (getpid () ^ time (NULL)) & 0x7fffffff;
+	request.error_status = 0;
+	request.error_index = 0;
+	response.max_vb = n;
+
+	asprintf (&cl_hidden_auth, "%s %s v%s %s:%s%s", progname,
+		usesnmpgetnext ? "GETNEXT" : "GET", proto, server_address, port, oid);
+	if (verbose)
+		printf ("%s\n", cl_hidden_auth);
+
+	if (my_udp_connect (server_address, atoi (port), &sd) != STATE_OK)
+		die (STATE_UNKNOWN, _("%s problem - Could not connect to %s\n"),
+			label, server_address);
+
+	batch = n;
+	while (done < n) {
+		request.vb = vbs + done;
+		request.nvb = (n - done < batch) ? n - done : batch;
+		request.request_id = (request.request_id + 1) & 0x7fffffff;
+
+		rc = np_snmp_exchange (sd, &request, &response, buf, NP_SNMP_MAX_MSG,
+		                       timeout_interval, retries);
+		if (rc == NP_SNMP_ERR_TIMEOUT)
+			return 0;
+
+		if ((rc == NP_SNMP_ERR_ENCODE ||
+		     (rc == NP_SNMP_OK && response.error_status == NP_SNMP_TOOBIG)) &&
+		    request.nvb > 1) {
+			batch = (request.nvb + 1) / 2;
+			if (verbose)
+				printf (_("Request for %d OIDs too big, retrying with %d\n"),
+					(int)request.nvb, (int)batch);
+			continue;
+		}
+		if (rc != NP_SNMP_OK)
+			die (STATE_UNKNOWN, _("%s problem - %s\n"), label, np_snmp_strerror (rc));
+
+		if (response.error_status != NP_SNMP_NOERROR) {
+			if (response.error_index > 0 && (size_t)response.error_index <= request.nvb)
+				np_snmp_format_oid (&request.vb[response.error_index - 1].oid,
+				                    name, sizeof (name));
+			else
+				strcpy (name, "?");
+			die (STATE_UNKNOWN, _("%s problem - %s (%s)\n"), label,
+				np_snmp_error_status (response.error_status), name);
+		}
+		if (response.nvb != request.nvb)
+			die (STATE_UNKNOWN, _("%s problem - Agent returned %d values for %d OIDs\n"),
+				label, (int)response.nvb, (int)request.nvb);
+
+		for (i = 0; i < response.nvb; i++) {
+			vb = &response.vb[i];
+			value = &values[done + i];
+			snmp_set_value (value, vb);
+			value->check = done + i;
+
+			if (verbose)
+				printf ("%s = %s\n", value->name, value->response);
+		}
+		done += response.nvb;
+	}
+	close (sd);
+
+	free (buf);
+	free (oids);
+	free (vbs);
+	free (response.vb);
+	return n;
+}
+
+
+
+/* Walks the table columns given with -o (GETBULK for SNMPv2c) and joins
+ * them by index, so that the values come out row by row.
+ * Returns the number of values received */
+int
+snmp_table_query (void)
+{
+	np_snmp_pdu request;
+	np_snmp_oid *columns;
+	struct table_walk walk;
+	char *oids, *ptr;
+	size_t i, n = 0;
+	int sd, rc;
+
+	oids = strdup (oid);
+	for (ptr = strtok (oids, " "); ptr; ptr = strtok (NULL, " "))
+		n++;
+	if (n == 0)
+		usage4 (_("No OIDs specified"));
+
+	columns = calloc (n, sizeof (np_snmp_oid));
+	if (columns == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for %d OIDs\n"), (int)n);
+	strcpy (oids, oid);
+	for (i = 0, ptr = strtok (oids, " "); ptr; ptr = strtok (NULL, " "), i++)
+		if (np_snmp_parse_oid (ptr, &columns[i]) == ERROR)
+			usage2 (_("Invalid OID"), ptr);
+
+	memset (&request, 0, sizeof (request));
+	request.version = strcmp (proto, "2c") ? NP_SNMP_V1 : NP_SNMP_V2C;
+	request.community = community;
+	request.community_len = strlen (community);
+	request.request_id = (getpid () ^ time (NULL)) & 0x7fffffff;
+
+	asprintf (&cl_hidden_auth, "%s %s v%s %s:%s%s", progname,
+		request.version == NP_SNMP_V1 ? "GETNEXT walk" : "GETBULK walk",
+		proto, server_address, port, oid);
+	if (verbose)
+		printf ("%s\n", cl_hidden_auth);
+
+	if (my_udp_connect (server_address, atoi (port), &sd) != STATE_OK)
+		die (STATE_UNKNOWN, _("%s problem - Could not connect to %s\n"),
+			label, server_address);
+
+	memset (&walk, 0, sizeof (walk));
+	walk.columns = columns;
+	rc = np_snmp_walk (sd, &request, columns, n, DEFAULT_MAX_REPETITIONS,
+	                   timeout_interval, retries, table_collect, &walk);
+	close (sd);
+	if (rc == NP_SNMP_ERR_TIMEOUT && walk.ncells == 0)
+		return 0;
+	else if (rc > 0)
+		die (STATE_UNKNOWN, _("%s problem - %s\n"), label, np_snmp_error_status (rc));
+	else if (rc != NP_SNMP_OK)
+		die (STATE_UNKNOWN, _("%s problem - %s\n"), label, np_snmp_strerror (rc));
+
+	/* join the columns: order by row, then by column */
+	qsort (walk.cells, walk.ncells, sizeof (struct table_cell), table_cell_compare);
+	values = calloc (walk.ncells ? walk.ncells : 1, sizeof (struct snmp_value));
+	if (values == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for %d values\n"), (int)walk.ncells);
+	for (i = 0; i < walk.ncells; i++) {
+		values[i] = walk.cells[i].value;
+		if (verbose)
+			printf ("%s = %s\n", values[i].name, values[i].response);
+	}
+
+	free (walk.cells);
+	free (columns);
+	free (oids);
+	return walk.ncells;
+}
+
+/* np_snmp_walk callback collecting the cells of a --table walk */
+void
+table_collect (size_t column, const np_snmp_varbind *vb, void *arg)
+{
+	struct table_walk *walk = arg;
+	struct table_cell *cell;
+	char index[NP_SNMP_OID_STR];
+	size_t i;
+
+	if (walk->ncells >= walk->cells_size) {
+		walk->cells_size = walk->cells_size ? walk->cells_size * 2 : 64;
+		walk->cells = realloc (walk->cells, walk->cells_size * sizeof (struct table_cell));
+		if (walk->cells == NULL)
+			die (STATE_UNKNOWN, _("Could not reallocate cells[%d]\n"), (int)walk->ncells);
+	}
+	cell = &walk->cells[walk->ncells++];
+	memset (cell, 0, sizeof (struct table_cell));
+
+	/* the index is what follows the column's OID */
+	cell->index.len = vb->oid.len - walk->columns[column].len;
+	for (i = 0; i < cell->index.len; i++)
+		cell->index.sub[i] = vb->oid.sub[walk->columns[column].len + i];
+
+	snmp_set_value (&cell->value, vb);
+	cell->value.check = column;
+	cell->value.index = strdup (np_snmp_format_oid (&cell->index, index, sizeof (index)));
+}
+
+int
+table_cell_compare (const void *a, const void *b)
+{
+	const struct table_cell *x = a, *y = b;
+	int cmp;
+
+	if ((cmp = np_snmp_oid_compare (&x->index, &y->index)))
+		return cmp;
+	if (x->value.check != y->value.check)
+		return x->value.check < y->value.check ? -1 : 1;
+	return 0;
+}
+
+
+
+#ifdef PATH_TO_SNMPGET
+/* Runs snmpget (or snmpgetnext) and parses its output. The values point
+ * into the output, which is read into one buffer and kept.
+ * Returns the number of values received */
+int
+snmp_command_query (void)
+{
+	np_snmp_text entry;
+	char *command_line = NULL;
+	char *response = NULL;
+	char *output;
+	char *ptr = NULL;
+	size_t output_size = MAX_INPUT_BUFFER, output_len = 0, n;
+	size_t values_size = 0;
+	int found = 0;
+
+	if ((output = malloc (output_size)) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for output\n"));
+
+	/* create the command line to execute */
+		if(usesnmpgetnext == TRUE) {
+		asprintf(&command_line, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
+			PATH_TO_SNMPGETNEXT, timeout_interval, retries, miblist, proto,
+			authpriv, server_address, port, oid);
+		asprintf(&cl_hidden_auth, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
+			PATH_TO_SNMPGETNEXT, timeout_interval, retries, miblist, proto,
+			"[authpriv]", server_address, port, oid);
+	}else{
+
+		asprintf (&command_line, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
+			PATH_TO_SNMPGET, timeout_interval, retries, miblist, proto,
+			authpriv, server_address, port, oid);
+		asprintf(&cl_hidden_auth, "%s -t %d -r %d -m %s -v %s %s %s:%s %s",
+			PATH_TO_SNMPGET, timeout_interval, retries, miblist, proto,
+			"[authpriv]", server_address, port, oid);
+	}
+	
+	if (verbose)
+		printf ("%s\n", command_line);
+	
+
+	/* run the command */
+	child_process = spopen (command_line);
+	if (child_process == NULL) {
+		printf (_("Could not open pipe: %s\n"), cl_hidden_auth);
+		exit (STATE_UNKNOWN);
+	}
+
+#if 0		/* Removed May 29, 2007 */
+	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+	if (child_stderr == NULL) {
+		printf (_("Could not open stderr for %s\n"), cl_hidden_auth);
+	}
+#endif
+
+	/* read everything, doubling the buffer as needed */
+	while ((n = fread (output + output_len, 1, output_size - output_len - 1, child_process)) > 0) {
+		output_len += n;
+		if (output_len + 1 == output_size) {
+			output_size *= 2;
+			if ((output = realloc (output, output_size)) == NULL)
+				die (STATE_UNKNOWN, _("Could not allocate memory for output\n"));
+		}
+	}
+	output[output_len] = '\0';
+
+	if (verbose)
+		printf ("%s\n", output);
+
+	ptr = output;
+
+	while (np_snmp_text_next (&ptr, delimiter, &entry)) {
+		if ((size_t)found >= values_size) {
+			values_size = values_size ? values_size * 2 : 8;
+			values = realloc (values, values_size * sizeof (struct snmp_value));
+			if (values == NULL)
+				die (STATE_UNKNOWN, _("Could not reallocate values[%d]\n"), found);
+		}
+
+		/* ptr is past the entry, so it can be terminated in place */
+		response = entry.type ? entry.type : entry.value;
+		entry.oid[entry.oid_len] = '\0';
+		entry.value[entry.value_len] = '\0';
+
+		values[found].name = entry.oid;
+		values[found].response = response;
+		values[found].show = snmp_show_value (response, entry.type_len, values[found].type);
+		values[found].numeric = FALSE;
+		values[found].check = found;
+		values[found].index = NULL;
+		values[found].no_rate = FALSE;
+		found++;
+	}	/* end while (ptr) */
 
 #if 0		/* Removed May 29, 2007 */
 	/* WARNING if output found on stderr */
@@ -392,19 +808,12 @@ main (int argc, char **argv)
 #endif
 
 	/* close the pipe */
-	if (spclose (child_process)) {
-		if (result == STATE_OK)
-			result = STATE_UNKNOWN;
-		asprintf (&outbuff, "%s (%s)", outbuff, _("snmpget returned an error status"));
-	}
-
-/* 	if (nunits == 1 || i == 1) */
-/* 		printf ("%s %s -%s %s\n", label, state_text (result), outbuff, units); */
-/* 	else */
-	printf ("%s %s -%s %s \n", label, state_text (result), outbuff, perfstr);
+	if (spclose (child_process))
+		command_failed = TRUE;
 
-	return result;
+	return found;
 }
+#endif
 
 
 
@@ -416,6 +825,11 @@ process_arguments (int argc, char **argv)
 	int c = 1;
 	int j = 0, jj = 0, ii = 0;
 
+	enum {
+		TABLE_MODE = CHAR_MAX + 1,
+		RATE_MODE
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		STD_LONG_OPTS,
@@ -441,6 +855,9 @@ process_arguments (int argc, char **argv)
 		{"authpasswd", required_argument, 0, 'A'},
 		{"privpasswd", required_argument, 0, 'X'},
 		{"next", no_argument, 0, 'n'},
+		{"table", no_argument, 0, TABLE_MODE},
+		{"walk", no_argument, 0, TABLE_MODE},
+		{"rate", no_argument, 0, RATE_MODE},
 		{0, 0, 0, 0}
 	};
 
@@ -493,6 +910,12 @@ process_arguments (int argc, char **argv)
 		case 'n':	/* usesnmpgetnext */
 			usesnmpgetnext = TRUE;
 			break;
+		case TABLE_MODE:	/* walk -o OIDs as table columns */
+			table_mode = TRUE;
+			break;
+		case RATE_MODE:	/* check counters as rates per second */
+			rate_mode = TRUE;
+			break;
 		case 'P':	/* SNMP protocol version */
 			proto = optarg;
 			break;
@@ -522,22 +945,24 @@ process_arguments (int argc, char **argv)
 		case 'c':									/* critical time threshold */
 			if (strspn (optarg, "0123456789:,") < strlen (optarg))
 				usage2 (_("Invalid critical threshold"), optarg);
-			for (ptr = optarg; ptr && jj < MAX_OIDS; jj++) {
-				if (llu_getll (&lower_crit_lim[jj], ptr) == 1)
-					eval_method[jj] |= CRIT_LT;
-				if (llu_getul (&upper_crit_lim[jj], ptr) == 1)
-					eval_method[jj] |= CRIT_GT;
+			for (ptr = optarg; ptr; jj++) {
+				get_check (jj);
+				if (llu_getll (&checks[jj].lower_crit_lim, ptr) == 1)
+					checks[jj].eval_method |= CRIT_LT;
+				if (llu_getul (&checks[jj].upper_crit_lim, ptr) == 1)
+					checks[jj].eval_method |= CRIT_GT;
 				(ptr = index (ptr, ',')) ? ptr++ : ptr;
 			}
 			break;
 		case 'w':									/* warning time threshold */
 			if (strspn (optarg, "0123456789:,") < strlen (optarg))
 				usage2 (_("Invalid warning threshold"), optarg);
-			for (ptr = optarg; ptr && ii < MAX_OIDS; ii++) {
-				if (llu_getll (&lower_warn_lim[ii], ptr) == 1)
-					eval_method[ii] |= WARN_LT;
-				if (llu_getul (&upper_warn_lim[ii], ptr) == 1)
-					eval_method[ii] |= WARN_GT;
+			for (ptr = optarg; ptr; ii++) {
+				get_check (ii);
+				if (llu_getll (&checks[ii].lower_warn_lim, ptr) == 1)
+					checks[ii].eval_method |= WARN_LT;
+				if (llu_getul (&checks[ii].upper_warn_lim, ptr) == 1)
+					checks[ii].eval_method |= WARN_GT;
 				(ptr = index (ptr, ',')) ? ptr++ : ptr;
 			}
 			break;
@@ -568,14 +993,14 @@ process_arguments (int argc, char **argv)
 				ii++;
 			}
 			if (c == 'E') 
-				eval_method[j+1] |= WARN_PRESENT;
+				get_check (j+1)->eval_method |= WARN_PRESENT;
 			else if (c == 'e')
-				eval_method[j+1] |= CRIT_PRESENT;
+				get_check (j+1)->eval_method |= CRIT_PRESENT;
 			break;
 		case 's':									/* string or substring */
 			strncpy (string_value, optarg, sizeof (string_value) - 1);
 			string_value[sizeof (string_value) - 1] = 0;
-			eval_method[jj++] = CRIT_STRING;
+			get_check (jj++)->eval_method = CRIT_STRING;
 			ii++;
 			break;
 		case 'R':									/* regex */
@@ -590,7 +1015,7 @@ process_arguments (int argc, char **argv)
 				printf (_("Could Not Compile Regular Expression"));
 				return ERROR;
 			}
-			eval_method[jj++] = CRIT_REGEX;
+			get_check (jj++)->eval_method = CRIT_REGEX;
 			ii++;
 			break;
 
@@ -606,7 +1031,7 @@ process_arguments (int argc, char **argv)
 			nlabels++;
 			if (nlabels >= labels_size) {
 				labels_size += 8;
-				labels = realloc (labels, labels_size);
+				labels = realloc (labels, labels_size * sizeof (char *));
 				if (labels == NULL)
 					die (STATE_UNKNOWN, _("Could not reallocate labels[%d]"), (int)nlabels);
 			}
@@ -618,11 +1043,11 @@ process_arguments (int argc, char **argv)
 			while (ptr && (ptr = nextarg (ptr))) {
 				if (nlabels >= labels_size) {
 					labels_size += 8;
-					labels = realloc (labels, labels_size);
+					labels = realloc (labels, labels_size * sizeof (char *));
 					if (labels == NULL)
 						die (STATE_UNKNOWN, _("Could not reallocate labels\n"));
 				}
-				labels++;
+				nlabels++;
 				ptr = thisarg (ptr);
 				if (strstr (ptr, "'") == ptr)
 					labels[nlabels - 1] = ptr + 1;
@@ -635,7 +1060,7 @@ process_arguments (int argc, char **argv)
 			nunits++;
 			if (nunits >= unitv_size) {
 				unitv_size += 8;
-				unitv = realloc (unitv, unitv_size);
+				unitv = realloc (unitv, unitv_size * sizeof (char *));
 				if (unitv == NULL)
 					die (STATE_UNKNOWN, _("Could not reallocate units [%d]\n"), (int)nunits);
 			}
@@ -647,7 +1072,7 @@ process_arguments (int argc, char **argv)
 			while (ptr && (ptr = nextarg (ptr))) {
 				if (nunits >= unitv_size) {
 					unitv_size += 8;
-					unitv = realloc (unitv, unitv_size);
+					unitv = realloc (unitv, unitv_size * sizeof (char *));
 					if (units == NULL)
 						die (STATE_UNKNOWN, _("Could not realloc() units\n"));
 				}
@@ -759,6 +1184,23 @@ validate_arguments ()
 
 
 
+/* Returns the checks of OID number i (counting from 0), making room for
+ * it if needed. New entries have no evaluation method */
+struct oid_check *
+get_check (size_t i)
+{
+	if (i >= nchecks) {
+		checks = realloc (checks, (i + 1) * sizeof (struct oid_check));
+		if (checks == NULL)
+			die (STATE_UNKNOWN, _("Could not reallocate checks[%d]\n"), (int)i);
+		memset (checks + nchecks, 0, (i + 1 - nchecks) * sizeof (struct oid_check));
+		nchecks = i + 1;
+	}
+	return &checks[i];
+}
+
+
+
 char *
 clarify_message (char *msg)
 {
@@ -801,37 +1243,37 @@ check_num (int i)
 {
 	int result;
 	result = STATE_OK;
-	if (eval_method[i] & WARN_GT && eval_method[i] & WARN_LT &&
-			lower_warn_lim[i] > upper_warn_lim[i]) {
-		if (response_value[i] <= lower_warn_lim[i] &&
-				response_value[i] >= upper_warn_lim[i]) {
+	if (checks[i].eval_method & WARN_GT && checks[i].eval_method & WARN_LT &&
+			checks[i].lower_warn_lim > checks[i].upper_warn_lim) {
+		if (checks[i].response_value <= checks[i].lower_warn_lim &&
+				checks[i].response_value >= checks[i].upper_warn_lim) {
 			result = STATE_WARNING;
 		}
 	}
 	else if
-		((eval_method[i] & WARN_GT && response_value[i] > upper_warn_lim[i]) ||
-		 (eval_method[i] & WARN_GE && response_value[i] >= upper_warn_lim[i]) ||
-		 (eval_method[i] & WARN_LT && response_value[i] < lower_warn_lim[i]) ||
-		 (eval_method[i] & WARN_LE && response_value[i] <= lower_warn_lim[i]) ||
-		 (eval_method[i] & WARN_EQ && response_value[i] == upper_warn_lim[i]) ||
-		 (eval_method[i] & WARN_NE && response_value[i] != upper_warn_lim[i])) {
+		((checks[i].eval_method & WARN_GT && checks[i].response_value > checks[i].upper_warn_lim) ||
+		 (checks[i].eval_method & WARN_GE && checks[i].response_value >= checks[i].upper_warn_lim) ||
+		 (checks[i].eval_method & WARN_LT && checks[i].response_value < checks[i].lower_warn_lim) ||
+		 (checks[i].eval_method & WARN_LE && checks[i].response_value <= checks[i].lower_warn_lim) ||
+		 (checks[i].eval_method & WARN_EQ && checks[i].response_value == checks[i].upper_warn_lim) ||
+		 (checks[i].eval_method & WARN_NE && checks[i].response_value != checks[i].upper_warn_lim)) {
 		result = STATE_WARNING;
 	}
 
-	if (eval_method[i] & CRIT_GT && eval_method[i] & CRIT_LT &&
-			lower_crit_lim[i] > upper_crit_lim[i]) {
-		if (response_value[i] <= lower_crit_lim[i] &&
-				response_value[i] >= upper_crit_lim[i]) {
+	if (checks[i].eval_method & CRIT_GT && checks[i].eval_method & CRIT_LT &&
+			checks[i].lower_crit_lim > checks[i].upper_crit_lim) {
+		if (checks[i].response_value <= checks[i].lower_crit_lim &&
+				checks[i].response_value >= checks[i].upper_crit_lim) {
 			result = STATE_CRITICAL;
 		}
 	}
 	else if
-		((eval_method[i] & CRIT_GT && response_value[i] > upper_crit_lim[i]) ||
-		 (eval_method[i] & CRIT_GE && response_value[i] >= upper_crit_lim[i]) ||
-		 (eval_method[i] & CRIT_LT && response_value[i] < lower_crit_lim[i]) ||
-		 (eval_method[i] & CRIT_LE && response_value[i] <= lower_crit_lim[i]) ||
-		 (eval_method[i] & CRIT_EQ && response_value[i] == upper_crit_lim[i]) ||
-		 (eval_method[i] & CRIT_NE && response_value[i] != upper_crit_lim[i])) {
+		((checks[i].eval_method & CRIT_GT && checks[i].response_value > checks[i].upper_crit_lim) ||
+		 (checks[i].eval_method & CRIT_GE && checks[i].response_value >= checks[i].upper_crit_lim) ||
+		 (checks[i].eval_method & CRIT_LT && checks[i].response_value < checks[i].lower_crit_lim) ||
+		 (checks[i].eval_method & CRIT_LE && checks[i].response_value <= checks[i].lower_crit_lim) ||
+		 (checks[i].eval_method & CRIT_EQ && checks[i].response_value == checks[i].upper_crit_lim) ||
+		 (checks[i].eval_method & CRIT_NE && checks[i].response_value != checks[i].upper_crit_lim)) {
 		result = STATE_CRITICAL;
 	}
 
@@ -941,6 +1383,13 @@ print_help (void)
 	/* SNMP and Authentication Protocol */
 	printf (" %s\n", "-n, --next");
   printf ("    %s\n", _("Use SNMP GETNEXT instead of SNMP GET"));
+  printf (" %s\n", "--table, --walk");
+  printf ("    %s\n", _("Walk each OID as a table column and check every row found, with the"));
+  printf ("    %s\n", _("thresholds given for that column (numeric OIDs, SNMP v1 or v2c only)"));
+  printf (" %s\n", "--rate");
+  printf ("    %s\n", _("Check Counter32/Counter64 values as a rate per second since the last run."));
+  printf ("    %s %s),\n", _("Samples are kept in $NAGIOS_PLUGIN_STATE_DIRECTORY (default"), NP_COUNTER_DIR);
+  printf ("    %s\n", _("so the first run of a check only stores them"));
   printf (" %s\n", "-P, --protocol=[1|2c|3]");
   printf ("    %s\n", _("SNMP protocol version"));
   printf (" %s\n", "-L, --seclevel=[noAuthNoPriv|authNoPriv|authPriv]");
@@ -996,12 +1445,12 @@ print_help (void)
 
 	printf (_(UT_VERBOSE));
 
-	printf ("%s\n", _("This plugin uses the 'snmpget' command included with the NET-SNMP package."));
-  printf ("%s\n", _("if you don't have the package installed, you will need to download it from"));
-  printf ("%s\n", _("http://net-snmp.sourceforge.net before you can use this plugin."));
+	printf ("%s\n", _("SNMP v1 and v2c queries for numeric OIDs are sent by the plugin itself."));
+  printf ("%s\n", _("MIB names and SNMPv3 need the 'snmpget' command included with the NET-SNMP"));
+  printf ("%s\n", _("package, available from http://net-snmp.sourceforge.net"));
 
 	printf ("%s\n", _("- Multiple OIDs may be indicated by a comma- or space-delimited list (lists with"));
-  printf ("%s\n", _(" internal spaces must be quoted) [max 8 OIDs]"));
+  printf ("%s\n", _(" internal spaces must be quoted)"));
 
 	printf ("%s\n", _("- Ranges are inclusive and are indicated with colons. When specified as"));
   printf ("%s\n", _(" 'min:max' a STATE_OK will be returned if the result is within the indicated"));
@@ -1031,5 +1480,5 @@ print_usage (void)
   printf ("[-C community] [-s string] [-r regex] [-R regexi] [-t timeout] [-e retries]\n");
   printf ("[-l label] [-u units] [-p port-number] [-d delimiter] [-D output-delimiter]\n");
   printf ("[-m miblist] [-P snmp version] [-L seclevel] [-U secname] [-a authproto]\n");
-  printf ("[-A authpasswd] [-X privpasswd]\n");
+  printf ("[-A authpasswd] [-X privpasswd] [--table] [--rate]\n");
 }
@@ -84,6 +84,7 @@ static int sd = 0;
 #define MAXBUF 1024
 static char buffer[MAXBUF];
 static int expect_mismatch_state = STATE_WARNING;
+static char *ssl_session_cache = NULL;
 
 #define FLAG_SSL 0x01
 #define FLAG_VERBOSE 0x02
@@ -235,6 +236,8 @@ main (int argc, char **argv)
 
 #ifdef HAVE_SSL
 	if (flags & FLAG_SSL){
+		if (ssl_session_cache)
+			np_net_ssl_session_cache (ssl_session_cache, server_address, server_port);
 		result = np_net_ssl_init(sd);
 		if (result == STATE_OK && check_cert == TRUE) {
 			result = np_net_ssl_check_cert(days_till_exp);
@@ -386,6 +389,10 @@ process_arguments (int argc, char **argv)
 	int c;
 	int escape = 0;
 
+	enum {
+		SSL_SESSION_CACHE = CHAR_MAX + 1
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
@@ -414,6 +421,7 @@ process_arguments (int argc, char **argv)
 #ifdef HAVE_SSL
 		{"ssl", no_argument, 0, 'S'},
 		{"certificate", required_argument, 0, 'D'},
+		{"ssl-session-cache", required_argument, 0, SSL_SESSION_CACHE},
 #endif
 		{0, 0, 0, 0}
 	};
@@ -575,6 +583,11 @@ process_arguments (int argc, char **argv)
 			die (STATE_UNKNOWN, _("Invalid option - SSL is not available"));
 #endif
 			break;
+#ifdef HAVE_SSL
+		case SSL_SESSION_CACHE:
+			ssl_session_cache = optarg;
+			break;
+#endif
 		case 'A':
 			flags |= FLAG_MATCH_ALL;
 			break;
@@ -636,6 +649,9 @@ print_help (void)
   printf ("    %s\n", _("Minimum number of days a certificate has to be valid."));
   printf (" %s\n", "-S, --ssl");
   printf ("    %s\n", _("Use SSL for the connection."));
+  printf (" %s\n", "--ssl-session-cache=FILE");
+  printf ("    %s\n", _("Save SSL sessions in FILE and resume them on later runs (OpenSSL only)."));
+  printf ("    %s\n", _("FILE may be shared with check_http and check_smtp"));
 #endif
 
 	printf (_(UT_WARN_CRIT));
@@ -655,6 +671,6 @@ print_usage (void)
   printf ("%s -H host -p port [-w <warning time>] [-c <critical time>] [-s <send string>]\n",progname);
   printf ("[-e <expect string>] [-q <quit string>][-m <maximum bytes>] [-d <delay>]\n");
   printf ("[-t <timeout seconds>] [-r <refuse state>] [-M <mismatch state>] [-v] [-4|-6] [-j]\n");
-  printf ("[-D <days to cert expiry>] [-S <use SSL>] [-E]\n");
+  printf ("[-D <days to cert expiry>] [-S <use SSL>] [--ssl-session-cache=<file>] [-E]\n");
 }
 
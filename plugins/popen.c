@@ -45,6 +45,7 @@
  ******************************************************************************/
 
 #include "common.h"
+#include "utils_base.h"
 
 /* extern so plugin has pid to kill exec'd process on timeouts */
 extern int timeout_interval;
@@ -210,13 +211,21 @@ spopen (const char *cmdstring)
 	if (pipe (pfderr) < 0)
 		return (NULL);							/* errno set by pipe() */
 
+	/* keep our pipe ends out of this child and any started later; the
+	 * child's ends get dup2()'ed onto stdout and stderr, clearing the flag */
+	for (i = 0; i < 2; i++) {
+		fcntl (pfd[i], F_SETFD, FD_CLOEXEC);
+		fcntl (pfderr[i], F_SETFD, FD_CLOEXEC);
+	}
+
 #ifdef REDHAT_SPOPEN_ERROR
 	if (signal (SIGCHLD, popen_sigchld_handler) == SIG_ERR) {
 		usage4 (_("Cannot catch SIGCHLD"));
 	}
 #endif
 
-	if ((pid = fork ()) < 0)
+	pid = np_spawn (argv, env, pfd[1], pfderr[1]);
+	if (pid < 0 && (pid = fork ()) < 0)
 		return (NULL);							/* errno set by fork() */
 	else if (pid == 0) {					/* child */
 		close (pfd[0]);
@@ -224,15 +233,15 @@ spopen (const char *cmdstring)
 			dup2 (pfd[1], STDOUT_FILENO);
 			close (pfd[1]);
 		}
+		else
+			fcntl (STDOUT_FILENO, F_SETFD, 0);
 		close (pfderr[0]);
 		if (pfderr[1] != STDERR_FILENO) {
 			dup2 (pfderr[1], STDERR_FILENO);
 			close (pfderr[1]);
 		}
-		/* close all descriptors in childpid[] */
-		for (i = 0; i < maxfd; i++)
-			if (childpid[i] > 0)
-				close (i);
+		else
+			fcntl (STDERR_FILENO, F_SETFD, 0);
 
 		execve (argv[0], argv, env);
 		_exit (0);
@@ -42,6 +42,8 @@
 
 /** includes **/
 #include "runcmd.h"
+#include "utils_base.h"
+#include <fcntl.h>
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
@@ -86,8 +88,10 @@ static long maxfd = 0;
 static int np_runcmd_open(const char *, int *, int *)
 	__attribute__((__nonnull__(1, 2, 3)));
 
-static int np_fetch_output(int, output *, int)
-	__attribute__((__nonnull__(2)));
+static int np_fetch_output(int, int, output *, output *);
+
+static int np_split_lines(output *, int)
+	__attribute__((__nonnull__(1)));
 
 static int np_runcmd_close(int);
 
@@ -190,9 +194,22 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 		argv[i++] = str;
 	}
 
-	if (pipe(pfd) < 0 || pipe(pfderr) < 0 || (pid = fork()) < 0)
+	if (pipe(pfd) < 0 || pipe(pfderr) < 0)
 		return -1; /* errno set by the failing function */
 
+	/* Mark all our pipe ends close-on-exec, so neither this child nor
+	 * any started later inherits them. The child's ends are dup2()'ed
+	 * onto stdout and stderr, which clears the flag again. This is
+	 * what keeps us from having to close descriptors in the child. */
+	for (i = 0; i < 2; i++) {
+		fcntl(pfd[i], F_SETFD, FD_CLOEXEC);
+		fcntl(pfderr[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	pid = np_spawn(argv, env, pfd[1], pfderr[1]);
+	if (pid < 0 && (pid = fork()) < 0)
+		return -1; /* errno set by fork() */
+
 	/* child runs exceve() and _exit. */
 	if (pid == 0) {
 #ifdef 	RLIMIT_CORE
@@ -206,18 +223,15 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 			dup2 (pfd[1], STDOUT_FILENO);
 			close (pfd[1]);
 		}
+		else
+			fcntl (STDOUT_FILENO, F_SETFD, 0);
 		close (pfderr[0]);
 		if (pfderr[1] != STDERR_FILENO) {
 			dup2 (pfderr[1], STDERR_FILENO);
 			close (pfderr[1]);
 		}
-
-		/* close all descriptors in np_pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if(np_pids[i] > 0)
-				close (i);
+		else
+			fcntl (STDERR_FILENO, F_SETFD, 0);
 
 		execve (argv[0], argv, env);
 		_exit (STATE_UNKNOWN);
@@ -273,30 +287,82 @@ popen_timeout_alarm_handler (int signo)
 }
 
 
+/* Drain the child's stdout and stderr at the same time, so a child which
+ * fills one pipe while we're blocked reading the other can't deadlock us.
+ * Output goes straight into op->buf, which grows geometrically. A NULL
+ * output struct means the caller doesn't care, but the pipe is still
+ * drained so the child can run to completion.
+ * Returns 0, or -1 if reading either pipe failed. */
 static int
-np_fetch_output(int fd, output *op, int flags)
+np_fetch_output(int fd_out, int fd_err, output *out, output *err)
 {
-	size_t len = 0, i = 0, lineno = 0;
-	size_t rsf = 6, ary_size = 0; /* rsf = right shift factor, dec'ed uncond once */
-	char *buf = NULL;
-	int ret;
-	char tmpbuf[4096];
-
-	op->buf = NULL;
-	op->buflen = 0;
-	while((ret = read(fd, tmpbuf, sizeof(tmpbuf))) > 0) {
-		len = (size_t)ret;
-		op->buf = realloc(op->buf, op->buflen + len + 1);
-		memcpy(op->buf + op->buflen, tmpbuf, len);
-		op->buflen += len;
-		i++;
+	struct pollfd pfd[2];
+	output *op[2];
+	size_t alloc[2] = { 0, 0 };
+	char scratch[4096];
+	int i, ret, result = 0;
+
+	pfd[0].fd = fd_out;
+	pfd[1].fd = fd_err;
+	op[0] = out;
+	op[1] = err;
+	for(i = 0; i < 2; i++) {
+		pfd[i].events = POLLIN;
+		if(op[i]) {
+			op[i]->buf = NULL;
+			op[i]->buflen = 0;
+		}
 	}
 
-	if(ret < 0) {
-		printf("read() returned %d: %s\n", ret, strerror(errno));
-		return ret;
+	while(pfd[0].fd >= 0 || pfd[1].fd >= 0) {
+		if(poll(pfd, 2, -1) < 0) {
+			if(errno == EINTR) continue;
+			printf("poll() returned -1: %s\n", strerror(errno));
+			return -1;
+		}
+
+		for(i = 0; i < 2; i++) {
+			if(pfd[i].fd < 0 || !pfd[i].revents) continue;
+
+			if(!op[i])
+				ret = read(pfd[i].fd, scratch, sizeof(scratch));
+			else {
+				if(alloc[i] - op[i]->buflen < sizeof(scratch)) {
+					alloc[i] = alloc[i] ? alloc[i] * 2 : 2 * sizeof(scratch);
+					op[i]->buf = realloc(op[i]->buf, alloc[i] + 1);
+					if(!op[i]->buf)
+						die(STATE_UNKNOWN, _("Could not allocate output buffer\n"));
+				}
+				ret = read(pfd[i].fd, op[i]->buf + op[i]->buflen,
+				           alloc[i] - op[i]->buflen);
+			}
+
+			if(ret > 0) {
+				if(op[i]) op[i]->buflen += ret;
+				continue;
+			}
+			if(ret < 0 && errno == EINTR) continue;
+			if(ret < 0) {
+				printf("read() returned %d: %s\n", ret, strerror(errno));
+				result = -1;
+			}
+			/* EOF or error; poll() ignores negative descriptors */
+			pfd[i].fd = -1;
+		}
 	}
 
+	return result;
+}
+
+
+/* Split the output buffer into lines, as requested by flags */
+static int
+np_split_lines(output *op, int flags)
+{
+	size_t i = 0, lineno = 0;
+	size_t rsf = 6, ary_size = 0; /* rsf = right shift factor, dec'ed uncond once */
+	char *buf = NULL;
+
 	/* some plugins may want to keep output unbroken, and some commands
 	 * will yield no output, so return here for those */
 	if(flags & RUNCMD_NO_ARRAYS || !op->buf || !op->buflen)
@@ -354,8 +420,15 @@ np_runcmd(const char *cmd, output *out, output *err, int flags)
 	if((fd = np_runcmd_open(cmd, pfd_out, pfd_err)) == -1)
 		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), cmd);
 
-	if(out) out->lines = np_fetch_output(pfd_out[0], out, flags);
-	if(err) err->lines = np_fetch_output(pfd_err[0], err, flags);
+	if(np_fetch_output(pfd_out[0], pfd_err[0], out, err) < 0) {
+		if(out) out->lines = -1;
+		if(err) err->lines = -1;
+	}
+	else {
+		if(out) out->lines = np_split_lines(out, flags);
+		if(err) err->lines = np_split_lines(err, flags);
+	}
+	close(pfd_err[0]);
 
 	return np_runcmd_close(fd);
 }
@@ -34,11 +34,179 @@
 #define LOCAL_TIMEOUT_ALARM_HANDLER
 #include "common.h"
 #include "netutils.h"
+#include <fcntl.h>
 
 #ifdef HAVE_SSL
 static SSL_CTX *c=NULL;
 static SSL *s=NULL;
 static int initialized=0;
+static char *session_cache=NULL;
+static char *session_key=NULL;
+
+#  ifdef USE_OPENSSL
+/* The session cache is a flat file shared by every plugin pointed at it,
+ * one "host:port expiry hex-encoded-session" line per server.  Readers
+ * take a shared lock, writers an exclusive one, and the file is rewritten
+ * in place so the lock stays valid.  The plugin's own alarm bounds the
+ * time we can spend waiting for a lock. */
+static int session_cache_open(short type){
+	struct flock fl;
+	int fd;
+
+	if ((fd = open (session_cache, O_RDWR | O_CREAT, 0600)) < 0)
+		return -1;
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	if (fcntl (fd, F_SETLKW, &fl) < 0) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+static char *session_cache_slurp(int fd){
+	char *data = NULL;
+	size_t len = 0, alloc = 0;
+	ssize_t n;
+
+	do {
+		if (alloc - len < 4096) {
+			alloc = alloc ? alloc * 2 : 8192;
+			if ((data = realloc (data, alloc + 1)) == NULL)
+				return NULL;
+		}
+		n = read (fd, data + len, alloc - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0);
+	if (n < 0) {
+		free (data);
+		return NULL;
+	}
+	data[len] = '\0';
+	return data;
+}
+
+/* Splits a cache line into its fields, returning FALSE for anything
+ * malformed.  The line is modified in place. */
+static int session_cache_entry(char *line, char **key, long *expiry, char **hex){
+	char *p, *end;
+
+	*key = line;
+	if ((p = strchr (line, ' ')) == NULL)
+		return FALSE;
+	*p++ = '\0';
+	*expiry = strtol (p, &end, 10);
+	if (end == p || *end != ' ')
+		return FALSE;
+	*hex = end + 1;
+	return TRUE;
+}
+
+static SSL_SESSION *session_cache_load(void){
+	SSL_SESSION *sess = NULL;
+	const unsigned char *p;
+	unsigned char *der;
+	char *data, *line, *next, *key, *hex;
+	long expiry;
+	size_t i, len;
+	int fd;
+
+	if ((fd = session_cache_open (F_RDLCK)) < 0)
+		return NULL;
+	data = session_cache_slurp (fd);
+	close (fd);
+	if (data == NULL)
+		return NULL;
+
+	for (line = data; line && *line; line = next) {
+		if ((next = strchr (line, '\n')) != NULL)
+			*next++ = '\0';
+		if (!session_cache_entry (line, &key, &expiry, &hex) ||
+		    strcmp (key, session_key) || expiry <= time (NULL))
+			continue;
+		len = strlen (hex) / 2;
+		if ((der = malloc (len + 1)) == NULL)
+			break;
+		for (i = 0; i < len; i++) {
+			if (sscanf (hex + 2 * i, "%2hhx", &der[i]) != 1)
+				break;
+		}
+		p = der;
+		if (i == len)
+			sess = d2i_SSL_SESSION (NULL, &p, len);
+		free (der);
+		break;
+	}
+	free (data);
+	return sess;
+}
+
+static void session_cache_store(SSL_SESSION *sess){
+	unsigned char *der, *p;
+	char *data, *line, *next, *key, *hex, *out;
+	long expiry;
+	size_t used;
+	int i, len, fd;
+
+	if ((len = i2d_SSL_SESSION (sess, NULL)) <= 0 ||
+	    (der = malloc (len)) == NULL)
+		return;
+	p = der;
+	i2d_SSL_SESSION (sess, &p);
+
+	if ((fd = session_cache_open (F_WRLCK)) < 0) {
+		free (der);
+		return;
+	}
+	if ((data = session_cache_slurp (fd)) == NULL ||
+	    (out = malloc (strlen (data) + strlen (session_key) + 2 * len + 32)) == NULL) {
+		free (data);
+		free (der);
+		close (fd);
+		return;
+	}
+
+	/* keep every other live entry, then append ours */
+	used = 0;
+	for (line = data; line && *line; line = next) {
+		if ((next = strchr (line, '\n')) != NULL)
+			*next++ = '\0';
+		if (!session_cache_entry (line, &key, &expiry, &hex) ||
+		    !strcmp (key, session_key) || expiry <= time (NULL))
+			continue;
+		used += sprintf (out + used, "%s %ld %s\n", key, expiry, hex);
+	}
+	used += sprintf (out + used, "%s %ld ", session_key,
+	                 (long)(SSL_SESSION_get_time (sess) + SSL_SESSION_get_timeout (sess)));
+	for (i = 0; i < len; i++)
+		used += sprintf (out + used, "%02x", der[i]);
+	out[used++] = '\n';
+
+	/* stale bytes left after the new entries would be read back as
+	 * entries, so a cache that can't be rewritten whole is dropped */
+	if (lseek (fd, 0, SEEK_SET) != 0 || write (fd, out, used) != (ssize_t)used ||
+	    ftruncate (fd, used) != 0)
+		unlink (session_cache);
+	close (fd);
+	free (out);
+	free (data);
+	free (der);
+}
+#  endif /* USE_OPENSSL */
+
+/* Enables resumption of TLS sessions across plugin runs.  Must be called
+ * before np_net_ssl_init(); a NULL file turns the cache off again. */
+void np_net_ssl_session_cache(const char *file, const char *host, int port){
+	free (session_cache);
+	free (session_key);
+	session_cache = session_key = NULL;
+	if (file == NULL)
+		return;
+	session_cache = strdup (file);
+	asprintf (&session_key, "%s:%d", host, port);
+}
 
 int np_net_ssl_init (int sd){
 		if (!initialized) {
@@ -54,6 +222,15 @@ int np_net_ssl_init (int sd){
 		}
 		if ((s = SSL_new (c)) != NULL){
 				SSL_set_fd (s, sd);
+#  ifdef USE_OPENSSL
+				if (session_key) {
+						SSL_SESSION *sess = session_cache_load ();
+						if (sess) {
+								SSL_set_session (s, sess);
+								SSL_SESSION_free (sess);
+						}
+				}
+#  endif /* USE_OPENSSL */
 				if (SSL_connect(s) == 1){
 						return OK;
 				} else {
@@ -70,6 +247,16 @@ int np_net_ssl_init (int sd){
 
 void np_net_ssl_cleanup (){
 		if(s){
+#  ifdef USE_OPENSSL
+				/* TLS 1.3 tickets arrive after the handshake, so the
+				 * session is only worth saving once we are done with it */
+				if (session_key && SSL_is_init_finished (s) && SSL_get_session (s)
+#    if OPENSSL_VERSION_NUMBER >= 0x10101000L
+				    && SSL_SESSION_is_resumable (SSL_get_session (s))
+#    endif
+				    )
+						session_cache_store (SSL_get_session (s));
+#  endif /* USE_OPENSSL */
 				SSL_shutdown (s);
 				SSL_free (s);
 				if(c) {
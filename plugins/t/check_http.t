@@ -9,7 +9,7 @@ use strict;
 use Test::More;
 use NPTest;
 
-plan tests => 26;
+plan tests => 29;
 
 my $successOutput = '/OK.*HTTP.*second/';
 
@@ -70,6 +70,13 @@ cmp_ok( $res->return_code, '==', 2, "Webserver $hostname_invalid not valid" );
 # Is also possible to get a socket timeout if DNS is not responding fast enough
 like( $res->output, "/Unable to open TCP socket|Socket timeout after/", "Output OK");
 
+$res = NPTest->testCmd(
+	"(echo $host_tcp_http; echo $hostname_invalid) | ./check_http --batch - -wt 300 -ct 600"
+	);
+cmp_ok( $res->return_code, '==', 2, "Batch returns the worst state" );
+like( $res->output, "/^$host_tcp_http\t0\tHTTP OK/m", "Result line for $host_tcp_http" );
+like( $res->output, "/^$hostname_invalid\t2\tHTTP CRITICAL/m", "Result line for $hostname_invalid" );
+
 SKIP: {
         skip "No internet access and no host serving nagios in index file",
               7 if $internet_access eq "no" && ! $host_tcp_http2;